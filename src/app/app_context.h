@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include "../autofocus/autofocus.h"
+#include "../autofocus/focus_compensation.h"
+#include "../filters/filter_offsets.h"
+#include "../moonlite/command.h"
+#include "../sensors/temperature_sensor.h"
+#include "../stepper/autotune.h"
+#include "../stepper/motion_controller.h"
+#include "../telemetry/telemetry.h"
+
+/**
+ * @brief Application state reachable from command handlers
+ */
+struct AppContext
+{
+    MotionController *controllers; // indexed by Command::motor
+    size_t controller_count;
+    Telemetry *telemetry;
+    TemperatureSensor *temperature;
+    Autofocus *autofocus; // indexed by Command::motor
+    Autotune *autotune;   // indexed by Command::motor
+    FocusCompensation *compensation; // indexed by Command::motor
+    FilterOffsets *filters;          // indexed by Command::motor
+
+    MotionController &axis(const Command &command) const
+    {
+        return controllers[command.motor];
+    }
+
+    Autofocus &focus(const Command &command) const
+    {
+        return autofocus[command.motor];
+    }
+
+    Autotune &tune(const Command &command) const
+    {
+        return autotune[command.motor];
+    }
+
+    FocusCompensation &thermal(const Command &command) const
+    {
+        return compensation[command.motor];
+    }
+
+    FilterOffsets &filter(const Command &command) const
+    {
+        return filters[command.motor];
+    }
+
+    bool anyAxisMoving() const
+    {
+        for (size_t i = 0; i < controller_count; i++)
+        {
+            if (controllers[i].getIsMoving())
+                return true;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,379 @@
+#include "command_table.h"
+
+namespace
+{
+    constexpr auto PROTOCOL = CommandContext::PROTOCOL;
+    constexpr auto MOTION = CommandContext::MOTION;
+
+    /**
+     * @brief Edit one parameter of the active motion profile (XPA, XPB, XPV, XPJ)
+     */
+    Response setProfileParameter(AppContext &app, const Command &cmd)
+    {
+        MotionController &motionController = app.axis(cmd);
+        MotionProfile profile = motionController.getProfile();
+        if (cmd.type == CommandType::CMD_XPA)
+            profile.max_speed = cmd.value;
+        else if (cmd.type == CommandType::CMD_XPB)
+            profile.acceleration = cmd.value;
+        else if (cmd.type == CommandType::CMD_XPV)
+            profile.start_speed = cmd.value;
+        else
+            profile.jerk = cmd.value;
+        motionController.setProfileParameters(profile.max_speed, profile.acceleration, profile.start_speed, profile.jerk);
+        return Response::none();
+    }
+
+    /**
+     * @brief Set or clear one resonance band of the active profile (XR0, XR1)
+     */
+    Response setResonanceBand(AppContext &app, const Command &cmd)
+    {
+        uint8_t band = (cmd.type == CommandType::CMD_XR1) ? 1 : 0;
+        uint32_t value = static_cast<uint32_t>(cmd.value);
+        app.axis(cmd).setResonanceBand(band, value >> 16, value & 0xFFFF);
+        return Response::none();
+    }
+
+    /**
+     * @brief Tuned speed and acceleration of one direction (XUO, XUN)
+     */
+    Response getAutotuneResult(AppContext &app, const Command &cmd)
+    {
+        FocuserDirection direction = (cmd.type == CommandType::CMD_XUO) ? FocuserDirection::OUTWARD : FocuserDirection::INWARD;
+        uint16_t speed, acceleration;
+        app.tune(cmd).getResult(direction, speed, acceleration);
+        return Response::hex8((static_cast<uint32_t>(speed) << 16) | acceleration);
+    }
+
+    constexpr bool isOrderedByType(const CommandSpec *table, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (static_cast<size_t>(table[i].type) != i)
+                return false;
+        }
+        return true;
+    }
+
+    constexpr bool hasValidOpcodes(const CommandSpec *table, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t length = 0;
+            while (table[i].opcode[length] != '\0')
+                length++;
+            // the '2' prefix selects the second focuser, so no opcode may start with it
+            if (length == 0 || table[i].opcode[0] == '2' || table[i].handler == nullptr)
+                return false;
+            // binary requests carry values as whole bytes
+            if (table[i].value_digits % 2 != 0)
+                return false;
+        }
+        return true;
+    }
+
+    constexpr bool startsWith(const char *str, const char *prefix)
+    {
+        while (*prefix != '\0')
+        {
+            if (*str++ != *prefix++)
+                return false;
+        }
+        return true;
+    }
+
+    constexpr size_t countCached(const CommandSpec *table, size_t count)
+    {
+        size_t cached = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (table[i].cached)
+                cached++;
+        }
+        return cached;
+    }
+
+    // The parser takes the first opcode matching the start of a message, so none may prefix another
+    constexpr bool hasUnambiguousOpcodes(const CommandSpec *table, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            for (size_t j = 0; j < count; j++)
+            {
+                if (i != j && startsWith(table[j].opcode, table[i].opcode))
+                    return false;
+            }
+        }
+        return true;
+    }
+}
+
+constexpr CommandSpec COMMAND_TABLE[COMMAND_COUNT] = {
+    // Initiate temperature conversion
+    {"C", 0, CommandType::CMD_C, PROTOCOL, [](AppContext &, const Command &)
+     { return Response::none(); }},
+
+    // Go to target position
+    {"FG", 0, CommandType::CMD_FG, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).startMovement(); return Response::none(); }},
+
+    // Halt motor movement immediately, also ends an autofocus or autotune run
+    {"FQ", 0, CommandType::CMD_FQ, MOTION, [](AppContext &app, const Command &cmd)
+     {
+         app.focus(cmd).abort();
+         app.tune(cmd).abort();
+         app.axis(cmd).stopMovement();
+         return Response::none();
+     }},
+
+    // Get red LED backlight brightness value
+    {"GB", 0, CommandType::CMD_GB, PROTOCOL, [](AppContext &, const Command &)
+     { return Response::hex2(0x00); }}, // TODO: Implement backlight control
+
+    // Get current temperature coefficient, the learned model's slope at the current temperature once it has one
+    {"GC", 0, CommandType::CMD_GC, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex2(static_cast<uint8_t>(app.thermal(cmd).getSlope())); }},
+
+    // Get current motor speed
+    {"GD", 0, CommandType::CMD_GD, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex2(app.axis(cmd).getSpeed()); }, true},
+
+    // Get half-step mode status
+    {"GH", 0, CommandType::CMD_GH, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex2(app.axis(cmd).getStepMode() == StepMode::HALF_STEP ? 0xFF : 0x00); }, true},
+
+    // Get motor is moving status (00=stopped, 01=moving)
+    {"GI", 0, CommandType::CMD_GI, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex2(app.axis(cmd).getIsMoving() ? 0x01 : 0x00); }, true},
+
+    // Get target position
+    {"GN", 0, CommandType::CMD_GN, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex4(app.axis(cmd).getTargetPosition()); }, true},
+
+    // Get current position
+    {"GP", 0, CommandType::CMD_GP, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex4(app.axis(cmd).getCurrentPosition()); }, true},
+
+    // Get current temperature in half degrees
+    {"GT", 0, CommandType::CMD_GT, PROTOCOL, [](AppContext &app, const Command &)
+     { return Response::hex4(app.temperature->getHalfDegrees()); }},
+
+    // Get firmware version
+    {"GV", 0, CommandType::CMD_GV, PROTOCOL, [](AppContext &, const Command &)
+     { return Response::string("V1.0"); }, true},
+
+    // Set temperature coefficient, used until the model has learned two points
+    {"SC", 2, CommandType::CMD_SC, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { app.thermal(cmd).setFallbackSlope(static_cast<int8_t>(cmd.value)); return Response::none(); }},
+
+    // Set motor speed
+    {"SD", 2, CommandType::CMD_SD, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).setSpeed(cmd.value); return Response::none(); }},
+
+    // Set full-step mode
+    {"SF", 0, CommandType::CMD_SF, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).setStepMode(StepMode::FULL_STEP); return Response::none(); }},
+
+    // Set half-step mode
+    {"SH", 0, CommandType::CMD_SH, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).setStepMode(StepMode::HALF_STEP); return Response::none(); }},
+
+    // Set target position
+    {"SN", 4, CommandType::CMD_SN, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).setTargetPosition(cmd.value); return Response::none(); }},
+
+    // Set current position
+    {"SP", 4, CommandType::CMD_SP, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).setCurrentPosition(cmd.value); return Response::none(); }},
+
+    // Get fault flags
+    {"XFS", 0, CommandType::CMD_XFS, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex2(app.axis(cmd).getFaultFlags()); }},
+
+    // Get lost step count
+    {"XFL", 0, CommandType::CMD_XFL, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex4(app.axis(cmd).getLostStepCount()); }},
+
+    // Get stall count
+    {"XFK", 0, CommandType::CMD_XFK, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex4(app.axis(cmd).getStallCount()); }},
+
+    // Clear fault flags and counters
+    {"XFC", 0, CommandType::CMD_XFC, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).clearFaults(); return Response::none(); }},
+
+    // Get worst step lateness in microseconds
+    {"XFJ", 0, CommandType::CMD_XFJ, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex8(app.axis(cmd).getMaxStepLatenessUs()); }},
+
+    // Start sensorless homing
+    {"XHS", 0, CommandType::CMD_XHS, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).startHoming(); return Response::none(); }},
+
+    // Set home offset
+    {"XHO", 4, CommandType::CMD_XHO, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).setHomeOffset(cmd.value); return Response::none(); }},
+
+    // Set StallGuard threshold
+    {"XHT", 2, CommandType::CMD_XHT, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).setStallThreshold(cmd.value); return Response::none(); }},
+
+    // Get homing state
+    {"XHI", 0, CommandType::CMD_XHI, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex2(static_cast<uint8_t>(app.axis(cmd).getHomingState())); }},
+
+    // Set jog velocity
+    {"XJV", 4, CommandType::CMD_XJV, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).setJogVelocity(static_cast<int16_t>(cmd.value)); return Response::none(); }},
+
+    // Get estimated move duration in milliseconds
+    {"XMT", 0, CommandType::CMD_XMT, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex8(static_cast<uint32_t>(app.axis(cmd).getRemainingMoveTimeUs() / 1000)); }},
+
+    // Select motion profile
+    {"XPS", 2, CommandType::CMD_XPS, MOTION, [](AppContext &app, const Command &cmd)
+     { app.axis(cmd).selectProfile(cmd.value); return Response::none(); }},
+
+    // Get active motion profile
+    {"XPG", 0, CommandType::CMD_XPG, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex2(app.axis(cmd).getActiveProfile()); }},
+
+    // Get active motion profile name
+    {"XPN", 0, CommandType::CMD_XPN, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::string(app.axis(cmd).getProfile().name); }},
+
+    {"XPA", 4, CommandType::CMD_XPA, MOTION, setProfileParameter},
+    {"XPB", 4, CommandType::CMD_XPB, MOTION, setProfileParameter},
+    {"XPV", 4, CommandType::CMD_XPV, MOTION, setProfileParameter},
+    {"XPJ", 4, CommandType::CMD_XPJ, MOTION, setProfileParameter},
+
+    // Save active motion profile to flash
+    // Flash writes stall the instruction cache, and with it every task, so never while an axis moves
+    {"XPW", 0, CommandType::CMD_XPW, PROTOCOL, [](AppContext &app, const Command &cmd)
+     {
+         if (!app.anyAxisMoving())
+             app.axis(cmd).saveProfile();
+         return Response::none();
+     }},
+
+    // Set telemetry period in milliseconds
+    {"XTR", 4, CommandType::CMD_XTR, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { app.telemetry->setPeriod(cmd.motor, static_cast<uint32_t>(cmd.value) * 1000); return Response::none(); }},
+
+    // Get dropped telemetry record count
+    {"XTD", 0, CommandType::CMD_XTD, PROTOCOL, [](AppContext &app, const Command &)
+     { return Response::hex4(app.telemetry->getDroppedRecordCount()); }},
+
+    {"XR0", 8, CommandType::CMD_XR0, MOTION, setResonanceBand},
+    {"XR1", 8, CommandType::CMD_XR1, MOTION, setResonanceBand},
+
+    // Start autofocus
+    {"XAS", 6, CommandType::CMD_XAS, MOTION, [](AppContext &app, const Command &cmd)
+     {
+         if (!app.tune(cmd).isActive())
+             app.focus(cmd).start(cmd.value >> 8, cmd.value & 0xFF);
+         return Response::none();
+     }},
+
+    // Report the star size at the current autofocus sample
+    {"XAH", 4, CommandType::CMD_XAH, MOTION, [](AppContext &app, const Command &cmd)
+     { app.focus(cmd).addSample(cmd.value); return Response::none(); }},
+
+    // Get autofocus state
+    {"XAI", 0, CommandType::CMD_XAI, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex2(static_cast<uint8_t>(app.focus(cmd).getState())); }},
+
+    // Get best focus position
+    {"XAP", 0, CommandType::CMD_XAP, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex4(app.focus(cmd).getBestPosition()); }},
+
+    // Start autotuning the active profile
+    {"XUS", 4, CommandType::CMD_XUS, MOTION, [](AppContext &app, const Command &cmd)
+     {
+         if (!app.focus(cmd).isActive())
+             app.tune(cmd).start(cmd.value);
+         return Response::none();
+     }},
+
+    // Get autotune state
+    {"XUI", 0, CommandType::CMD_XUI, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex2(static_cast<uint8_t>(app.tune(cmd).getState())); }},
+
+    {"XUO", 0, CommandType::CMD_XUO, PROTOCOL, getAutotuneResult},
+    {"XUN", 0, CommandType::CMD_XUN, PROTOCOL, getAutotuneResult},
+
+    // Enable or disable temperature compensation
+    {"XCE", 2, CommandType::CMD_XCE, MOTION, [](AppContext &app, const Command &cmd)
+     { app.thermal(cmd).setEnabled(cmd.value != 0); return Response::none(); }},
+
+    // Confirm the current position as best focus, for focus runs done by the host
+    {"XCR", 0, CommandType::CMD_XCR, MOTION, [](AppContext &app, const Command &cmd)
+     { app.thermal(cmd).record(); return Response::none(); }},
+
+    // Clear the learned temperature model
+    {"XCC", 0, CommandType::CMD_XCC, MOTION, [](AppContext &app, const Command &cmd)
+     { app.thermal(cmd).clear(); return Response::none(); }},
+
+    // Get learned temperature model point count
+    {"XCN", 0, CommandType::CMD_XCN, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex2(app.thermal(cmd).getPointCount()); }},
+
+    // Change filter: move by the preset's offset from the active one, folded into a pending or running move
+    {"XOA", 2, CommandType::CMD_XOA, MOTION, [](AppContext &app, const Command &cmd)
+     {
+         if (!app.focus(cmd).isActive() && !app.tune(cmd).isActive())
+             app.filter(cmd).apply(cmd.value);
+         return Response::none();
+     }},
+
+    // Mark the filter in place without moving
+    {"XOK", 2, CommandType::CMD_XOK, MOTION, [](AppContext &app, const Command &cmd)
+     { app.filter(cmd).setActive(cmd.value); return Response::none(); }},
+
+    // Get active filter offset preset
+    {"XOG", 0, CommandType::CMD_XOG, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex2(app.filter(cmd).getActive()); }},
+
+    // Select filter offset preset to edit
+    {"XOE", 2, CommandType::CMD_XOE, MOTION, [](AppContext &app, const Command &cmd)
+     { app.filter(cmd).select(cmd.value); return Response::none(); }},
+
+    // Set selected preset offset
+    {"XOS", 4, CommandType::CMD_XOS, MOTION, [](AppContext &app, const Command &cmd)
+     { app.filter(cmd).setOffset(static_cast<int16_t>(cmd.value)); return Response::none(); }},
+
+    // Get selected preset offset
+    {"XOO", 0, CommandType::CMD_XOO, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex4(static_cast<uint16_t>(app.filter(cmd).getOffset())); }},
+
+    // Set selected preset name
+    {"XON", 8, CommandType::CMD_XON, MOTION, [](AppContext &app, const Command &cmd)
+     { app.filter(cmd).setName(static_cast<uint32_t>(cmd.value)); return Response::none(); }},
+
+    // Get selected preset name
+    {"XOM", 0, CommandType::CMD_XOM, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::string(app.filter(cmd).getName()); }},
+
+    // Save filter offset presets to flash, never while an axis moves (see XPW)
+    {"XOW", 0, CommandType::CMD_XOW, PROTOCOL, [](AppContext &app, const Command &cmd)
+     {
+         if (!app.anyAxisMoving())
+             app.filter(cmd).save();
+         return Response::none();
+     }},
+
+    // Get FG to first step time of the last move in microseconds
+    {"XFG", 0, CommandType::CMD_XFG, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex8(app.axis(cmd).getFirstStepDelayUs()); }},
+
+    // Get longest FG to first step time in microseconds
+    {"XFW", 0, CommandType::CMD_XFW, PROTOCOL, [](AppContext &app, const Command &cmd)
+     { return Response::hex8(app.axis(cmd).getMaxFirstStepDelayUs()); }},
+};
+
+static_assert(isOrderedByType(COMMAND_TABLE, COMMAND_COUNT), "COMMAND_TABLE must list commands in CommandType order");
+static_assert(hasValidOpcodes(COMMAND_TABLE, COMMAND_COUNT), "COMMAND_TABLE entry has an empty or '2' prefixed opcode, an odd value width or no handler");
+static_assert(hasUnambiguousOpcodes(COMMAND_TABLE, COMMAND_COUNT), "COMMAND_TABLE opcode is a prefix of another opcode");
+static_assert(countCached(COMMAND_TABLE, COMMAND_COUNT) <= RESPONSE_CACHE_SIZE, "More cached commands than RESPONSE_CACHE_SIZE");
+static_assert(COMMAND_COUNT <= 0x80, "Binary requests encode CommandType in 7 bits");
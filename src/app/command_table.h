@@ -0,0 +1,22 @@
+#pragma once
+
+#include "../moonlite/command.h"
+#include "app_context.h"
+
+/**
+ * @brief Every supported command, ordered by CommandType
+ *
+ * The parser matches opcodes against this table and the dispatcher indexes it by
+ * Command::type, so adding a command means adding a CommandType and one entry here.
+ */
+extern const CommandSpec COMMAND_TABLE[COMMAND_COUNT];
+
+/**
+ * @brief Table entry for a parsed command
+ * @return nullptr for UNKNOWN
+ */
+inline const CommandSpec *findCommandSpec(CommandType type)
+{
+    size_t index = static_cast<size_t>(type);
+    return index < COMMAND_COUNT ? &COMMAND_TABLE[index] : nullptr;
+}
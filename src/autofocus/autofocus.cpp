@@ -0,0 +1,126 @@
+#include "autofocus.h"
+
+namespace
+{
+    constexpr int FRACTION_BITS = VCurveFit::VERTEX_FRACTION_BITS;
+}
+
+Autofocus::Autofocus(MotionController &controller) : controller_(controller)
+{
+}
+
+void Autofocus::moveTo(long position)
+{
+    // inward targets are overshot and approached outward, turning round within the one move
+    target_ = position;
+    long via = position < controller_.getCurrentPosition() ? position - step_ : position;
+    controller_.setTargetPosition(position, via);
+    controller_.startMovement();
+}
+
+void Autofocus::moveToSample(int x)
+{
+    pending_x_ = x;
+    state_ = State::MOVING;
+    moveTo(gridPosition(x));
+}
+
+void Autofocus::fail()
+{
+    state_ = State::FAILED;
+    controller_.setTargetPosition(center_);
+    controller_.startMovement();
+}
+
+void Autofocus::start(uint16_t step, uint8_t samples)
+{
+    if (isActive() || controller_.getIsMoving())
+        return;
+
+    if (step == 0 || samples < MIN_PLANNED_SAMPLES || samples > VCurveFit::MAX_SAMPLES)
+        return;
+
+    fit_.reset();
+    center_ = controller_.getCurrentPosition();
+    step_ = step;
+    planned_ = samples;
+    moveToSample(-(samples - 1) / 2);
+}
+
+void Autofocus::addSample(uint16_t hfr)
+{
+    if (state_ != State::WAITING)
+        return;
+
+    fit_.addSample(pending_x_, hfr);
+    if (fit_.getSampleCount() == 1 || pending_x_ < first_x_)
+    {
+        first_x_ = pending_x_;
+        first_hfr_ = hfr;
+    }
+    if (fit_.getSampleCount() == 1 || pending_x_ > last_x_)
+    {
+        last_x_ = pending_x_;
+        last_hfr_ = hfr;
+    }
+
+    if (fit_.getSampleCount() < planned_)
+    {
+        moveToSample(last_x_ + 1);
+        return;
+    }
+
+    // accept the vertex once at least one sampled grid point lies beyond it on either side
+    int32_t vertex;
+    bool convex = fit_.solve(vertex);
+    int32_t low = (first_x_ + 1) * (1 << FRACTION_BITS);
+    int32_t high = (last_x_ - 1) * (1 << FRACTION_BITS);
+    if (convex && vertex >= low && vertex <= high)
+    {
+        int64_t offset = static_cast<int64_t>(vertex) * step_ + (1 << (FRACTION_BITS - 1));
+        best_position_ = center_ + static_cast<long>(offset >> FRACTION_BITS);
+        state_ = State::FOCUSING;
+        moveTo(best_position_);
+        return;
+    }
+
+    if (fit_.getSampleCount() >= VCurveFit::MAX_SAMPLES)
+    {
+        fail();
+        return;
+    }
+
+    // grow the grid towards the minimum, or towards the smaller end while the curve is not convex yet
+    bool grow_inward = convex ? vertex < low : first_hfr_ < last_hfr_;
+    moveToSample(grow_inward ? first_x_ - 1 : last_x_ + 1);
+}
+
+void Autofocus::abort()
+{
+    if (!isActive())
+        return;
+
+    state_ = State::FAILED;
+}
+
+void Autofocus::update()
+{
+    State state = state_;
+    if ((state != State::MOVING && state != State::FOCUSING) || controller_.getIsMoving())
+        return;
+
+    // a move the run did not ask for (FG, FQ, homing) took the focuser elsewhere
+    if (controller_.getCurrentPosition() != target_)
+    {
+        abort();
+        return;
+    }
+
+    if (state == State::FOCUSING)
+    {
+        completed_runs_.store(completed_runs_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        state_ = State::DONE;
+        return;
+    }
+    state_ = State::WAITING;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "vcurve_fit.h"
+#include "../stepper/motion_controller.h"
+
+/**
+ * @brief V-curve autofocus run by the focuser, the host only measures
+ *
+ * start() samples a grid of positions around the current one. At each grid point the run waits
+ * until the host reports the star size with addSample(), feeds it to a VCurveFit and moves on to
+ * the next point on its own. Once the planned points are in, the grid grows towards the minimum
+ * until the fitted vertex has a sample on either side, then the focuser moves to the vertex.
+ *
+ * Every sample position and the final position are approached outward, the way the first grid
+ * point is, so backlash is the same for all of them. Inward targets are overshot by one grid step,
+ * turning round in the same move (see MotionController::setTargetPosition()).
+ *
+ * start(), addSample(), abort() and update() belong to the motion task; getState() and
+ * getBestPosition() are safe from other tasks.
+ */
+class Autofocus
+{
+public:
+    enum class State : uint8_t
+    {
+        IDLE = 0x00,
+        MOVING = 0x01,   // moving to the next sample position
+        WAITING = 0x02,  // at a sample position, waiting for the host's measurement
+        FOCUSING = 0x03, // moving to the fitted best focus
+        DONE = 0x04,     // at best focus, see getBestPosition()
+        FAILED = 0x05,   // no minimum within MAX_SAMPLES (the focuser returns to the start), or interrupted
+    };
+
+    static constexpr uint8_t MIN_PLANNED_SAMPLES = 3;
+
+private:
+    MotionController &controller_;
+    VCurveFit fit_;
+
+    std::atomic<State> state_{State::IDLE};
+    std::atomic<long> best_position_{0};
+    std::atomic<uint16_t> completed_runs_{0};
+
+    long center_ = 0;       // position the run started at, grid point 0
+    long step_ = 0;         // grid spacing in steps
+    uint8_t planned_ = 0;   // samples taken before the grid may grow
+    int first_x_ = 0;       // lowest grid point sampled so far
+    int last_x_ = 0;        // highest grid point sampled so far
+    int pending_x_ = 0;     // grid point being moved to or measured
+    uint16_t first_hfr_ = 0;
+    uint16_t last_hfr_ = 0;
+
+    long target_ = 0;       // final position of the current move
+
+    long gridPosition(int x) const
+    {
+        return center_ + x * step_;
+    }
+
+    void moveTo(long position);
+    void moveToSample(int x);
+    void fail();
+
+public:
+    explicit Autofocus(MotionController &controller);
+
+    /**
+     * @brief Start a run around the current position
+     * @param step Grid spacing in steps
+     * @param samples Grid points planned before the fit decides, centred on the current position
+     *
+     * Ignored while the focuser moves or another run is active, or if the arguments are out of range.
+     */
+    void start(uint16_t step, uint8_t samples);
+
+    /**
+     * @brief Report the star size measured at the current grid point
+     * @param hfr HFR or FWHM in hundredths of a pixel
+     */
+    void addSample(uint16_t hfr);
+
+    /**
+     * @brief Stop the run, the focuser stays where it is
+     */
+    void abort();
+
+    /**
+     * @brief Chain the next move of the run once the controller is idle (motion task, after update())
+     */
+    void update();
+
+    State getState() const
+    {
+        return state_;
+    }
+
+    bool isActive() const
+    {
+        State state = state_;
+        return state == State::MOVING || state == State::WAITING || state == State::FOCUSING;
+    }
+
+    /**
+     * @brief Fitted best focus position of the last successful run
+     */
+    long getBestPosition() const
+    {
+        return best_position_;
+    }
+
+    /**
+     * @brief Runs that ended at best focus since start-up, wraps
+     */
+    uint16_t getCompletedRunCount() const
+    {
+        return completed_runs_;
+    }
+};
@@ -0,0 +1,101 @@
+#include "focus_compensation.h"
+
+FocusCompensation::FocusCompensation(MotionController &controller, const Autofocus &autofocus, const Autotune &autotune,
+                                     const FilterOffsets &filters, const TemperatureSensor &temperature,
+                                     const char *settings_namespace)
+    : controller_(controller), autofocus_(autofocus), autotune_(autotune), filters_(filters), temperature_(temperature),
+      store_(settings_namespace)
+{
+}
+
+void FocusCompensation::begin()
+{
+    store_.load(model_);
+    changed(temperature_.getHalfDegrees());
+    dirty_ = false;
+}
+
+void FocusCompensation::changed(int16_t temperature)
+{
+    dirty_ = true;
+    point_count_ = model_.getCount();
+    slope_ = constrain(model_.getSlope(temperature, fallback_slope_), -128L, 127L);
+}
+
+void FocusCompensation::setEnabled(bool enabled)
+{
+    if (enabled && !enabled_)
+    {
+        reference_temperature_ = temperature_.getHalfDegrees();
+        last_check_us_ = micros();
+    }
+    enabled_ = enabled;
+}
+
+void FocusCompensation::record()
+{
+    if (controller_.getIsMoving())
+        return;
+
+    int16_t temperature = temperature_.getHalfDegrees();
+    model_.record(temperature, controller_.getCurrentPosition() - filters_.getActiveOffset());
+    reference_temperature_ = temperature;
+    changed(temperature);
+}
+
+void FocusCompensation::clear()
+{
+    model_.clear();
+    changed(temperature_.getHalfDegrees());
+}
+
+unsigned long FocusCompensation::update()
+{
+    // a run that reached best focus confirms the position, the focuser is still there
+    uint16_t runs = autofocus_.getCompletedRunCount();
+    if (runs != autofocus_runs_)
+    {
+        autofocus_runs_ = runs;
+        record();
+    }
+
+    if (dirty_ && !save_pending_.load(std::memory_order_acquire))
+    {
+        snapshot_ = model_;
+        dirty_ = false;
+        save_pending_.store(true, std::memory_order_release);
+    }
+
+    if (!enabled_)
+        return ULONG_MAX;
+
+    unsigned long now = micros();
+    if (now - last_check_us_ < CHECK_PERIOD_US)
+        return CHECK_PERIOD_US - (now - last_check_us_);
+    last_check_us_ = now;
+
+    int16_t temperature = temperature_.getHalfDegrees();
+    slope_ = constrain(model_.getSlope(temperature, fallback_slope_), -128L, 127L);
+
+    // never move under a run that owns the focuser, or a move of its own
+    if (controller_.getIsMoving() || autofocus_.isActive() || autotune_.isActive())
+        return CHECK_PERIOD_US;
+
+    // a target set with SN waits for FG, the correction follows once the focuser got there
+    if (controller_.getTargetPosition() != controller_.getCurrentPosition())
+        return CHECK_PERIOD_US;
+
+    long correction = model_.getCorrection(reference_temperature_, temperature, fallback_slope_);
+    if (labs(correction) >= MIN_CORRECTION && controller_.shiftTarget(correction))
+        reference_temperature_ = temperature;
+    return CHECK_PERIOD_US;
+}
+
+void FocusCompensation::saveIfPending()
+{
+    if (!save_pending_.load(std::memory_order_acquire))
+        return;
+
+    store_.save(snapshot_);
+    save_pending_.store(false, std::memory_order_release);
+}
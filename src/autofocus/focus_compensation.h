@@ -0,0 +1,121 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "autofocus.h"
+#include "focus_model.h"
+#include "../filters/filter_offsets.h"
+#include "../sensors/temperature_sensor.h"
+#include "../stepper/autotune.h"
+#include "../stepper/motion_controller.h"
+#include "../storage/focus_model_store.h"
+
+/**
+ * @brief Keeps focus across temperature changes with a FocusModel learned from focus runs
+ *
+ * Every autofocus run that ends at best focus, and every position the host confirms with
+ * record(), adds a point to the model at the current temperature and becomes the reference
+ * the focuser is known to be focused for. While enabled, the temperature is checked every
+ * CHECK_PERIOD_US and once the model's correction from the reference temperature reaches
+ * MIN_CORRECTION the focuser moves by it and the reference follows. A target set with SN and
+ * not yet started holds the correction back until the focuser has been there. Until the model
+ * has two points the Moonlite coefficient (SC, steps per degree) is used instead. Points are
+ * recorded without the active filter's offset, so runs through any filter teach the same model.
+ *
+ * The model is written to flash by the protocol task, see saveIfPending(). update(), record(),
+ * clear() and setEnabled() belong to the motion task; the getters and setFallbackSlope() are
+ * safe from other tasks.
+ */
+class FocusCompensation
+{
+public:
+    static constexpr unsigned long CHECK_PERIOD_US = 1000000;
+    static constexpr long MIN_CORRECTION = 4; // steps, smaller corrections wait for more drift
+
+private:
+    MotionController &controller_;
+    const Autofocus &autofocus_;
+    const Autotune &autotune_;
+    const FilterOffsets &filters_;
+    const TemperatureSensor &temperature_;
+    FocusModelStore store_;
+
+    FocusModel model_;
+    FocusModel snapshot_;                  // copy of model_ for the protocol task to save
+    std::atomic<bool> save_pending_{false}; // snapshot_ belongs to the protocol task while set
+    bool dirty_ = false;                   // model_ changed since the last snapshot
+
+    std::atomic<bool> enabled_{false};
+    std::atomic<int8_t> fallback_slope_{0};
+    std::atomic<int8_t> slope_{0};          // model slope at the last temperature looked at, for GC
+    std::atomic<uint8_t> point_count_{0};
+
+    uint16_t autofocus_runs_ = 0;           // completed runs already recorded
+    int16_t reference_temperature_ = 0;     // temperature the current position is focused for
+    unsigned long last_check_us_ = 0;
+
+    void changed(int16_t temperature);
+
+public:
+    FocusCompensation(MotionController &controller, const Autofocus &autofocus, const Autotune &autotune,
+                      const FilterOffsets &filters, const TemperatureSensor &temperature, const char *settings_namespace);
+
+    /**
+     * @brief Load the model from flash
+     */
+    void begin();
+
+    /**
+     * @brief Start or stop following the temperature, starting takes the current position as focused
+     */
+    void setEnabled(bool enabled);
+
+    bool isEnabled() const
+    {
+        return enabled_;
+    }
+
+    /**
+     * @brief Confirm the current position as best focus at the current temperature
+     *
+     * For focus runs done by the host; ignored while the focuser moves.
+     */
+    void record();
+
+    /**
+     * @brief Forget every learned point
+     */
+    void clear();
+
+    /**
+     * @brief Moonlite temperature coefficient, steps per degree, used until the model has two points
+     */
+    void setFallbackSlope(int8_t slope)
+    {
+        fallback_slope_ = slope;
+    }
+
+    /**
+     * @brief Steps per degree the compensation works with at the last temperature looked at
+     */
+    int8_t getSlope() const
+    {
+        return point_count_ >= 2 ? slope_.load() : fallback_slope_.load();
+    }
+
+    uint8_t getPointCount() const
+    {
+        return point_count_;
+    }
+
+    /**
+     * @brief Record finished autofocus runs and correct for the temperature (motion task, after update())
+     * @return Microseconds until the next temperature check, ULONG_MAX while disabled
+     */
+    unsigned long update();
+
+    /**
+     * @brief Write a changed model to flash (protocol task, only while no axis moves)
+     */
+    void saveIfPending();
+};
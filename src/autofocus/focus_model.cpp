@@ -0,0 +1,154 @@
+#include "focus_model.h"
+
+namespace
+{
+    // Rounds halves away from zero, den > 0
+    long divideRounded(int64_t num, int64_t den)
+    {
+        return static_cast<long>(num >= 0 ? (num + den / 2) / den : -((-num + den / 2) / den));
+    }
+
+    int16_t clampTemperature(int16_t temperature, int16_t low, int16_t high)
+    {
+        return temperature < low ? low : (temperature > high ? high : temperature);
+    }
+}
+
+void FocusModel::record(int16_t temperature, long position)
+{
+    size_t nearest = count_;
+    int16_t nearest_distance = MERGE_DISTANCE + 1;
+    for (size_t i = 0; i < count_; i++)
+    {
+        int16_t distance = points_[i].temperature > temperature ? points_[i].temperature - temperature
+                                                                : temperature - points_[i].temperature;
+        if (distance < nearest_distance)
+        {
+            nearest = i;
+            nearest_distance = distance;
+        }
+    }
+
+    if (nearest < count_)
+    {
+        // moves towards the new temperature but stays nearer to it than either neighbour, the order holds
+        Point &point = points_[nearest];
+        int64_t weight = point.weight;
+        point.position = divideRounded(point.position * weight + position, weight + 1);
+        point.temperature = static_cast<int16_t>(divideRounded(point.temperature * weight + temperature, weight + 1));
+        if (point.weight < MAX_WEIGHT)
+            point.weight++;
+        return;
+    }
+
+    size_t index = count_;
+    while (index > 0 && points_[index - 1].temperature > temperature)
+    {
+        points_[index] = points_[index - 1];
+        index--;
+    }
+    points_[index] = Point{static_cast<int32_t>(position), temperature, 1};
+    count_++;
+
+    if (count_ > MAX_POINTS)
+        removeFlattestPoint();
+}
+
+bool FocusModel::load(const Point *points, size_t count)
+{
+    count_ = 0;
+    if (count > MAX_POINTS)
+        return false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (points[i].weight == 0 || points[i].weight > MAX_WEIGHT)
+            return false;
+        if (i > 0 && points[i].temperature <= points[i - 1].temperature)
+            return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        points_[i] = points[i];
+    count_ = count;
+    return true;
+}
+
+size_t FocusModel::findSegment(int16_t temperature) const
+{
+    size_t low = 0;
+    size_t high = count_ - 2;
+    while (low < high)
+    {
+        size_t middle = (low + high + 1) / 2;
+        if (points_[middle].temperature <= temperature)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+long FocusModel::interpolate(size_t segment, int16_t temperature) const
+{
+    const Point &first = points_[segment];
+    const Point &second = points_[segment + 1];
+    int64_t rise = static_cast<int64_t>(second.position - first.position) * (temperature - first.temperature);
+    return first.position + divideRounded(rise, second.temperature - first.temperature);
+}
+
+bool FocusModel::predict(int16_t temperature, long &position) const
+{
+    if (count_ < 2)
+        return false;
+
+    temperature = clampTemperature(temperature, points_[0].temperature - EXTRAPOLATION_LIMIT,
+                                   points_[count_ - 1].temperature + EXTRAPOLATION_LIMIT);
+    position = interpolate(findSegment(temperature), temperature);
+    return true;
+}
+
+long FocusModel::getCorrection(int16_t from, int16_t to, int8_t fallback_slope) const
+{
+    long from_position, to_position;
+    if (predict(from, from_position) && predict(to, to_position))
+        return to_position - from_position;
+
+    return divideRounded(static_cast<int64_t>(fallback_slope) * (to - from), 2);
+}
+
+long FocusModel::getSlope(int16_t temperature, int8_t fallback_slope) const
+{
+    if (count_ < 2)
+        return fallback_slope;
+
+    size_t segment = findSegment(temperature);
+    const Point &first = points_[segment];
+    const Point &second = points_[segment + 1];
+    return 2L * (second.position - first.position) / (second.temperature - first.temperature);
+}
+
+void FocusModel::removeFlattestPoint()
+{
+    size_t flattest = 1;
+    int64_t smallest = INT64_MAX;
+    for (size_t i = 1; i + 1 < count_; i++)
+    {
+        // distance from the line through the neighbours, what dropping the point changes in the model
+        const Point &before = points_[i - 1];
+        const Point &after = points_[i + 1];
+        int64_t line = static_cast<int64_t>(before.position) * (after.temperature - before.temperature) +
+                       static_cast<int64_t>(after.position - before.position) * (points_[i].temperature - before.temperature);
+        int64_t deviation = static_cast<int64_t>(points_[i].position) * (after.temperature - before.temperature) - line;
+        deviation = (deviation < 0 ? -deviation : deviation) / (after.temperature - before.temperature);
+        if (deviation < smallest)
+        {
+            flattest = i;
+            smallest = deviation;
+        }
+    }
+
+    for (size_t i = flattest; i + 1 < count_; i++)
+        points_[i] = points_[i + 1];
+    count_--;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Piecewise-linear best focus position against temperature, learned from focus runs
+ *
+ * Every confirmed focus run adds a (temperature, position) point. A point within MERGE_DISTANCE
+ * of an existing one is averaged into it, with the older point weighing at most MAX_WEIGHT runs,
+ * so the model keeps following slow changes of the optics. Once MAX_POINTS are held, the
+ * interior point that lies closest to the line through its neighbours is dropped, which keeps
+ * the knots where the curve bends and the ends of the temperature range seen so far.
+ *
+ * predict() interpolates between the two knots around a temperature, a binary search and one
+ * division, and extrapolates the end segments for up to EXTRAPOLATION_LIMIT beyond the range.
+ * Temperatures are in half degrees Celsius (Moonlite GT units), positions in steps.
+ */
+class FocusModel
+{
+public:
+    static constexpr size_t MAX_POINTS = 12;
+    static constexpr int16_t MERGE_DISTANCE = 2;      // 1 degree
+    static constexpr uint8_t MAX_WEIGHT = 4;
+    static constexpr int16_t EXTRAPOLATION_LIMIT = 10; // 5 degrees
+
+    struct Point
+    {
+        int32_t position;
+        int16_t temperature;
+        uint8_t weight; // runs averaged into the point, up to MAX_WEIGHT
+    };
+
+    void clear()
+    {
+        count_ = 0;
+    }
+
+    /**
+     * @brief Add the result of a focus run
+     */
+    void record(int16_t temperature, long position);
+
+    /**
+     * @brief Replace the model with stored points
+     * @return false, leaving the model empty, if the points are not a valid model
+     */
+    bool load(const Point *points, size_t count);
+
+    const Point *getPoints() const
+    {
+        return points_;
+    }
+
+    size_t getCount() const
+    {
+        return count_;
+    }
+
+    /**
+     * @brief Best focus position at a temperature
+     * @return false with fewer than two points
+     */
+    bool predict(int16_t temperature, long &position) const;
+
+    /**
+     * @brief Focus change for a temperature change
+     * @param fallback_slope Steps per degree used while the model has fewer than two points
+     */
+    long getCorrection(int16_t from, int16_t to, int8_t fallback_slope) const;
+
+    /**
+     * @brief Slope of the segment used at a temperature, in steps per degree rounded towards zero
+     * @return fallback_slope with fewer than two points
+     */
+    long getSlope(int16_t temperature, int8_t fallback_slope) const;
+
+private:
+    Point points_[MAX_POINTS + 1] = {}; // sorted by temperature, one spare for an insert before pruning
+    size_t count_ = 0;
+
+    // First knot of the segment used at a temperature, count_ >= 2
+    size_t findSegment(int16_t temperature) const;
+
+    long interpolate(size_t segment, int16_t temperature) const;
+
+    void removeFlattestPoint();
+};
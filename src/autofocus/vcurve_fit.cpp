@@ -0,0 +1,81 @@
+#include "vcurve_fit.h"
+
+namespace
+{
+    // HFR^2 scaling, keeps y within 22 bits for HFR up to MAX_HFR
+    constexpr int Y_SHIFT = 4;
+
+    int64_t magnitude(int64_t value)
+    {
+        return value < 0 ? -value : value;
+    }
+}
+
+void VCurveFit::reset()
+{
+    *this = VCurveFit();
+}
+
+bool VCurveFit::addSample(int x, uint16_t hfr)
+{
+    if (count_ >= MAX_SAMPLES)
+        return false;
+
+    if (hfr > MAX_HFR)
+        hfr = MAX_HFR;
+
+    int64_t y = (static_cast<int64_t>(hfr) * hfr) >> Y_SHIFT;
+    int64_t x2 = static_cast<int64_t>(x) * x;
+
+    count_++;
+    sum_x_ += x;
+    sum_x2_ += x2;
+    sum_x3_ += x2 * x;
+    sum_x4_ += x2 * x2;
+    sum_y_ += y;
+    sum_xy_ += x * y;
+    sum_x2y_ += x2 * y;
+    return true;
+}
+
+bool VCurveFit::solve(int32_t &vertex) const
+{
+    if (count_ < 3)
+        return false;
+
+    // Normal equations of y = a x^2 + b x + c with c eliminated:
+    //   a11 a + a12 b = b1
+    //   a12 a + a22 b = b2
+    int64_t n = count_;
+    int64_t a11 = n * sum_x4_ - sum_x2_ * sum_x2_;
+    int64_t a12 = n * sum_x3_ - sum_x_ * sum_x2_;
+    int64_t a22 = n * sum_x2_ - sum_x_ * sum_x_;
+    int64_t b1 = n * sum_x2y_ - sum_x2_ * sum_y_;
+    int64_t b2 = n * sum_xy_ - sum_x_ * sum_y_;
+
+    int64_t determinant = a11 * a22 - a12 * a12;
+    if (determinant <= 0)
+        return false; // fewer than three distinct positions
+
+    // Cramer's rule; the vertex -b / 2a only needs the numerators, the determinant cancels
+    int64_t a_numerator = b1 * a22 - a12 * b2;
+    int64_t b_numerator = a11 * b2 - a12 * b1;
+    if (a_numerator <= 0)
+        return false;
+
+    // make room for the fraction bits and the factor 2
+    while (magnitude(b_numerator) >= (INT64_C(1) << 53) || a_numerator >= (INT64_C(1) << 53))
+    {
+        b_numerator /= 2;
+        a_numerator /= 2;
+    }
+    if (a_numerator == 0)
+        return false;
+
+    int64_t result = -b_numerator * (INT64_C(1) << (VERTEX_FRACTION_BITS - 1)) / a_numerator;
+    if (magnitude(result) > INT32_MAX)
+        return false;
+
+    vertex = static_cast<int32_t>(result);
+    return true;
+}
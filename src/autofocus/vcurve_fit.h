@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Incremental least-squares parabola through HFR^2 samples, in fixed point
+ *
+ * The HFR of a star against focuser position follows a hyperbola, whose square is a parabola, so
+ * fitting y = HFR^2 with a parabola is exact for noise-free curves. Samples are positions in units
+ * of the sampling step relative to the run's start, and only the power sums are kept, so adding
+ * a sample costs a few integer multiply-adds and the fit never needs the samples again.
+ *
+ * With at most MAX_SAMPLES samples, |x| <= MAX_SAMPLES and HFR <= MAX_HFR every intermediate
+ * product fits in 64 bits.
+ */
+class VCurveFit
+{
+public:
+    static constexpr uint8_t MAX_SAMPLES = 16;
+    static constexpr uint16_t MAX_HFR = 8191; // larger values are clamped
+    static constexpr int VERTEX_FRACTION_BITS = 8;
+
+    void reset();
+
+    /**
+     * @param x Sample position in steps of the sampling grid, |x| <= MAX_SAMPLES
+     * @param hfr Half flux radius (or FWHM) in any fixed unit, e.g. hundredths of a pixel
+     * @return false once MAX_SAMPLES samples are held
+     */
+    bool addSample(int x, uint16_t hfr);
+
+    uint8_t getSampleCount() const
+    {
+        return count_;
+    }
+
+    /**
+     * @brief Position of the fitted minimum
+     * @param vertex Set to the minimum in grid steps, with VERTEX_FRACTION_BITS fraction bits
+     * @return false if there are fewer than three distinct positions or the curve does not open upwards
+     */
+    bool solve(int32_t &vertex) const;
+
+private:
+    uint8_t count_ = 0;
+    int64_t sum_x_ = 0;
+    int64_t sum_x2_ = 0;
+    int64_t sum_x3_ = 0;
+    int64_t sum_x4_ = 0;
+    int64_t sum_y_ = 0;
+    int64_t sum_xy_ = 0;
+    int64_t sum_x2y_ = 0;
+};
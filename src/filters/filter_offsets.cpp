@@ -0,0 +1,78 @@
+#include "filter_offsets.h"
+
+FilterOffsets::FilterOffsets(MotionController &controller, const char *settings_namespace)
+    : controller_(controller), store_(settings_namespace)
+{
+}
+
+void FilterOffsets::begin()
+{
+    store_.load(presets_);
+}
+
+void FilterOffsets::beginEdit()
+{
+    edit_count_.store(edit_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void FilterOffsets::endEdit()
+{
+    edit_count_.store(edit_count_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+FilterOffsets::Preset FilterOffsets::readPreset(uint8_t index) const
+{
+    Preset preset;
+    uint32_t before, after;
+    do
+    {
+        before = edit_count_.load(std::memory_order_acquire);
+        preset = presets_[index];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = edit_count_.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+    return preset;
+}
+
+void FilterOffsets::save() const
+{
+    Preset presets[COUNT];
+    for (uint8_t i = 0; i < COUNT; i++)
+        presets[i] = readPreset(i);
+    store_.save(presets);
+}
+
+void FilterOffsets::apply(uint8_t index)
+{
+    if (index >= COUNT)
+        return;
+
+    if (controller_.shiftTarget(presets_[index].offset - getActiveOffset()))
+        active_ = index;
+}
+
+void FilterOffsets::setActive(uint8_t index)
+{
+    if (index < COUNT || index == NONE)
+        active_ = index;
+}
+
+void FilterOffsets::setName(uint32_t packed)
+{
+    char name[NAME_LENGTH + 1];
+    size_t length = 0;
+    for (size_t i = 0; i < NAME_LENGTH; i++)
+    {
+        char ch = static_cast<char>(packed >> (8 * (NAME_LENGTH - 1 - i)));
+        if (ch == '\0')
+            break;
+        // replies end at '#', keep the name printable and free of it
+        name[length++] = (ch >= ' ' && ch <= '~' && ch != '#') ? ch : '?';
+    }
+    name[length] = '\0';
+
+    beginEdit();
+    memcpy(presets_[selected_].name, name, length + 1);
+    endEdit();
+}
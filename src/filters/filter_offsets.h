@@ -0,0 +1,129 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "../stepper/motion_controller.h"
+#include "../storage/filter_offset_store.h"
+
+/**
+ * @brief Named focus offsets of the filters in front of one focuser
+ *
+ * Each preset holds the focus shift of a filter relative to the reference filter, which has
+ * offset 0. apply() moves the focuser by the difference between the new filter's offset and the
+ * active one's, folding it into any pending or running move (see MotionController::shiftTarget()),
+ * so a filter change is a single command and a single ramp. Until a preset is applied or marked
+ * active the reference filter is assumed to be in place.
+ *
+ * Presets are edited through a selected preset, the way the motion profile commands edit the
+ * active profile, and written to flash with save(). Edits and apply() belong to the motion task;
+ * the getters are safe from other tasks. The presets are too large to update atomically, so
+ * edits bump edit_count_ before and after writing and readers copy a preset until the count
+ * is even and the same on both sides of the copy (a seqlock; the motion task is never preempted
+ * by a reader, so a retry is all a reader can run into).
+ */
+class FilterOffsets
+{
+public:
+    static constexpr uint8_t COUNT = FilterOffsetStore::PRESET_COUNT;
+    static constexpr uint8_t NONE = 0xFF; // no preset applied, the reference filter is in place
+    static constexpr size_t NAME_LENGTH = FilterOffsetStore::NAME_LENGTH;
+
+    using Preset = FilterOffsetStore::Preset;
+
+private:
+    MotionController &controller_;
+    FilterOffsetStore store_;
+
+    Preset presets_[COUNT] = {};
+    std::atomic<uint32_t> edit_count_{0}; // odd while the motion task writes presets_
+    std::atomic<uint8_t> active_{NONE};
+    std::atomic<uint8_t> selected_{0};
+    mutable char name_[NAME_LENGTH + 1] = {}; // getName() reply, protocol task only
+
+    void beginEdit();
+    void endEdit();
+    Preset readPreset(uint8_t index) const;
+
+public:
+    FilterOffsets(MotionController &controller, const char *settings_namespace);
+
+    /**
+     * @brief Load the presets from flash
+     */
+    void begin();
+
+    /**
+     * @brief Change to a preset's filter: move by its offset relative to the active preset
+     *
+     * Starts the move like FG, including a target set with SN that was not started yet.
+     * Ignored for an index out of range or while the focuser jogs or homes.
+     */
+    void apply(uint8_t index);
+
+    /**
+     * @brief Mark a preset's filter as the one in place without moving, NONE for the reference filter
+     */
+    void setActive(uint8_t index);
+
+    uint8_t getActive() const
+    {
+        return active_;
+    }
+
+    /**
+     * @brief Offset of the active preset, 0 for the reference filter
+     */
+    int16_t getActiveOffset() const
+    {
+        uint8_t active = active_;
+        return active < COUNT ? readPreset(active).offset : 0;
+    }
+
+    /**
+     * @brief Select the preset setOffset(), setName() and the getters below work on
+     */
+    void select(uint8_t index)
+    {
+        if (index < COUNT)
+            selected_ = index;
+    }
+
+    uint8_t getSelected() const
+    {
+        return selected_;
+    }
+
+    /**
+     * @brief Set the selected preset's offset in steps, the focuser does not move
+     */
+    void setOffset(int16_t offset)
+    {
+        beginEdit();
+        presets_[selected_].offset = offset;
+        endEdit();
+    }
+
+    int16_t getOffset() const
+    {
+        return readPreset(selected_).offset;
+    }
+
+    /**
+     * @brief Set the selected preset's name from up to four characters packed big-endian, 00 ends it early
+     */
+    void setName(uint32_t packed);
+
+    /**
+     * @brief Name of the selected preset, valid until the next call (protocol task)
+     */
+    const char *getName() const
+    {
+        memcpy(name_, readPreset(selected_).name, sizeof(name_));
+        return name_;
+    }
+
+    /**
+     * @brief Persist every preset (call from the protocol task while idle)
+     */
+    void save() const;
+};
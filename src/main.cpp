@@ -1,125 +1,212 @@
 #include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "autofocus/autofocus.h"
+#include "autofocus/focus_compensation.h"
+#include "filters/filter_offsets.h"
 #include "moonlite/moonlite.h"
 #include "moonlite/command.h"
 #include "stepper/motion_controller.h"
-
-Moonlite moonlite(9600);
-MotionController motionController;
-
-void setup()
+#include "app/app_context.h"
+#include "app/command_table.h"
+#include "sensors/temperature_sensor.h"
+#include "stepper/autotune.h"
+#include "tasks/motion_task.h"
+#include "telemetry/telemetry.h"
+#include "util/heap_guard.h"
+
+// Protocol and housekeeping run in the Arduino loop task (priority 1), motion preempts them
+constexpr UBaseType_t MOTION_TASK_PRIORITY = 10;
+constexpr uint32_t HOUSEKEEPING_PERIOD_MS = 100;
+constexpr uint32_t TELEMETRY_FLUSH_PERIOD_MS = 20; // replaces the housekeeping period while telemetry streams
+
+Moonlite moonlite(COMMAND_TABLE, COMMAND_COUNT, 9600);
+
+// DIAG outputs go to GPIO0/GPIO1 for sensorless homing. Boards without the DIAG wires build with
+// -DEAF_NO_DIAG: the pins are left alone and stalls are read as SG_RESULT over UART instead.
+#ifdef EAF_NO_DIAG
+constexpr uint8_t DIAG_PINS[MOTOR_COUNT] = {TMC2209Driver::NO_DIAG_PIN, TMC2209Driver::NO_DIAG_PIN};
+#else
+constexpr uint8_t DIAG_PINS[MOTOR_COUNT] = {0, 1};
+#endif
+
+// Both TMC2209s share one UART; the second one is strapped to address 1 (MS1 high).
+MotionController motionControllers[MOTOR_COUNT] = {
+    MotionController(6, 5, 21, 7, 8, 0b00, "focuser0", DIAG_PINS[0]),
+    MotionController(3, 4, 10, 7, 8, 0b01, "focuser1", DIAG_PINS[1]),
+};
+
+Autofocus autofocus[MOTOR_COUNT] = {
+    Autofocus(motionControllers[0]),
+    Autofocus(motionControllers[1]),
+};
+
+Autotune autotune[MOTOR_COUNT] = {
+    Autotune(motionControllers[0]),
+    Autotune(motionControllers[1]),
+};
+
+TemperatureSensor temperatureSensor;
+Telemetry telemetry(temperatureSensor);
+
+// Filter presets and learned models live next to the profiles, in each focuser's namespace
+FilterOffsets filterOffsets[MOTOR_COUNT] = {
+    FilterOffsets(motionControllers[0], "focuser0"),
+    FilterOffsets(motionControllers[1], "focuser1"),
+};
+
+FocusCompensation focusCompensation[MOTOR_COUNT] = {
+    FocusCompensation(motionControllers[0], autofocus[0], autotune[0], filterOffsets[0], temperatureSensor, "focuser0"),
+    FocusCompensation(motionControllers[1], autofocus[1], autotune[1], filterOffsets[1], temperatureSensor, "focuser1"),
+};
+
+void applyMotionCommand(const Command &cmd);
+
+AppContext app{motionControllers, MOTOR_COUNT, &telemetry, &temperatureSensor, autofocus, autotune, focusCompensation,
+               filterOffsets};
+MotionTask motionTask(motionControllers, MOTOR_COUNT, applyMotionCommand, &telemetry, autofocus, autotune,
+                      focusCompensation);
+
+/**
+ * @brief Run a posted command's handler (runs on the motion task)
+ */
+void applyMotionCommand(const Command &cmd)
 {
-    motionController.begin();
+    const CommandSpec *spec = findCommandSpec(cmd.type);
+    if (spec != nullptr)
+        spec->handler(app, cmd);
 }
 
-void loop()
+void dispatchCommands()
 {
-    moonlite.update();
-    if (moonlite.commandAvailable())
+    // Commands are framed and queued by the serial RX callback as bytes arrive
+    while (moonlite.commandAvailable())
     {
         Command cmd = moonlite.getCommand();
+        const CommandSpec *spec = findCommandSpec(cmd.type);
+        if (spec == nullptr)
+            continue; // Unknown command, ignore
 
-        switch (cmd.type)
+        // Queries are answered here, anything that changes motion state goes to the motion task
+        if (spec->context == CommandContext::MOTION)
         {
-        case CommandType::CMD_C:
-            // Initiate temperature conversion
-            break;
-
-        case CommandType::CMD_FG:
-            // Go to target position
-            motionController.startMovement();
-            break;
-
-        case CommandType::CMD_FQ:
-            // Halt motor movement immediately
-            motionController.stopMovement();
-            break;
-
-        case CommandType::CMD_GB:
-            // Get red LED backlight brightness value
-            moonlite.sendHex2(0x00); // TODO: Implement backlight control
-            break;
-
-        case CommandType::CMD_GC:
-            // Get current temperature coefficient
-            moonlite.sendHex2(0x02); // TODO: Implement temperature compensation
-            break;
-
-        case CommandType::CMD_GD:
-            // Get current motor speed
-            moonlite.sendHex2(motionController.getSpeed()); // TODO: Implement speed control
-            break;
-
-        case CommandType::CMD_GH:
-            // Get half-step mode status
-            if (motionController.getStepMode() == StepMode::HALF_STEP)
-                moonlite.sendHex2(0xFF);
-            else
-                moonlite.sendHex2(0x00);
-            break;
+            motionTask.post(cmd);
+        }
+        else if (spec->cached)
+        {
+            // Polled getters reuse their last reply until the motion task changes the axis state
+            uint32_t state_version = app.axis(cmd).getStateVersion();
+            if (!moonlite.sendCached(cmd, state_version))
+                moonlite.sendAndCache(spec->handler(app, cmd), cmd, state_version);
+        }
+        else
+        {
+            moonlite.send(spec->handler(app, cmd));
+        }
+    }
+}
 
-        case CommandType::CMD_GI:
-            // Get motor is moving status (00=stopped, 01=moving)
-            if (motionController.getIsMoving())
-                moonlite.sendHex2(0x01);
+void dispatchRequests()
+{
+    // Binary requests run the same handlers in order and are answered with one frame
+    Moonlite::Request request;
+    while (moonlite.getRequest(request))
+    {
+        if (!request.valid)
+        {
+            moonlite.sendReply(request, Moonlite::RequestStatus::BAD_REQUEST, nullptr);
+            continue;
+        }
+
+        Response responses[Moonlite::MAX_BATCH_SIZE];
+        Moonlite::RequestStatus status = Moonlite::RequestStatus::OK;
+        for (size_t i = 0; i < request.count; i++)
+        {
+            const Command &cmd = request.commands[i];
+            const CommandSpec &spec = *findCommandSpec(cmd.type);
+            if (spec.context == CommandContext::MOTION)
+            {
+                responses[i] = Response::none();
+                if (!motionTask.post(cmd))
+                    status = Moonlite::RequestStatus::BUSY;
+            }
             else
-                moonlite.sendHex2(0x00);
-            break;
-
-        case CommandType::CMD_GN:
-            // Get target position
-            moonlite.sendHex4(motionController.getTargetPosition());
-            break;
-
-        case CommandType::CMD_GP:
-            // Get current position
-            moonlite.sendHex4(motionController.getCurrentPosition());
-            break;
-
-        case CommandType::CMD_GT:
-            // Get current temperature
-            // Return placeholder 20 degrees Celsius
-            moonlite.sendHex4(40); // 20 C = 40 in half degrees
-            break;
-
-        case CommandType::CMD_GV:
-            // Get firmware version
-            moonlite.sendString("V1.0"); // Version 1
-            break;
-
-        case CommandType::CMD_SC:
-            // Set temperature coefficient
-            // Value in cmd.value
-            break;
-
-        case CommandType::CMD_SD:
-            // Set motor speed
-            motionController.setSpeed(cmd.value);
-            break;
-
-        case CommandType::CMD_SF:
-            // Set full-step mode
-            motionController.setStepMode(StepMode::FULL_STEP);
-            break;
-
-        case CommandType::CMD_SH:
-            // Set half-step mode
-            motionController.setStepMode(StepMode::HALF_STEP);
-            break;
-
-        case CommandType::CMD_SN:
-            // Set target position
-            motionController.setTargetPosition(cmd.value);
-            break;
-
-        case CommandType::CMD_SP:
-            // Set current position
-            motionController.setCurrentPosition(cmd.value);
-            break;
-
-        case CommandType::UNKNOWN:
-            // Unknown command, ignore
-            break;
+            {
+                responses[i] = spec.handler(app, cmd);
+            }
         }
+        moonlite.sendReply(request, status, responses);
     }
-    motionController.update();
+}
+
+void streamTelemetry()
+{
+    // Pack as many records into each frame as fit
+    constexpr size_t RECORDS_PER_FRAME = Moonlite::MAX_STREAM_LENGTH / sizeof(TelemetryRecord);
+    TelemetryRecord records[RECORDS_PER_FRAME];
+    size_t count = 0;
+    while (count < RECORDS_PER_FRAME && telemetry.pop(records[count]))
+    {
+        if (++count == RECORDS_PER_FRAME)
+        {
+            moonlite.sendStream(records, sizeof(records), telemetry.getDroppedRecordCount());
+            count = 0;
+        }
+    }
+    if (count > 0)
+        moonlite.sendStream(records, count * sizeof(TelemetryRecord), telemetry.getDroppedRecordCount());
+}
+
+void saveSettings()
+{
+    // Flash writes stall the instruction cache, and with it every task, so never while an axis moves
+    if (app.anyAxisMoving())
+        return;
+
+    for (auto &compensation : focusCompensation)
+        compensation.saveIfPending();
+    for (auto &tune : autotune)
+        tune.saveIfPending();
+}
+
+void setup()
+{
+    for (auto &motionController : motionControllers)
+        motionController.begin();
+    for (auto &filters : filterOffsets)
+        filters.begin();
+    for (auto &compensation : focusCompensation)
+        compensation.begin();
+
+    moonlite.begin();
+
+#ifndef EAF_SINGLE_LOOP
+    moonlite.setDispatcherTask(xTaskGetCurrentTaskHandle());
+    motionTask.begin(MOTION_TASK_PRIORITY);
+#endif
+
+    // Everything that allocates (tasks, timers, serial callbacks) is set up by now
+    HeapGuard::seal();
+}
+
+void loop()
+{
+#ifdef EAF_SINGLE_LOOP
+    // Reference build: parsing, dispatch and stepping share one loop, compare XFJ against the task split
+    dispatchCommands();
+    dispatchRequests();
+    motionTask.poll();
+    streamTelemetry();
+    saveSettings();
+#else
+    // Sleep until the RX callback queues a command, or until housekeeping is due
+    uint32_t wait_ms = telemetry.isEnabled() ? TELEMETRY_FLUSH_PERIOD_MS : HOUSEKEEPING_PERIOD_MS;
+    if (!moonlite.commandAvailable() && !moonlite.requestAvailable())
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+
+    dispatchCommands();
+    dispatchRequests();
+    streamTelemetry();
+    saveSettings();
+#endif
 }
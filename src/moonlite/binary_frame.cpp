@@ -0,0 +1,116 @@
+#include "binary_frame.h"
+#include <string.h>
+
+uint16_t crc16(const uint8_t *data, size_t length, uint16_t crc)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+void BinaryFrame::begin(unsigned long now_us)
+{
+    state_ = State::LENGTH;
+    received_ = 0;
+    last_byte_us_ = now_us;
+}
+
+bool BinaryFrame::isReceiving() const
+{
+    return state_ != State::IDLE;
+}
+
+BinaryFrame::Result BinaryFrame::receiveByte(uint8_t byte, unsigned long now_us)
+{
+    if (state_ == State::IDLE)
+        return Result::PENDING;
+
+    bytes_[received_++] = byte;
+    last_byte_us_ = now_us;
+
+    switch (state_)
+    {
+    case State::IDLE:
+        break;
+
+    case State::LENGTH:
+        // an oversized length can only be noise, drop back to ASCII
+        if (byte > MAX_PAYLOAD_LENGTH)
+        {
+            state_ = State::IDLE;
+            return Result::CRC_ERROR;
+        }
+        length_ = byte;
+        state_ = (length_ > 0) ? State::PAYLOAD : State::CRC_HIGH;
+        if (length_ == 0)
+            crc_ = crc16(bytes_, 1);
+        break;
+
+    case State::PAYLOAD:
+        if (received_ == 1u + length_)
+        {
+            crc_ = crc16(bytes_, received_);
+            state_ = State::CRC_HIGH;
+        }
+        break;
+
+    case State::CRC_HIGH:
+        if (byte != (crc_ >> 8))
+        {
+            state_ = State::IDLE;
+            return Result::CRC_ERROR;
+        }
+        state_ = State::CRC_LOW;
+        break;
+
+    case State::CRC_LOW:
+        state_ = State::IDLE;
+        return (byte == (crc_ & 0xFF)) ? Result::COMPLETE : Result::CRC_ERROR;
+    }
+    return Result::PENDING;
+}
+
+bool BinaryFrame::expire(unsigned long now_us)
+{
+    if (state_ == State::IDLE || now_us - last_byte_us_ <= INTER_BYTE_TIMEOUT_US)
+        return false;
+
+    state_ = State::IDLE;
+    return true;
+}
+
+size_t BinaryFrame::getResyncBytes(uint8_t *buffer) const
+{
+    const uint8_t *sync = static_cast<const uint8_t *>(memchr(bytes_, SYNC, received_));
+    if (sync == nullptr)
+        return 0;
+
+    size_t length = received_ - (sync - bytes_);
+    memcpy(buffer, sync, length);
+    return length;
+}
+
+const uint8_t *BinaryFrame::getPayload() const
+{
+    return &bytes_[1];
+}
+
+size_t BinaryFrame::getLength() const
+{
+    return length_;
+}
+
+size_t BinaryFrame::encode(const uint8_t *payload, uint8_t length, uint8_t *buffer)
+{
+    buffer[0] = SYNC;
+    buffer[1] = length;
+    memcpy(&buffer[2], payload, length);
+    uint16_t crc = crc16(&buffer[1], length + 1);
+    buffer[length + 2] = crc >> 8;
+    buffer[length + 3] = crc & 0xFF;
+    return length + OVERHEAD;
+}
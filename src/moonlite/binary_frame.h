@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+ */
+uint16_t crc16(const uint8_t *data, size_t length, uint16_t crc = 0xFFFF);
+
+/**
+ * @brief Framing of the binary protocol that shares the serial port with Moonlite
+ *
+ * A frame is SYNC, LENGTH, LENGTH payload bytes and a big-endian CRC-16 over LENGTH and the
+ * payload. SYNC never appears in ASCII Moonlite traffic, so frames are recognised between commands.
+ * A frame whose bytes stop coming for INTER_BYTE_TIMEOUT_US is dropped, and the bytes of a dropped
+ * frame can be searched for the SYNC of a frame that started inside it (see getResyncBytes()).
+ */
+class BinaryFrame
+{
+public:
+    static constexpr uint8_t SYNC = 0xA5;
+    static constexpr size_t MAX_PAYLOAD_LENGTH = 128;
+    static constexpr size_t OVERHEAD = 4; // SYNC, LENGTH and CRC
+    static constexpr unsigned long INTER_BYTE_TIMEOUT_US = 20000; // a sender writes a frame in one go
+
+    enum class Result : uint8_t
+    {
+        PENDING,   // more bytes are needed
+        COMPLETE,  // payload is ready in getPayload()
+        CRC_ERROR, // frame was corrupted or timed out and has been dropped
+    };
+
+private:
+    enum class State : uint8_t
+    {
+        IDLE,
+        LENGTH,
+        PAYLOAD,
+        CRC_HIGH,
+        CRC_LOW,
+    };
+
+    State state_ = State::IDLE;
+    uint8_t length_ = 0;
+    size_t received_ = 0; // bytes after SYNC
+    uint16_t crc_ = 0;
+    unsigned long last_byte_us_ = 0;
+    uint8_t bytes_[MAX_PAYLOAD_LENGTH + OVERHEAD - 1]; // LENGTH, payload and CRC as received
+
+public:
+    /**
+     * @brief Start receiving a frame, call after the SYNC byte
+     * @param now_us micros() when SYNC arrived
+     */
+    void begin(unsigned long now_us);
+
+    /**
+     * @brief Whether a frame has been started and not yet completed
+     */
+    bool isReceiving() const;
+
+    /**
+     * @brief Feed the byte following SYNC or a previous byte of the frame
+     * @param now_us micros() when the byte arrived
+     */
+    Result receiveByte(uint8_t byte, unsigned long now_us);
+
+    /**
+     * @brief Drop a frame whose next byte is more than INTER_BYTE_TIMEOUT_US overdue
+     * @return true if a frame was dropped, its bytes can be taken with getResyncBytes()
+     */
+    bool expire(unsigned long now_us);
+
+    /**
+     * @brief Bytes of the frame just dropped, from the first SYNC after its own
+     *
+     * A lost byte or a stray SYNC makes a frame swallow the start of the next one, those bytes
+     * are fed again.
+     * @param buffer Output, at least MAX_PAYLOAD_LENGTH + OVERHEAD - 1 bytes
+     * @return Number of bytes copied, 0 if the frame held no SYNC
+     */
+    size_t getResyncBytes(uint8_t *buffer) const;
+
+    const uint8_t *getPayload() const;
+
+    size_t getLength() const;
+
+    /**
+     * @brief Wrap a payload into a frame
+     * @param buffer Output, at least length + OVERHEAD bytes
+     * @return Frame length in bytes
+     */
+    static size_t encode(const uint8_t *payload, uint8_t length, uint8_t *buffer);
+};
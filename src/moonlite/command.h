@@ -1,12 +1,20 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
+// Motor index carried in Command::motor. Commands prefixed with '2' address the second focuser.
+constexpr int PRIMARY_MOTOR = 0;
+constexpr int SECONDARY_MOTOR = 1;
+constexpr int MOTOR_COUNT = 2;
+
 enum class CommandType
 {
     CMD_C,  // Initiate temperature conversion
     CMD_FG, // Go to target position (with XXXX parameter)
     CMD_FQ, // Halt motor movement immediately
     CMD_GB, // Get red LED backlight brightness value (00-FF)
-    CMD_GC, // Get current temperature coefficient (XX format, signed 2's complement)
+    CMD_GC, // Get current temperature coefficient (XX format, signed 2's complement, steps per degree, learned once available)
     CMD_GD, // Get current motor speed (FF=slow, 00=fast)
     CMD_GH, // Get half-step mode status
     CMD_GI, // Get motor is moving status (00=stopped, 01=moving)
@@ -14,12 +22,60 @@ enum class CommandType
     CMD_GP, // Get current position (XXXX format)
     CMD_GT, // Get current temperature (XXXX format in half degrees Celsius)
     CMD_GV, // Get firmware version (XX format)
-    CMD_SC, // Set temperature coefficient (SCXX format, signed 2's complement)
+    CMD_SC, // Set temperature coefficient (SCXX format, signed 2's complement, steps per degree, used until a model is learned)
     CMD_SD, // Set motor speed (SDXX format, FF=slow, 00=fast)
     CMD_SF, // Set full-step mode
     CMD_SH, // Set half-step mode
     CMD_SN, // Set target position (SNXXXX format)
     CMD_SP, // Set current position (SPXXXX format)
+
+    // Extensions (X prefix), not part of the original Moonlite protocol
+    CMD_XFS, // Get fault flags (XX format, 01=lost steps, 02=stall)
+    CMD_XFL, // Get lost step count (XXXX format)
+    CMD_XFK, // Get stall count (XXXX format)
+    CMD_XFC, // Clear fault flags and counters
+    CMD_XFJ, // Get worst step lateness since the last XFC (XXXXXXXX format, microseconds)
+    CMD_XHS, // Start sensorless homing
+    CMD_XHO, // Set home offset (XHOXXXX format)
+    CMD_XHT, // Set StallGuard threshold (XHTXX format)
+    CMD_XHI, // Get homing state (XX format)
+    CMD_XJV, // Set jog velocity (XJVXXXX format, signed 2's complement steps/s, 0000=stop)
+    CMD_XMT, // Get estimated duration of the planned move (XXXXXXXX format, milliseconds)
+    CMD_XPS, // Select motion profile (XPSXX format)
+    CMD_XPG, // Get active motion profile (XX format)
+    CMD_XPN, // Get active motion profile name
+    CMD_XPA, // Set active profile max speed (XPAXXXX format, steps/s)
+    CMD_XPB, // Set active profile acceleration (XPBXXXX format, steps/s^2)
+    CMD_XPV, // Set active profile start speed (XPVXXXX format, steps/s)
+    CMD_XPJ, // Set active profile jerk (XPJXXXX format, steps/s^3, 0000=trapezoidal)
+    CMD_XPW, // Save active motion profile and selection to flash (ignored while moving)
+    CMD_XTR, // Set telemetry period (XTRXXXX format, milliseconds, 0000=off)
+    CMD_XTD, // Get dropped telemetry record count (XXXX format)
+    CMD_XR0, // Set active profile resonance band 0 (XR0LLLLHHHH format, low and high edge in steps/s, HHHH<=LLLL clears)
+    CMD_XR1, // Set active profile resonance band 1 (XR1LLLLHHHH format)
+    CMD_XAS, // Start autofocus around the current position (XASWWWWNN format, WWWW=grid step, NN=planned samples)
+    CMD_XAH, // Report the HFR or FWHM measured at the current autofocus sample (XAHXXXX format, hundredths of a pixel)
+    CMD_XAI, // Get autofocus state (XX format, 00=idle, 01=moving, 02=waiting for XAH, 03=focusing, 04=done, 05=failed)
+    CMD_XAP, // Get best focus position of the last autofocus run (XXXX format)
+    CMD_XUS, // Start load-aware autotuning of the active profile (XUSXXXX format, test move length in steps, moves outward first)
+    CMD_XUI, // Get autotune state (XX format, 00=idle, 01=running, 02=done, 03=failed)
+    CMD_XUO, // Get autotuned outward max speed and acceleration (SSSSAAAA format, steps/s and steps/s^2)
+    CMD_XUN, // Get autotuned inward max speed and acceleration (SSSSAAAA format)
+    CMD_XCE, // Enable temperature compensation (XCEXX format, 00=off, 01=on, the current position is taken as focused)
+    CMD_XCR, // Record the current position as best focus at the current temperature in the learned model
+    CMD_XCC, // Clear the learned temperature model
+    CMD_XCN, // Get learned temperature model point count (XX format)
+    CMD_XOA, // Apply filter offset preset (XOAXX format, 00-0F), one move by its offset from the active preset, a pending SN target included
+    CMD_XOK, // Mark a filter offset preset as in place without moving (XOKXX format, FF=reference filter)
+    CMD_XOG, // Get active filter offset preset (XX format, FF=reference filter)
+    CMD_XOE, // Select the filter offset preset edited by XOS and XON and read by XOO and XOM (XOEXX format)
+    CMD_XOS, // Set selected preset offset (XOSXXXX format, signed 2's complement steps from the reference filter)
+    CMD_XOO, // Get selected preset offset (XXXX format)
+    CMD_XON, // Set selected preset name (XONXXXXXXXX format, up to four ASCII characters, 00 ends the name)
+    CMD_XOM, // Get selected preset name
+    CMD_XOW, // Save filter offset presets to flash (ignored while moving)
+    CMD_XFG, // Get time from FG to the first step of the last move (XXXXXXXX format, microseconds)
+    CMD_XFW, // Get longest FG to first step time since the last XFC (XXXXXXXX format, microseconds)
     UNKNOWN,
 };
 
@@ -27,5 +83,59 @@ struct Command
 {
     CommandType type;
     int value;
-    int motor;
+    int motor; // PRIMARY_MOTOR or SECONDARY_MOTOR
+};
+
+
+/**
+ * @brief Reply produced by a command handler, formatted by the protocol layer
+ */
+struct Response
+{
+    enum class Format : uint8_t
+    {
+        NONE,   // nothing is sent
+        HEX2,   // XX#
+        HEX4,   // XXXX#
+        HEX8,   // XXXXXXXX#
+        STRING, // text#
+    };
+
+    Format format;
+    uint32_t value;
+    const char *text;
+
+    static constexpr Response none() { return Response{Format::NONE, 0, nullptr}; }
+    static constexpr Response hex2(uint8_t value) { return Response{Format::HEX2, value, nullptr}; }
+    static constexpr Response hex4(uint16_t value) { return Response{Format::HEX4, value, nullptr}; }
+    static constexpr Response hex8(uint32_t value) { return Response{Format::HEX8, value, nullptr}; }
+    static constexpr Response string(const char *text) { return Response{Format::STRING, 0, text}; }
 };
+
+// Where a command runs: queries are answered by the protocol task, motion state changes are posted to the motion task
+enum class CommandContext : uint8_t
+{
+    PROTOCOL,
+    MOTION,
+};
+
+struct AppContext;
+
+/**
+ * @brief One entry of the command table shared by the parser and the dispatcher
+ */
+struct CommandSpec
+{
+    const char *opcode;   // characters after ':' and the optional '2' prefix
+    uint8_t value_digits; // hex digits following the opcode, 0 if the command has no value
+    CommandType type;
+    CommandContext context;
+    Response (*handler)(AppContext &app, const Command &command);
+    bool cached = false; // reply is reused until the axis state version changes, see Moonlite::sendCached()
+};
+
+// Table entries are indexed by CommandType, UNKNOWN has no entry
+constexpr size_t COMMAND_COUNT = static_cast<size_t>(CommandType::UNKNOWN);
+
+// Number of cached commands Moonlite keeps a formatted reply for, per focuser
+constexpr size_t RESPONSE_CACHE_SIZE = 8;
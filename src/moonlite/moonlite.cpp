@@ -1,51 +1,250 @@
 #include "moonlite.h"
+#include <string.h>
 
-Moonlite::Moonlite(unsigned long baudRate)
+Moonlite *Moonlite::instance_ = nullptr;
+
+Moonlite::Moonlite(const CommandSpec *command_table, size_t command_table_size, unsigned long baudRate)
+    : command_table_(command_table), command_table_size_(command_table_size)
 {
     Serial.begin(baudRate);
 }
 
-void Moonlite::update()
+void Moonlite::begin()
+{
+    instance_ = this;
+#if ARDUINO_USB_CDC_ON_BOOT
+    Serial.onEvent(ARDUINO_HW_CDC_RX_EVENT, onSerialEvent);
+#else
+    Serial.onReceive([]()
+                     { instance_->receive(); });
+#endif
+}
+
+#if ARDUINO_USB_CDC_ON_BOOT
+void Moonlite::onSerialEvent(void *arg, esp_event_base_t base, int32_t id, void *data)
 {
-    receive();
+    instance_->receive();
+}
+#endif
+
+void Moonlite::setDispatcherTask(TaskHandle_t task)
+{
+    dispatcher_task_ = task;
 }
 
 bool Moonlite::commandAvailable() const
 {
-    return command_available_;
+    return !commands_.empty();
 }
 
 Command Moonlite::getCommand()
 {
-    command_available_ = false;
-    return current_command_;
+    Command command = {CommandType::UNKNOWN, 0, PRIMARY_MOTOR};
+    commands_.pop(command);
+    return command;
+}
+
+uint16_t Moonlite::getDroppedCommandCount() const
+{
+    return dropped_commands_.load(std::memory_order_relaxed);
+}
+
+void Moonlite::sendStream(const void *data, size_t length, uint16_t dropped)
+{
+    uint8_t payload[BinaryFrame::MAX_PAYLOAD_LENGTH];
+    length = min(length, MAX_STREAM_LENGTH);
+    payload[0] = 0;
+    payload[1] = static_cast<uint8_t>(RequestStatus::STREAM);
+    payload[2] = dropped >> 8;
+    payload[3] = dropped & 0xFF;
+    memcpy(&payload[4], data, length);
+
+    uint8_t frame[BinaryFrame::MAX_PAYLOAD_LENGTH + BinaryFrame::OVERHEAD];
+    Serial.write(frame, BinaryFrame::encode(payload, length + 4, frame));
+}
+
+uint16_t Moonlite::getUnknownCommandCount() const
+{
+    return unknown_commands_.load(std::memory_order_relaxed);
+}
+
+bool Moonlite::requestAvailable() const
+{
+    return !requests_.empty();
+}
+
+bool Moonlite::getRequest(Request &request)
+{
+    return requests_.pop(request);
+}
+
+uint16_t Moonlite::getFrameErrorCount() const
+{
+    return frame_errors_.load(std::memory_order_relaxed);
+}
+
+void Moonlite::sendReply(const Request &request, RequestStatus status, const Response *responses)
+{
+    uint8_t payload[BinaryFrame::MAX_PAYLOAD_LENGTH];
+    size_t length = 0;
+    payload[length++] = request.id;
+    payload[length++] = static_cast<uint8_t>(status);
+
+    for (size_t i = 0; responses != nullptr && i < request.count; i++)
+    {
+        const Response &response = responses[i];
+        size_t value_bytes = 0;
+        switch (response.format)
+        {
+        case Response::Format::NONE:
+            break;
+        case Response::Format::HEX2:
+            value_bytes = 1;
+            break;
+        case Response::Format::HEX4:
+            value_bytes = 2;
+            break;
+        case Response::Format::HEX8:
+            value_bytes = 4;
+            break;
+        case Response::Format::STRING:
+            value_bytes = 1 + strlen(response.text);
+            break;
+        }
+
+        if (length + value_bytes > sizeof(payload))
+        {
+            payload[1] = static_cast<uint8_t>(RequestStatus::TRUNCATED);
+            break;
+        }
+
+        if (response.format == Response::Format::STRING)
+        {
+            payload[length++] = value_bytes - 1;
+            memcpy(&payload[length], response.text, value_bytes - 1);
+            length += value_bytes - 1;
+        }
+        else
+        {
+            for (size_t byte = value_bytes; byte > 0; byte--)
+                payload[length++] = response.value >> (8 * (byte - 1));
+        }
+    }
+
+    uint8_t frame[BinaryFrame::MAX_PAYLOAD_LENGTH + BinaryFrame::OVERHEAD];
+    Serial.write(frame, BinaryFrame::encode(payload, length, frame));
 }
 
 void Moonlite::sendHex2(uint8_t value)
 {
-    char buffer[3];
-    sprintf(buffer, "%02X", value);
-    Serial.print(buffer);
-    Serial.print('#');
+    send(Response::hex2(value));
 }
 
 void Moonlite::sendHex4(uint16_t value)
 {
-    char buffer[5];
-    sprintf(buffer, "%04X", value);
-    Serial.print(buffer);
-    Serial.print('#');
+    send(Response::hex4(value));
+}
+
+void Moonlite::sendHex8(uint32_t value)
+{
+    send(Response::hex8(value));
 }
 
 void Moonlite::sendString(const char *str)
 {
-    Serial.print(str);
-    Serial.print('#');
+    Serial.write(reinterpret_cast<const uint8_t *>(str), strlen(str));
+    Serial.write('#');
 }
 
 void Moonlite::sendAck()
 {
-    Serial.print('#');
+    Serial.write('#');
+}
+
+size_t Moonlite::formatHex(uint32_t value, size_t digits, char *buffer)
+{
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+    for (size_t i = digits; i > 0; i--)
+    {
+        buffer[i - 1] = HEX_DIGITS[value & 0xF];
+        value >>= 4;
+    }
+    buffer[digits] = END_CHARACTER;
+    return digits + 1;
+}
+
+size_t Moonlite::formatResponse(const Response &response, char *buffer)
+{
+    // Hand-rolled rather than snprintf, which would pull newlib's printf machinery into the protocol path
+    switch (response.format)
+    {
+    case Response::Format::NONE:
+        return 0;
+    case Response::Format::HEX2:
+        return formatHex(response.value, 2, buffer);
+    case Response::Format::HEX4:
+        return formatHex(response.value, 4, buffer);
+    case Response::Format::HEX8:
+        return formatHex(response.value, 8, buffer);
+    case Response::Format::STRING:
+    {
+        size_t length = strnlen(response.text, RESPONSE_MAX_LENGTH - 1);
+        memcpy(buffer, response.text, length);
+        buffer[length] = END_CHARACTER;
+        return length + 1;
+    }
+    }
+    return 0;
+}
+
+void Moonlite::send(const Response &response)
+{
+    char buffer[RESPONSE_MAX_LENGTH];
+    size_t length = formatResponse(response, buffer);
+    if (length > 0)
+        Serial.write(reinterpret_cast<const uint8_t *>(buffer), length);
+}
+
+Moonlite::CachedResponse *Moonlite::findCachedResponse(const Command &command, bool allocate)
+{
+    for (CachedResponse &entry : response_cache_[command.motor])
+    {
+        if (entry.type == command.type)
+            return &entry;
+        if (entry.type == CommandType::UNKNOWN)
+        {
+            if (!allocate)
+                return nullptr;
+            entry.type = command.type;
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool Moonlite::sendCached(const Command &command, uint32_t state_version)
+{
+    const CachedResponse *entry = findCachedResponse(command, false);
+    if (entry == nullptr || entry->length == 0 || entry->state_version != state_version)
+        return false;
+
+    Serial.write(reinterpret_cast<const uint8_t *>(entry->bytes), entry->length);
+    return true;
+}
+
+void Moonlite::sendAndCache(const Response &response, const Command &command, uint32_t state_version)
+{
+    CachedResponse *entry = findCachedResponse(command, true);
+    if (entry == nullptr)
+    {
+        send(response);
+        return;
+    }
+
+    entry->length = formatResponse(response, entry->bytes);
+    entry->state_version = state_version;
+    if (entry->length > 0)
+        Serial.write(reinterpret_cast<const uint8_t *>(entry->bytes), entry->length);
 }
 
 int Moonlite::parseHex(const char *str, size_t length)
@@ -67,198 +266,181 @@ int Moonlite::parseHex(const char *str, size_t length)
 
 void Moonlite::receive()
 {
-    while (Serial.available())
+    // A frame cut off by a lost byte or a disconnect must not hold the next data
+    unsigned long now_us = micros();
+    if (frame_.expire(now_us))
     {
-        char ch = Serial.read();
-
-        switch (ch)
-        {
-        case START_CHARACTER:
-            command_.clear();
-            command_available_ = false;
-            break;
-
-        case END_CHARACTER:
-            parseCommand();
-            command_available_ = true;
-            break;
+        frame_errors_.fetch_add(1, std::memory_order_relaxed);
+        resync();
+    }
 
-        default:
-            command_ += ch;
-            command_available_ = false;
+    for (;;)
+    {
+        if (resync_next_ < resync_length_)
+            receiveByte(static_cast<char>(resync_[resync_next_++]), now_us);
+        else if (Serial.available())
+            receiveByte(Serial.read(), now_us);
+        else
             break;
-        }
     }
 }
 
-void Moonlite::parseFocuserCommand()
+void Moonlite::resync()
 {
-    if (command_.length() < 2)
-    {
-        current_command_ = Command{CommandType::UNKNOWN, 0};
-        return;
-    }
+    // A frame fed from resync_ covers a suffix of it, so what is left joins its SYNC-led rest
+    size_t rest = resync_length_ - resync_next_;
+    uint8_t bytes[sizeof(resync_)];
+    size_t length = frame_.getResyncBytes(bytes);
+    memmove(&resync_[length], &resync_[resync_next_], rest);
+    memcpy(resync_, bytes, length);
+    resync_length_ = length + rest;
+    resync_next_ = 0;
+}
 
-    switch (command_[1])
-    {
-    case 'G':
-        current_command_ = Command{CommandType::CMD_FG, 0};
-        break;
-    case 'Q':
-        current_command_ = Command{CommandType::CMD_FQ, 0};
-        break;
-    default:
-        current_command_ = Command{CommandType::UNKNOWN, 0};
-        break;
-    }
+void Moonlite::notifyDispatcher()
+{
+    if (dispatcher_task_ != nullptr)
+        xTaskNotifyGive(dispatcher_task_);
 }
 
-void Moonlite::parseGetCommand()
+void Moonlite::receiveByte(char ch, unsigned long now_us)
 {
-    if (command_.length() < 2)
+    uint8_t byte = static_cast<uint8_t>(ch);
+    if (frame_.isReceiving())
     {
-        current_command_ = Command{CommandType::UNKNOWN, 0};
-        return;
-    }
+        switch (frame_.receiveByte(byte, now_us))
+        {
+        case BinaryFrame::Result::PENDING:
+            break;
 
-    switch (command_[1])
-    {
-    case 'B':
-        current_command_ = Command{CommandType::CMD_GB, 0};
-        break;
-    case 'C':
-        current_command_ = Command{CommandType::CMD_GC, 0};
-        break;
-    case 'D':
-        current_command_ = Command{CommandType::CMD_GD, 0};
-        break;
-    case 'H':
-        current_command_ = Command{CommandType::CMD_GH, 0};
-        break;
-    case 'I':
-        current_command_ = Command{CommandType::CMD_GI, 0};
-        break;
-    case 'N':
-        current_command_ = Command{CommandType::CMD_GN, 0};
-        break;
-    case 'P':
-        current_command_ = Command{CommandType::CMD_GP, 0};
-        break;
-    case 'T':
-        current_command_ = Command{CommandType::CMD_GT, 0};
-        break;
-    case 'V':
-        current_command_ = Command{CommandType::CMD_GV, 0};
-        break;
-    default:
-        current_command_ = Command{CommandType::UNKNOWN, 0};
-        break;
+        case BinaryFrame::Result::COMPLETE:
+        {
+            Request request;
+            parseRequest(frame_.getPayload(), frame_.getLength(), request);
+            if (requests_.push(request))
+                notifyDispatcher();
+            else
+                dropped_commands_.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+
+        case BinaryFrame::Result::CRC_ERROR:
+            frame_errors_.fetch_add(1, std::memory_order_relaxed);
+            resync();
+            break;
+        }
+        return;
     }
-}
 
-void Moonlite::parseSetCommand()
-{
-    if (command_.length() < 2)
+    if (!receiving_ && byte == BinaryFrame::SYNC)
     {
-        current_command_ = Command{CommandType::UNKNOWN, 0};
+        frame_.begin(now_us);
         return;
     }
 
-    switch (command_[1])
+    switch (ch)
     {
-    case 'C':
-        if (command_.length() >= 4)
-        {
-            int value = parseHex(&command_[2], 2);
-            current_command_ = Command{CommandType::CMD_SC, value};
-        }
-        else
-        {
-            current_command_ = Command{CommandType::UNKNOWN, 0};
-        }
+    case START_CHARACTER:
+        message_length_ = 0;
+        receiving_ = true;
         break;
 
-    case 'D':
-        if (command_.length() >= 4)
-        {
-            int value = parseHex(&command_[2], 2);
-            current_command_ = Command{CommandType::CMD_SD, value};
-        }
-        else
+    case END_CHARACTER:
+        if (!receiving_)
+            break;
+
+        receiving_ = false;
+        parseCommand();
+        if (current_command_.type == CommandType::UNKNOWN)
+            unknown_commands_.fetch_add(1, std::memory_order_relaxed);
+        if (!commands_.push(current_command_))
         {
-            current_command_ = Command{CommandType::UNKNOWN, 0};
+            dropped_commands_.fetch_add(1, std::memory_order_relaxed);
+            break;
         }
-        break;
 
-    case 'F':
-        current_command_ = Command{CommandType::CMD_SF, 0};
+        notifyDispatcher();
         break;
 
-    case 'H':
-        current_command_ = Command{CommandType::CMD_SH, 0};
-        break;
+    default:
+        if (!receiving_)
+            break;
 
-    case 'N':
-        if (command_.length() >= 6)
-        {
-            int value = parseHex(&command_[2], 4);
-            current_command_ = Command{CommandType::CMD_SN, value};
-        }
+        // a frame that never ends is noise, wait for the next start character
+        if (message_length_ >= MAX_MESSAGE_LENGTH)
+            receiving_ = false;
         else
-        {
-            current_command_ = Command{CommandType::UNKNOWN, 0};
-        }
+            message_[message_length_++] = ch;
         break;
+    }
+}
 
-    case 'P':
-        if (command_.length() >= 6)
+void Moonlite::parseRequest(const uint8_t *payload, size_t length, Request &request)
+{
+    request.id = (length > 0) ? payload[0] : 0;
+    request.valid = length > 0;
+    request.count = 0;
+
+    size_t offset = 1;
+    while (request.valid && offset < length)
+    {
+        uint8_t operation = payload[offset++];
+        size_t index = operation & 0x7F;
+        if (index >= command_table_size_ || request.count >= MAX_BATCH_SIZE)
         {
-            int value = parseHex(&command_[2], 4);
-            current_command_ = Command{CommandType::CMD_SP, value};
+            request.valid = false;
+            break;
         }
-        else
+
+        const CommandSpec &spec = command_table_[index];
+        size_t value_bytes = spec.value_digits / 2;
+        if (offset + value_bytes > length)
         {
-            current_command_ = Command{CommandType::UNKNOWN, 0};
+            request.valid = false;
+            break;
         }
-        break;
 
-    default:
-        current_command_ = Command{CommandType::UNKNOWN, 0};
-        break;
+        int value = 0;
+        for (size_t i = 0; i < value_bytes; i++)
+            value = (value << 8) | payload[offset++];
+
+        int motor = (operation & 0x80) ? SECONDARY_MOTOR : PRIMARY_MOTOR;
+        request.commands[request.count++] = Command{spec.type, value, motor};
     }
 }
 
 void Moonlite::parseCommand()
 {
-    if (command_[0] == '2')
-        command_ = command_.substr(1);
+    message_[message_length_] = '\0';
+    const char *message = message_;
+    size_t length = message_length_;
 
-    if (command_.length() < 1)
+    int motor = PRIMARY_MOTOR;
+    if (length > 0 && message[0] == '2')
     {
-        current_command_ = Command{CommandType::UNKNOWN, 0};
-        return;
+        message++;
+        length--;
+        motor = SECONDARY_MOTOR;
     }
 
-    switch (command_[0])
-    {
-    case 'C':
-        current_command_ = Command{CommandType::CMD_C, 0};
-        break;
+    current_command_ = Command{CommandType::UNKNOWN, 0, motor};
 
-    case 'F':
-        parseFocuserCommand();
-        break;
-
-    case 'G':
-        parseGetCommand();
-        break;
+    for (size_t i = 0; i < command_table_size_; i++)
+    {
+        const CommandSpec &spec = command_table_[i];
 
-    case 'S':
-        parseSetCommand();
-        break;
+        size_t opcode_length = 0;
+        while (spec.opcode[opcode_length] != '\0' && spec.opcode[opcode_length] == message[opcode_length])
+            opcode_length++;
+        if (spec.opcode[opcode_length] != '\0')
+            continue;
 
-    default:
-        current_command_ = Command{CommandType::UNKNOWN, 0};
-        break;
+        // opcodes are unambiguous, so a match with a missing value is not retried against other entries
+        if (length >= opcode_length + spec.value_digits)
+        {
+            int value = parseHex(message + opcode_length, spec.value_digits);
+            current_command_ = Command{spec.type, value, motor};
+        }
+        return;
     }
 }
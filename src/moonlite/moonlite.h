@@ -1,28 +1,100 @@
 #pragma once
 
 #include <Arduino.h>
-#include <string>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include "command.h"
+#include "binary_frame.h"
+#include "../util/spsc_queue.h"
 
 /**
- * @brief Non-blocking Moonlite protocol communication handler
+ * @brief Event-driven Moonlite protocol communication handler
  *
  * Handles serial communication for Moonlite focuser protocol.
  * Commands are framed with ':' (start) and '#' (end) characters.
+ * Binary requests (see BinaryFrame) are recognised by their sync byte and may be mixed with
+ * ASCII commands on the same port; they batch several commands and are answered in one frame.
+ * Received bytes are framed and parsed from the serial RX callback as they arrive and
+ * complete commands are queued for the dispatcher.
  * This class only parses the protocol - business logic should be handled separately.
  */
 class Moonlite
 {
+public:
+    static constexpr size_t MAX_BATCH_SIZE = 16;
+
+    // Second payload byte of a binary reply
+    enum class RequestStatus : uint8_t
+    {
+        OK = 0x00,
+        BAD_REQUEST = 0x01, // unknown command or truncated value, nothing was run
+        BUSY = 0x02,        // a motion command was dropped because the motion queue was full
+        TRUNCATED = 0x03,   // the replies did not fit into one frame and were cut short
+        STREAM = 0x80,      // unsolicited stream frame, request id 0, see sendStream()
+    };
+
+    /**
+     * @brief Decoded binary request
+     *
+     * Payload: request id, then one operation per command. An operation is a byte holding the
+     * CommandType in bits 0-6 and the focuser in bit 7, followed by the command value as
+     * value_digits / 2 big-endian bytes.
+     */
+    struct Request
+    {
+        uint8_t id;
+        bool valid;
+        uint8_t count;
+        Command commands[MAX_BATCH_SIZE];
+    };
+
 private:
     static const char START_CHARACTER = ':';
     static const char END_CHARACTER = '#';
     static const int MAX_MESSAGE_LENGTH = 16;
+    static constexpr size_t COMMAND_QUEUE_SIZE = 16;
+    static constexpr size_t REQUEST_QUEUE_SIZE = 4;
+    static constexpr size_t RESPONSE_MAX_LENGTH = 12; // longest reply including '#', strings are cut to fit
+
+    struct CachedResponse
+    {
+        CommandType type = CommandType::UNKNOWN; // UNKNOWN marks a free slot
+        uint32_t state_version = 0;
+        uint8_t length = 0;
+        char bytes[RESPONSE_MAX_LENGTH];
+    };
+
+    // RX callbacks carry no user pointer, so they reach the instance through this
+    static Moonlite *instance_;
 
-    // Current message buffer
-    std::string command_;
+    // Current message and its terminator, only touched from the RX callback
+    char message_[MAX_MESSAGE_LENGTH + 1];
+    size_t message_length_ = 0;
+    bool receiving_ = false; // between START_CHARACTER and END_CHARACTER
+    BinaryFrame frame_;      // binary request being received, also only touched from the RX callback
 
-    Command current_command_ = {CommandType::UNKNOWN, 0};
-    bool command_available_ = false;
+    // Bytes of a dropped frame from the next SYNC on, fed again before new serial data
+    uint8_t resync_[BinaryFrame::MAX_PAYLOAD_LENGTH + BinaryFrame::OVERHEAD - 1];
+    size_t resync_length_ = 0;
+    size_t resync_next_ = 0;
+
+    Command current_command_ = {CommandType::UNKNOWN, 0, PRIMARY_MOTOR};
+
+    // Opcodes and value widths, shared with the dispatcher
+    const CommandSpec *command_table_;
+    size_t command_table_size_;
+
+    // Parsed commands, pushed by the RX callback and popped by the dispatcher
+    SpscQueue<Command, COMMAND_QUEUE_SIZE> commands_;
+    std::atomic<uint16_t> dropped_commands_{0};
+    std::atomic<uint16_t> unknown_commands_{0};
+    SpscQueue<Request, REQUEST_QUEUE_SIZE> requests_;
+    std::atomic<uint16_t> frame_errors_{0};
+    TaskHandle_t dispatcher_task_ = nullptr;
+
+    // Formatted replies of polled getters, only touched by the dispatcher
+    CachedResponse response_cache_[MOTOR_COUNT][RESPONSE_CACHE_SIZE];
 
     /**
      * @brief Parse hex string to integer
@@ -33,43 +105,80 @@ private:
     int parseHex(const char *str, size_t length);
 
     /**
-     * @brief Receive and buffer incoming serial data (non-blocking)
+     * @brief Write a value as upper-case hex digits followed by '#'
+     * @return digits + 1
+     */
+    static size_t formatHex(uint32_t value, size_t digits, char *buffer);
+
+    /**
+     * @brief Format a response with its '#' terminator
+     * @return Number of bytes written to buffer (at most RESPONSE_MAX_LENGTH)
+     */
+    size_t formatResponse(const Response &response, char *buffer);
+
+    /**
+     * @brief Cache slot holding the reply for a command, nullptr if none
+     * @param allocate Claim a free slot when the command has none yet
+     */
+    CachedResponse *findCachedResponse(const Command &command, bool allocate);
+
+    /**
+     * @brief Drain incoming serial data (runs in the RX callback)
      */
     void receive();
 
     /**
-     * @brief Parse Focuser commands (FG, FQ)
+     * @brief Frame one received byte, queueing the command when its end character arrives
+     * @param now_us micros() when the byte arrived, times out binary frames
      */
-    void parseFocuserCommand();
+    void receiveByte(char ch, unsigned long now_us);
 
     /**
-     * @brief Parse Get commands (GB, GC, GD, GH, GI, GN, GP, GT, GV)
+     * @brief Queue the bytes of a dropped frame from its next SYNC on
      */
-    void parseGetCommand();
+    void resync();
+
+#if ARDUINO_USB_CDC_ON_BOOT
+    static void onSerialEvent(void *arg, esp_event_base_t base, int32_t id, void *data);
+#endif
 
     /**
-     * @brief Parse Set commands (SC, SD, SF, SH, SN, SP)
+     * @brief Decode the payload of a received binary frame into a Request
      */
-    void parseSetCommand();
+    void parseRequest(const uint8_t *payload, size_t length, Request &request);
+
+    /**
+     * @brief Wake the dispatcher after queueing a command or request
+     */
+    void notifyDispatcher();
 
     /**
      * @brief Parse buffered command string into Command struct
+     *
+     * A leading '2' selects the second focuser and is recorded in Command::motor. The rest is
+     * matched against the command table in one pass, which also gives the value width.
      */
     void parseCommand();
 
 public:
     /**
      * @brief Initialize Moonlite communication
+     * @param command_table Commands recognised by the parser
+     * @param command_table_size Number of entries in command_table
      * @param baudRate Serial baud rate (default: 9600, standard for Moonlite)
      */
-    explicit Moonlite(unsigned long baudRate = 9600);
+    Moonlite(const CommandSpec *command_table, size_t command_table_size, unsigned long baudRate = 9600);
 
     /**
-     * @brief Update communication state (call frequently in main loop)
-     *
-     * Non-blocking - processes available serial data without delay
+     * @brief Register the serial RX callback (call once from setup())
+     */
+    void begin();
+
+    /**
+     * @brief Task to notify whenever a command is queued
+     * @param task Dispatcher task handle, nullptr to poll commandAvailable() instead
      */
-    void update();
+    void setDispatcherTask(TaskHandle_t task);
 
     /**
      * @brief Check if a new command has been received
@@ -78,11 +187,62 @@ public:
     bool commandAvailable() const;
 
     /**
-     * @brief Get the received command (clears the available flag)
-     * @return Parsed command with type and value
+     * @brief Take the oldest received command from the queue
+     * @return Parsed command with type and value, UNKNOWN if the queue is empty
      */
     Command getCommand();
 
+    /**
+     * @brief Number of complete commands and binary requests dropped because a queue was full
+     */
+    uint16_t getDroppedCommandCount() const;
+
+    /**
+     * @brief Number of complete ASCII frames that matched no command or lacked their value
+     */
+    uint16_t getUnknownCommandCount() const;
+
+    /**
+     * @brief Check if a binary request has been received
+     */
+    bool requestAvailable() const;
+
+    /**
+     * @brief Take the oldest received binary request
+     * @return false if there is none
+     */
+    bool getRequest(Request &request);
+
+    /**
+     * @brief Number of binary frames dropped for a bad CRC or length, or left incomplete
+     */
+    uint16_t getFrameErrorCount() const;
+
+    /**
+     * @brief Answer a binary request in one frame
+     * @param request Request being answered, supplies the request id
+     * @param status Outcome of the request
+     * @param responses One response per command in the request, may be nullptr for BAD_REQUEST
+     *
+     * The reply payload is the request id, the status and each response in order: nothing for
+     * NONE, 1, 2 or 4 big-endian bytes for HEX2, HEX4 and HEX8, a length byte and the text for STRING.
+     */
+    void sendReply(const Request &request, RequestStatus status, const Response *responses);
+
+    /**
+     * @brief Largest data block sendStream() accepts
+     */
+    static constexpr size_t MAX_STREAM_LENGTH = BinaryFrame::MAX_PAYLOAD_LENGTH - 4;
+
+    /**
+     * @brief Send an unsolicited binary frame
+     * @param data Raw stream data, at most MAX_STREAM_LENGTH bytes
+     * @param dropped Running count of data the sender had to drop, lets the host spot gaps
+     *
+     * The payload is request id 0, RequestStatus::STREAM, dropped as two big-endian bytes and the data.
+     */
+    void sendStream(const void *data, size_t length, uint16_t dropped);
+
     /**
      * @brief Send 2-digit hex response (for GB, GC, GD, GV commands)
      * @param value 8-bit value to send (0x00-0xFF)
@@ -95,6 +255,12 @@ public:
      */
     void sendHex4(uint16_t value);
 
+    /**
+     * @brief Send 8-digit hex response (for extension commands)
+     * @param value 32-bit value to send
+     */
+    void sendHex8(uint32_t value);
+
     /**
      * @brief Send '#' terminated string
      * @param str Null-terminated string to send
@@ -105,4 +271,22 @@ public:
      * @brief Send simple acknowledgment (no data)
      */
     void sendAck();
+
+    /**
+     * @brief Send a handler's response in its format, nothing for Response::Format::NONE
+     */
+    void send(const Response &response);
+
+    /**
+     * @brief Resend the reply cached for a command if the state it was built from is unchanged
+     * @param command Command being answered, its type and motor select the cache slot
+     * @param state_version MotionController::getStateVersion() of the addressed focuser, read before its state
+     * @return false if nothing current is cached, answer with sendAndCache() instead
+     */
+    bool sendCached(const Command &command, uint32_t state_version);
+
+    /**
+     * @brief Send a response and keep the formatted bytes for sendCached()
+     */
+    void sendAndCache(const Response &response, const Command &command, uint32_t state_version);
 };
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * @brief Latest focuser temperature, shared between tasks
+ *
+ * No probe is read yet, so it holds a fixed 20 degrees Celsius until setHalfDegrees() is called.
+ */
+class TemperatureSensor
+{
+private:
+    std::atomic<int16_t> half_degrees_{40};
+
+public:
+    /**
+     * @brief Temperature in half degrees Celsius (Moonlite GT units)
+     */
+    int16_t getHalfDegrees() const
+    {
+        return half_degrees_.load(std::memory_order_relaxed);
+    }
+
+    void setHalfDegrees(int16_t half_degrees)
+    {
+        half_degrees_.store(half_degrees, std::memory_order_relaxed);
+    }
+};
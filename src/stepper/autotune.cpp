@@ -0,0 +1,254 @@
+#include "autotune.h"
+
+Autotune::Autotune(MotionController &controller) : controller_(controller)
+{
+}
+
+bool Autotune::applyCandidate(Search &search)
+{
+    for (;;)
+    {
+        bool finished = search.phase == Phase::FINISHED;
+        float speed = finished ? search.best_speed : search.speed;
+        float acceleration = finished ? search.best_acceleration : search.acceleration;
+        controller_.setProfileParameters(speed, acceleration, original_.start_speed, original_.jerk);
+        if (finished)
+            return true;
+
+        // a setting is only tested if the move reaches its speed, and the ramp is not cut short before it
+        size_t ramp_steps = controller_.getCruiseRampSteps();
+        if (2 * ramp_steps <= distance_ && ramp_steps < RampTable::MAX_STEPS - 1)
+            return true;
+
+        if (search.phase == Phase::SPEED)
+            search.phase = Phase::FINISHED; // the fastest speed this distance can test has passed
+        else if (!backOff(search))
+            return false;
+    }
+}
+
+void Autotune::startLeg(FocuserDirection direction)
+{
+    if (!applyCandidate(searches_[indexOf(direction)]))
+    {
+        if (direction == FocuserDirection::OUTWARD)
+        {
+            fail();
+            return;
+        }
+
+        // out at the end of the last leg, come back at the original settings and fail there
+        controller_.setProfileParameters(original_.max_speed, original_.acceleration, original_.start_speed,
+                                         original_.jerk);
+    }
+
+    leg_ = direction;
+    leg_target_ = start_position_ + (direction == FocuserDirection::OUTWARD ? distance_ : 0);
+    lost_steps_before_ = controller_.getLostStepCount();
+    stalls_before_ = controller_.getStallCount();
+    controller_.setTargetPosition(leg_target_);
+    controller_.startMovement();
+}
+
+bool Autotune::passed() const
+{
+    // without samples the move was too short or too slow to judge, count it as a failure
+    return controller_.getMoveLoadSampleCount() > 0 &&
+           controller_.getMoveMinLoad() > controller_.getStallLoad() + LOAD_MARGIN &&
+           controller_.getLostStepCount() <= lost_steps_before_ && controller_.getStallCount() <= stalls_before_;
+}
+
+bool Autotune::backOff(Search &search)
+{
+    search.speed /= SPEED_STEP_FACTOR;
+    search.acceleration /= ACCELERATION_STEP_FACTOR;
+    if (search.speed >= MIN_SPEED && search.speed > original_.start_speed)
+        return true;
+
+    search.phase = Phase::FAILED;
+    return false;
+}
+
+void Autotune::beginSpeedPhase(Search &search)
+{
+    search.acceleration = search.best_acceleration;
+    search.speed = search.best_speed * SPEED_STEP_FACTOR;
+    search.phase = (search.speed > MAX_SPEED) ? Phase::FINISHED : Phase::SPEED;
+}
+
+void Autotune::advance(Search &search, bool passed)
+{
+    switch (search.phase)
+    {
+    case Phase::ACCELERATION:
+        if (passed)
+        {
+            search.best_speed = search.speed;
+            search.best_acceleration = search.acceleration;
+            search.acceleration *= ACCELERATION_STEP_FACTOR;
+            if (search.acceleration > MAX_ACCELERATION)
+                beginSpeedPhase(search);
+        }
+        else if (search.best_acceleration > 0.0f)
+        {
+            beginSpeedPhase(search);
+        }
+        else
+        {
+            // the starting profile is already too much for this load, come down until a move passes
+            backOff(search);
+        }
+        break;
+
+    case Phase::SPEED:
+        if (!passed)
+        {
+            search.phase = Phase::FINISHED;
+            break;
+        }
+        search.best_speed = search.speed;
+        search.speed *= SPEED_STEP_FACTOR;
+        if (search.speed > MAX_SPEED)
+            search.phase = Phase::FINISHED;
+        break;
+
+    default:
+        break; // legs of a finished direction only bring the focuser back
+    }
+}
+
+void Autotune::finish()
+{
+    for (size_t i = 0; i < 2; i++)
+    {
+        // both limits are below 65536, so each fits its half
+        uint32_t speed = static_cast<uint32_t>(searches_[i].best_speed * SAFETY_FACTOR);
+        uint32_t acceleration = static_cast<uint32_t>(searches_[i].best_acceleration * SAFETY_FACTOR);
+        results_[i] = (speed << 16) | acceleration;
+    }
+
+    const Search &inward = searches_[indexOf(FocuserDirection::INWARD)];
+    const Search &outward = searches_[indexOf(FocuserDirection::OUTWARD)];
+    float speed = min(inward.best_speed, outward.best_speed) * SAFETY_FACTOR;
+    float acceleration = min(inward.best_acceleration, outward.best_acceleration) * SAFETY_FACTOR;
+
+    controller_.setLoadSampling(false);
+    controller_.setProfileParameters(max(speed, original_.start_speed), acceleration, original_.start_speed,
+                                     original_.jerk);
+    controller_.setSpeed(original_speed_code_);
+    state_ = State::DONE;
+    save_pending_.store(true, std::memory_order_release);
+}
+
+void Autotune::restore()
+{
+    restore_pending_ = false;
+    controller_.setLoadSampling(false);
+    controller_.setProfileParameters(original_.max_speed, original_.acceleration, original_.start_speed, original_.jerk);
+    controller_.setSpeed(original_speed_code_);
+}
+
+void Autotune::fail()
+{
+    state_ = State::FAILED;
+    restore();
+}
+
+void Autotune::start(uint16_t distance)
+{
+    if (isActive() || controller_.getIsMoving() || distance < MIN_DISTANCE)
+        return;
+
+    original_ = controller_.getProfile();
+    original_speed_code_ = controller_.getSpeed();
+    start_position_ = controller_.getCurrentPosition();
+    distance_ = distance;
+    for (Search &search : searches_)
+        search = Search{Phase::ACCELERATION, original_.max_speed, original_.acceleration, 0.0f, 0.0f};
+
+    // the first leg is set up by update(), once the other axis is at rest
+    state_ = State::RUNNING;
+    first_leg_pending_ = true;
+}
+
+void Autotune::abort()
+{
+    if (state_ != State::RUNNING)
+        return;
+
+    state_ = State::FAILED;
+    restore_pending_ = !first_leg_pending_; // nothing was changed yet otherwise
+    first_leg_pending_ = false;
+}
+
+void Autotune::update(bool other_axis_moving)
+{
+    // each leg rebuilds the ramp, which would hold up the steps of the other axis
+    if (controller_.getIsMoving() || other_axis_moving)
+        return;
+
+    if (restore_pending_)
+    {
+        restore();
+        return;
+    }
+
+    if (state_ != State::RUNNING)
+        return;
+
+    if (first_leg_pending_)
+    {
+        first_leg_pending_ = false;
+        if (controller_.getCurrentPosition() != start_position_)
+        {
+            state_ = State::FAILED; // moved away before the run began, the profile is untouched
+            return;
+        }
+
+        controller_.setSpeed(0x02); // cruise at the profile's max speed
+        controller_.setLoadSampling(true);
+        startLeg(FocuserDirection::OUTWARD);
+        return;
+    }
+
+    // a move the run did not ask for (FG, FQ, homing) took the focuser elsewhere
+    if (controller_.getCurrentPosition() != leg_target_)
+    {
+        fail();
+        return;
+    }
+
+    advance(searches_[indexOf(leg_)], passed());
+
+    // every outward leg is followed by the inward one, so the run only ends back at the start
+    if (leg_ == FocuserDirection::OUTWARD)
+    {
+        startLeg(FocuserDirection::INWARD);
+        return;
+    }
+
+    bool done = true;
+    for (const Search &search : searches_)
+    {
+        if (search.phase == Phase::FAILED)
+        {
+            fail();
+            return;
+        }
+        done &= search.phase == Phase::FINISHED;
+    }
+
+    if (done)
+        finish();
+    else
+        startLeg(FocuserDirection::OUTWARD);
+}
+
+void Autotune::saveIfPending()
+{
+    if (!save_pending_.load(std::memory_order_acquire))
+        return;
+
+    controller_.saveProfile();
+    save_pending_.store(false, std::memory_order_release);
+}
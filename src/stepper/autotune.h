@@ -0,0 +1,153 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "focuser_direction.h"
+#include "motion_profile.h"
+#include "motion_controller.h"
+
+/**
+ * @brief Load-aware tuning of the active profile's max speed and acceleration
+ *
+ * start() runs test moves out from the current position and back, each with the StallGuard load
+ * sampled by the controller. A move passes if its lowest SG_RESULT stays LOAD_MARGIN above the
+ * stall level and no stall or lost step was flagged. Each direction is searched on its own legs:
+ * first the acceleration grows at the profile's max speed until a move fails, then the max speed
+ * grows at the best acceleration, as far as the test distance lets the ramp reach it. A gravity
+ * load on the drawtube makes the two directions differ.
+ *
+ * The profile has one ramp for both directions, so the result applied to the active profile is
+ * the lower of the two, times SAFETY_FACTOR; getResult() reports each direction. The tuned profile
+ * is written to flash by the protocol task like XPW would, see saveIfPending(). The run ends back
+ * at the start position with the speed code restored. A move that fails may have lost steps, so
+ * home again if one did.
+ *
+ * Every leg rebuilds the active ramp, so the run only starts a leg while the other axis is at
+ * rest and waits between legs otherwise.
+ *
+ * start(), abort() and update() belong to the motion task; getState(), getResult() and
+ * saveIfPending() are safe from other tasks.
+ */
+class Autotune
+{
+public:
+    enum class State : uint8_t
+    {
+        IDLE = 0x00,
+        RUNNING = 0x01, // test moves in progress
+        DONE = 0x02,    // result applied to the active profile, see getResult()
+        FAILED = 0x03,  // nothing passed, or interrupted; the profile is unchanged
+    };
+
+    static constexpr uint16_t MIN_DISTANCE = 100;
+
+private:
+    static constexpr uint16_t LOAD_MARGIN = 60;                 // SG_RESULT headroom above the stall level
+    static constexpr float SPEED_STEP_FACTOR = 1.25f;           // candidate growth per passing move
+    static constexpr float ACCELERATION_STEP_FACTOR = 1.5f;
+    static constexpr float SAFETY_FACTOR = 0.8f;                // applied to the highest passing settings
+    static constexpr float MIN_SPEED = 125.0f;                  // steps per second, StallGuard needs more than 100
+    static constexpr float MAX_SPEED = 4000.0f;
+    static constexpr float MAX_ACCELERATION = 20000.0f;         // steps per second squared
+
+    enum class Phase : uint8_t
+    {
+        ACCELERATION, // raising the acceleration at the starting max speed
+        SPEED,        // raising the max speed at the best acceleration
+        FINISHED,
+        FAILED,       // nothing passed, down to MIN_SPEED
+    };
+
+    struct Search
+    {
+        Phase phase;
+        float speed;             // settings of the next test move
+        float acceleration;
+        float best_speed;        // highest passing settings, 0 until a move passes
+        float best_acceleration;
+    };
+
+    MotionController &controller_;
+
+    std::atomic<State> state_{State::IDLE};
+    std::atomic<uint32_t> results_[2] = {}; // indexed by FocuserDirection, speed << 16 | acceleration
+
+    Search searches_[2]; // indexed by FocuserDirection
+    MotionProfile original_ = {};
+    uint8_t original_speed_code_ = 0;
+    bool restore_pending_ = false;          // aborted mid-move, restore once the focuser stops
+    bool first_leg_pending_ = false;        // started, waiting for both axes to be at rest
+    std::atomic<bool> save_pending_{false}; // a tuned profile waits for the protocol task to save it
+
+    long start_position_ = 0;
+    uint16_t distance_ = 0;
+    FocuserDirection leg_ = FocuserDirection::OUTWARD;
+    long leg_target_ = 0;
+    uint16_t lost_steps_before_ = 0;
+    uint16_t stalls_before_ = 0;
+
+    static size_t indexOf(FocuserDirection direction)
+    {
+        return static_cast<size_t>(direction);
+    }
+
+    bool applyCandidate(Search &search);
+    void startLeg(FocuserDirection direction);
+    bool passed() const;
+    bool backOff(Search &search);
+    void advance(Search &search, bool passed);
+    void beginSpeedPhase(Search &search);
+    void finish();
+    void restore();
+    void fail();
+
+public:
+    explicit Autotune(MotionController &controller);
+
+    /**
+     * @brief Start tuning from the current position
+     * @param distance Length of each test move in steps, the focuser travels this far outward
+     *
+     * Ignored while the focuser moves or a run is active, or below MIN_DISTANCE. Longer moves
+     * let higher speeds be reached and tested. The first move waits for the other axis to stop.
+     */
+    void start(uint16_t distance);
+
+    /**
+     * @brief Stop the run, the profile and speed code are restored once the focuser is idle
+     */
+    void abort();
+
+    /**
+     * @brief Evaluate a finished test move and start the next (motion task, after update())
+     * @param other_axis_moving Hold the next leg, its ramp rebuild would delay the other axis' steps
+     */
+    void update(bool other_axis_moving);
+
+    /**
+     * @brief Write the tuned profile to flash (protocol task, only while no axis moves)
+     */
+    void saveIfPending();
+
+    State getState() const
+    {
+        return state_;
+    }
+
+    bool isActive() const
+    {
+        return state_ == State::RUNNING || restore_pending_;
+    }
+
+    /**
+     * @brief Tuned settings of one direction from the last successful run, after the safety factor
+     * @param speed Max speed in steps per second
+     * @param acceleration Acceleration in steps per second squared
+     */
+    void getResult(FocuserDirection direction, uint16_t &speed, uint16_t &acceleration) const
+    {
+        uint32_t result = results_[indexOf(direction)];
+        speed = result >> 16;
+        acceleration = result & 0xFFFF;
+    }
+};
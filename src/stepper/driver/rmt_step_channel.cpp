@@ -0,0 +1,115 @@
+#ifdef EAF_RMT_STEPPING
+
+#include "rmt_step_channel.h"
+#include <esp32-hal-matrix.h>
+#include <soc/rmt_struct.h>
+
+RmtStepChannel *RmtStepChannel::channels_[MAX_CHANNELS] = {};
+size_t RmtStepChannel::channel_count_ = 0;
+rmt_isr_handle_t RmtStepChannel::interrupt_ = nullptr;
+
+namespace
+{
+    // ESP32-C3 RMT_INT_ST bits of the TX channels
+    constexpr uint32_t txEndBit(rmt_channel_t channel)
+    {
+        return 1u << channel;
+    }
+
+    constexpr uint32_t txThresholdBit(rmt_channel_t channel)
+    {
+        return 1u << (8 + channel);
+    }
+}
+
+bool RmtStepChannel::begin(uint8_t step_pin, RmtStepStream &stream)
+{
+    if (channel_count_ >= MAX_CHANNELS)
+        return false;
+
+    stream_ = &stream;
+    step_pin_ = step_pin;
+    channel_ = static_cast<rmt_channel_t>(channel_count_);
+
+    rmt_config_t config = RMT_DEFAULT_CONFIG_TX(static_cast<gpio_num_t>(step_pin), channel_);
+    config.clk_div = CLOCK_DIVIDER;
+    config.mem_block_num = 1;
+    config.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+    config.tx_config.idle_output_en = true;
+    if (rmt_config(&config) != ESP_OK)
+        return false;
+
+    // one handler serves every channel, the IDF's own RMT driver is not installed
+    if (interrupt_ == nullptr && rmt_isr_register(onInterrupt, nullptr, 0, &interrupt_) != ESP_OK)
+        return false;
+
+    RMT.tx_conf[channel_].mem_tx_wrap_en = 1;
+    RMT.tx_conf[channel_].conf_update = 1;
+    rmt_set_tx_thr_intr_en(channel_, true, RmtStepStream::CHUNK_ITEMS);
+    rmt_set_tx_intr_en(channel_, true);
+
+    // rmt_config() routed the pin to the channel, leave it to digitalWrite until a stream starts
+    pinMatrixOutDetach(step_pin_, false, false);
+
+    channels_[channel_count_++] = this;
+    available_ = true;
+    return true;
+}
+
+bool RmtStepChannel::loadHalf(size_t half)
+{
+    RmtItem items[RmtStepStream::CHUNK_ITEMS];
+    size_t count = stream_->takeChunk(items);
+    if (count == 0)
+        return false;
+
+    static_assert(sizeof(RmtItem) == sizeof(rmt_item32_t), "RmtItem must match the channel memory layout");
+    rmt_fill_tx_items(channel_, reinterpret_cast<const rmt_item32_t *>(items), count,
+                      half * RmtStepStream::CHUNK_ITEMS);
+    return true;
+}
+
+void RmtStepChannel::onInterrupt(void *arg)
+{
+    uint32_t status = RMT.int_st.val;
+    RMT.int_clr.val = status;
+
+    for (size_t i = 0; i < channel_count_; i++)
+    {
+        RmtStepChannel &channel = *channels_[i];
+        if (status & txThresholdBit(channel.channel_))
+        {
+            // the half that just went out is free again
+            if (channel.loadHalf(channel.next_half_))
+                channel.next_half_ ^= 1;
+        }
+        if (status & txEndBit(channel.channel_))
+            channel.running_.store(false, std::memory_order_release);
+    }
+}
+
+void RmtStepChannel::start()
+{
+    if (!available_ || isRunning() || !loadHalf(0))
+        return;
+
+    // a stream that ended in the first half never reads the second
+    next_half_ = 1;
+    if (!stream_->isEnded() && loadHalf(1))
+        next_half_ = 0;
+
+    rmt_set_gpio(channel_, RMT_MODE_TX, static_cast<gpio_num_t>(step_pin_), false);
+    running_.store(true, std::memory_order_release);
+    rmt_tx_start(channel_, true);
+}
+
+void RmtStepChannel::release()
+{
+    if (!available_ || isRunning())
+        return;
+
+    pinMatrixOutDetach(step_pin_, false, false);
+    digitalWrite(step_pin_, LOW);
+}
+
+#endif
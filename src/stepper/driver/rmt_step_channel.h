@@ -0,0 +1,76 @@
+#pragma once
+
+#ifdef EAF_RMT_STEPPING
+
+#include <Arduino.h>
+#include <atomic>
+#include <driver/rmt.h>
+#include "../rmt_step_stream.h"
+
+/**
+ * @brief Plays an RmtStepStream on a STEP pin through one RMT TX channel (ESP32-C3)
+ *
+ * The 48-item channel memory runs in wrap mode as two halves of RmtStepStream::CHUNK_ITEMS: the
+ * threshold interrupt fires each time a half has been sent and refills it from the stream while
+ * the other half plays, so the CPU only sees one interrupt per chunk. The channel stops at the
+ * stream's end marker. It drives the STEP pin only while it transmits; live stepping keeps using
+ * digitalWrite.
+ *
+ * Channels are handed out in begin() order, the ESP32-C3 has two TX channels.
+ */
+class RmtStepChannel
+{
+public:
+    static constexpr size_t MAX_CHANNELS = 2;
+
+private:
+    static constexpr uint8_t CLOCK_DIVIDER = 80; // 80 MHz APB clock to 1 us ticks
+
+    static RmtStepChannel *channels_[MAX_CHANNELS];
+    static size_t channel_count_;
+    static rmt_isr_handle_t interrupt_;
+
+    RmtStepStream *stream_ = nullptr;
+    rmt_channel_t channel_ = RMT_CHANNEL_0;
+    uint8_t step_pin_ = 0;
+    bool available_ = false;
+    size_t next_half_ = 0;   // half of the channel memory refilled on the next threshold interrupt
+    std::atomic<bool> running_{false};
+
+    static void onInterrupt(void *arg);
+
+    // Load the next chunk into a half of the channel memory, false once the stream has ended
+    bool loadHalf(size_t half);
+
+public:
+    /**
+     * @brief Claim the next TX channel for a STEP pin and set it up
+     * @return false if every channel is taken or the RMT setup failed; steps then stay live
+     */
+    bool begin(uint8_t step_pin, RmtStepStream &stream);
+
+    bool isAvailable() const
+    {
+        return available_;
+    }
+
+    /**
+     * @brief Take the STEP pin and send the queued pulses (motion task, while stopped)
+     */
+    void start();
+
+    /**
+     * @brief Still sending, false once the channel reached an end marker
+     */
+    bool isRunning() const
+    {
+        return running_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Hand the STEP pin back to digitalWrite (motion task, while stopped)
+     */
+    void release();
+};
+
+#endif
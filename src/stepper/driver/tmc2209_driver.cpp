@@ -1,15 +1,21 @@
 #include "tmc2209_driver.h"
 #include <Arduino.h>
 
-TMC2209Driver::TMC2209Driver(uint8_t step_pin, uint8_t dir_pin, uint8_t enable_pin, uint8_t tx_pin, uint8_t rx_pin)
-    : tmc2209_(&Serial1, R_SENSE, DEFAULT_ADDRESS),
+TMC2209Driver *TMC2209Driver::bus_reader_ = nullptr;
+
+TMC2209Driver::TMC2209Driver(uint8_t step_pin, uint8_t dir_pin, uint8_t enable_pin, uint8_t tx_pin, uint8_t rx_pin,
+                             uint8_t address, uint8_t diag_pin)
+    : enabled_(false), direction_(true), step_mode_(StepMode::FULL_STEP),
+      stall_threshold_(DEFAULT_STALL_THRESHOLD), tpwmthrs_(0), run_current_(31), hold_current_(16),
       step_pin_(step_pin), dir_pin_(dir_pin), enable_pin_(enable_pin),
-      tx_pin_(tx_pin), rx_pin_(rx_pin),
-      enabled_(false), direction_(true)
+      tx_pin_(tx_pin), rx_pin_(rx_pin), diag_pin_(diag_pin), address_(address),
+      tmc2209_(&Serial1, R_SENSE, address)
 {
     pinMode(step_pin_, OUTPUT);
     pinMode(dir_pin_, OUTPUT);
     pinMode(enable_pin_, OUTPUT);
+    if (hasDiagPin())
+        pinMode(diag_pin_, INPUT_PULLDOWN); // a loose DIAG wire reads as no stall rather than floating
 }
 
 void TMC2209Driver::begin()
@@ -24,16 +30,28 @@ void TMC2209Driver::begin()
     tmc2209_.rms_current(600); // Set current to 600mA
 
     tmc2209_.microsteps(FS_MICROSTEPS); // Start in full-step mode
+    step_mode_ = StepMode::FULL_STEP;
     tmc2209_.intpol(true);              // Enable interpolation to 256 microsteps for smoother motion
 
-    tmc2209_.en_spreadCycle(false); // Disable spreadCycle for quieter operation
+    tmc2209_.en_spreadCycle(false); // StealthChop below TPWMTHRS, SpreadCycle above it
+    tmc2209_.TPWMTHRS(tpwmthrs_);   // 0 = StealthChop only until a motion profile sets a threshold
     tmc2209_.pwm_autoscale(true);   // Enable automatic scaling of PWM amplitude
     tmc2209_.I_scale_analog(false); // Use internal current scaling
 
-    tmc2209_.TPOWERDOWN(10);
-    tmc2209_.ihold(16);
-    tmc2209_.irun(31);
-    tmc2209_.iholddelay(10);
+    // Run and hold currents are scheduled by MotionController from here on
+    tmc2209_.TPOWERDOWN(POWER_DOWN_DELAY);
+    tmc2209_.ihold(hold_current_);
+    tmc2209_.irun(run_current_);
+    tmc2209_.iholddelay(HOLD_DELAY);
+
+    tmc2209_.TCOOLTHRS(0xFFFFF); // Keep StallGuard output active at every step rate
+    tmc2209_.SGTHRS(stall_threshold_);
+
+    // Step mode changes rewrite CHOPCONF raw with only MRES changed. TOFF was set above, so a value
+    // without it means the read failed.
+    chopconf_ = tmc2209_.CHOPCONF();
+    if ((chopconf_ & CHOPCONF_TOFF_MASK) == 0)
+        chopconf_ = 0;
 }
 
 void TMC2209Driver::step()
@@ -44,6 +62,11 @@ void TMC2209Driver::step()
     delayMicroseconds(2); // Minimum pulse width
 }
 
+uint8_t TMC2209Driver::getStepPin() const
+{
+    return step_pin_;
+}
+
 void TMC2209Driver::enable()
 {
     digitalWrite(enable_pin_, LOW); // Active LOW
@@ -75,29 +98,258 @@ bool TMC2209Driver::getDirection() const
 
 void TMC2209Driver::setStepMode(StepMode mode)
 {
+    uint16_t microsteps;
     switch (mode)
     {
     case StepMode::FULL_STEP:
-        tmc2209_.microsteps(FS_MICROSTEPS);
+        microsteps = FS_MICROSTEPS;
         break;
     case StepMode::HALF_STEP:
-        tmc2209_.microsteps(HS_MICROSTEPS);
+        microsteps = HS_MICROSTEPS;
         break;
     default:
-        break;
+        return;
+    }
+
+    if (mode == step_mode_)
+        return;
+
+    step_mode_ = mode;
+    if (chopconf_ == 0)
+    {
+        tmc2209_.microsteps(microsteps);
+        return;
     }
+
+    // MRES 0 is 256 microsteps, every step up halves them
+    uint32_t mres = 8 - __builtin_ctz(microsteps);
+    chopconf_ = (chopconf_ & ~CHOPCONF_MRES_MASK) | (mres << 24);
+    queueWrite(PENDING_STEP_MODE);
 }
 
-StepMode TMC2209Driver::getStepMode()
+StepMode TMC2209Driver::getStepMode() const
 {
-    uint16_t microsteps = tmc2209_.microsteps();
-    switch (microsteps)
+    // Cached: reading MRES back over UART on every motion update would stall the step loop
+    return step_mode_;
+}
+
+uint16_t TMC2209Driver::getMicrostepCountIncrement() const
+{
+    return (step_mode_ == StepMode::HALF_STEP) ? MSCNT_PER_FULL_STEP / HS_MICROSTEPS
+                                               : MSCNT_PER_FULL_STEP / FS_MICROSTEPS;
+}
+
+uint8_t TMC2209Driver::calculateCrc(const uint8_t *datagram, uint8_t length)
+{
+    // CRC-8 with polynomial x^8 + x^2 + x + 1, each byte fed in LSB first
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < length; i++)
     {
-    case FS_MICROSTEPS:
-        return StepMode::FULL_STEP;
-    case HS_MICROSTEPS:
-        return StepMode::HALF_STEP;
-    default:
-        return StepMode::UNKNOWN;
+        uint8_t byte = datagram[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = ((crc >> 7) ^ (byte & 0x01)) ? (crc << 1) ^ 0x07 : crc << 1;
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+bool TMC2209Driver::requestRegister(uint8_t reg)
+{
+    if (bus_reader_ != nullptr && bus_reader_ != this)
+        return false;
+
+    while (Serial1.available() > 0)
+        Serial1.read();
+    reply_length_ = 0;
+    read_register_ = reg;
+    bus_reader_ = this;
+
+    uint8_t datagram[] = {UART_SYNC, address_, reg, 0};
+    datagram[3] = calculateCrc(datagram, 3);
+    Serial1.write(datagram, sizeof(datagram));
+    return true;
+}
+
+bool TMC2209Driver::readRegister(uint32_t &value)
+{
+    if (bus_reader_ != this)
+        return false;
+
+    const uint8_t header[] = {UART_SYNC, UART_MASTER_ADDRESS, read_register_};
+
+    while (Serial1.available() > 0)
+    {
+        uint8_t byte = Serial1.read();
+
+        // the single-wire bus echoes the request first, skip anything until the reply header
+        if (reply_length_ < sizeof(header) && byte != header[reply_length_])
+        {
+            reply_length_ = (byte == UART_SYNC) ? 1 : 0;
+            reply_[0] = byte;
+            continue;
+        }
+
+        reply_[reply_length_++] = byte;
+        if (reply_length_ < READ_REPLY_LENGTH)
+            continue;
+
+        reply_length_ = 0;
+        if (calculateCrc(reply_, READ_REPLY_LENGTH - 1) != reply_[READ_REPLY_LENGTH - 1])
+            return false;
+
+        // 32-bit register value, most significant byte first
+        value = (static_cast<uint32_t>(reply_[3]) << 24) | (static_cast<uint32_t>(reply_[4]) << 16) |
+                (static_cast<uint32_t>(reply_[5]) << 8) | reply_[6];
+        bus_reader_ = nullptr;
+        return true;
     }
+    return false;
+}
+
+void TMC2209Driver::cancelRead()
+{
+    if (bus_reader_ == this)
+        bus_reader_ = nullptr;
+}
+
+bool TMC2209Driver::requestStallGuardResult()
+{
+    return requestRegister(REG_SG_RESULT);
+}
+
+bool TMC2209Driver::readStallGuardResult(uint16_t &sg_result)
+{
+    uint32_t value;
+    if (read_register_ != REG_SG_RESULT || !readRegister(value))
+        return false;
+
+    sg_result = value & 0x3FF; // SG_RESULT is the low 10 bits
+    return true;
+}
+
+bool TMC2209Driver::requestMicrostepCount()
+{
+    return requestRegister(REG_MSCNT);
+}
+
+bool TMC2209Driver::readMicrostepCount(uint16_t &mscnt)
+{
+    uint32_t value;
+    if (read_register_ != REG_MSCNT || !readRegister(value))
+        return false;
+
+    mscnt = value & 0x3FF; // MSCNT is the low 10 bits
+    return true;
+}
+
+void TMC2209Driver::setStallThreshold(uint8_t threshold)
+{
+    if (threshold == stall_threshold_)
+        return;
+
+    stall_threshold_ = threshold;
+    queueWrite(PENDING_STALL_THRESHOLD);
+}
+
+uint8_t TMC2209Driver::getStallThreshold() const
+{
+    return stall_threshold_;
+}
+
+bool TMC2209Driver::isStallResult(uint16_t sg_result) const
+{
+    return sg_result <= 2 * static_cast<uint16_t>(stall_threshold_);
+}
+
+bool TMC2209Driver::hasDiagPin() const
+{
+    return diag_pin_ != NO_DIAG_PIN;
+}
+
+bool TMC2209Driver::isStalled()
+{
+    // DIAG pulses high when SG_RESULT <= 2 * SGTHRS
+    return hasDiagPin() && digitalRead(diag_pin_) == HIGH;
+}
+
+void TMC2209Driver::setSpreadCycleSpeed(float speed)
+{
+    uint32_t tpwmthrs = 0;
+    if (speed > 0.0f)
+    {
+        // TSTEP is the time between 1/256 microsteps; a full-step-mode pulse is 256 / FS_MICROSTEPS of those
+        float tstep = CLOCK_HZ * FS_MICROSTEPS / (256.0f * speed);
+        tpwmthrs = (tstep > TPWMTHRS_MAX) ? TPWMTHRS_MAX : static_cast<uint32_t>(tstep);
+    }
+
+    if (tpwmthrs == tpwmthrs_)
+        return;
+
+    tpwmthrs_ = tpwmthrs;
+    queueWrite(PENDING_SPREADCYCLE_SPEED);
+}
+
+void TMC2209Driver::setRunCurrent(uint8_t irun)
+{
+    if (irun > 31)
+        irun = 31;
+
+    if (irun == run_current_)
+        return;
+
+    run_current_ = irun;
+    queueWrite(PENDING_CURRENTS);
+}
+
+void TMC2209Driver::setHoldCurrent(uint8_t ihold)
+{
+    if (ihold > 31)
+        ihold = 31;
+
+    if (ihold == hold_current_)
+        return;
+
+    hold_current_ = ihold;
+    queueWrite(PENDING_CURRENTS);
+}
+
+void TMC2209Driver::writeRegister(uint8_t reg, uint32_t value)
+{
+    // The register library's writes wait out a reply delay, this runs between steps of both axes
+    uint8_t datagram[] = {UART_SYNC,
+                          address_,
+                          static_cast<uint8_t>(reg | WRITE_FLAG),
+                          static_cast<uint8_t>(value >> 24),
+                          static_cast<uint8_t>(value >> 16),
+                          static_cast<uint8_t>(value >> 8),
+                          static_cast<uint8_t>(value),
+                          0};
+    datagram[7] = calculateCrc(datagram, 7);
+    Serial1.write(datagram, sizeof(datagram)); // the echo is skipped by the next split read
+}
+
+void TMC2209Driver::queueWrite(uint8_t pending)
+{
+    pending_writes_ |= pending;
+    flushWrites();
+}
+
+void TMC2209Driver::flushWrites()
+{
+    // A split read's reply would collide with the datagrams, they wait until it is in or given up
+    if (pending_writes_ == 0 || bus_reader_ != nullptr)
+        return;
+
+    if (pending_writes_ & PENDING_CURRENTS)
+        writeRegister(REG_IHOLD_IRUN, hold_current_ | (static_cast<uint32_t>(run_current_) << 8) |
+                                          (static_cast<uint32_t>(HOLD_DELAY) << 16));
+    if (pending_writes_ & PENDING_STALL_THRESHOLD)
+        writeRegister(REG_SGTHRS, stall_threshold_);
+    if (pending_writes_ & PENDING_SPREADCYCLE_SPEED)
+        writeRegister(REG_TPWMTHRS, tpwmthrs_);
+    if (pending_writes_ & PENDING_STEP_MODE)
+        writeRegister(REG_CHOPCONF, chopconf_);
+    pending_writes_ = 0;
 }
@@ -6,29 +6,84 @@
 
 class TMC2209Driver
 {
+public:
+    static constexpr uint8_t NO_DIAG_PIN = 0xFF;
+
 private:
     static constexpr float R_SENSE = 0.11f;          // Sense resistor value in ohms
     static constexpr uint8_t DEFAULT_ADDRESS = 0b00; // Default UART address for TMC2209
     static constexpr uint8_t FS_MICROSTEPS = 16;
     static constexpr uint8_t HS_MICROSTEPS = 32;
+    static constexpr uint16_t MSCNT_PER_FULL_STEP = 256; // MSCNT advances 256 counts per full step
+    static constexpr uint8_t DEFAULT_STALL_THRESHOLD = 40;
+    static constexpr float CLOCK_HZ = 12e6f;           // internal clock, TSTEP is measured in its cycles
+    static constexpr uint32_t TPWMTHRS_MAX = 0xFFFFF;  // 20-bit register
+    static constexpr uint8_t POWER_DOWN_DELAY = 10;     // TPOWERDOWN, ~0.2 s of standstill before IRUN drops to IHOLD
+    static constexpr uint8_t HOLD_DELAY = 10;           // IHOLDDELAY, gradual drop to IHOLD
+
+    // UART datagrams, see the TMC2209 datasheet
+    static constexpr uint8_t UART_SYNC = 0x05;
+    static constexpr uint8_t UART_MASTER_ADDRESS = 0xFF; // replies carry it in the address byte
+    static constexpr uint8_t REG_IHOLD_IRUN = 0x10;
+    static constexpr uint8_t REG_TPWMTHRS = 0x13;
+    static constexpr uint8_t REG_SGTHRS = 0x40;
+    static constexpr uint8_t REG_SG_RESULT = 0x41;
+    static constexpr uint8_t REG_MSCNT = 0x6A;
+    static constexpr uint8_t REG_CHOPCONF = 0x6C;
+    static constexpr uint32_t CHOPCONF_TOFF_MASK = 0x0000000F; // 0 turns the drivers off
+    static constexpr uint32_t CHOPCONF_MRES_MASK = 0x0F000000; // halvings from 256 microsteps
+    static constexpr uint8_t READ_REPLY_LENGTH = 8;      // sync, address, register, 4 data bytes, CRC
+    static constexpr uint8_t WRITE_FLAG = 0x80;          // set in the register byte of a write datagram
+
+    // Registers with a write held back, see flushWrites()
+    static constexpr uint8_t PENDING_CURRENTS = 0x01;
+    static constexpr uint8_t PENDING_STALL_THRESHOLD = 0x02;
+    static constexpr uint8_t PENDING_SPREADCYCLE_SPEED = 0x04;
+    static constexpr uint8_t PENDING_STEP_MODE = 0x08;
 
     bool enabled_;
     bool direction_;
+    StepMode step_mode_;
+    uint8_t stall_threshold_;
+    uint32_t tpwmthrs_;
+    uint32_t chopconf_ = 0; // as read back after setup, 0 if that failed
+    uint8_t run_current_;
+    uint8_t hold_current_;
     uint8_t step_pin_;
     uint8_t dir_pin_;
     uint8_t enable_pin_;
     uint8_t tx_pin_;
     uint8_t rx_pin_;
+    uint8_t diag_pin_;
+    uint8_t address_;
+
+    uint8_t reply_[READ_REPLY_LENGTH]; // reply to the outstanding split read collected so far
+    uint8_t reply_length_ = 0;
+    uint8_t read_register_ = 0;        // register of the outstanding split read
+    uint8_t pending_writes_ = 0;       // PENDING_* registers changed while a read held the UART
+
+    // Replies carry no slave address, so only one driver on the shared UART may have a read outstanding
+    static TMC2209Driver *bus_reader_;
 
     TMC2209Stepper tmc2209_;
 
+    static uint8_t calculateCrc(const uint8_t *datagram, uint8_t length);
+
+    bool requestRegister(uint8_t reg);
+    bool readRegister(uint32_t &value);
+    void writeRegister(uint8_t reg, uint32_t value);
+    void queueWrite(uint8_t pending);
+
 public:
-    explicit TMC2209Driver(uint8_t step_pin, uint8_t dir_pin, uint8_t enable_pin, uint8_t tx_pin, uint8_t rx_pin);
+    explicit TMC2209Driver(uint8_t step_pin, uint8_t dir_pin, uint8_t enable_pin, uint8_t tx_pin, uint8_t rx_pin,
+                           uint8_t address = DEFAULT_ADDRESS, uint8_t diag_pin = NO_DIAG_PIN);
 
     void begin();
 
     void step();
 
+    uint8_t getStepPin() const;
+
     void enable();
 
     void disable();
@@ -39,7 +94,113 @@ public:
 
     bool getDirection() const;
 
+    /**
+     * @brief Switch between full and half stepping (MRES in CHOPCONF)
+     *
+     * Skips the UART write if nothing changed. Never blocks, see setHoldCurrent(), unless reading
+     * CHOPCONF back failed in begin(); the register library then writes it with its own copy.
+     */
     void setStepMode(StepMode mode);
 
-    StepMode getStepMode();
+    StepMode getStepMode() const;
+
+    /**
+     * @brief Send a read request for the internal microstep counter (MSCNT, 0-1023) and return without
+     * waiting for the reply
+     * @return false if another driver on the UART has a split read outstanding, nothing is sent then
+     *
+     * Collect the reply with readMicrostepCount().
+     */
+    bool requestMicrostepCount();
+
+    /**
+     * @brief Collect the reply to requestMicrostepCount(), see readStallGuardResult()
+     */
+    bool readMicrostepCount(uint16_t &mscnt);
+
+    /**
+     * @brief MSCNT change caused by a single step pulse in the current step mode
+     */
+    uint16_t getMicrostepCountIncrement() const;
+
+    /**
+     * @brief Send a read request for the StallGuard load measurement (SG_RESULT, lower means higher load)
+     * and return without waiting for the reply
+     * @return false if another driver on the UART has a split read outstanding, nothing is sent then
+     *
+     * Collect the reply with readStallGuardResult(); the round trip takes about 1.2 ms at 115200 baud.
+     * Bytes left over from an earlier request are discarded.
+     */
+    bool requestStallGuardResult();
+
+    /**
+     * @brief Collect the reply to requestStallGuardResult() from the bytes received so far
+     * @return true once a complete reply with a valid CRC is in, false while it is incomplete
+     *
+     * Never blocks. A corrupt reply is dropped and never completes, so give up after a timeout with
+     * cancelRead() and send a new request.
+     */
+    bool readStallGuardResult(uint16_t &sg_result);
+
+    /**
+     * @brief Give up on the outstanding split read and free the UART for the other driver
+     */
+    void cancelRead();
+
+    /**
+     * @brief Set the StallGuard threshold (SGTHRS); a stall is reported when SG_RESULT <= 2 * threshold
+     *
+     * Skips the UART write if nothing changed. Never blocks, see setHoldCurrent().
+     */
+    void setStallThreshold(uint8_t threshold);
+
+    uint8_t getStallThreshold() const;
+
+    /**
+     * @brief Check a StallGuard sample against the configured threshold
+     */
+    bool isStallResult(uint16_t sg_result) const;
+
+    bool hasDiagPin() const;
+
+    /**
+     * @brief Check the DIAG pin for a stall
+     *
+     * Always false without a DIAG pin; check split SG_RESULT reads with isStallResult() then.
+     */
+    bool isStalled();
+
+    /**
+     * @brief Set the speed above which the driver leaves StealthChop for SpreadCycle (TPWMTHRS)
+     * @param speed Steps per second, 0 keeps StealthChop at every speed
+     *
+     * The threshold is expressed in TSTEP, which does not depend on the step mode: half-stepping doubles
+     * the pulse rate and the microstep resolution together. Skips the UART write if nothing changed.
+     * Never blocks, see setHoldCurrent().
+     */
+    void setSpreadCycleSpeed(float speed);
+
+    /**
+     * @brief Set the run current scale (IRUN, 0-31 of the configured RMS current)
+     *
+     * Skips the UART write if nothing changed. Never blocks, see setHoldCurrent().
+     */
+    void setRunCurrent(uint8_t irun);
+
+    /**
+     * @brief Set the standstill current scale (IHOLD, 0-31 of the configured RMS current)
+     *
+     * The driver drops from IRUN to IHOLD once the motor has stood still for POWER_DOWN_DELAY, and
+     * applies a new IHOLD at once when already standing. Skips the UART write if nothing changed.
+     *
+     * Never blocks: the write datagram is queued in the UART's TX FIFO, and while a split read
+     * (of either driver) waits for its reply on the shared wire it is held back until
+     * flushWrites().
+     */
+    void setHoldCurrent(uint8_t ihold);
+
+    /**
+     * @brief Send the register writes held back by a split read, once the UART is free (every update)
+     */
+    void flushWrites();
 };
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "motion_controller.h"
 
-MotionController::MotionController() : stepper_driver_(6, 5, 21, 7, 8)
+MotionController::MotionController(uint8_t step_pin, uint8_t dir_pin, uint8_t enable_pin, uint8_t tx_pin, uint8_t rx_pin,
+                                   uint8_t driver_address, const char *settings_namespace, uint8_t diag_pin)
+    : stepper_driver_(step_pin, dir_pin, enable_pin, tx_pin, rx_pin, driver_address, diag_pin),
+      profile_store_(settings_namespace)
 {
 }
 
@@ -8,4 +11,20 @@ void MotionController::begin()
 {
   stepper_driver_.begin();
   stepper_driver_.enable();
+#ifdef EAF_RMT_STEPPING
+  step_channel_.begin(stepper_driver_.getStepPin(), step_stream_); // without a free channel moves stay live
+#endif
+
+  for (uint8_t i = 0; i < PROFILE_COUNT; i++)
+  {
+    if (!profile_store_.loadProfile(i, profiles_[i]))
+      profiles_[i] = DEFAULT_PROFILES[i];
+    ramps_[i].build(profiles_[i]);
+  }
+  homing_ramp_.build(HOMING_PROFILE);
+
+  active_profile_ = profile_store_.loadActiveProfile();
+  applySpeedLimit();
+  stepper_driver_.setHoldCurrent(HOLD_CURRENT_IDLE); // raised again ahead of every move, see energise()
+  mscnt_check_due_ = true; // the first reading is the base lost steps are counted from
 }
@@ -1,31 +1,424 @@
 #pragma once
 #include <Arduino.h>
+#include <atomic>
+#include <climits>
+#include <esp_timer.h>
 #include "driver/tmc2209_driver.h"
 #include "driver/step_mode.h"
 #include "focuser_direction.h"
+#include "motion_profile.h"
+#include "ramp_table.h"
+#include "../storage/profile_store.h"
+#ifdef EAF_RMT_STEPPING
+#include "driver/rmt_step_channel.h"
+#include "rmt_step_stream.h"
+#endif
 
+/**
+ * @brief Point-to-point, jog and homing motion for one focuser
+ *
+ * Setters and update() belong to the motion task. Getters for state the protocol task polls
+ * (positions, moving flag, speed code, faults, homing state, move time) read atomics and are
+ * safe to call from other tasks.
+ *
+ * Built with EAF_RMT_STEPPING, point-to-point moves are not stepped by update() but planned
+ * ahead into an RmtStepStream that an RMT channel plays on the STEP pin; update() then only runs
+ * once per chunk to top the stream up. Jogging and homing react to every step and stay live.
+ *
+ * The standstill current is scheduled as well: it is raised as soon as a target is set, so the
+ * rotor is held firmly before FG, and dropped HOLD_DROP_DELAY_US after the focuser comes to rest.
+ */
 class MotionController
 {
+public:
+    // Fault flags reported by getFaultFlags()
+    static constexpr uint8_t FAULT_LOST_STEPS = 0x01; // MSCNT disagreed with the pulses sent
+    static constexpr uint8_t FAULT_STALL = 0x02;      // StallGuard reported a stall during a move
+
+    enum class HomingState : uint8_t
+    {
+        IDLE = 0x00,      // never homed
+        SEEK_FAST = 0x01, // running inward at speed until the end stop stalls the motor
+        BACK_OFF = 0x02,  // moving away from the end stop
+        SEEK_SLOW = 0x03, // slow final touch against the end stop
+        HOMED = 0x04,     // position re-zeroed to the home offset
+        FAILED = 0x05,    // no stall within the travel limit, or aborted with FQ
+    };
+
 private:
+    static constexpr uint16_t MSCNT_MODULO = 1024;
+    static constexpr unsigned long STALL_SAMPLE_PERIOD_US = 50000; // at most one SG_RESULT read per 50 ms
+    static constexpr unsigned long HOMING_STALL_SAMPLE_PERIOD_US = 0; // seeking the end stop, read back to back
+    static constexpr unsigned long STALL_DETECT_MAX_INTERVAL_US = 10000; // SG_RESULT is meaningless below 100 steps/s
+    static constexpr unsigned long READ_REPLY_TIMEOUT_US = 5000;         // a split UART read normally takes ~1.2 ms
+    static constexpr unsigned long MSCNT_POLL_US = 500;                  // idle, collect the MSCNT reply this often
+
+    static constexpr float HOMING_FAST_SPEED = 500.0f; // steps per second
+    static constexpr float HOMING_SLOW_SPEED = 120.0f; // steps per second, kept above the stall detection limit
+    static constexpr MotionProfile HOMING_PROFILE = {"HOMING", HOMING_FAST_SPEED, 2000.0f, 8.0f, 0.0f, {}, false};
+    static constexpr long HOMING_BACKOFF_STEPS = 200;
+    static constexpr long HOMING_MAX_TRAVEL = 70000;       // more than the full 16-bit Moonlite range
+
+    static constexpr unsigned long JOG_TIMEOUT_US = 500000; // jog stops unless the velocity is refreshed
+#ifdef EAF_RMT_STEPPING
+    static constexpr unsigned long STREAM_MAX_SLEEP_US = 20000; // position and stalls are looked at this often
+#endif
+
+    static constexpr float SPREADCYCLE_MIN_CRUISE_SPEED = 200.0f; // slower cruises stay in StealthChop throughout
+    static constexpr float SPREADCYCLE_SWITCH_FRACTION = 0.7f;    // switch on the way up, clear of the cruise speed
+    static constexpr uint8_t RUN_CURRENT_MIN = 16;                // IRUN at the start speed of profiles with scale_run_current
+    static constexpr uint8_t RUN_CURRENT_MAX = 31;
+    static constexpr float FULL_CURRENT_SPEED = 500.0f;           // cruise speed that gets RUN_CURRENT_MAX
+    static constexpr uint8_t HOLD_CURRENT_ACTIVE = 16;            // IHOLD around moves, holds the rotor firmly
+    static constexpr uint8_t HOLD_CURRENT_IDLE = 4;               // IHOLD at rest, the drive train holds the load
+    static constexpr unsigned long HOLD_DROP_DELAY_US = 1000000;  // rest after arrival or an unstarted SN before dropping
+    static constexpr unsigned long ENERGISE_SETTLE_US = 20000;    // coil current and StealthChop settle after raising IHOLD
+
     TMC2209Driver stepper_driver_;
+    ProfileStore profile_store_;
 
-    long current_position_ = 0;
-    long target_position_ = 0;
+    std::atomic<long> current_position_{0};
+    std::atomic<long> target_position_{0};
     unsigned long distance_ = 0;
 
-    bool is_moving_ = false;
+    std::atomic<bool> is_moving_{false};
     bool change_position_ = true;
+    bool resume_pending_ = false; // the move stops on its ramp, then continues to a shifted target, see shiftTarget()
 
     FocuserDirection direction_ = FocuserDirection::OUTWARD;
 
     unsigned long last_step_time_ = 0;
     unsigned long step_interval_us_ = 0;
-    uint8_t speed_ = 0x02;
+    std::atomic<uint8_t> speed_{0x02};
+
+    MotionProfile profiles_[PROFILE_COUNT];
+    RampTable ramps_[PROFILE_COUNT];
+    RampTable homing_ramp_;
+    std::atomic<uint8_t> active_profile_{0};
+
+    const RampTable *ramp_ = &ramps_[0]; // ramp of the current move
+    size_t ramp_index_ = 0;              // position in ramp_, also the number of steps needed to stop
+    size_t cruise_index_ = 0;            // ramp entry matching the speed selected with setSpeed()
+    unsigned long spreadcycle_interval_us_ = 0; // intervals shorter than this run in SpreadCycle, 0 = never
+
+    uint16_t mscnt_base_ = 0;         // MSCNT at rest when move_pulses_ was last zeroed
+    bool mscnt_base_valid_ = false;
+    long move_pulses_ = 0;            // net pulses since mscnt_base_, signed by direction
+    bool mscnt_check_due_ = false;    // read MSCNT at the next rest, see pollMicrostepCount()
+    bool mscnt_request_pending_ = false;
+    unsigned long mscnt_request_time_ = 0;
+    unsigned long last_stall_sample_time_ = 0;
+    bool stalled_ = false;
+    bool stall_detected_ = false; // a stall started during the current move
+
+    bool load_sampling_ = false; // see setLoadSampling()
+    bool load_request_pending_ = false;
+    unsigned long load_request_time_ = 0;
+    std::atomic<uint16_t> move_min_load_{UINT16_MAX}; // lowest SG_RESULT of the current or last move
+    std::atomic<uint16_t> move_load_samples_{0};
+
+    std::atomic<uint8_t> fault_flags_{0};
+    std::atomic<uint16_t> lost_step_count_{0};
+    std::atomic<uint16_t> stall_count_{0};
+    std::atomic<unsigned long> max_step_lateness_us_{0};
+    unsigned long window_step_lateness_us_ = 0; // since the last telemetry sample
+
+    bool energised_ = false;            // IHOLD is HOLD_CURRENT_ACTIVE, see energise()
+    unsigned long energised_at_us_ = 0; // IHOLD was raised from HOLD_CURRENT_IDLE at this time
+    unsigned long hold_since_us_ = 0;   // the drop to HOLD_CURRENT_IDLE is timed from here
+
+    bool first_step_pending_ = false;
+    unsigned long move_start_us_ = 0;
+    unsigned long first_step_wait_us_ = 0; // from move_start_us_ until the first step may go out
+    std::atomic<unsigned long> first_step_delay_us_{0};
+    std::atomic<unsigned long> max_first_step_delay_us_{0};
+
+    // 64-bit: a slow move can outlast the 32-bit micros() wrap, and its time the range of unsigned long
+    std::atomic<uint64_t> planned_move_time_us_{0}; // estimate for the move set up with SN
+    std::atomic<int64_t> move_deadline_us_{0};      // esp_timer_get_time() at which the running move should end
+
+    // What beginMove() would wait before the first step of the planned move, see publishFirstStepWait()
+    std::atomic<unsigned long> first_step_ready_us_{0}; // rested and settled from this micros() on
+    std::atomic<unsigned long> first_step_settle_us_{0}; // the coils are at the idle current and settle after FG
+    std::atomic<unsigned long> first_step_lead_us_{0};  // the plan counts one start interval ahead of the first step
+
+    std::atomic<HomingState> homing_state_{HomingState::IDLE};
+
+    // Bumped after every change visible through the Moonlite getters, see getStateVersion()
+    std::atomic<uint32_t> state_version_{0};
+    bool homing_aborted_ = false;
+    long home_offset_ = 0;
+
+    bool jogging_ = false;
+    int jog_velocity_ = 0;  // signed target, steps per second (positive is outward)
+    size_t jog_index_ = 0;  // ramp entry matching the jog speed
+    unsigned long last_jog_time_ = 0;
+
+#ifdef EAF_RMT_STEPPING
+    RmtStepStream step_stream_;
+    RmtStepChannel step_channel_;
+    bool streaming_ = false;          // the current move goes out through step_channel_
+    long stream_start_position_ = 0;
+    long stream_start_pulses_ = 0;    // move_pulses_ before the move
+    uint8_t stream_phase_ = 0;        // half-stepping: 1 if the first pulse completes a position step
+#endif
+
+    // Only the motion task writes the counters, so a load/store pair is enough
+    static void incrementSaturating(std::atomic<uint16_t> &counter, uint16_t amount = 1)
+    {
+        uint16_t value = counter.load(std::memory_order_relaxed);
+        counter.store((value > UINT16_MAX - amount) ? UINT16_MAX : value + amount, std::memory_order_relaxed);
+    }
+
+    void notifyStateChanged()
+    {
+        state_version_.fetch_add(1, std::memory_order_release);
+    }
+
+    void publishMoveTime()
+    {
+        uint64_t move_time_us = estimateMoveTimeUs();
+        if (is_moving_)
+        {
+            move_deadline_us_ = esp_timer_get_time() + static_cast<int64_t>(move_time_us);
+        }
+        else
+        {
+            planned_move_time_us_ = move_time_us;
+            publishFirstStepWait();
+        }
+    }
+
+    // Mirrors the first step wait of beginMove() so an idle XMT matches the move FG starts
+    void publishFirstStepWait()
+    {
+        unsigned long interval_us = ramp_->getInterval(0);
+        unsigned long ready_us = last_step_time_ + interval_us;
+        unsigned long settled_us = energised_at_us_ + ENERGISE_SETTLE_US;
+        if (energised_ && static_cast<long>(settled_us - ready_us) > 0)
+            ready_us = settled_us;
+        first_step_ready_us_ = ready_us;
+        first_step_settle_us_ = energised_ ? 0 : ENERGISE_SETTLE_US;
+        first_step_lead_us_ = stepper_driver_.getStepMode() == StepMode::FULL_STEP ? interval_us : interval_us >> 1;
+    }
+
+    // Position the current leg ends at, distance_ steps ahead
+    long getStopPosition() const
+    {
+        return current_position_ + (direction_ == FocuserDirection::OUTWARD ? 1 : -1) * static_cast<long>(distance_);
+    }
+
+    static uint16_t foldMicrostepError(uint16_t error)
+    {
+        return (error > MSCNT_MODULO / 2) ? MSCNT_MODULO - error : error;
+    }
+
+    void verifyMicrostepCount(uint16_t mscnt)
+    {
+        uint16_t increment = stepper_driver_.getMicrostepCountIncrement();
+        uint16_t expected = ((move_pulses_ * increment) % MSCNT_MODULO + MSCNT_MODULO) % MSCNT_MODULO;
+        uint16_t travelled = (mscnt + MSCNT_MODULO - mscnt_base_) % MSCNT_MODULO;
+
+        // MSCNT counts up or down depending on DIR polarity and SHAFT, accept either orientation
+        uint16_t error_up = foldMicrostepError((travelled + MSCNT_MODULO - expected) % MSCNT_MODULO);
+        uint16_t error_down = foldMicrostepError((travelled + expected) % MSCNT_MODULO);
+        uint16_t error = min(error_up, error_down);
+
+        if (error == 0)
+            return;
+
+        fault_flags_ |= FAULT_LOST_STEPS;
+        incrementSaturating(lost_step_count_, (error + increment - 1) / increment);
+    }
+
+    /**
+     * @brief Split MSCNT read at rest, so the check never holds up the other axis's steps
+     *
+     * The reading is checked against the pulses sent since the previous one and becomes the base for
+     * the next check. A move that starts before the reply is in abandons the read; its pulses then
+     * add to the ones still unchecked and the reading after it covers both moves.
+     */
+    void pollMicrostepCount(unsigned long now)
+    {
+        if (!mscnt_check_due_)
+            return;
+
+        if (mscnt_request_pending_)
+        {
+            uint16_t mscnt;
+            if (stepper_driver_.readMicrostepCount(mscnt))
+            {
+                mscnt_request_pending_ = false;
+                mscnt_check_due_ = false;
+                if (mscnt_base_valid_)
+                    verifyMicrostepCount(mscnt);
+                mscnt_base_ = mscnt;
+                mscnt_base_valid_ = true;
+                move_pulses_ = 0;
+            }
+            else if (now - mscnt_request_time_ > READ_REPLY_TIMEOUT_US)
+            {
+                stepper_driver_.cancelRead();
+                mscnt_request_pending_ = false; // lost or corrupt, ask again
+            }
+            return;
+        }
+
+        // the other axis may hold the UART with a read of its own
+        if (stepper_driver_.requestMicrostepCount())
+        {
+            mscnt_request_pending_ = true;
+            mscnt_request_time_ = now;
+        }
+    }
+
+    void recordStall(bool stalled)
+    {
+        if (stalled && !stalled_)
+        {
+            // count each stall once, not every sample taken while it lasts; homing stalls are expected
+            stall_detected_ = true;
+            if (!isHoming())
+            {
+                fault_flags_ |= FAULT_STALL;
+                incrementSaturating(stall_count_);
+            }
+        }
+        stalled_ = stalled;
+    }
+
+    // Split SG_RESULT read: collect the reply of the pending request, or send the next one
+    void sampleLoad(unsigned long now)
+    {
+        if (load_request_pending_)
+        {
+            uint16_t sg_result;
+            if (stepper_driver_.readStallGuardResult(sg_result))
+            {
+                load_request_pending_ = false;
+                if (sg_result < move_min_load_.load(std::memory_order_relaxed))
+                    move_min_load_.store(sg_result, std::memory_order_relaxed);
+                incrementSaturating(move_load_samples_);
+                recordStall(stepper_driver_.isStallResult(sg_result));
+            }
+            else if (now - load_request_time_ > READ_REPLY_TIMEOUT_US)
+            {
+                stepper_driver_.cancelRead();
+                load_request_pending_ = false; // lost or corrupt, ask again
+            }
+            return;
+        }
+
+        if (step_interval_us_ > STALL_DETECT_MAX_INTERVAL_US)
+            return;
+
+        if (stepper_driver_.requestStallGuardResult())
+        {
+            load_request_pending_ = true;
+            load_request_time_ = now;
+        }
+    }
+
+    void pollStall(unsigned long now)
+    {
+        if (load_sampling_)
+        {
+            sampleLoad(now);
+            return;
+        }
+
+        if (step_interval_us_ > STALL_DETECT_MAX_INTERVAL_US)
+            return;
+
+        if (step_interval_us_ < spreadcycle_interval_us_)
+            return; // StallGuard only works in StealthChop
+
+        if (stepper_driver_.hasDiagPin())
+        {
+            recordStall(stepper_driver_.isStalled());
+            return;
+        }
+
+        // SG_RESULT has to come over UART: a rate-limited split read, so no step on either axis waits for it.
+        // A homing seek reads as often as the UART allows, every sample period would run it on into the end stop.
+        unsigned long period_us = isHomingSeek() ? HOMING_STALL_SAMPLE_PERIOD_US : STALL_SAMPLE_PERIOD_US;
+        if (load_request_pending_)
+        {
+            sampleLoad(now);
+        }
+        else if (now - last_stall_sample_time_ >= period_us)
+        {
+            sampleLoad(now);
+            if (load_request_pending_)
+                last_stall_sample_time_ = now;
+        }
+    }
+
+    bool isHomingSeek() const
+    {
+        return homing_state_ == HomingState::SEEK_FAST || homing_state_ == HomingState::SEEK_SLOW;
+    }
+
+    void startHomingMove(long target, float speed)
+    {
+        ramp_ = &homing_ramp_;
+        cruise_index_ = homing_ramp_.getIndexForSpeed(speed);
+        target_position_ = target;
+        distance_ = abs(target_position_ - current_position_);
+        updateDirection();
+        notifyStateChanged();
+        startMovement();
+    }
 
-    float min_speed_ = 8.0f;     // steps per second
-    float max_speed_ = 250.0f;   // steps per second
-    float current_speed_ = 0.0f; // steps per second
-    float acceleration_ = 80.0f; // steps per second squared
+    void finishHoming(bool success)
+    {
+        applySpeedLimit();
+
+        if (success)
+        {
+            current_position_ = home_offset_;
+            target_position_ = home_offset_;
+            distance_ = 0;
+            updateDirection();
+        }
+
+        homing_state_ = success ? HomingState::HOMED : HomingState::FAILED;
+        notifyStateChanged();
+    }
+
+    void advanceHoming()
+    {
+        if (homing_aborted_)
+        {
+            finishHoming(false);
+            return;
+        }
+
+        switch (homing_state_)
+        {
+        case HomingState::SEEK_FAST:
+            if (!stall_detected_)
+            {
+                finishHoming(false);
+                break;
+            }
+            homing_state_ = HomingState::BACK_OFF;
+            startHomingMove(current_position_ + HOMING_BACKOFF_STEPS, HOMING_FAST_SPEED);
+            break;
+
+        case HomingState::BACK_OFF:
+            homing_state_ = HomingState::SEEK_SLOW;
+            startHomingMove(current_position_ - 2 * HOMING_BACKOFF_STEPS, HOMING_SLOW_SPEED);
+            break;
+
+        case HomingState::SEEK_SLOW:
+            finishHoming(stall_detected_);
+            break;
+
+        default:
+            break;
+        }
+    }
 
     void updateDirection()
     {
@@ -33,38 +426,323 @@ private:
         stepper_driver_.setDirection(direction_ == FocuserDirection::INWARD);
     }
 
-    unsigned long getStepsToStop() const
+    /**
+     * @brief Speed selected by an SD code on the active profile
+     *
+     * 0x02 (and below) is the profile's max speed and the speed halves each time the code doubles,
+     * so the classic codes 02/04/08/10/20 give 250/125/63/32/16 steps/s on the default profile.
+     */
+    float getSpeedForCode(uint8_t code) const
+    {
+        const MotionProfile &profile = profiles_[active_profile_];
+        if (code <= 0x02)
+            return profile.max_speed;
+
+        return max(profile.max_speed * 2.0f / code, profile.start_speed);
+    }
+
+    void applySpeedLimit()
+    {
+        ramp_ = &ramps_[active_profile_];
+        cruise_index_ = ramp_->getIndexForSpeed(getSpeedForCode(speed_));
+        configureChopper();
+    }
+
+    /**
+     * @brief Match the driver's chopper mode and run current to the cruise speed of the coming moves
+     *
+     * Fast cruises switch to SpreadCycle part way up the ramp, so the switch happens while accelerating
+     * rather than at the cruise speed where TSTEP jitter would make the driver toggle between modes.
+     * Run current stays at RUN_CURRENT_MAX; a profile with scale_run_current lets it grow linearly from
+     * RUN_CURRENT_MIN at the start speed to RUN_CURRENT_MAX at FULL_CURRENT_SPEED instead. Both are
+     * UART writes, so this only runs when the speed limit changes.
+     * Load sampling keeps StealthChop throughout.
+     */
+    void configureChopper()
+    {
+        const MotionProfile &profile = profiles_[active_profile_];
+        float cruise_speed = 1e6f / ramp_->getInterval(cruise_index_);
+
+        float switch_speed = 0.0f;
+        if (cruise_speed >= SPREADCYCLE_MIN_CRUISE_SPEED && !load_sampling_)
+            switch_speed = max(cruise_speed * SPREADCYCLE_SWITCH_FRACTION, profile.start_speed);
+
+        stepper_driver_.setSpreadCycleSpeed(switch_speed);
+        spreadcycle_interval_us_ = (switch_speed > 0.0f) ? static_cast<unsigned long>(1e6f / switch_speed) : 0;
+
+        uint8_t run_current = RUN_CURRENT_MAX;
+        if (profile.scale_run_current)
+        {
+            float scale = (cruise_speed - profile.start_speed) / (FULL_CURRENT_SPEED - profile.start_speed);
+            scale = constrain(scale, 0.0f, 1.0f);
+            run_current = RUN_CURRENT_MIN + static_cast<uint8_t>(scale * (RUN_CURRENT_MAX - RUN_CURRENT_MIN));
+        }
+        stepper_driver_.setRunCurrent(run_current);
+    }
+
+    void rebuildActiveRamp()
+    {
+        ramps_[active_profile_].build(profiles_[active_profile_]);
+        applySpeedLimit();
+    }
+
+    // Ramp entry for the next position step of a point-to-point move
+    size_t getNextRampIndex(size_t index, unsigned long remaining) const
+    {
+        return RampTable::getNextIndex(index, remaining, cruise_index_);
+    }
+
+    // Time one position step takes at a ramp entry, half-stepping sends two pulses at half the interval
+    unsigned long getPositionPeriodUs(size_t index) const
+    {
+        unsigned long interval = ramp_->getInterval(index);
+        return stepper_driver_.getStepMode() == StepMode::FULL_STEP ? interval : (interval >> 1) << 1;
+    }
+
+#ifdef EAF_RMT_STEPPING
+    /**
+     * @brief Plan pulses into the stream until it is full or the move is planned to its end
+     *
+     * Walks the ramp exactly as update() does per pulse, so distance_, ramp_index_ and
+     * change_position_ describe the end of the queued pulses rather than the shaft.
+     */
+    void fillStream()
+    {
+        bool half_step = stepper_driver_.getStepMode() == StepMode::HALF_STEP;
+        while (distance_ > 0)
+        {
+            bool change_position = !half_step || !change_position_;
+            unsigned long remaining = change_position ? distance_ - 1 : distance_;
+            size_t index = change_position ? getNextRampIndex(ramp_index_, remaining) : ramp_index_;
+            unsigned long interval_us = ramp_->getInterval(index);
+
+            // nothing follows the last pulse, it only needs the minimum low time
+            unsigned long gap_us = (remaining == 0) ? 0 : (half_step ? interval_us >> 1 : interval_us);
+            if (!step_stream_.pushPulse(gap_us))
+                return;
+
+            change_position_ = change_position;
+            distance_ = remaining;
+            ramp_index_ = index;
+            step_interval_us_ = interval_us;
+        }
+    }
+
+    // The shaft position follows the pulses the channel has taken, at most two chunks early
+    void trackStreamPosition()
+    {
+        long pulses = step_stream_.getPulsesSent();
+        long steps = (stepper_driver_.getStepMode() == StepMode::HALF_STEP) ? (pulses + stream_phase_) / 2 : pulses;
+        bool outward = direction_ == FocuserDirection::OUTWARD;
+        long position = stream_start_position_ + (outward ? steps : -steps);
+
+        move_pulses_ = stream_start_pulses_ + (outward ? pulses : -pulses);
+        if (position != current_position_)
+        {
+            current_position_ = position;
+            notifyStateChanged();
+        }
+    }
+
+    void updateStream()
+    {
+        fillStream();
+
+        bool finished = false;
+        if (!step_channel_.isRunning())
+        {
+            if (!step_stream_.empty())
+            {
+                if (first_step_pending_)
+                {
+                    unsigned long now = micros();
+                    if (now - move_start_us_ < first_step_wait_us_)
+                        return; // coils still settling
+                    recordFirstStep(now);
+                }
+                if (step_stream_.isEnded())
+                    step_stream_.restart(); // ran dry before this update, the rest goes out late
+                step_channel_.start();
+            }
+            else
+            {
+                finished = distance_ == 0;
+            }
+        }
+
+        trackStreamPosition();
+
+        if (finished)
+        {
+            last_step_time_ = micros(); // the last pulse went out no later than this
+            streaming_ = false;
+            step_channel_.release();
+            endMove();
+            return;
+        }
+
+        pollStall(micros());
+    }
+#endif
+
+    /**
+     * @brief Raise the standstill current ahead of a move
+     *
+     * Called as soon as a target is set, so a move started later finds the rotor already held in
+     * place; the first step waits ENERGISE_SETTLE_US only if the current was raised just now.
+     */
+    void energise()
     {
-        float speed_diff_squared = current_speed_ * current_speed_ - min_speed_ * min_speed_;
-        return (speed_diff_squared > 0) ? (speed_diff_squared / (2 * acceleration_)) : 0;
+        hold_since_us_ = micros();
+        if (energised_)
+            return;
+
+        stepper_driver_.setHoldCurrent(HOLD_CURRENT_ACTIVE);
+        energised_ = true;
+        energised_at_us_ = hold_since_us_;
+        if (!is_moving_)
+            publishFirstStepWait();
     }
 
-    void updateSpeed(float delta_time)
+    // Drop to HOLD_CURRENT_IDLE once the focuser has rested HOLD_DROP_DELAY_US, heat shifts focus
+    void updateHoldCurrent()
     {
-        unsigned long steps_to_stop = getStepsToStop();
-        float speed_change = acceleration_ * delta_time;
+        if (energised_ && micros() - hold_since_us_ >= HOLD_DROP_DELAY_US)
+        {
+            stepper_driver_.setHoldCurrent(HOLD_CURRENT_IDLE);
+            energised_ = false;
+            publishFirstStepWait();
+        }
+    }
+
+    void recordFirstStep(unsigned long now)
+    {
+        first_step_pending_ = false;
+        unsigned long delay_us = now - move_start_us_;
+        first_step_delay_us_.store(delay_us, std::memory_order_relaxed);
+        if (delay_us > max_first_step_delay_us_.load(std::memory_order_relaxed))
+            max_first_step_delay_us_.store(delay_us, std::memory_order_relaxed);
+    }
+
+    // Drop a split read still waiting for its reply, its result no longer applies
+    void cancelPendingReads()
+    {
+        if (mscnt_request_pending_ || load_request_pending_)
+            stepper_driver_.cancelRead();
+        mscnt_request_pending_ = false;
+        load_request_pending_ = false;
+    }
 
-        if (distance_ <= steps_to_stop)
+    void beginMove()
+    {
+        cancelPendingReads(); // MSCNT would be read while the first steps go out
+        stalled_ = false;
+        stall_detected_ = false;
+        move_min_load_ = UINT16_MAX;
+        move_load_samples_ = 0;
+
+        ramp_index_ = 0;
+        step_interval_us_ = ramp_->getInterval(ramp_index_);
+
+        // the first step goes out once the coils have settled and the motor has rested a start interval since its last pulse
+        unsigned long now = micros();
+        unsigned long rested_us = now - last_step_time_;
+        energise();
+        unsigned long energised_us = now - energised_at_us_;
+        first_step_wait_us_ = (rested_us < step_interval_us_) ? step_interval_us_ - rested_us : 0;
+        if (energised_us < ENERGISE_SETTLE_US)
+            first_step_wait_us_ = max(first_step_wait_us_, ENERGISE_SETTLE_US - energised_us);
+        move_start_us_ = now;
+        first_step_pending_ = true;
+
+        unsigned long actual_interval_us = stepper_driver_.getStepMode() == StepMode::FULL_STEP ? step_interval_us_ : step_interval_us_ >> 1;
+        last_step_time_ = now + first_step_wait_us_ - actual_interval_us;
+        move_deadline_us_ = esp_timer_get_time() + static_cast<long>(last_step_time_ - now) +
+                            static_cast<int64_t>(planned_move_time_us_.load());
+
+#ifdef EAF_RMT_STEPPING
+        // jog and homing are called with their flags already set; ramps too slow to encode stay live
+        streaming_ = step_channel_.isAvailable() && !jogging_ && !isHoming() &&
+                     ramp_->getInterval(0) <= RmtStepStream::MAX_INTERVAL_US;
+        if (streaming_)
         {
-            // decelerate
-            current_speed_ -= speed_change;
-            if (current_speed_ < min_speed_)
-                current_speed_ = min_speed_;
+            step_stream_.reset();
+            stream_start_position_ = current_position_;
+            stream_start_pulses_ = move_pulses_;
+            stream_phase_ = change_position_ ? 0 : 1;
         }
-        else if (current_speed_ < max_speed_)
+#endif
+
+        is_moving_ = true;
+        notifyStateChanged();
+    }
+
+    void endMove()
+    {
+        hold_since_us_ = micros();
+        if (resume_pending_)
         {
-            // accelerate
-            current_speed_ += speed_change;
-            if (current_speed_ > max_speed_)
-                current_speed_ = max_speed_;
+            resume_pending_ = false;
+            distance_ = abs(target_position_ - current_position_);
+            if (distance_ > 0)
+            {
+                // the shifted target lies behind, turn round without reporting the axis as stopped
+                ramp_index_ = 0;
+                updateDirection();
+                planned_move_time_us_ = estimateMoveTimeUs();
+                beginMove();
+                return;
+            }
         }
 
-        step_interval_us_ = static_cast<unsigned long>(1e6f / current_speed_);
+        is_moving_ = false;
+        planned_move_time_us_ = 0;
+        notifyStateChanged();
+        cancelPendingReads();
+        mscnt_check_due_ = true;
+    }
+
+    void updateJogRamp()
+    {
+        bool reverse = jog_velocity_ != 0 && (jog_velocity_ > 0) != (direction_ == FocuserDirection::OUTWARD);
+
+        if (jog_velocity_ == 0 || reverse)
+        {
+            // decelerate to the start speed before stopping or reversing
+            if (ramp_index_ > 0)
+            {
+                ramp_index_--;
+            }
+            else if (jog_velocity_ == 0)
+            {
+                jogging_ = false;
+                target_position_ = current_position_.load();
+                endMove();
+            }
+            else
+            {
+                direction_ = (jog_velocity_ > 0) ? FocuserDirection::OUTWARD : FocuserDirection::INWARD;
+                stepper_driver_.setDirection(direction_ == FocuserDirection::INWARD);
+            }
+        }
+        else if (ramp_index_ < jog_index_)
+        {
+            ramp_index_++;
+        }
+        else if (ramp_index_ > jog_index_)
+        {
+            ramp_index_--;
+        }
     }
 
 public:
-    MotionController();
+    MotionController(uint8_t step_pin, uint8_t dir_pin, uint8_t enable_pin, uint8_t tx_pin, uint8_t rx_pin,
+                     uint8_t driver_address, const char *settings_namespace,
+                     uint8_t diag_pin = TMC2209Driver::NO_DIAG_PIN);
 
+    /**
+     * @brief Initialise the driver, load profiles from flash and precompute every ramp
+     */
     void begin();
 
     void setCurrentPosition(long position)
@@ -76,6 +754,8 @@ public:
         target_position_ = position;
         distance_ = 0;
         updateDirection();
+        publishMoveTime();
+        notifyStateChanged();
     }
 
     long getCurrentPosition() const
@@ -90,7 +770,34 @@ public:
 
         target_position_ = position;
         distance_ = abs(target_position_ - current_position_);
+        resume_pending_ = false;
+        if (distance_ > 0)
+            energise(); // ahead of FG
         updateDirection();
+        publishMoveTime();
+        notifyStateChanged();
+    }
+
+    /**
+     * @brief Set a target reached by way of a turning point, in one move
+     *
+     * The move runs to via, turns round there and carries on to position without getIsMoving()
+     * dropping in between. A via on the way to position or at either end of the move is no turn and
+     * gives the plain move, as does a position already reached.
+     */
+    void setTargetPosition(long position, long via)
+    {
+        setTargetPosition(position);
+        if (is_moving_ || distance_ == 0 || via == current_position_ || via == position ||
+            (via > current_position_) == (position > via))
+            return;
+
+        distance_ = abs(via - current_position_);
+        energise();
+        direction_ = (via > current_position_) ? FocuserDirection::OUTWARD : FocuserDirection::INWARD;
+        stepper_driver_.setDirection(direction_ == FocuserDirection::INWARD);
+        resume_pending_ = true;
+        publishMoveTime();
     }
 
     long getTargetPosition() const
@@ -100,7 +807,7 @@ public:
 
     bool getIsMoving() const
     {
-        return is_moving_;
+        return is_moving_ || isHoming();
     }
 
     void setStepMode(StepMode mode)
@@ -108,44 +815,33 @@ public:
         if (is_moving_)
             return;
 
+        // MSCNT keeps its count, but pulses not yet checked were sent at the old increment
+        if (mode != stepper_driver_.getStepMode() && move_pulses_ != 0)
+            mscnt_base_valid_ = false;
         stepper_driver_.setStepMode(mode);
+        publishMoveTime();
+        notifyStateChanged();
     }
 
-    StepMode getStepMode()
+    StepMode getStepMode() const
     {
         return stepper_driver_.getStepMode();
     }
 
+    /**
+     * @brief Set the cruise speed from a Moonlite SD code
+     *
+     * Any code is accepted and maps continuously onto the active profile, see getSpeedForCode().
+     */
     void setSpeed(uint8_t speed)
     {
         if (is_moving_)
             return;
 
-        switch (speed)
-        {
-        case 0x02: // 250 steps/s
-            max_speed_ = 250.0f;
-            speed_ = speed;
-            break;
-        case 0x04: // 125 steps/s
-            max_speed_ = 125.0f;
-            speed_ = speed;
-            break;
-        case 0x08: // 63 steps/s
-            max_speed_ = 63.0f;
-            speed_ = speed;
-            break;
-        case 0x10: // 32 steps/s
-            max_speed_ = 32.0f;
-            speed_ = speed;
-            break;
-        case 0x20: // 16 steps/s
-            max_speed_ = 16.0f;
-            speed_ = speed;
-            break;
-        default:
-            break;
-        }
+        speed_ = speed;
+        applySpeedLimit();
+        publishMoveTime();
+        notifyStateChanged();
     }
 
     uint8_t getSpeed() const
@@ -155,25 +851,59 @@ public:
 
     void update()
     {
+        stepper_driver_.flushWrites();
         if (!is_moving_)
+        {
+            updateHoldCurrent();
+            pollMicrostepCount(micros());
+            return;
+        }
+
+#ifdef EAF_RMT_STEPPING
+        if (streaming_)
+        {
+            updateStream();
             return;
+        }
+#endif
+
+        if (jogging_ && micros() - last_jog_time_ > JOG_TIMEOUT_US)
+            jog_velocity_ = 0; // watchdog: the hand controller went quiet
 
-        if (distance_ == 0)
+        if (!jogging_ && distance_ == 0)
         {
-            is_moving_ = false;
-            current_speed_ = 0.0f;
+            endMove();
+            if (isHoming())
+                advanceHoming();
             return;
         }
 
         auto now = micros();
+        if (first_step_pending_ && now - move_start_us_ < first_step_wait_us_)
+            return; // last_step_time_ lies ahead until the first step is due
+
         auto delta_time = now - last_step_time_;
 
         auto actual_interval_us = stepper_driver_.getStepMode() == StepMode::FULL_STEP ? step_interval_us_ : step_interval_us_ >> 1;
 
         if (delta_time < actual_interval_us)
+        {
+            pollStall(now);
+            if (stall_detected_ && isHomingSeek())
+                distance_ = 0; // reached the end stop, stop dead
             return;
+        }
 
         stepper_driver_.step();
+        move_pulses_ += (direction_ == FocuserDirection::OUTWARD) ? 1 : -1;
+        if (first_step_pending_)
+            recordFirstStep(now);
+
+        unsigned long lateness_us = delta_time - actual_interval_us;
+        if (lateness_us > max_step_lateness_us_.load(std::memory_order_relaxed))
+            max_step_lateness_us_.store(lateness_us, std::memory_order_relaxed);
+        if (lateness_us > window_step_lateness_us_)
+            window_step_lateness_us_ = lateness_us;
 
         if (stepper_driver_.getStepMode() == StepMode::HALF_STEP)
             change_position_ = !change_position_;
@@ -181,32 +911,509 @@ public:
         if (change_position_)
         {
             current_position_ += (direction_ == FocuserDirection::OUTWARD) ? 1 : -1;
-            distance_--;
+            notifyStateChanged();
+            if (jogging_)
+            {
+                updateJogRamp();
+            }
+            else
+            {
+                distance_--;
+                ramp_index_ = getNextRampIndex(ramp_index_, distance_);
+            }
+            step_interval_us_ = ramp_->getInterval(ramp_index_);
         }
 
-        updateSpeed(actual_interval_us / 1e6f);
-
         last_step_time_ += actual_interval_us;
+
+        // check DIAG on every step; the UART fallback is rate limited
+        pollStall(now);
+        if (stall_detected_ && isHomingSeek())
+            distance_ = 0; // the motion task sleeps until each step is due, so this is where a stall usually shows
+    }
+
+    /**
+     * @brief Time until update() has work to do
+     * @return Microseconds until the next step is due, 0 if it is due now; when idle, until the
+     *         hold current drops or the MSCNT reply is looked for, ULONG_MAX once neither is left
+     */
+    unsigned long getMicrosUntilNextStep() const
+    {
+        if (!is_moving_)
+        {
+            unsigned long wait_us = mscnt_check_due_ ? MSCNT_POLL_US : ULONG_MAX;
+            if (!energised_)
+                return wait_us;
+            unsigned long rested_us = micros() - hold_since_us_;
+            return (rested_us >= HOLD_DROP_DELAY_US) ? 0 : min(wait_us, HOLD_DROP_DELAY_US - rested_us);
+        }
+
+        if (first_step_pending_ && (jogging_ || distance_ > 0))
+        {
+            unsigned long waited_us = micros() - move_start_us_;
+            if (waited_us < first_step_wait_us_)
+                return first_step_wait_us_ - waited_us;
+        }
+
+#ifdef EAF_RMT_STEPPING
+        if (streaming_)
+            return (distance_ > 0) ? min(step_stream_.getRefillDelayUs(), STREAM_MAX_SLEEP_US) : STREAM_MAX_SLEEP_US;
+#endif
+
+        if (!jogging_ && distance_ == 0)
+            return 0;
+
+        unsigned long actual_interval_us = stepper_driver_.getStepMode() == StepMode::FULL_STEP ? step_interval_us_ : step_interval_us_ >> 1;
+        unsigned long elapsed_us = micros() - last_step_time_;
+        return (elapsed_us >= actual_interval_us) ? 0 : actual_interval_us - elapsed_us;
     }
 
     void startMovement()
     {
         if (current_position_ != target_position_)
+            beginMove();
+    }
+
+    /**
+     * @brief Move the target by a number of steps and go there in one move
+     *
+     * Idle, the shift adds to a target set with SN and not yet started, so both become one move.
+     * During a point-to-point move that can still reach the shifted target without turning round,
+     * the move is stretched or shortened and keeps its ramp. Otherwise it stops on its ramp and
+     * carries on to the shifted target from there.
+     * @return false while jogging or homing, nothing changes then
+     */
+    bool shiftTarget(long steps)
+    {
+        if (jogging_ || isHoming())
+            return false;
+
+        target_position_ += steps;
+        if (!is_moving_)
         {
-            is_moving_ = true;
-            current_speed_ = min_speed_;
-            step_interval_us_ = static_cast<unsigned long>(1e6f / current_speed_);
-            last_step_time_ = micros();
+            distance_ = abs(target_position_ - current_position_);
+            resume_pending_ = false;
+            updateDirection();
+            publishMoveTime();
+            notifyStateChanged();
+            startMovement();
+            return true;
         }
+
+        if (!resume_pending_)
+        {
+            // distance_ counts from the last step taken, or queued when streaming
+            long remaining = static_cast<long>(distance_) + (direction_ == FocuserDirection::OUTWARD ? steps : -steps);
+            bool stretch = remaining >= static_cast<long>(ramp_index_);
+#ifdef EAF_RMT_STEPPING
+            stretch = stretch && (!streaming_ || distance_ > 0); // the last queued pulse has no gap after it
+#endif
+            if (stretch)
+            {
+                distance_ = remaining;
+            }
+            else
+            {
+                resume_pending_ = true;
+                if (distance_ > ramp_index_)
+                    distance_ = ramp_index_;
+            }
+            publishMoveTime();
+        }
+        notifyStateChanged();
+        return true;
     }
 
     void stopMovement()
     {
-        // decelerate to stop safely
-        auto steps_to_stop = getStepsToStop();
-        if (distance_ > steps_to_stop)
+        resume_pending_ = false;
+        if (isHoming())
+            homing_aborted_ = true;
+
+        if (jogging_)
         {
-            distance_ = steps_to_stop;
+            jog_velocity_ = 0;
+            return;
         }
+
+        // decelerate to stop safely, walking back down the ramp takes ramp_index_ steps
+        if (distance_ > ramp_index_)
+        {
+            distance_ = ramp_index_;
+            publishMoveTime();
+        }
+    }
+
+    uint8_t getFaultFlags() const
+    {
+        return fault_flags_;
+    }
+
+    uint16_t getLostStepCount() const
+    {
+        return lost_step_count_;
+    }
+
+    uint16_t getStallCount() const
+    {
+        return stall_count_;
+    }
+
+    void clearFaults()
+    {
+        fault_flags_ = 0;
+        lost_step_count_ = 0;
+        stall_count_ = 0;
+        max_step_lateness_us_ = 0;
+        max_first_step_delay_us_ = 0;
+    }
+
+    /**
+     * @brief Largest delay of a step past its scheduled time since the last clearFaults()
+     */
+    unsigned long getMaxStepLatenessUs() const
+    {
+        return max_step_lateness_us_;
+    }
+
+    /**
+     * @brief Time from the start of the last move (FG) to its first step
+     *
+     * Covers waiting for the coils to settle after energise() and for the motor to rest a start
+     * interval after a previous move; the FG command's trip through the motion queue is not included.
+     */
+    unsigned long getFirstStepDelayUs() const
+    {
+        return first_step_delay_us_;
+    }
+
+    /**
+     * @brief Largest getFirstStepDelayUs() since the last clearFaults()
+     */
+    unsigned long getMaxFirstStepDelayUs() const
+    {
+        return max_first_step_delay_us_;
+    }
+
+    /**
+     * @brief Largest step lateness since the previous call, for telemetry (motion task only)
+     */
+    unsigned long takeWindowStepLatenessUs()
+    {
+        unsigned long lateness_us = window_step_lateness_us_;
+        window_step_lateness_us_ = 0;
+        return lateness_us;
+    }
+
+    /**
+     * @brief Start sensorless homing against the inward end stop
+     *
+     * Runs inward fast until StallGuard reports a stall, backs off, touches the end stop again slowly
+     * and then sets the current position to the home offset. Progress is reported by getHomingState().
+     */
+    void startHoming()
+    {
+        if (is_moving_ || isHoming())
+            return;
+
+        homing_aborted_ = false;
+
+        // StallGuard needs StealthChop for the whole run, applySpeedLimit() restores the threshold afterwards
+        stepper_driver_.setSpreadCycleSpeed(0.0f);
+        spreadcycle_interval_us_ = 0;
+        stepper_driver_.setRunCurrent(RUN_CURRENT_MAX);
+
+        homing_state_ = HomingState::SEEK_FAST;
+        startHomingMove(current_position_ - HOMING_MAX_TRAVEL, HOMING_FAST_SPEED);
+    }
+
+    bool isHoming() const
+    {
+        return homing_state_ == HomingState::SEEK_FAST || homing_state_ == HomingState::BACK_OFF ||
+               homing_state_ == HomingState::SEEK_SLOW;
+    }
+
+    HomingState getHomingState() const
+    {
+        return homing_state_;
+    }
+
+    /**
+     * @brief Counter that changes whenever position, target, moving status, speed or step mode change
+     *
+     * Readers on another task load it before reading that state; an unchanged value means answers
+     * computed earlier are still current.
+     */
+    uint32_t getStateVersion() const
+    {
+        return state_version_.load(std::memory_order_acquire);
+    }
+
+    void setHomeOffset(long offset)
+    {
+        home_offset_ = offset;
+    }
+
+    void setStallThreshold(uint8_t threshold)
+    {
+        if (is_moving_)
+            return;
+
+        stepper_driver_.setStallThreshold(threshold);
+    }
+
+    /**
+     * @brief Stream a target velocity for hand controllers
+     * @param velocity Signed speed in steps per second, positive is outward, 0 stops
+     *
+     * The speed ramps with the normal acceleration limit and is capped by the speed set with setSpeed().
+     * Jogging stops on its own unless the velocity is refreshed within JOG_TIMEOUT_US.
+     */
+    void setJogVelocity(int velocity)
+    {
+        if (isHoming() || (is_moving_ && !jogging_))
+            return;
+
+        jog_velocity_ = velocity;
+        jog_index_ = min(ramp_->getIndexForSpeed(abs(velocity)), cruise_index_);
+        last_jog_time_ = micros();
+
+        if (!jogging_)
+        {
+            if (velocity == 0)
+                return;
+
+            jogging_ = true;
+            direction_ = (velocity > 0) ? FocuserDirection::OUTWARD : FocuserDirection::INWARD;
+            stepper_driver_.setDirection(direction_ == FocuserDirection::INWARD);
+            beginMove();
+            return;
+        }
+
+        // Let a speed-up take effect on the pending step instead of after its (longer) interval
+        bool same_direction = (velocity > 0) == (direction_ == FocuserDirection::OUTWARD);
+        if (velocity != 0 && same_direction && ramp_index_ < jog_index_)
+        {
+            ramp_index_++;
+            step_interval_us_ = ramp_->getInterval(ramp_index_);
+        }
+    }
+
+    bool isJogging() const
+    {
+        return jogging_;
+    }
+
+    /**
+     * @brief Time the planned (or remaining) move takes, in microseconds
+     *
+     * Walks the precomputed ramp the same way update() does, skipping over the cruise phase in one
+     * multiplication, so the result matches the stepped move exactly apart from loop latency.
+     * Returns 0 while jogging or homing.
+     */
+    uint64_t estimateMoveTimeUs() const
+    {
+        if (jogging_ || isHoming())
+            return 0;
+
+        uint64_t total_us = estimateRampTimeUs(is_moving_ ? ramp_index_ : 0, distance_);
+        if (resume_pending_)
+        {
+            // then from rest to a shifted target behind the point the move stops at
+            total_us += estimateRampTimeUs(0, abs(target_position_ - getStopPosition()));
+        }
+        return total_us;
+    }
+
+    // Time the ramp takes from an entry over the remaining position steps
+    uint64_t estimateRampTimeUs(size_t index, unsigned long remaining) const
+    {
+        uint64_t total_us = 0;
+
+        while (remaining > 0)
+        {
+            if (index == cruise_index_ && remaining > index)
+            {
+                // cruise until the remaining distance equals the steps needed to stop
+                total_us += static_cast<uint64_t>(remaining - index) * getPositionPeriodUs(index);
+                remaining = index;
+            }
+            else
+            {
+                total_us += getPositionPeriodUs(index);
+                remaining--;
+            }
+            index = getNextRampIndex(index, remaining);
+        }
+
+        return total_us;
+    }
+
+    /**
+     * @brief Time left until the running move ends, or the duration of the planned move when idle
+     *
+     * Published by the motion task whenever the plan changes, safe to call from other tasks. When idle
+     * it counts from now, so it includes the rest and coil settle the first step would wait after FG.
+     */
+    uint64_t getRemainingMoveTimeUs() const
+    {
+        if (!is_moving_)
+        {
+            uint64_t planned_us = planned_move_time_us_;
+            if (planned_us == 0)
+                return 0;
+
+            long ready_in_us = static_cast<long>(first_step_ready_us_ - micros());
+            unsigned long wait_us = max(ready_in_us > 0 ? static_cast<unsigned long>(ready_in_us) : 0ul, first_step_settle_us_.load());
+            return planned_us + wait_us - first_step_lead_us_;
+        }
+
+        int64_t remaining_us = move_deadline_us_ - esp_timer_get_time();
+        return remaining_us > 0 ? remaining_us : 0;
+    }
+
+    float getCurrentSpeed() const
+    {
+        return is_moving_ ? 1e6f / step_interval_us_ : 0.0f;
+    }
+
+    FocuserDirection getDirection() const
+    {
+        return direction_;
+    }
+
+    /**
+     * @brief Select the active motion profile
+     *
+     * Every profile's ramp is precomputed in begin(), so switching only swaps a pointer.
+     * The selection is saved to flash by saveProfile().
+     */
+    void selectProfile(uint8_t index)
+    {
+        if (is_moving_ || isHoming() || index >= PROFILE_COUNT)
+            return;
+
+        active_profile_ = index;
+        applySpeedLimit();
+        publishMoveTime();
+    }
+
+    uint8_t getActiveProfile() const
+    {
+        return active_profile_;
+    }
+
+    const MotionProfile &getProfile() const
+    {
+        return profiles_[active_profile_];
+    }
+
+    /**
+     * @brief Replace the parameters of the active profile and rebuild its ramp
+     *
+     * Values that would make the ramp unusable (zero speeds or acceleration) are ignored.
+     * Changes are kept in RAM until saveProfile() is called.
+     */
+    void setProfileParameters(float max_speed, float acceleration, float start_speed, float jerk)
+    {
+        if (is_moving_ || isHoming())
+            return;
+
+        if (start_speed <= 0.0f || max_speed < start_speed || acceleration <= 0.0f || jerk < 0.0f)
+            return;
+
+        MotionProfile &profile = profiles_[active_profile_];
+        profile.max_speed = max_speed;
+        profile.acceleration = acceleration;
+        profile.start_speed = start_speed;
+        profile.jerk = jerk;
+        rebuildActiveRamp();
+        publishMoveTime();
+    }
+
+    /**
+     * @brief Set a resonance band of the active profile and rebuild its ramp
+     * @param index Band number, below MotionProfile::RESONANCE_BAND_COUNT
+     * @param low_speed Lower edge in steps per second
+     * @param high_speed Upper edge in steps per second, not above low_speed clears the band
+     *
+     * Changes are kept in RAM until saveProfile() is called.
+     */
+    void setResonanceBand(uint8_t index, float low_speed, float high_speed)
+    {
+        if (is_moving_ || isHoming() || index >= MotionProfile::RESONANCE_BAND_COUNT)
+            return;
+
+        if (high_speed <= low_speed)
+            low_speed = high_speed = 0.0f;
+
+        profiles_[active_profile_].resonance_bands[index] = ResonanceBand{low_speed, high_speed};
+        rebuildActiveRamp();
+        publishMoveTime();
+    }
+
+    /**
+     * @brief Top speed of the coming moves, the ramp entry the speed code selects, in steps per second
+     */
+    float getCruiseSpeed() const
+    {
+        return 1e6f / ramp_->getInterval(cruise_index_);
+    }
+
+    /**
+     * @brief Steps the coming moves take to reach getCruiseSpeed(), and to stop from it
+     */
+    size_t getCruiseRampSteps() const
+    {
+        return cruise_index_;
+    }
+
+    /**
+     * @brief Sample the StallGuard load during moves without holding up steps
+     *
+     * Replaces the stall polling of normal moves: SG_RESULT is requested over UART again as soon as
+     * the previous reply is in, rather than once per STALL_SAMPLE_PERIOD_US, and the DIAG pin is not
+     * used. Every sample also counts as a stall check. StallGuard needs StealthChop, so the chopper stays in it at
+     * every speed while sampling is on.
+     */
+    void setLoadSampling(bool enabled)
+    {
+        if (is_moving_ || isHoming())
+            return;
+
+        load_sampling_ = enabled;
+        cancelPendingReads();
+        configureChopper();
+    }
+
+    /**
+     * @brief Lowest SG_RESULT sampled during the current or last move, UINT16_MAX without samples
+     */
+    uint16_t getMoveMinLoad() const
+    {
+        return move_min_load_;
+    }
+
+    uint16_t getMoveLoadSampleCount() const
+    {
+        return move_load_samples_;
+    }
+
+    /**
+     * @brief SG_RESULT at or below which the driver reports a stall
+     */
+    uint16_t getStallLoad() const
+    {
+        return 2 * static_cast<uint16_t>(stepper_driver_.getStallThreshold());
+    }
+
+    /**
+     * @brief Persist the active profile and its selection (call from the protocol task while idle)
+     */
+    void saveProfile()
+    {
+        uint8_t index = active_profile_;
+        profile_store_.saveProfile(index, profiles_[index]);
+        profile_store_.saveActiveProfile(index);
     }
 };
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief Speed range in which the motor resonates and loses torque
+ *
+ * Ramps cross the range at an increased acceleration and never cruise strictly inside it.
+ * A band with high_speed <= low_speed is unused.
+ */
+struct ResonanceBand
+{
+    float low_speed;
+    float high_speed;
+};
+
+/**
+ * @brief Named set of motion tuning parameters
+ *
+ * Speeds are in steps per second, acceleration in steps per second squared and jerk in
+ * steps per second cubed. A jerk of 0 gives a plain trapezoidal ramp. Profiles run at the full run
+ * current unless scale_run_current lowers it for slow cruises, for light loads only.
+ */
+struct MotionProfile
+{
+    static constexpr uint8_t NAME_LENGTH = 8;
+    static constexpr uint8_t RESONANCE_BAND_COUNT = 2;
+
+    char name[NAME_LENGTH];
+    float max_speed;
+    float acceleration;
+    float start_speed;
+    float jerk;
+    ResonanceBand resonance_bands[RESONANCE_BAND_COUNT];
+    bool scale_run_current;
+};
+
+constexpr uint8_t PROFILE_COUNT = 4;
+
+// Factory profiles, used until a profile has been saved to flash
+constexpr MotionProfile DEFAULT_PROFILES[PROFILE_COUNT] = {
+    {"DEFAULT", 250.0f, 80.0f, 8.0f, 0.0f, {}, false},
+    {"FAST", 800.0f, 400.0f, 16.0f, 0.0f, {}, false},
+    {"SMOOTH", 250.0f, 120.0f, 8.0f, 400.0f, {}, true},
+    {"HEAVY", 125.0f, 40.0f, 8.0f, 0.0f, {}, false},
+};
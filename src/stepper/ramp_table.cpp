@@ -0,0 +1,113 @@
+#include "ramp_table.h"
+#include <math.h>
+
+namespace
+{
+    bool isInside(const ResonanceBand &band, float speed)
+    {
+        return band.high_speed > band.low_speed && speed > band.low_speed && speed < band.high_speed;
+    }
+
+    bool isInsideAny(const MotionProfile &profile, float speed)
+    {
+        for (const ResonanceBand &band : profile.resonance_bands)
+        {
+            if (isInside(band, speed))
+                return true;
+        }
+        return false;
+    }
+}
+
+void RampTable::build(const MotionProfile &profile)
+{
+    // the top entry is where long moves cruise, keep it below any band it falls into
+    float max_speed = profile.max_speed;
+    for (uint8_t pass = 0; pass < MotionProfile::RESONANCE_BAND_COUNT; pass++)
+    {
+        for (const ResonanceBand &band : profile.resonance_bands)
+        {
+            if (isInside(band, max_speed))
+                max_speed = band.low_speed;
+        }
+    }
+
+    float speed = profile.start_speed;
+    // with jerk limiting the acceleration builds up from zero
+    float acceleration = (profile.jerk > 0.0f) ? 0.0f : profile.acceleration;
+
+    for (BandEntries &entries : band_entries_)
+        entries = BandEntries{0, 0};
+
+    length_ = 0;
+    while (length_ < MAX_STEPS)
+    {
+        // rounded up, a step never runs faster than the ramp speed, so a cruise at a band's low edge stays out
+        uint32_t interval = static_cast<uint32_t>(ceilf(1e6f / speed));
+        float step_speed = 1e6f / interval;
+        for (uint8_t band = 0; band < MotionProfile::RESONANCE_BAND_COUNT; band++)
+        {
+            // speeds only grow along the table, so the entries inside a band are contiguous
+            if (isInside(profile.resonance_bands[band], step_speed))
+            {
+                if (band_entries_[band].first == band_entries_[band].last)
+                    band_entries_[band].first = length_;
+                band_entries_[band].last = length_ + 1;
+            }
+        }
+        intervals_us_[length_++] = interval;
+
+        if (speed >= max_speed)
+            break;
+
+        if (profile.jerk > 0.0f)
+        {
+            float jerk_change = profile.jerk / speed;
+
+            // start easing off once the remaining speed gain equals what it takes to bring acceleration to zero
+            if (max_speed - speed <= acceleration * acceleration / (2 * profile.jerk))
+                acceleration = fmaxf(acceleration - jerk_change, jerk_change);
+            else
+                acceleration = fminf(acceleration + jerk_change, profile.acceleration);
+        }
+
+        // get through resonance bands fast, the jerk-limited build-up is suspended meanwhile
+        float step_acceleration = acceleration;
+        if (isInsideAny(profile, speed))
+            step_acceleration = fmaxf(acceleration, profile.acceleration) * BAND_ACCELERATION_FACTOR;
+
+        // constant acceleration over one step: v1^2 = v0^2 + 2a
+        speed = fminf(sqrtf(speed * speed + 2 * step_acceleration), max_speed);
+    }
+}
+
+size_t RampTable::getIndexForSpeed(float speed) const
+{
+    if (length_ == 0 || speed <= 0.0f)
+        return 0;
+
+    uint32_t interval = static_cast<uint32_t>(1e6f / speed);
+
+    // intervals shrink along the table, find the last one that is still >= interval
+    size_t low = 0;
+    size_t high = length_;
+    while (high - low > 1)
+    {
+        size_t middle = (low + high) / 2;
+        if (intervals_us_[middle] >= interval)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    // drop below the band instead of cruising in it, overlapping bands may take one pass each
+    for (uint8_t pass = 0; pass < MotionProfile::RESONANCE_BAND_COUNT; pass++)
+    {
+        for (const BandEntries &entries : band_entries_)
+        {
+            if (low >= entries.first && low < entries.last)
+                low = (entries.first > 0) ? entries.first - 1 : 0;
+        }
+    }
+    return low;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "motion_profile.h"
+
+/**
+ * @brief Precomputed acceleration ramp of a motion profile
+ *
+ * Entry k holds the step interval used k steps into the ramp, starting at the profile's start
+ * speed and ending at its max speed. Deceleration walks the same table backwards, so the
+ * number of steps needed to stop from entry k is k.
+ *
+ * Entries inside one of the profile's resonance bands are built with BAND_ACCELERATION_FACTOR
+ * times the acceleration, so both ramp directions pass the band quickly, and getIndexForSpeed()
+ * never picks one of them as a cruise entry.
+ */
+class RampTable
+{
+public:
+    static constexpr size_t MAX_STEPS = 1024;
+    static constexpr float BAND_ACCELERATION_FACTOR = 4.0f;
+
+    /**
+     * @brief Rebuild the table for a profile
+     *
+     * If the max speed cannot be reached within MAX_STEPS the ramp is cut short and its last
+     * entry becomes the top speed. A max speed inside a resonance band is lowered to the band's
+     * low edge.
+     */
+    void build(const MotionProfile &profile);
+
+    uint32_t getInterval(size_t index) const
+    {
+        return intervals_us_[index];
+    }
+
+    size_t getLength() const
+    {
+        return length_;
+    }
+
+    /**
+     * @brief Ramp entry for the next position step of a point-to-point move
+     * @param index Current entry, also the number of steps needed to stop
+     * @param remaining Position steps left after this one
+     * @param cruise_index Entry of the cruise speed
+     */
+    static size_t getNextIndex(size_t index, unsigned long remaining, size_t cruise_index)
+    {
+        if (remaining <= index)
+            return index > 0 ? index - 1 : 0; // decelerate
+        if (index < cruise_index)
+            return index + 1;
+        if (index > cruise_index)
+            return index - 1;
+        return index;
+    }
+
+    /**
+     * @brief Find the last ramp entry that does not exceed a speed and lies outside every resonance band
+     * @param speed Speed in steps per second
+     * @return Index into the table, 0 if the speed is below the start speed
+     */
+    size_t getIndexForSpeed(float speed) const;
+
+private:
+    // Ramp entries [first, last) lie inside a band, first == last if the ramp does not reach it
+    struct BandEntries
+    {
+        size_t first;
+        size_t last;
+    };
+
+    uint32_t intervals_us_[MAX_STEPS] = {};
+    size_t length_ = 0;
+    BandEntries band_entries_[MotionProfile::RESONANCE_BAND_COUNT] = {};
+};
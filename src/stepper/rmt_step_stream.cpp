@@ -0,0 +1,102 @@
+#include "rmt_step_stream.h"
+
+size_t RmtStepStream::encode(uint32_t interval_us, RmtItem *items)
+{
+    uint32_t low_us = (interval_us > 2 * PULSE_US ? interval_us : 2 * PULSE_US) - PULSE_US;
+
+    // the LOW time is spread evenly over the LOW halves, the pulse item's and two per filler item
+    size_t count = (low_us <= MAX_DURATION) ? 1 : 1 + (low_us - MAX_DURATION + 2 * MAX_DURATION - 1) / (2 * MAX_DURATION);
+    if (items == nullptr)
+        return count;
+
+    uint32_t halves = 2 * count - 1;
+    uint32_t share = low_us / halves;
+    uint32_t longer = low_us % halves; // halves that get one tick more
+    auto half = [&](uint32_t n) { return share + (n < longer ? 1 : 0); };
+
+    items[0] = RmtItem::make(PULSE_US, true, half(0), false);
+    for (size_t i = 1; i < count; i++)
+        items[i] = RmtItem::make(half(2 * i - 1), false, half(2 * i), false);
+    return count;
+}
+
+void RmtStepStream::reset()
+{
+    RmtItem item;
+    while (queue_.pop(item))
+    {
+    }
+
+    pulses_sent_.store(0, std::memory_order_relaxed);
+    sent_us_.store(0, std::memory_order_relaxed);
+    queued_us_ = 0;
+    for (uint32_t &duration : recent_us_)
+        duration = 0;
+    recent_total_us_ = 0;
+    recent_next_ = 0;
+    underruns_ = 0;
+    ended_.store(false, std::memory_order_release);
+}
+
+bool RmtStepStream::pushPulse(uint32_t interval_us)
+{
+    RmtItem items[MAX_PULSE_ITEMS];
+    size_t count = encode(interval_us, nullptr);
+    if (count > MAX_PULSE_ITEMS || queue_.size() + count > QUEUE_ITEMS - 1)
+        return false;
+
+    encode(interval_us, items);
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t duration = items[i].getDuration0() + items[i].getDuration1();
+        queued_us_ += duration;
+        recent_total_us_ += duration - recent_us_[recent_next_];
+        recent_us_[recent_next_] = duration;
+        recent_next_ = (recent_next_ + 1) % CHUNK_ITEMS;
+        queue_.push(items[i]);
+    }
+    return true;
+}
+
+size_t RmtStepStream::takeChunk(RmtItem *items)
+{
+    if (ended_.load(std::memory_order_acquire))
+        return 0;
+
+    size_t count = 0;
+    uint32_t pulses = 0;
+    uint32_t duration_us = 0;
+    while (count < CHUNK_ITEMS && queue_.pop(items[count]))
+    {
+        pulses += items[count].getLevel0() ? 1 : 0;
+        duration_us += items[count].getDuration0() + items[count].getDuration1();
+        count++;
+    }
+
+    // only this side writes the counters
+    pulses_sent_.store(pulses_sent_.load(std::memory_order_relaxed) + pulses, std::memory_order_release);
+    sent_us_.store(sent_us_.load(std::memory_order_relaxed) + duration_us, std::memory_order_release);
+
+    if (count < CHUNK_ITEMS)
+    {
+        // the rest of the half still holds old items, stop the channel before it reaches them
+        items[count++] = RmtItem{0};
+        ended_.store(true, std::memory_order_release);
+    }
+    return count;
+}
+
+void RmtStepStream::restart()
+{
+    if (underruns_ < UINT16_MAX)
+        underruns_++;
+    ended_.store(false, std::memory_order_release);
+}
+
+unsigned long RmtStepStream::getRefillDelayUs() const
+{
+    uint32_t queued_us = queued_us_ - sent_us_.load(std::memory_order_acquire);
+    if (queued_us <= recent_total_us_ + REFILL_MARGIN_US)
+        return 0;
+    return queued_us - recent_total_us_ - REFILL_MARGIN_US;
+}
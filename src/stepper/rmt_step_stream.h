@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "../util/spsc_queue.h"
+
+/**
+ * @brief One RMT symbol: two level/duration pairs, laid out like the IDF's rmt_item32_t
+ *
+ * Durations are in channel ticks. A zero duration ends the transmission.
+ */
+struct RmtItem
+{
+    uint32_t value;
+
+    static constexpr RmtItem make(uint32_t duration0, bool level0, uint32_t duration1, bool level1)
+    {
+        return RmtItem{duration0 | (level0 ? 1u << 15 : 0u) | (duration1 << 16) | (level1 ? 1u << 31 : 0u)};
+    }
+
+    uint32_t getDuration0() const
+    {
+        return value & 0x7FFF;
+    }
+
+    bool getLevel0() const
+    {
+        return (value >> 15) & 1;
+    }
+
+    uint32_t getDuration1() const
+    {
+        return (value >> 16) & 0x7FFF;
+    }
+
+    bool getLevel1() const
+    {
+        return value >> 31;
+    }
+
+    bool isEnd() const
+    {
+        return getDuration0() == 0 || getDuration1() == 0;
+    }
+};
+
+/**
+ * @brief STEP pulse train encoded for an RMT channel, queued ahead of the hardware
+ *
+ * The motion task pushes one pulse per interval (producer); the channel's refill interrupt takes
+ * it out CHUNK_ITEMS at a time into the half of the channel memory it just finished sending
+ * (consumer). A pulse is HIGH for PULSE_US and LOW for the rest of its interval, the interval
+ * being the time to the next pulse; intervals beyond one item's range get LOW filler items. When
+ * the queue runs dry the chunk is closed with an end marker and the channel stops: an underrun,
+ * which only delays the following pulses.
+ *
+ * Nothing here touches the hardware, so the encoder and the consumer are the same on the host
+ * (tools/rmt_check).
+ */
+class RmtStepStream
+{
+public:
+    static constexpr uint32_t PULSE_US = 2;            // STEP high time, as TMC2209Driver::step()
+    static constexpr uint32_t MAX_DURATION = 0x7FFF;   // 15-bit duration field, in 1 us ticks
+    static constexpr size_t CHUNK_ITEMS = 24;          // half of the 48-item channel memory of the ESP32-C3
+    static constexpr size_t QUEUE_ITEMS = 64;
+    static constexpr unsigned long REFILL_MARGIN_US = 1000; // wake-up latency allowed for the producer
+    static constexpr size_t MAX_PULSE_ITEMS = 8;
+    static constexpr uint32_t MAX_INTERVAL_US = PULSE_US + (2 * MAX_PULSE_ITEMS - 1) * MAX_DURATION; // ~0.5 s
+
+    /**
+     * @brief Encode the pulse that starts an interval
+     * @param interval_us Time to the next pulse, clamped to at least twice PULSE_US
+     * @param items Destination, nullptr to only count
+     * @return Number of items, 1 up to 32767 us and one more per further 65534 us
+     */
+    static size_t encode(uint32_t interval_us, RmtItem *items);
+
+    /**
+     * @brief Clear the queue and the counters at the start of a move (while the channel is stopped)
+     */
+    void reset();
+
+    /**
+     * @brief Queue one pulse (producer side)
+     * @param interval_us Time to the next pulse, up to MAX_INTERVAL_US
+     * @return false if it does not fit, nothing was queued
+     */
+    bool pushPulse(uint32_t interval_us);
+
+    /**
+     * @brief Move the next items into a chunk of the channel memory (consumer side)
+     * @param items CHUNK_ITEMS destination slots
+     * @return Items written, an end marker included if the queue ran dry; 0 once the stream has ended
+     */
+    size_t takeChunk(RmtItem *items);
+
+    /**
+     * @brief Start a new transmission after the stream ended, with what has been queued since
+     */
+    void restart();
+
+    bool isEnded() const
+    {
+        return ended_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Pulses handed to the channel since reset(), up to two chunks ahead of the STEP pin
+     */
+    uint32_t getPulsesSent() const
+    {
+        return pulses_sent_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Transmissions that ran dry before the producer caught up, since reset()
+     */
+    uint16_t getUnderrunCount() const
+    {
+        return underruns_;
+    }
+
+    bool empty() const
+    {
+        return queue_.empty();
+    }
+
+    /**
+     * @brief Time the producer may sleep before it has to top the queue up (producer side)
+     *
+     * The channel only runs dry when a chunk finds the queue short of CHUNK_ITEMS, so the queued
+     * time less the most recently queued chunk is safe, less REFILL_MARGIN_US for wake-up latency.
+     */
+    unsigned long getRefillDelayUs() const;
+
+private:
+    SpscQueue<RmtItem, QUEUE_ITEMS> queue_;
+    std::atomic<uint32_t> pulses_sent_{0};
+    std::atomic<uint32_t> sent_us_{0}; // duration of the items taken, wraps
+    std::atomic<bool> ended_{false};
+
+    // producer side
+    uint32_t queued_us_ = 0;                 // duration of the items pushed, wraps
+    uint32_t recent_us_[CHUNK_ITEMS] = {};   // durations of the last CHUNK_ITEMS items pushed
+    uint32_t recent_total_us_ = 0;
+    size_t recent_next_ = 0;
+    uint16_t underruns_ = 0;
+};
@@ -0,0 +1,40 @@
+#include "filter_offset_store.h"
+#include <Preferences.h>
+
+namespace
+{
+    constexpr const char *PRESETS_KEY = "filters";
+}
+
+FilterOffsetStore::FilterOffsetStore(const char *name_space) : namespace_(name_space)
+{
+}
+
+bool FilterOffsetStore::load(Preset (&presets)[PRESET_COUNT]) const
+{
+    Preset stored[PRESET_COUNT];
+
+    Preferences preferences;
+    preferences.begin(namespace_, true);
+    bool valid = preferences.getBytesLength(PRESETS_KEY) == sizeof(stored) &&
+                 preferences.getBytes(PRESETS_KEY, stored, sizeof(stored)) == sizeof(stored);
+    preferences.end();
+
+    if (!valid)
+        return false;
+
+    for (size_t i = 0; i < PRESET_COUNT; i++)
+    {
+        presets[i] = stored[i];
+        presets[i].name[NAME_LENGTH] = '\0';
+    }
+    return true;
+}
+
+void FilterOffsetStore::save(const Preset (&presets)[PRESET_COUNT]) const
+{
+    Preferences preferences;
+    preferences.begin(namespace_, false);
+    preferences.putBytes(PRESETS_KEY, presets, sizeof(Preset) * PRESET_COUNT);
+    preferences.end();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Flash-backed storage for the filter offset presets of one focuser
+ *
+ * Shares the focuser's NVS namespace with its ProfileStore. All presets are kept in one entry;
+ * an entry written with a different preset layout is ignored.
+ */
+class FilterOffsetStore
+{
+public:
+    static constexpr size_t PRESET_COUNT = 16;
+    static constexpr size_t NAME_LENGTH = 4;
+
+    struct Preset
+    {
+        int16_t offset;             // steps relative to the reference filter
+        char name[NAME_LENGTH + 1]; // NUL terminated
+    };
+
+private:
+    const char *namespace_;
+
+public:
+    /**
+     * @param name_space NVS namespace (at most 15 characters)
+     */
+    explicit FilterOffsetStore(const char *name_space);
+
+    /**
+     * @brief Load every preset
+     * @return true if valid presets were stored, otherwise the presets are left untouched
+     */
+    bool load(Preset (&presets)[PRESET_COUNT]) const;
+
+    void save(const Preset (&presets)[PRESET_COUNT]) const;
+};
@@ -0,0 +1,41 @@
+#include "focus_model_store.h"
+#include <Preferences.h>
+
+namespace
+{
+    constexpr const char *MODEL_KEY = "focus";
+}
+
+FocusModelStore::FocusModelStore(const char *name_space) : namespace_(name_space)
+{
+}
+
+bool FocusModelStore::load(FocusModel &model) const
+{
+    FocusModel::Point points[FocusModel::MAX_POINTS];
+
+    Preferences preferences;
+    preferences.begin(namespace_, true);
+    size_t length = preferences.getBytesLength(MODEL_KEY);
+    bool valid = length % sizeof(FocusModel::Point) == 0 && length <= sizeof(points) &&
+                 preferences.getBytes(MODEL_KEY, points, sizeof(points)) == length;
+    preferences.end();
+
+    if (!valid)
+    {
+        model.clear();
+        return false;
+    }
+    return model.load(points, length / sizeof(FocusModel::Point));
+}
+
+void FocusModelStore::save(const FocusModel &model) const
+{
+    Preferences preferences;
+    preferences.begin(namespace_, false);
+    if (model.getCount() == 0)
+        preferences.remove(MODEL_KEY);
+    else
+        preferences.putBytes(MODEL_KEY, model.getPoints(), model.getCount() * sizeof(FocusModel::Point));
+    preferences.end();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "../autofocus/focus_model.h"
+
+/**
+ * @brief Flash-backed storage for a learned FocusModel
+ *
+ * Shares the focuser's NVS namespace with its ProfileStore. An entry written with a different
+ * point layout or an invalid model is ignored.
+ */
+class FocusModelStore
+{
+private:
+    const char *namespace_;
+
+public:
+    /**
+     * @param name_space NVS namespace (at most 15 characters)
+     */
+    explicit FocusModelStore(const char *name_space);
+
+    /**
+     * @brief Load the model
+     * @return true if a valid model was stored, otherwise the model is left empty
+     */
+    bool load(FocusModel &model) const;
+
+    void save(const FocusModel &model) const;
+};
@@ -0,0 +1,59 @@
+#include "profile_store.h"
+#include <Preferences.h>
+
+namespace
+{
+    void profileKey(uint8_t index, char *key)
+    {
+        key[0] = 'p';
+        key[1] = '0' + index;
+        key[2] = '\0';
+    }
+}
+
+ProfileStore::ProfileStore(const char *name_space) : namespace_(name_space)
+{
+}
+
+bool ProfileStore::loadProfile(uint8_t index, MotionProfile &profile) const
+{
+    char key[3];
+    profileKey(index, key);
+
+    Preferences preferences;
+    preferences.begin(namespace_, true);
+    bool valid = preferences.getBytesLength(key) == sizeof(MotionProfile) &&
+                 preferences.getBytes(key, &profile, sizeof(MotionProfile)) == sizeof(MotionProfile);
+    preferences.end();
+
+    return valid;
+}
+
+void ProfileStore::saveProfile(uint8_t index, const MotionProfile &profile) const
+{
+    char key[3];
+    profileKey(index, key);
+
+    Preferences preferences;
+    preferences.begin(namespace_, false);
+    preferences.putBytes(key, &profile, sizeof(MotionProfile));
+    preferences.end();
+}
+
+uint8_t ProfileStore::loadActiveProfile() const
+{
+    Preferences preferences;
+    preferences.begin(namespace_, true);
+    uint8_t index = preferences.getUChar("active", 0);
+    preferences.end();
+
+    return index < PROFILE_COUNT ? index : 0;
+}
+
+void ProfileStore::saveActiveProfile(uint8_t index) const
+{
+    Preferences preferences;
+    preferences.begin(namespace_, false);
+    preferences.putUChar("active", index);
+    preferences.end();
+}
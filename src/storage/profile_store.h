@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include "../stepper/motion_profile.h"
+
+/**
+ * @brief Flash-backed storage for motion profiles
+ *
+ * Uses one NVS namespace per focuser. Entries written by an older firmware with a different
+ * MotionProfile layout are ignored.
+ */
+class ProfileStore
+{
+private:
+    const char *namespace_;
+
+public:
+    /**
+     * @param name_space NVS namespace (at most 15 characters)
+     */
+    explicit ProfileStore(const char *name_space);
+
+    /**
+     * @brief Load a profile
+     * @return true if a valid profile was stored for this index
+     */
+    bool loadProfile(uint8_t index, MotionProfile &profile) const;
+
+    void saveProfile(uint8_t index, const MotionProfile &profile) const;
+
+    uint8_t loadActiveProfile() const;
+
+    void saveActiveProfile(uint8_t index) const;
+};
@@ -0,0 +1,93 @@
+#include "motion_task.h"
+
+MotionTask::MotionTask(MotionController *controllers, size_t controller_count, CommandHandler handler,
+                       Telemetry *telemetry, Autofocus *autofocus, Autotune *autotune,
+                       FocusCompensation *compensation)
+    : controllers_(controllers), controller_count_(controller_count), handler_(handler), telemetry_(telemetry),
+      autofocus_(autofocus), autotune_(autotune), compensation_(compensation)
+{
+}
+
+void MotionTask::begin(UBaseType_t priority)
+{
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = onWakeTimer;
+    timer_args.arg = this;
+    timer_args.dispatch_method = ESP_TIMER_TASK;
+    timer_args.name = "motion_wake";
+    esp_timer_create(&timer_args, &wake_timer_);
+
+    xTaskCreate(taskEntry, "motion", STACK_SIZE, this, priority, &task_);
+}
+
+bool MotionTask::post(const Command &command)
+{
+    if (!commands_.push(command))
+        return false;
+
+    // The motion task has the higher priority, so it runs the command before this call returns
+    if (task_ != nullptr)
+        xTaskNotifyGive(task_);
+    return true;
+}
+
+unsigned long MotionTask::poll()
+{
+    Command command;
+    while (commands_.pop(command))
+        handler_(command);
+
+    unsigned long wait_us = ULONG_MAX;
+    for (size_t i = 0; i < controller_count_; i++)
+    {
+        controllers_[i].update();
+        if (autofocus_ != nullptr)
+            autofocus_[i].update(); // may start the run's next move right away
+        if (autotune_ != nullptr)
+            autotune_[i].update(isAnyOtherMoving(i));
+        if (compensation_ != nullptr)
+            wait_us = min(wait_us, compensation_[i].update());
+        wait_us = min(wait_us, controllers_[i].getMicrosUntilNextStep());
+    }
+
+    if (telemetry_ != nullptr && telemetry_->isEnabled())
+        wait_us = min(wait_us, telemetry_->sample(controllers_, controller_count_));
+    return wait_us;
+}
+
+bool MotionTask::isAnyOtherMoving(size_t index) const
+{
+    for (size_t i = 0; i < controller_count_; i++)
+    {
+        if (i != index && controllers_[i].getIsMoving())
+            return true;
+    }
+    return false;
+}
+
+void MotionTask::taskEntry(void *arg)
+{
+    static_cast<MotionTask *>(arg)->run();
+}
+
+void MotionTask::onWakeTimer(void *arg)
+{
+    xTaskNotifyGive(static_cast<MotionTask *>(arg)->task_);
+}
+
+void MotionTask::run()
+{
+    for (;;)
+    {
+        unsigned long wait_us = poll();
+        if (wait_us < MIN_SLEEP_US)
+            continue;
+
+        if (wait_us != ULONG_MAX)
+            esp_timer_start_once(wake_timer_, wait_us);
+
+        // Woken by the timer when a step is due or by post() when a command arrives
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        esp_timer_stop(wake_timer_);
+    }
+}
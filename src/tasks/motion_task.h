@@ -0,0 +1,84 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "../autofocus/autofocus.h"
+#include "../autofocus/focus_compensation.h"
+#include "../moonlite/command.h"
+#include "../stepper/autotune.h"
+#include "../stepper/motion_controller.h"
+#include "../telemetry/telemetry.h"
+#include "../util/spsc_queue.h"
+
+/**
+ * @brief High-priority task that owns the motion controllers
+ *
+ * Commands that change motion state are posted here from the protocol task through a lock-free
+ * queue and applied between steps. Between steps the task sleeps on a one-shot esp_timer armed for
+ * the earliest step due on any axis, so serial traffic, temperature reads and other housekeeping
+ * in lower-priority tasks cannot delay a step.
+ */
+class MotionTask
+{
+public:
+    using CommandHandler = void (*)(const Command &command);
+
+private:
+    static constexpr size_t COMMAND_QUEUE_SIZE = 16;
+    static constexpr uint32_t STACK_SIZE = 4096;
+    static constexpr unsigned long MIN_SLEEP_US = 100; // closer steps are waited for by spinning
+
+    MotionController *controllers_;
+    size_t controller_count_;
+    CommandHandler handler_;
+    Telemetry *telemetry_;
+    Autofocus *autofocus_;
+    Autotune *autotune_;
+    FocusCompensation *compensation_;
+
+    SpscQueue<Command, COMMAND_QUEUE_SIZE> commands_;
+    TaskHandle_t task_ = nullptr;
+    esp_timer_handle_t wake_timer_ = nullptr;
+
+    static void taskEntry(void *arg);
+    static void onWakeTimer(void *arg);
+
+    void run();
+    bool isAnyOtherMoving(size_t index) const;
+
+public:
+    /**
+     * @param controllers Motion controllers indexed by Command::motor
+     * @param controller_count Number of controllers
+     * @param handler Applies a posted command, runs on the motion task
+     * @param telemetry Sampled after every update while enabled, nullptr for none
+     * @param autofocus Autofocus runs indexed like the controllers, updated after their controller, nullptr for none
+     * @param autotune Autotune runs indexed like the controllers, updated after their controller, nullptr for none
+     * @param compensation Temperature compensation indexed like the controllers, updated last, nullptr for none
+     */
+    MotionTask(MotionController *controllers, size_t controller_count, CommandHandler handler,
+               Telemetry *telemetry = nullptr, Autofocus *autofocus = nullptr, Autotune *autotune = nullptr,
+               FocusCompensation *compensation = nullptr);
+
+    /**
+     * @brief Start the task
+     * @param priority FreeRTOS priority, above the Arduino loop task and below the esp_timer task
+     */
+    void begin(UBaseType_t priority);
+
+    /**
+     * @brief Queue a command for the motion task (protocol task side)
+     * @return false if the queue is full and the command was dropped
+     */
+    bool post(const Command &command);
+
+    /**
+     * @brief Apply queued commands and run every controller once
+     * @return Microseconds until the next step is due on any axis, ULONG_MAX when all are idle
+     *
+     * Called by the task itself; a build with EAF_SINGLE_LOOP calls it from loop() instead.
+     */
+    unsigned long poll();
+};
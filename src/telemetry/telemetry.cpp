@@ -0,0 +1,87 @@
+#include "telemetry.h"
+#include <climits>
+
+Telemetry::Telemetry(const TemperatureSensor &temperature)
+    : temperature_(temperature)
+{
+}
+
+void Telemetry::setPeriod(int motor, uint32_t period_us)
+{
+    if (period_us != 0 && period_us < MIN_PERIOD_US)
+        period_us = MIN_PERIOD_US;
+    period_us_[motor].store(period_us, std::memory_order_relaxed);
+
+    bool enabled = false;
+    for (const auto &period : period_us_)
+        enabled |= period.load(std::memory_order_relaxed) != 0;
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+uint32_t Telemetry::getPeriod(int motor) const
+{
+    return period_us_[motor].load(std::memory_order_relaxed);
+}
+
+TelemetryRecord Telemetry::makeRecord(MotionController &controller, int motor, unsigned long now)
+{
+    float speed = controller.getCurrentSpeed();
+    if (controller.getDirection() == FocuserDirection::INWARD)
+        speed = -speed;
+
+    uint8_t flags = 0;
+    if (controller.getIsMoving())
+        flags |= FLAG_MOVING;
+    if (controller.isJogging())
+        flags |= FLAG_JOGGING;
+    if (controller.isHoming())
+        flags |= FLAG_HOMING;
+    if (controller.getFaultFlags() & MotionController::FAULT_STALL)
+        flags |= FLAG_STALLED;
+
+    TelemetryRecord record;
+    record.time_us = now;
+    record.position = controller.getCurrentPosition();
+    record.speed = static_cast<int16_t>(speed);
+    record.lateness_us = min(controller.takeWindowStepLatenessUs(), static_cast<unsigned long>(UINT16_MAX));
+    record.temperature = temperature_.getHalfDegrees();
+    record.motor = motor;
+    record.flags = flags;
+    return record;
+}
+
+unsigned long Telemetry::sample(MotionController *controllers, size_t count)
+{
+    unsigned long now = micros();
+    unsigned long wait_us = ULONG_MAX;
+
+    for (size_t motor = 0; motor < count && motor < MOTOR_COUNT; motor++)
+    {
+        uint32_t period_us = period_us_[motor].load(std::memory_order_relaxed);
+        if (period_us == 0)
+            continue;
+
+        unsigned long elapsed_us = now - last_sample_us_[motor];
+        if (elapsed_us >= period_us)
+        {
+            if (!records_.push(makeRecord(controllers[motor], motor, now)))
+                dropped_records_.fetch_add(1, std::memory_order_relaxed);
+
+            // keep the cadence, but do not burst to catch up after a long gap
+            last_sample_us_[motor] = (elapsed_us < 2 * period_us) ? last_sample_us_[motor] + period_us : now;
+            elapsed_us = now - last_sample_us_[motor];
+        }
+        wait_us = min(wait_us, static_cast<unsigned long>(period_us - elapsed_us));
+    }
+    return wait_us;
+}
+
+bool Telemetry::pop(TelemetryRecord &record)
+{
+    return records_.pop(record);
+}
+
+uint16_t Telemetry::getDroppedRecordCount() const
+{
+    return dropped_records_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "../moonlite/command.h"
+#include "../sensors/temperature_sensor.h"
+#include "../stepper/motion_controller.h"
+#include "../util/spsc_queue.h"
+
+/**
+ * @brief One telemetry sample, streamed as raw little-endian bytes
+ */
+struct __attribute__((packed)) TelemetryRecord
+{
+    uint32_t time_us;      // micros() at the sample
+    int32_t position;      // current position in steps
+    int16_t speed;         // steps per second, negative when moving inward
+    uint16_t lateness_us;  // worst step lateness since the previous sample of this focuser
+    int16_t temperature;   // half degrees Celsius
+    uint8_t motor;         // PRIMARY_MOTOR or SECONDARY_MOTOR
+    uint8_t flags;         // FLAG_* bits
+};
+
+static_assert(sizeof(TelemetryRecord) == 16, "TelemetryRecord is a fixed 16-byte wire record");
+
+/**
+ * @brief Periodic samples of motion state, produced on the motion task and streamed by the protocol task
+ *
+ * Sampling is off until setPeriod() is given a non-zero period, and while it is off the motion task
+ * only pays for one relaxed load per loop. Records that do not fit the ring buffer are counted and dropped.
+ */
+class Telemetry
+{
+public:
+    static constexpr uint8_t FLAG_MOVING = 0x01;
+    static constexpr uint8_t FLAG_JOGGING = 0x02;
+    static constexpr uint8_t FLAG_HOMING = 0x04;
+    static constexpr uint8_t FLAG_STALLED = 0x08; // FAULT_STALL is set
+    static constexpr uint32_t MIN_PERIOD_US = 5000;
+
+private:
+    static constexpr size_t RECORD_QUEUE_SIZE = 64;
+
+    const TemperatureSensor &temperature_;
+
+    SpscQueue<TelemetryRecord, RECORD_QUEUE_SIZE> records_;
+    std::atomic<uint32_t> period_us_[MOTOR_COUNT] = {};
+    std::atomic<bool> enabled_{false}; // any period is non-zero
+    std::atomic<uint16_t> dropped_records_{0};
+
+    unsigned long last_sample_us_[MOTOR_COUNT] = {}; // motion task only
+
+    TelemetryRecord makeRecord(MotionController &controller, int motor, unsigned long now);
+
+public:
+    explicit Telemetry(const TemperatureSensor &temperature);
+
+    /**
+     * @brief Set the sampling period of one focuser (protocol task)
+     * @param period_us Microseconds between samples, 0 stops sampling, shorter periods are raised to MIN_PERIOD_US
+     */
+    void setPeriod(int motor, uint32_t period_us);
+
+    uint32_t getPeriod(int motor) const;
+
+    bool isEnabled() const
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Record a sample for every focuser whose period has elapsed (motion task)
+     * @param controllers Motion controllers indexed by motor, at most MOTOR_COUNT
+     * @return Microseconds until the next sample is due
+     */
+    unsigned long sample(MotionController *controllers, size_t count);
+
+    /**
+     * @brief Take the oldest record (protocol task)
+     * @return false if the buffer is empty
+     */
+    bool pop(TelemetryRecord &record);
+
+    /**
+     * @brief Records dropped because the protocol task did not drain the buffer in time
+     */
+    uint16_t getDroppedRecordCount() const;
+};
@@ -0,0 +1,126 @@
+#include "heap_guard.h"
+#include <atomic>
+
+namespace
+{
+    std::atomic<bool> sealed{false};
+}
+
+void HeapGuard::seal()
+{
+#ifdef EAF_HEAP_GUARD
+    sealed.store(true, std::memory_order_release);
+#endif
+}
+
+bool HeapGuard::isSealed()
+{
+    return sealed.load(std::memory_order_acquire);
+}
+
+#ifdef EAF_HEAP_GUARD
+#include <Arduino.h>
+#include <malloc.h>
+#include <new>
+#include <stdlib.h>
+
+namespace
+{
+    // alignment 0 for the default, which malloc() already guarantees
+    void *allocate(size_t size, size_t alignment, void *caller)
+    {
+        if (sealed.load(std::memory_order_relaxed))
+        {
+            log_e("allocation of %u bytes after setup() from %p", static_cast<unsigned>(size), caller);
+            abort();
+        }
+
+        size = size ? size : 1;
+        void *block = alignment ? memalign(alignment, size) : malloc(size);
+        if (block == nullptr)
+            abort(); // out of memory during setup(), nothing sensible to continue with
+        return block;
+    }
+}
+
+void *operator new(size_t size)
+{
+    return allocate(size, 0, __builtin_return_address(0));
+}
+
+void *operator new[](size_t size)
+{
+    return allocate(size, 0, __builtin_return_address(0));
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate(size, 0, __builtin_return_address(0));
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate(size, 0, __builtin_return_address(0));
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    return allocate(size, static_cast<size_t>(alignment), __builtin_return_address(0));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return allocate(size, static_cast<size_t>(alignment), __builtin_return_address(0));
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocate(size, static_cast<size_t>(alignment), __builtin_return_address(0));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocate(size, static_cast<size_t>(alignment), __builtin_return_address(0));
+}
+
+void operator delete(void *block) noexcept
+{
+    free(block);
+}
+
+void operator delete[](void *block) noexcept
+{
+    free(block);
+}
+
+void operator delete(void *block, size_t) noexcept
+{
+    free(block);
+}
+
+void operator delete[](void *block, size_t) noexcept
+{
+    free(block);
+}
+
+// memalign() blocks go back through free() like the others
+void operator delete(void *block, std::align_val_t) noexcept
+{
+    free(block);
+}
+
+void operator delete[](void *block, std::align_val_t) noexcept
+{
+    free(block);
+}
+
+void operator delete(void *block, size_t, std::align_val_t) noexcept
+{
+    free(block);
+}
+
+void operator delete[](void *block, size_t, std::align_val_t) noexcept
+{
+    free(block);
+}
+#endif
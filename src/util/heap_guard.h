@@ -0,0 +1,21 @@
+#pragma once
+
+/**
+ * @brief Run-time check that the firmware allocates nothing once setup() is done
+ *
+ * Builds with EAF_HEAP_GUARD replace the global operator new and delete. Until seal() they
+ * forward to malloc and free; after it any C++ allocation logs its size and caller and aborts,
+ * and the panic backtrace points at the offending code. The footprint report
+ * (tools/footprint/footprint.py) checks at link time that no firmware source references an
+ * allocator at all. Without EAF_HEAP_GUARD seal() does nothing.
+ */
+class HeapGuard
+{
+public:
+    /**
+     * @brief Forbid further allocation (call at the end of setup())
+     */
+    static void seal();
+
+    static bool isSealed();
+};
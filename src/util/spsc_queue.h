@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @brief Lock-free single-producer single-consumer ring buffer
+ *
+ * One task (or callback) may push and one other task may pop without any locking.
+ * Holds up to CAPACITY - 1 items.
+ *
+ * @tparam T Item type, copied in and out
+ * @tparam CAPACITY Number of slots, must be a power of two
+ */
+template <typename T, size_t CAPACITY>
+class SpscQueue
+{
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+private:
+    T items_[CAPACITY] = {};
+    std::atomic<size_t> head_{0}; // next slot to write, owned by the producer
+    std::atomic<size_t> tail_{0}; // next slot to read, owned by the consumer
+
+public:
+    /**
+     * @brief Append an item (producer side)
+     * @return false if the queue is full and the item was dropped
+     */
+    bool push(const T &item)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t next = (head + 1) & (CAPACITY - 1);
+        if (next == tail_.load(std::memory_order_acquire))
+            return false;
+
+        items_[head] = item;
+        head_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Remove the oldest item (consumer side)
+     * @return false if the queue is empty
+     */
+    bool pop(T &item)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire))
+            return false;
+
+        item = items_[tail];
+        tail_.store((tail + 1) & (CAPACITY - 1), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Number of queued items
+     *
+     * Exact for the side that calls it, the other side can only have moved it since: a producer
+     * sees at most this many, a consumer at least this many.
+     */
+    size_t size() const
+    {
+        return (head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire)) & (CAPACITY - 1);
+    }
+};
@@ -0,0 +1,226 @@
+// Host check of the load-aware autotune (src/stepper/autotune.h) against the emulator's load model
+// (LoadModel: friction, gravity against outward motion and inertia): runs the firmware built with
+// EAF_SINGLE_LOOP on the emulator's virtual clock and tunes the first axis with XUS under a set of
+// loads, one of them while the other axis keeps moving and one too heavy to tune at all.
+//
+//   pio run -e autotune_check && .pio/build/autotune_check/program [--distance N] [--verbose]
+//
+// Per load it reports the end state, the tuned settings of each direction and of the profile, and
+// how often the run changed the profile while the other axis stepped. Fails when a run does not
+// end DONE (FAILED for the load that cannot be tuned) back at its start position, when the tuned
+// profile is not the one saved to flash, when a move out and back at the tuned profile slips on
+// the model, when gravity does not let the inward direction tune at least as high as the outward
+// one, or when the profile changed while the other axis moved.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "storage/profile_store.h"
+#include "../emulator/firmware_session.h"
+
+extern Autotune autotune[];
+
+namespace
+{
+    constexpr long START_POSITION = 20000;
+    constexpr uint64_t RUN_TIMEOUT_US = 1800000000ULL;
+    constexpr uint64_t BUSY_MOVE_PERIOD_US = 6000000; // the other axis starts a move this often
+    constexpr long BUSY_MOVE = 400;
+
+    struct Case
+    {
+        const char *name;
+        LoadModel load;
+        bool busy;     // the other axis keeps moving during the run
+        bool tunable;  // expected to end DONE, FAILED otherwise
+    };
+
+    const Case CASES[] = {
+        {"light", {0.10f, 0.00f, 0.00002f, 3000.0f}, false, true},
+        {"heavy", {0.30f, 0.00f, 0.00010f, 3000.0f}, false, true},
+        {"gravity", {0.15f, 0.25f, 0.00004f, 3000.0f}, false, true},
+        {"busy", {0.10f, 0.00f, 0.00002f, 3000.0f}, true, true},
+        {"stuck", {1.20f, 0.00f, 0.00000f, 3000.0f}, false, false},
+    };
+
+    struct Outcome
+    {
+        std::string state;
+        long position = 0;
+        uint32_t outward = 0; // speed << 16 | acceleration, as XUO and XUN report them
+        uint32_t inward = 0;
+        float max_speed = 0.0f;
+        float acceleration = 0.0f;
+        unsigned long held_violations = 0; // profile changes while the other axis moved
+        bool saved = false;
+        bool slipped = false;
+    };
+
+    std::string command(const char *format, long value)
+    {
+        char text[24];
+        snprintf(text, sizeof(text), format, value);
+        return text;
+    }
+
+    // Puts the first axis' profile back to DEFAULT's settings for the next load
+    void resetProfile()
+    {
+        const MotionProfile &profile = DEFAULT_PROFILES[0];
+        FirmwareSession::send(":XPS00#");
+        FirmwareSession::send(command(":XPA%04lX#", lround(profile.max_speed)));
+        FirmwareSession::send(command(":XPB%04lX#", lround(profile.acceleration)));
+    }
+
+    long modelPosition()
+    {
+        return VirtualHardware::instance().findDriver(FirmwareSession::BOARD_AXES[0].address)->getPosition();
+    }
+
+    // Out and back at the tuned profile, without load sampling, with the model's rotor followed
+    bool slipsAtTunedProfile(uint16_t distance)
+    {
+        long before = modelPosition();
+        FirmwareSession::send(":SD02#");
+        FirmwareSession::send(command(":SN%04lX#", START_POSITION + distance) + ":FG#");
+        FirmwareSession::runUntilIdle();
+        FirmwareSession::send(command(":SN%04lX#", START_POSITION) + ":FG#");
+        FirmwareSession::runUntilIdle();
+        return modelPosition() != before;
+    }
+
+    Outcome tune(const Case &trial, uint16_t distance)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        MotionController &controller = motionControllers[0];
+        MotionController &other = motionControllers[1];
+        hardware.setLoad(trial.load);
+        resetProfile();
+
+        Outcome outcome;
+        uint64_t next_busy_move_us = hardware.micros();
+        long busy_target = START_POSITION;
+        if (trial.busy)
+            FirmwareSession::send(command(":2SN%04lX#", busy_target + BUSY_MOVE) + ":2FG#");
+        FirmwareSession::send(command(":XUS%04lX#", distance));
+
+        uint64_t deadline = hardware.micros() + RUN_TIMEOUT_US;
+        while (hardware.micros() < deadline)
+        {
+            if (trial.busy && hardware.micros() >= next_busy_move_us && !other.getIsMoving())
+            {
+                busy_target = (busy_target == START_POSITION) ? START_POSITION + BUSY_MOVE : START_POSITION;
+                FirmwareSession::send(command(":2SN%04lX#", busy_target) + ":2FG#");
+                next_busy_move_us = hardware.micros() + BUSY_MOVE_PERIOD_US;
+            }
+
+            MotionProfile before = controller.getProfile();
+            bool other_moving = other.getIsMoving();
+            uint64_t until = trial.busy ? min(deadline, next_busy_move_us) : deadline;
+            FirmwareSession::step(max(until, hardware.micros() + 1));
+            const MotionProfile &after = controller.getProfile();
+            if (other_moving && other.getIsMoving() &&
+                (after.max_speed != before.max_speed || after.acceleration != before.acceleration))
+                outcome.held_violations++;
+
+            if (!autotune[0].isActive() && !controller.getIsMoving())
+                break;
+        }
+        FirmwareSession::runUntilIdle();
+        FirmwareSession::run(100000); // housekeeping saves the tuned profile once both axes rest
+
+        outcome.state = FirmwareSession::send(":XUI#");
+        outcome.position = controller.getCurrentPosition();
+        outcome.outward = strtoul(FirmwareSession::send(":XUO#").c_str(), nullptr, 16);
+        outcome.inward = strtoul(FirmwareSession::send(":XUN#").c_str(), nullptr, 16);
+        outcome.max_speed = controller.getProfile().max_speed;
+        outcome.acceleration = controller.getProfile().acceleration;
+
+        MotionProfile stored = {};
+        ProfileStore store("focuser0");
+        outcome.saved = store.loadProfile(controller.getActiveProfile(), stored) &&
+                        stored.max_speed == outcome.max_speed && stored.acceleration == outcome.acceleration;
+        if (outcome.state == "02#")
+            outcome.slipped = slipsAtTunedProfile(distance);
+        return outcome;
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --distance N   length of each test move in steps (default 3200)\n"
+                "  --verbose      print where runs that did not end DONE left the focuser\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long distance = 3200;
+    bool verbose = false;
+
+    static const option options[] = {
+        {"distance", required_argument, nullptr, 'd'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            distance = strtol(optarg, nullptr, 10);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (distance < Autotune::MIN_DISTANCE || distance > UINT16_MAX)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FirmwareSession::begin(START_POSITION);
+    FirmwareSession::send(command(":SP%04lX#", START_POSITION) + command(":2SP%04lX#", START_POSITION));
+
+    bool ok = true;
+    printf("%-8s %-6s %9s %9s %9s %9s %9s %9s %5s %6s %7s\n", "load", "state", "out_sps", "out_acc", "in_sps",
+           "in_acc", "max_sps", "accel", "held", "saved", "slipped");
+    for (const Case &trial : CASES)
+    {
+        Outcome outcome = tune(trial, static_cast<uint16_t>(distance));
+        uint16_t out_speed = outcome.outward >> 16, out_acceleration = outcome.outward & 0xFFFF;
+        uint16_t in_speed = outcome.inward >> 16, in_acceleration = outcome.inward & 0xFFFF;
+
+        bool done = outcome.state == "02#";
+        bool passed = outcome.position == START_POSITION && outcome.held_violations == 0 &&
+                      done == trial.tunable && (outcome.state == "03#" || done);
+        if (done)
+            passed &= outcome.saved && !outcome.slipped;
+        if (done && trial.load.gravity > 0.0f)
+            passed &= in_speed >= out_speed && in_acceleration >= out_acceleration;
+
+        printf("%-8s %-6s %9u %9u %9u %9u %9.0f %9.0f %5lu %6s %7s %s\n", trial.name, outcome.state.c_str(),
+               out_speed, out_acceleration, in_speed, in_acceleration, outcome.max_speed, outcome.acceleration,
+               outcome.held_violations, outcome.saved ? "yes" : "no", outcome.slipped ? "yes" : "no",
+               passed ? "ok" : "FAIL");
+        if (verbose && !done)
+            printf("         ended at %ld, started at %ld\n", outcome.position, START_POSITION);
+        ok &= passed;
+    }
+
+    printf("sps and acc in steps/s and steps/s^2; held: profile changes while the other axis moved;\n"
+           "slipped: a move out and back at the tuned profile lost steps on the model\n");
+    return ok ? 0 : 1;
+}
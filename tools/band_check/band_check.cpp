@@ -0,0 +1,285 @@
+// Host check of resonance bands (MotionProfile::resonance_bands, RampTable) on a MotionController
+// stepped on the emulator's virtual clock: for every profile and a set of band layouts (one band
+// below max speed, one around it, two apart, two overlapping) it runs out-and-back moves at every
+// speed code and jogs at speeds inside the bands, and follows the ramp speed step by step.
+//
+//   pio run -e band_check && .pio/build/band_check/program [--distance N] [--verbose]
+//
+// Fails when a step is taken at a ramp speed strictly inside a band at the same speed as the step
+// before it (cruising in the band), or when one crossing of a band takes longer than the band's
+// width at BAND_ACCELERATION_FACTOR times the profile acceleration plus one step interval at each
+// edge. Reports the time spent inside bands per layout.
+
+#include <Arduino.h>
+#include <climits>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "stepper/motion_controller.h"
+#include "../emulator/virtual_hardware.h"
+
+namespace
+{
+    constexpr uint8_t ADDRESS = 0b00;
+    constexpr AxisWiring AXIS = {ADDRESS, 6, 5, 0};
+    MotionController controller(6, 5, 21, 7, 8, ADDRESS, "band", 0);
+
+    constexpr uint8_t SPEED_CODES[] = {0x02, 0x04, 0x08, 0x10, 0x20};
+    constexpr long START_STEPS = 200;
+    constexpr unsigned long JOG_US = 3000000;
+    constexpr unsigned long JOG_REFRESH_US = 200000; // inside MotionController::JOG_TIMEOUT_US
+    constexpr uint64_t TIMEOUT_US = 3600000000ULL;
+
+    // Band edges as fractions of the profile's max speed
+    struct Layout
+    {
+        const char *name;
+        float bands[MotionProfile::RESONANCE_BAND_COUNT][2];
+    };
+
+    const Layout LAYOUTS[] = {
+        {"below", {{0.40f, 0.55f}, {0.0f, 0.0f}}},
+        {"around", {{0.80f, 1.20f}, {0.0f, 0.0f}}},
+        {"two", {{0.30f, 0.40f}, {0.60f, 0.70f}}},
+        {"overlap", {{0.40f, 0.60f}, {0.50f, 0.70f}}},
+    };
+
+    struct Tally
+    {
+        unsigned long steps = 0;
+        unsigned long band_steps = 0;
+        double band_us = 0.0;
+        double cruise_in_band_us = 0.0;
+        double worst_crossing_us = 0.0;  // longest single stay inside a band
+        double crossing_limit_us = 0.0; // for that stay
+        bool slow_crossing = false;
+        bool unfinished = false;
+    };
+
+    // The merged band (overlapping bands count as one) a speed lies strictly inside, false if none
+    bool findBand(const MotionProfile &profile, float speed, float &low, float &high)
+    {
+        bool found = false;
+        for (uint8_t pass = 0; pass < MotionProfile::RESONANCE_BAND_COUNT; pass++)
+        {
+            for (const ResonanceBand &band : profile.resonance_bands)
+            {
+                bool used = band.high_speed > band.low_speed;
+                bool inside = found ? (band.low_speed < high && band.high_speed > low)
+                                    : (speed > band.low_speed && speed < band.high_speed);
+                if (!used || !inside)
+                    continue;
+                low = found ? min(low, band.low_speed) : band.low_speed;
+                high = found ? max(high, band.high_speed) : band.high_speed;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    // Steps the controller the way MotionTask::poll() does, optionally refreshing a jog
+    void follow(Tally &tally, uint64_t until_us, int jog_velocity = 0)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        const MotionProfile &profile = controller.getProfile();
+        long position = controller.getCurrentPosition();
+        uint64_t last_step_us = 0;
+        float last_speed = 0.0f;
+        uint64_t next_refresh_us = hardware.micros() + JOG_REFRESH_US;
+        double stay_us = 0.0; // inside the current band so far
+        float low = 0.0f;
+        float high = 0.0f;
+
+        while (controller.getIsMoving() && hardware.micros() < until_us)
+        {
+            if (jog_velocity != 0 && hardware.micros() >= next_refresh_us)
+            {
+                controller.setJogVelocity(jog_velocity);
+                next_refresh_us += JOG_REFRESH_US;
+            }
+
+            float speed = controller.getCurrentSpeed(); // of the step about to be taken
+            controller.update();
+            uint64_t now = hardware.micros();
+            if (controller.getCurrentPosition() != position)
+            {
+                position = controller.getCurrentPosition();
+                double interval_us = last_step_us > 0 ? static_cast<double>(now - last_step_us) : 0.0;
+                tally.steps++;
+
+                float band_low = 0.0f;
+                float band_high = 0.0f;
+                if (last_step_us > 0 && findBand(profile, speed, band_low, band_high))
+                {
+                    tally.band_steps++;
+                    tally.band_us += interval_us;
+                    if (speed == last_speed)
+                        tally.cruise_in_band_us += interval_us;
+
+                    if (stay_us == 0.0)
+                    {
+                        low = band_low;
+                        high = band_high;
+                    }
+                    stay_us += interval_us;
+                }
+                else if (stay_us > 0.0)
+                {
+                    // width at the band acceleration, plus the partial intervals at both edges
+                    double band_acceleration = profile.acceleration * RampTable::BAND_ACCELERATION_FACTOR;
+                    double limit_us = (high - low) / band_acceleration * 1e6 + 2e6 / low;
+                    if (stay_us > limit_us)
+                        tally.slow_crossing = true;
+                    if (stay_us > tally.worst_crossing_us)
+                    {
+                        tally.worst_crossing_us = stay_us;
+                        tally.crossing_limit_us = limit_us;
+                    }
+                    stay_us = 0.0;
+                }
+                last_step_us = now;
+                last_speed = speed;
+            }
+
+            unsigned long wait_us = controller.getMicrosUntilNextStep();
+            uint64_t next_us = now + (wait_us == ULONG_MAX ? 1000 : max(wait_us, 1ul));
+            if (jog_velocity != 0)
+                next_us = min(next_us, next_refresh_us);
+            hardware.advanceTo(min(next_us, until_us));
+        }
+    }
+
+    void moveTo(Tally &tally, long target)
+    {
+        controller.setTargetPosition(target);
+        controller.startMovement();
+        follow(tally, VirtualHardware::instance().micros() + TIMEOUT_US);
+        tally.unfinished |= controller.getIsMoving();
+    }
+
+    void jog(Tally &tally, int velocity)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        long start = controller.getCurrentPosition();
+        controller.setJogVelocity(velocity);
+        follow(tally, hardware.micros() + JOG_US, velocity);
+        controller.setJogVelocity(0);
+        follow(tally, hardware.micros() + TIMEOUT_US);
+        tally.unfinished |= controller.getIsMoving();
+        moveTo(tally, start);
+    }
+
+    void setLayout(const Layout &layout, float max_speed)
+    {
+        for (uint8_t band = 0; band < MotionProfile::RESONANCE_BAND_COUNT; band++)
+            controller.setResonanceBand(band, layout.bands[band][0] * max_speed, layout.bands[band][1] * max_speed);
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --distance N   length of each leg in steps, long enough to reach max speed (default 3000)\n"
+                "  --verbose      print every speed code, not only the total per layout\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long distance = 3000;
+    bool verbose = false;
+
+    static const option options[] = {
+        {"distance", required_argument, nullptr, 'd'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            distance = strtol(optarg, nullptr, 10);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (distance <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    VirtualHardware &hardware = VirtualHardware::instance();
+    hardware.useManualClock();
+    hardware.setStartPosition(START_STEPS);
+    hardware.attachAxis(AXIS);
+    controller.begin();
+
+    bool ok = true;
+    printf("%-8s %-8s %5s %7s %6s %9s %10s %10s %9s\n", "profile", "layout", "speed", "steps", "band", "band_ms",
+           "cruise_ms", "crossing", "limit");
+    for (uint8_t index = 0; index < PROFILE_COUNT; index++)
+    {
+        controller.selectProfile(index);
+        float max_speed = DEFAULT_PROFILES[index].max_speed;
+        for (const Layout &layout : LAYOUTS)
+        {
+            setLayout(layout, max_speed);
+            Tally total;
+            for (uint8_t speed : SPEED_CODES)
+            {
+                Tally tally;
+                controller.setSpeed(speed);
+                long start = controller.getCurrentPosition();
+                moveTo(tally, start + distance);
+                moveTo(tally, start);
+
+                // jogs asked for a speed inside each band
+                controller.setSpeed(0x02);
+                for (const auto &band : layout.bands)
+                {
+                    if (band[1] > band[0])
+                        jog(tally, static_cast<int>((band[0] + band[1]) / 2 * max_speed));
+                }
+
+                bool passed = !tally.unfinished && !tally.slow_crossing && tally.cruise_in_band_us == 0.0;
+                if (verbose || !passed)
+                    printf("%-8s %-8s %5X %7lu %6lu %9.1f %10.1f %10.1f %9.1f %s\n", DEFAULT_PROFILES[index].name,
+                           layout.name, speed, tally.steps, tally.band_steps, tally.band_us / 1000,
+                           tally.cruise_in_band_us / 1000, tally.worst_crossing_us / 1000,
+                           tally.crossing_limit_us / 1000, passed ? "ok" : "FAIL");
+                ok &= passed;
+
+                total.steps += tally.steps;
+                total.band_steps += tally.band_steps;
+                total.band_us += tally.band_us;
+                total.cruise_in_band_us += tally.cruise_in_band_us;
+                if (tally.worst_crossing_us > total.worst_crossing_us)
+                {
+                    total.worst_crossing_us = tally.worst_crossing_us;
+                    total.crossing_limit_us = tally.crossing_limit_us;
+                }
+            }
+            if (!verbose)
+                printf("%-8s %-8s %5s %7lu %6lu %9.1f %10.1f %10.1f %9.1f\n", DEFAULT_PROFILES[index].name,
+                       layout.name, "all", total.steps, total.band_steps, total.band_us / 1000,
+                       total.cruise_in_band_us / 1000, total.worst_crossing_us / 1000, total.crossing_limit_us / 1000);
+        }
+        setLayout(Layout{"none", {{0.0f, 0.0f}, {0.0f, 0.0f}}}, max_speed);
+    }
+
+    printf("band and band_ms: steps and time at a ramp speed inside a band, cruise_ms the part at an\n"
+           "unchanged speed; crossing: longest single stay in a band (ms) against its limit\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+// Host consistency check of the Moonlite response cache (Moonlite::sendCached(), invalidated by
+// MotionController::getStateVersion()): runs the firmware built with EAF_SINGLE_LOOP on the
+// emulator's virtual clock through a random sequence of commands and motion on both axes, moves,
+// jogs, halts, position resets, speed and step mode changes and stretches of stepping, and polls a
+// random cached getter after every one of them.
+//
+//   pio run -e cache_check && .pio/build/cache_check/program [--operations N] [--seed N] [--verbose]
+//
+// Each poll goes through dispatchCommands() the way a client's does and its reply is compared with
+// the one the handler formats fresh at the same moment. Fails on any difference. Polls made while
+// the axis state version has not changed since the same getter was last answered are counted as
+// cache hits, to show the check covers both paths.
+
+#include <getopt.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "app/command_table.h"
+#include "moonlite/moonlite.h"
+#include "../emulator/firmware_session.h"
+
+void dispatchCommands();
+extern Moonlite moonlite;
+extern AppContext app;
+
+namespace
+{
+    constexpr long START_POSITION = 20000;
+    constexpr long MAX_MOVE = 400;
+    constexpr unsigned long MAX_RUN_US = 400000;
+
+    struct Tally
+    {
+        long polls = 0;
+        long hits = 0;
+        long mismatches = 0;
+    };
+
+    std::string takeReply()
+    {
+        std::string reply;
+        uint8_t buffer[256];
+        while (size_t length = Serial.takeTransmitted(buffer, sizeof(buffer)))
+            reply.append(reinterpret_cast<const char *>(buffer), length);
+        return reply;
+    }
+
+    std::string command(bool secondary, const char *opcode, long value = -1, int digits = 0)
+    {
+        char text[24];
+        if (value < 0)
+            snprintf(text, sizeof(text), ":%s%s#", secondary ? "2" : "", opcode);
+        else
+            snprintf(text, sizeof(text), ":%s%s%0*lX#", secondary ? "2" : "", opcode, digits, value);
+        return text;
+    }
+
+    // One random change of the axis state, or a stretch of time for moves and jogs to step through
+    std::string randomOperation(std::mt19937 &random)
+    {
+        bool secondary = std::uniform_int_distribution<int>(0, 1)(random) == 1;
+        long position = START_POSITION + std::uniform_int_distribution<long>(-MAX_MOVE, MAX_MOVE)(random);
+        switch (std::uniform_int_distribution<int>(0, 9)(random))
+        {
+        case 0:
+        case 1:
+            return command(secondary, "SN", position, 4) + command(secondary, "FG");
+        case 2:
+            return command(secondary, "SN", position, 4); // target only, FG later or never
+        case 3:
+            return command(secondary, "FG");
+        case 4:
+            return command(secondary, "FQ");
+        case 5:
+            return command(secondary, "SP", position, 4);
+        case 6:
+            return command(secondary, "SD", 1 << std::uniform_int_distribution<int>(1, 5)(random), 2);
+        case 7:
+            return command(secondary, std::uniform_int_distribution<int>(0, 1)(random) ? "SF" : "SH");
+        case 8:
+            return command(secondary, "XJV",
+                           static_cast<uint16_t>(std::uniform_int_distribution<int>(-150, 150)(random)), 4);
+        default:
+            return "";
+        }
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --operations N   random operations, each followed by a poll (default 20000)\n"
+                "  --seed N         random seed (default 1)\n"
+                "  --verbose        print every mismatch\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long operations = 20000;
+    unsigned long seed = 1;
+    bool verbose = false;
+
+    static const option options[] = {
+        {"operations", required_argument, nullptr, 'o'},
+        {"seed", required_argument, nullptr, 's'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'o':
+            operations = strtol(optarg, nullptr, 10);
+            break;
+        case 's':
+            seed = strtoul(optarg, nullptr, 10);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (operations <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FirmwareSession::begin(START_POSITION);
+    std::mt19937 random(seed);
+
+    std::vector<const CommandSpec *> getters;
+    for (size_t i = 0; i < COMMAND_COUNT; i++)
+        if (COMMAND_TABLE[i].cached)
+            getters.push_back(&COMMAND_TABLE[i]);
+
+    // state version each getter was last answered at, per axis
+    std::vector<uint32_t> answered_at[MOTOR_COUNT] = {std::vector<uint32_t>(getters.size(), UINT32_MAX),
+                                                      std::vector<uint32_t>(getters.size(), UINT32_MAX)};
+    Tally tally;
+    for (long i = 0; i < operations; i++)
+    {
+        std::string operation = randomOperation(random);
+        if (operation.empty())
+            FirmwareSession::run(std::uniform_int_distribution<unsigned long>(1, MAX_RUN_US)(random));
+        else
+            FirmwareSession::send(operation);
+        takeReply();
+
+        // poll without stepping in between, the fresh reply must describe the same moment
+        size_t getter = std::uniform_int_distribution<size_t>(0, getters.size() - 1)(random);
+        int motor = std::uniform_int_distribution<int>(PRIMARY_MOTOR, SECONDARY_MOTOR)(random);
+        const CommandSpec &spec = *getters[getter];
+        std::string bytes = command(motor == SECONDARY_MOTOR, spec.opcode);
+        Serial.deliver(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+        dispatchCommands();
+        std::string cached = takeReply();
+
+        Command cmd{spec.type, 0, motor};
+        moonlite.send(spec.handler(app, cmd));
+        std::string fresh = takeReply();
+
+        uint32_t version = app.axis(cmd).getStateVersion();
+        if (answered_at[motor][getter] == version)
+            tally.hits++;
+        answered_at[motor][getter] = version;
+        tally.polls++;
+
+        if (cached != fresh)
+        {
+            tally.mismatches++;
+            if (verbose)
+                printf("after %-24s %s answered %-10s expected %s\n", operation.empty() ? "(run)" : operation.c_str(),
+                       bytes.c_str(), cached.c_str(), fresh.c_str());
+        }
+    }
+
+    bool ok = tally.mismatches == 0 && tally.hits > 0 && tally.hits < tally.polls;
+    printf("%-10s %8s %8s %10s\n", "operations", "polls", "hits", "mismatches");
+    printf("%-10ld %8ld %8ld %10ld %s\n", operations, tally.polls, tally.hits, tally.mismatches, ok ? "ok" : "FAIL");
+    printf("hits are polls answered with the axis state unchanged since the same getter was last answered\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+// Host check of the StealthChop/SpreadCycle switch and run current (MotionController::configureChopper())
+// against the emulator's TMC2209 model, which takes TPWMTHRS and IRUN from the UART writes and
+// switches chopper on the TSTEP it measures between STEP pulses. Runs an out-and-back move for every
+// profile, speed code and step mode, then a fast move with load sampling on and sensorless homing.
+//
+//   pio run -e chopper_check && .pio/build/chopper_check/program [--distance N] [--verbose]
+//
+// Per move it reports the cruise speed, the speed at which the driver entered SpreadCycle on the way
+// up, the mode changes and IRUN. Fails when a cruise below SPREADCYCLE_MIN_CRUISE_SPEED, a sampled
+// move or homing leaves StealthChop, a faster cruise does not change mode exactly twice per leg
+// (up and down, none while cruising), the switch lies outside start speed..SWITCH_MARGIN of the
+// cruise speed, or IRUN is below RUN_CURRENT_MAX for a profile without scale_run_current. Also fails
+// when a register write after setup waits out the register library's reply delay on the motion loop,
+// or goes out while a read reply is still on the shared UART.
+
+#include <Arduino.h>
+#include <climits>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "stepper/motion_controller.h"
+#include "../emulator/virtual_hardware.h"
+
+namespace
+{
+    constexpr uint8_t ADDRESS = 0b00;
+    constexpr AxisWiring AXIS = {ADDRESS, 6, 5, 0};
+    MotionController controller(6, 5, 21, 7, 8, ADDRESS, "chopper", 0);
+
+    constexpr uint8_t SPEED_CODES[] = {0x02, 0x04, 0x08, 0x10, 0x20};
+    constexpr float SPREADCYCLE_MIN_CRUISE_SPEED = 200.0f; // MotionController::SPREADCYCLE_MIN_CRUISE_SPEED
+    constexpr uint8_t RUN_CURRENT_MAX = 31;                // MotionController::RUN_CURRENT_MAX
+    constexpr float SWITCH_MARGIN = 0.9f;                  // TSTEP jitter at cruise must not reach the threshold
+    constexpr long START_STEPS = 200;                      // full steps from the end stop
+    constexpr uint64_t TIMEOUT_US = 3600000000ULL;
+
+    struct Move
+    {
+        float cruise_speed = 0.0f;
+        float switch_speed = 0.0f; // 0 if the move stayed in StealthChop
+        uint16_t switches = 0;
+        uint8_t irun = 0;
+        bool finished = false;
+    };
+
+    TMC2209Stepper &model()
+    {
+        return *VirtualHardware::instance().findDriver(ADDRESS);
+    }
+
+    // Runs the controller the way MotionTask::poll() does until it comes to rest
+    void runUntilIdle(Move &move)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        uint64_t deadline = hardware.micros() + TIMEOUT_US;
+        while (controller.getIsMoving() && hardware.micros() < deadline)
+        {
+            controller.update();
+            move.cruise_speed = max(move.cruise_speed, controller.getCurrentSpeed());
+            if (move.switch_speed == 0.0f && model().isSpreadCycle())
+                move.switch_speed = controller.getCurrentSpeed();
+
+            unsigned long wait_us = controller.getMicrosUntilNextStep();
+            hardware.advanceTo(hardware.micros() + (wait_us == ULONG_MAX ? 1000 : max(wait_us, 1ul)));
+        }
+        move.finished = !controller.getIsMoving();
+        move.switches += model().takeModeSwitches();
+        move.irun = model().irun();
+    }
+
+    Move outAndBack(long distance)
+    {
+        Move move;
+        model().takeModeSwitches();
+        long start = controller.getCurrentPosition();
+        for (long target : {start + distance, start})
+        {
+            controller.setTargetPosition(target);
+            controller.startMovement();
+            runUntilIdle(move);
+        }
+        return move;
+    }
+
+    bool checkMove(const MotionProfile &profile, const Move &move, bool stealthchop_only)
+    {
+        if (!move.finished)
+            return false;
+        if (!profile.scale_run_current && move.irun != RUN_CURRENT_MAX)
+            return false;
+
+        if (stealthchop_only || move.cruise_speed < SPREADCYCLE_MIN_CRUISE_SPEED)
+            return move.switches == 0;
+
+        return move.switches == 4 && move.switch_speed >= profile.start_speed &&
+               move.switch_speed <= move.cruise_speed * SWITCH_MARGIN;
+    }
+
+    void printMove(const char *profile, const char *speed, const char *mode, const Move &move, bool passed,
+                   const char *note = "")
+    {
+        printf("%-8s %5s %4s %8.1f %8.1f %8u %4u %s%s\n", profile, speed, mode, move.cruise_speed, move.switch_speed,
+               move.switches, move.irun, passed ? "ok" : "FAIL", note);
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --distance N   length of each leg in steps, long enough to reach cruise (default 3000)\n"
+                "  --verbose      print every move, not only failures and the special cases\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long distance = 3000;
+    bool verbose = false;
+
+    static const option options[] = {
+        {"distance", required_argument, nullptr, 'd'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            distance = strtol(optarg, nullptr, 10);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (distance <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    VirtualHardware &hardware = VirtualHardware::instance();
+    hardware.useManualClock();
+    hardware.setStartPosition(START_STEPS);
+    hardware.attachAxis(AXIS);
+    controller.begin();
+    hardware.takeLibraryWriteMicros(); // setup may block
+    hardware.takeBusCollisions();
+
+    bool ok = true;
+    int moves = 0;
+    printf("%-8s %5s %4s %8s %8s %8s %4s\n", "profile", "speed", "mode", "cruise", "switch", "changes", "irun");
+    for (uint8_t index = 0; index < PROFILE_COUNT; index++)
+    {
+        controller.selectProfile(index);
+        const MotionProfile &profile = controller.getProfile();
+        for (uint8_t speed : SPEED_CODES)
+        {
+            controller.setSpeed(speed);
+            for (StepMode mode : {StepMode::FULL_STEP, StepMode::HALF_STEP})
+            {
+                controller.setStepMode(mode);
+                Move move = outAndBack(distance);
+                bool passed = checkMove(profile, move, false);
+                if (verbose || !passed)
+                {
+                    char code[4];
+                    snprintf(code, sizeof(code), "%X", speed);
+                    printMove(profile.name, code, mode == StepMode::FULL_STEP ? "SF" : "SH", move, passed);
+                }
+                moves++;
+                ok &= passed;
+            }
+        }
+    }
+
+    // StallGuard needs StealthChop: load sampling and homing keep it at any speed
+    controller.selectProfile(1);
+    controller.setSpeed(0x02);
+    controller.setStepMode(StepMode::FULL_STEP);
+    controller.setLoadSampling(true);
+    Move sampled = outAndBack(distance);
+    controller.setLoadSampling(false);
+    bool passed = checkMove(controller.getProfile(), sampled, true);
+    printMove(controller.getProfile().name, "2", "SF", sampled, passed, " (load sampling)");
+    ok &= passed;
+
+    Move homing;
+    model().takeModeSwitches();
+    controller.startHoming();
+    runUntilIdle(homing);
+    homing.finished &= controller.getHomingState() == MotionController::HomingState::HOMED;
+    passed = homing.finished && homing.switches == 0 && homing.irun == RUN_CURRENT_MAX;
+    printMove("HOMING", "-", "SF", homing, passed);
+    ok &= passed;
+
+    // homing restores the profile's threshold
+    Move after = outAndBack(distance);
+    passed = checkMove(controller.getProfile(), after, false);
+    printMove(controller.getProfile().name, "2", "SF", after, passed, " (after homing)");
+    ok &= passed;
+
+    uint64_t library_us = hardware.takeLibraryWriteMicros();
+    uint32_t collisions = hardware.takeBusCollisions();
+    passed = library_us == 0 && collisions == 0;
+    printf("UART after setup: %llu us in register library writes, %u datagrams over a reply %s\n",
+           static_cast<unsigned long long>(library_us), collisions, passed ? "ok" : "FAIL");
+    ok &= passed;
+
+    printf("%d profile moves; cruise and switch in steps/s, changes between StealthChop and SpreadCycle\n", moves);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,432 @@
+// Host benchmark of the Moonlite command path, per entry of COMMAND_TABLE: the RX callback framing
+// and parsing a command (Serial.deliver()), dispatchCommands() in src/main.cpp looking it up and
+// answering it or posting it, and for MOTION commands the motion task applying it
+// (MotionTask::poll(), which also runs one update pass over both axes). The same commands are also
+// sent as a binary request (BinaryFrame) and run through dispatchRequests(). Runs the firmware built
+// with EAF_SINGLE_LOOP on the emulator's manual clock, which stays put so no step is taken while
+// timing.
+//
+//   pio run -e dispatch_bench && .pio/build/dispatch_bench/program [--repeat N] [--max-ns N]
+//
+// Every command is sent in batches that fit the command queue, as ASCII frames in one delivery or
+// one binary request; the host time of each stage is divided by the commands in the batch. Each
+// batch of motion commands is followed by FQ on both axes outside the timed part. Fails when a
+// command is not recognised or dropped, or when the parse plus dispatch time of a command exceeds
+// --max-ns in either protocol (0, the default, only reports).
+//
+// Then it drives an autofocus run the way imaging software drives one, once per protocol, on the
+// emulator's clock: a V-curve of AF_POINTS positions AF_STEP steps apart, each moved to with SN and
+// FG, polled with GI and GP until the focuser stops, then exposed with GT read for the record, and a
+// last move to the best focus in the middle. The ASCII client sends each getter as its own round
+// trip and the setters without waiting; the binary client sends each of those exchanges as one
+// request. Reports the bytes each way and the round trips per run. Fails when a run does not end at
+// the best focus or a binary request is not answered OK.
+
+#include <algorithm>
+#include <chrono>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <vector>
+#include "app/command_table.h"
+#include "moonlite/moonlite.h"
+#include "../emulator/firmware_session.h"
+
+void dispatchCommands();
+void dispatchRequests();
+extern Moonlite moonlite;
+
+namespace
+{
+    constexpr size_t BATCH = 8; // half the command queue, a burst a client could send
+
+    constexpr size_t AF_POINTS = 9;
+    constexpr long AF_STEP = 100;
+    constexpr long AF_BEST_FOCUS = 20000; // the middle of the V-curve
+    constexpr uint64_t AF_POLL_PERIOD_US = 100000;
+    constexpr uint64_t AF_EXPOSURE_US = 2000000;
+    constexpr int AF_MAX_POLLS = 600; // per move, a minute
+
+    struct Cost
+    {
+        double parse_ns = 0.0;
+        double dispatch_ns = 0.0;
+        double apply_ns = 0.0; // motion task, MOTION commands only
+        double binary_parse_ns = 0.0;
+        double binary_dispatch_ns = 0.0;
+        size_t ascii_bytes = 0; // per command
+        size_t binary_bytes = 0;
+    };
+
+    double elapsedNs(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void discardReplies()
+    {
+        uint8_t buffer[256];
+        while (Serial.takeTransmitted(buffer, sizeof(buffer)))
+        {
+        }
+    }
+
+    std::string frame(const CommandSpec &spec, long value = 1)
+    {
+        char text[32];
+        if (spec.value_digits > 0)
+            snprintf(text, sizeof(text), ":%s%0*lX#", spec.opcode, spec.value_digits, value);
+        else
+            snprintf(text, sizeof(text), ":%s#", spec.opcode);
+        return text;
+    }
+
+    // One request id, then the command's index and value bytes BATCH times
+    std::string binaryFrame(const CommandSpec &spec, uint8_t index)
+    {
+        uint8_t payload[BinaryFrame::MAX_PAYLOAD_LENGTH];
+        size_t length = 0;
+        payload[length++] = 1;
+        for (size_t i = 0; i < BATCH; i++)
+        {
+            payload[length++] = index;
+            for (size_t byte = 1; byte <= spec.value_digits / 2u; byte++)
+                payload[length++] = (byte == spec.value_digits / 2u) ? 1 : 0;
+        }
+
+        uint8_t frame[BinaryFrame::MAX_PAYLOAD_LENGTH + BinaryFrame::OVERHEAD];
+        size_t frame_length = BinaryFrame::encode(payload, length, frame);
+        return std::string(reinterpret_cast<const char *>(frame), frame_length);
+    }
+
+    Cost measure(const CommandSpec &spec, uint8_t index, int repeat)
+    {
+        std::string batch;
+        for (size_t i = 0; i < BATCH; i++)
+            batch += frame(spec);
+        std::string request = binaryFrame(spec, index);
+
+        Cost cost;
+        cost.ascii_bytes = batch.size() / BATCH;
+        cost.binary_bytes = request.size();
+        for (int round = 0; round < repeat; round++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            Serial.deliver(reinterpret_cast<const uint8_t *>(batch.data()), batch.size());
+            cost.parse_ns += elapsedNs(start);
+
+            start = std::chrono::steady_clock::now();
+            dispatchCommands();
+            cost.dispatch_ns += elapsedNs(start);
+
+            if (spec.context == CommandContext::MOTION)
+            {
+                start = std::chrono::steady_clock::now();
+                motionTask.poll();
+                cost.apply_ns += elapsedNs(start);
+
+                // whatever the command started, it must not carry over into the next batch
+                FirmwareSession::send(":FQ#:2FQ#");
+            }
+            discardReplies();
+
+            start = std::chrono::steady_clock::now();
+            Serial.deliver(reinterpret_cast<const uint8_t *>(request.data()), request.size());
+            cost.binary_parse_ns += elapsedNs(start);
+
+            start = std::chrono::steady_clock::now();
+            dispatchRequests();
+            cost.binary_dispatch_ns += elapsedNs(start);
+
+            if (spec.context == CommandContext::MOTION)
+            {
+                motionTask.poll();
+                FirmwareSession::send(":FQ#:2FQ#");
+            }
+            discardReplies();
+        }
+
+        double commands = static_cast<double>(repeat) * BATCH;
+        cost.parse_ns /= commands;
+        cost.dispatch_ns /= commands;
+        cost.apply_ns /= commands;
+        cost.binary_parse_ns /= commands;
+        cost.binary_dispatch_ns /= commands;
+        return cost;
+    }
+
+    // Bytes each way and the exchanges a client waited on
+    struct Traffic
+    {
+        size_t sent = 0;
+        size_t received = 0;
+        size_t round_trips = 0;
+        size_t polls = 0;
+        bool ok = true;
+    };
+
+    struct Call
+    {
+        const char *opcode;
+        long value; // ignored for commands without one
+    };
+
+    // Getters answer with a value, everything else the client sends without waiting in ASCII
+    bool isGetter(const CommandSpec &spec)
+    {
+        return spec.context == CommandContext::PROTOCOL && spec.value_digits == 0;
+    }
+
+    const CommandSpec *findSpec(const char *opcode, uint8_t &index)
+    {
+        for (size_t i = 0; i < COMMAND_COUNT; i++)
+        {
+            if (strcmp(COMMAND_TABLE[i].opcode, opcode) == 0)
+            {
+                index = static_cast<uint8_t>(i);
+                return &COMMAND_TABLE[i];
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief One exchange of an autofocus client
+     * @return For each call, its reply value, or -1 for setters and a failed exchange
+     *
+     * ASCII sends the setters in one write without waiting, then every getter as its own round trip.
+     * Binary sends every call in one request and waits for the reply.
+     */
+    std::vector<long> exchange(const std::vector<Call> &calls, bool binary, Traffic &traffic)
+    {
+        std::vector<long> values(calls.size(), -1);
+        if (!binary)
+        {
+            std::string setters;
+            for (const Call &call : calls)
+            {
+                uint8_t index;
+                const CommandSpec *spec = findSpec(call.opcode, index);
+                if (spec != nullptr && !isGetter(*spec))
+                    setters += frame(*spec, call.value);
+            }
+            if (!setters.empty())
+            {
+                traffic.sent += setters.size();
+                traffic.received += FirmwareSession::send(setters).size();
+            }
+
+            for (size_t i = 0; i < calls.size(); i++)
+            {
+                uint8_t index;
+                const CommandSpec *spec = findSpec(calls[i].opcode, index);
+                if (spec == nullptr || !isGetter(*spec))
+                    continue;
+                std::string request = frame(*spec, 0);
+                std::string reply = FirmwareSession::send(request);
+                traffic.sent += request.size();
+                traffic.received += reply.size();
+                traffic.round_trips++;
+                values[i] = strtol(reply.c_str(), nullptr, 16);
+            }
+            return values;
+        }
+
+        uint8_t payload[BinaryFrame::MAX_PAYLOAD_LENGTH];
+        size_t length = 0;
+        payload[length++] = static_cast<uint8_t>(traffic.round_trips + 1);
+        for (const Call &call : calls)
+        {
+            uint8_t index;
+            const CommandSpec *spec = findSpec(call.opcode, index);
+            if (spec == nullptr)
+                return values;
+            payload[length++] = index;
+            for (size_t byte = spec->value_digits / 2u; byte > 0; byte--)
+                payload[length++] = static_cast<uint8_t>(call.value >> (8 * (byte - 1)));
+        }
+
+        uint8_t request[BinaryFrame::MAX_PAYLOAD_LENGTH + BinaryFrame::OVERHEAD];
+        size_t request_length = BinaryFrame::encode(payload, length, request);
+        std::string reply = FirmwareSession::send(std::string(reinterpret_cast<const char *>(request), request_length));
+        traffic.sent += request_length;
+        traffic.received += reply.size();
+        traffic.round_trips++;
+
+        // SYNC, LENGTH, then the id, status and each getter's value bytes
+        BinaryFrame decoder;
+        BinaryFrame::Result result = BinaryFrame::Result::PENDING;
+        if (!reply.empty() && static_cast<uint8_t>(reply[0]) == BinaryFrame::SYNC)
+        {
+            decoder.begin(0);
+            for (size_t i = 1; i < reply.size() && result == BinaryFrame::Result::PENDING; i++)
+                result = decoder.receiveByte(static_cast<uint8_t>(reply[i]), 0);
+        }
+        const uint8_t *reply_payload = decoder.getPayload();
+        if (result != BinaryFrame::Result::COMPLETE || decoder.getLength() < 2 || reply_payload[1] != 0)
+        {
+            traffic.ok = false;
+            return values;
+        }
+
+        size_t offset = 2;
+        for (size_t i = 0; i < calls.size(); i++)
+        {
+            uint8_t index;
+            const CommandSpec *spec = findSpec(calls[i].opcode, index);
+            if (!isGetter(*spec))
+                continue;
+            size_t value_bytes = strcmp(spec->opcode, "GI") == 0 ? 1 : 2; // the getters the client uses
+            long value = 0;
+            for (size_t byte = 0; byte < value_bytes && offset < decoder.getLength(); byte++)
+                value = (value << 8) | reply_payload[offset++];
+            values[i] = value;
+        }
+        return values;
+    }
+
+    Traffic runAutofocus(bool binary)
+    {
+        char position[8];
+        snprintf(position, sizeof(position), "%04lX", AF_BEST_FOCUS);
+        FirmwareSession::runUntilIdle();
+        // the sweep above left telemetry streaming; this also drains what it sent
+        FirmwareSession::send(std::string(":XTR0000#:2XTR0000#:SP") + position + "#");
+
+        std::vector<long> targets;
+        for (size_t point = 0; point < AF_POINTS; point++)
+            targets.push_back(AF_BEST_FOCUS + (static_cast<long>(point) - static_cast<long>(AF_POINTS / 2)) * AF_STEP);
+        targets.push_back(AF_BEST_FOCUS);
+
+        Traffic traffic;
+        for (size_t move = 0; move < targets.size(); move++)
+        {
+            exchange({{"SN", targets[move]}, {"FG", 0}}, binary, traffic);
+
+            bool moving = true;
+            for (int polls = 0; moving && polls < AF_MAX_POLLS; polls++)
+            {
+                FirmwareSession::run(AF_POLL_PERIOD_US);
+                std::vector<long> values = exchange({{"GI", 0}, {"GP", 0}}, binary, traffic);
+                moving = values[0] != 0;
+                traffic.polls++;
+            }
+            traffic.ok &= !moving;
+
+            if (move < AF_POINTS)
+            {
+                exchange({{"GT", 0}}, binary, traffic);
+                FirmwareSession::run(AF_EXPOSURE_US);
+            }
+        }
+
+        traffic.ok &= motionControllers[0].getCurrentPosition() == AF_BEST_FOCUS;
+        return traffic;
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --repeat N   batches of %zu per command (default 2000)\n"
+                "  --max-ns N   fail when parse plus dispatch of a command takes longer in either protocol\n"
+                "               (default 0, report only)\n",
+                program, BATCH);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int repeat = 2000;
+    double max_ns = 0.0;
+
+    static const option options[] = {
+        {"repeat", required_argument, nullptr, 'r'},
+        {"max-ns", required_argument, nullptr, 'm'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'r':
+            repeat = atoi(optarg);
+            break;
+        case 'm':
+            max_ns = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (repeat <= 0 || max_ns < 0.0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FirmwareSession::begin();
+
+    bool ok = true;
+    double total_ns = 0.0;
+    double worst_ns = 0.0;
+    double binary_total_ns = 0.0;
+    size_t ascii_bytes = 0;
+    size_t binary_bytes = 0;
+    printf("%-6s %-8s %9s %11s %9s %10s %12s %6s %6s\n", "opcode", "context", "parse_ns", "dispatch_ns", "apply_ns",
+           "bparse_ns", "bdispatch_ns", "bytes", "bbytes");
+    for (size_t i = 0; i < COMMAND_COUNT; i++)
+    {
+        const CommandSpec &spec = COMMAND_TABLE[i];
+        uint16_t unknown = moonlite.getUnknownCommandCount();
+        uint16_t dropped = moonlite.getDroppedCommandCount();
+        uint16_t frame_errors = moonlite.getFrameErrorCount();
+        Cost cost = measure(spec, static_cast<uint8_t>(i), repeat);
+
+        double path_ns = cost.parse_ns + cost.dispatch_ns;
+        double binary_path_ns = cost.binary_parse_ns + cost.binary_dispatch_ns;
+        bool passed = moonlite.getUnknownCommandCount() == unknown && moonlite.getDroppedCommandCount() == dropped &&
+                      moonlite.getFrameErrorCount() == frame_errors &&
+                      (max_ns == 0.0 || (path_ns <= max_ns && binary_path_ns <= max_ns));
+        total_ns += path_ns;
+        binary_total_ns += binary_path_ns;
+        worst_ns = max(worst_ns, max(path_ns, binary_path_ns));
+        ascii_bytes += cost.ascii_bytes * BATCH;
+        binary_bytes += cost.binary_bytes;
+        bool motion = spec.context == CommandContext::MOTION;
+        char apply[16] = "-";
+        if (motion)
+            snprintf(apply, sizeof(apply), "%.1f", cost.apply_ns);
+        printf("%-6s %-8s %9.1f %11.1f %9s %10.1f %12.1f %6zu %6.1f %s\n", spec.opcode, motion ? "motion" : "protocol",
+               cost.parse_ns, cost.dispatch_ns, apply, cost.binary_parse_ns, cost.binary_dispatch_ns, cost.ascii_bytes,
+               static_cast<double>(cost.binary_bytes) / BATCH, passed ? "ok" : "FAIL");
+        ok &= passed;
+    }
+
+    printf("%zu commands, parse plus dispatch %.1f ns ASCII and %.1f ns binary on average, %.1f ns worst;\n"
+           "%.1f bytes per command ASCII, %.1f binary; host time per command in batches of %zu, b* columns\n"
+           "for the binary request, apply_ns includes one motion task update pass\n",
+           COMMAND_COUNT, total_ns / COMMAND_COUNT, binary_total_ns / COMMAND_COUNT, worst_ns,
+           static_cast<double>(ascii_bytes) / (COMMAND_COUNT * BATCH),
+           static_cast<double>(binary_bytes) / (COMMAND_COUNT * BATCH), BATCH);
+
+    printf("\n%-8s %9s %9s %11s %6s\n", "protocol", "bytes_out", "bytes_in", "round_trips", "polls");
+    for (bool binary : {false, true})
+    {
+        Traffic traffic = runAutofocus(binary);
+        printf("%-8s %9zu %9zu %11zu %6zu %s\n", binary ? "binary" : "ascii", traffic.sent, traffic.received,
+               traffic.round_trips, traffic.polls, traffic.ok ? "ok" : "FAIL");
+        ok &= traffic.ok;
+    }
+    printf("per autofocus run: %zu points %ld steps apart and a move to the best focus, GI and GP polled every\n"
+           "%llu ms while moving, GT read at every point; ASCII setters are sent without waiting for a reply\n",
+           AF_POINTS, AF_STEP, static_cast<unsigned long long>(AF_POLL_PERIOD_US / 1000));
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+// Host emulator: runs the firmware's setup() and loop() (built with EAF_SINGLE_LOOP) on a virtual
+// clock and exposes its Moonlite port on a Linux pseudo-terminal.
+//
+//   pio run -e emulator && .pio/build/emulator/program --link /tmp/eaf --latency-us 1000
+//
+// Point an INDI/ASCOM client, or tools/loadgen, at the printed device path.
+
+#include <Arduino.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include "serial_link.h"
+#include "virtual_hardware.h"
+
+void setup();
+void loop();
+
+namespace
+{
+    // Mirrors the MotionController wiring in src/main.cpp
+    constexpr AxisWiring BOARD_AXES[] = {
+        {0b00, 6, 5, 0},
+        {0b01, 3, 4, 1},
+    };
+
+    volatile sig_atomic_t running = 1;
+
+    void stop(int)
+    {
+        running = 0;
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --link PATH         symlink to the pseudo-terminal (default: print its path only)\n"
+                "  --baud N            limit the link to N baud, 0 = unlimited like USB CDC (default 0)\n"
+                "  --latency-us N      one-way link latency in microseconds (default 1000)\n"
+                "  --time-scale F      virtual microseconds per host microsecond (default 1.0)\n"
+                "  --start-steps N     distance of each focuser from its inward end stop (default 20000)\n"
+                "  --poll-us N         host sleep between loop() calls (default 50)\n"
+                "  --load F,G,I        load on each focuser: friction, gravity against outward motion and\n"
+                "                      inertia per step/s^2, as fractions of the standstill torque (default 0,0,0)\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *link_path = nullptr;
+    unsigned long baud = 0;
+    unsigned long latency_us = 1000;
+    double time_scale = 1.0;
+    long start_steps = 20000;
+    unsigned long poll_us = 50;
+    LoadModel load;
+
+    static const option options[] = {
+        {"link", required_argument, nullptr, 'l'},
+        {"baud", required_argument, nullptr, 'b'},
+        {"latency-us", required_argument, nullptr, 'L'},
+        {"time-scale", required_argument, nullptr, 't'},
+        {"start-steps", required_argument, nullptr, 's'},
+        {"poll-us", required_argument, nullptr, 'p'},
+        {"load", required_argument, nullptr, 'm'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'l':
+            link_path = optarg;
+            break;
+        case 'b':
+            baud = strtoul(optarg, nullptr, 10);
+            break;
+        case 'L':
+            latency_us = strtoul(optarg, nullptr, 10);
+            break;
+        case 't':
+            time_scale = strtod(optarg, nullptr);
+            break;
+        case 's':
+            start_steps = strtol(optarg, nullptr, 10);
+            break;
+        case 'p':
+            poll_us = strtoul(optarg, nullptr, 10);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%f,%f,%f", &load.friction, &load.gravity, &load.inertia) != 3)
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (time_scale <= 0.0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    VirtualHardware &hardware = VirtualHardware::instance();
+    hardware.setTimeScale(time_scale);
+    hardware.setStartPosition(start_steps);
+    hardware.setLoad(load);
+    for (const AxisWiring &axis : BOARD_AXES)
+        hardware.attachAxis(axis);
+
+    SerialLink link;
+    link.setBaud(baud);
+    link.setLatency(latency_us);
+    if (!link.open(link_path))
+    {
+        fprintf(stderr, "cannot create pseudo-terminal: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("%s\n", link.getPath());
+    fflush(stdout);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    setup();
+    while (running)
+    {
+        bool busy = link.service(Serial, hardware.micros());
+        loop();
+        if (!busy && poll_us > 0)
+            usleep(poll_us);
+    }
+    return 0;
+}
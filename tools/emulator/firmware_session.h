@@ -0,0 +1,91 @@
+#pragma once
+
+// The firmware of src/main.cpp (built with EAF_SINGLE_LOOP) on the emulator's manual clock, for
+// host checks that talk Moonlite to it and look at the motion state between commands.
+
+#include <Arduino.h>
+#include <climits>
+#include <string>
+#include "tasks/motion_task.h"
+#include "virtual_hardware.h"
+
+void setup();
+void loop();
+extern MotionTask motionTask;
+extern MotionController motionControllers[];
+
+namespace FirmwareSession
+{
+    // Mirrors the MotionController wiring in src/main.cpp
+    constexpr AxisWiring BOARD_AXES[] = {
+        {0b00, 6, 5, 0},
+        {0b01, 3, 4, 1},
+    };
+
+    /**
+     * @brief Wire both axes, put the focusers start_steps full steps out from their end stops and run setup()
+     */
+    inline void begin(long start_steps = 20000)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        hardware.useManualClock();
+        hardware.setStartPosition(start_steps);
+        for (const AxisWiring &axis : BOARD_AXES)
+            hardware.attachAxis(axis);
+        setup();
+    }
+
+    /**
+     * @brief One loop() pass, then the clock jumps to the next step or wake-up but not past until_us
+     */
+    inline void step(uint64_t until_us)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        loop();
+        unsigned long wait_us = motionTask.poll();
+        uint64_t next_us = (wait_us == ULONG_MAX) ? until_us : hardware.micros() + max(wait_us, 1ul);
+        hardware.advanceTo(min(next_us, until_us));
+    }
+
+    /**
+     * @brief Run the firmware for a stretch of virtual time
+     */
+    inline void run(uint64_t duration_us)
+    {
+        uint64_t until_us = VirtualHardware::instance().micros() + duration_us;
+        while (VirtualHardware::instance().micros() < until_us)
+            step(until_us);
+    }
+
+    /**
+     * @brief Run until both axes are at rest, at most timeout_us
+     * @return false on timeout
+     */
+    inline bool runUntilIdle(uint64_t timeout_us = 600000000)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        uint64_t until_us = hardware.micros() + timeout_us;
+        do
+        {
+            step(until_us);
+        } while ((motionControllers[0].getIsMoving() || motionControllers[1].getIsMoving()) &&
+                 hardware.micros() < until_us);
+        return !motionControllers[0].getIsMoving() && !motionControllers[1].getIsMoving();
+    }
+
+    /**
+     * @brief Deliver bytes to the Moonlite port, dispatch them and return what the firmware sent back
+     */
+    inline std::string send(const std::string &bytes)
+    {
+        Serial.deliver(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+        loop();
+        motionTask.poll(); // posted motion commands are applied before the caller looks at the state
+
+        std::string reply;
+        uint8_t buffer[256];
+        while (size_t length = Serial.takeTransmitted(buffer, sizeof(buffer)))
+            reply.append(reinterpret_cast<const char *>(buffer), length);
+        return reply;
+    }
+}
@@ -0,0 +1,113 @@
+#include "serial_link.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+SerialLink::~SerialLink()
+{
+    if (!link_path_.empty())
+        unlink(link_path_.c_str());
+    if (slave_fd_ >= 0)
+        close(slave_fd_);
+    if (master_fd_ >= 0)
+        close(master_fd_);
+}
+
+bool SerialLink::open(const char *link_path)
+{
+    master_fd_ = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd_ < 0 || grantpt(master_fd_) != 0 || unlockpt(master_fd_) != 0)
+        return false;
+
+    slave_path_ = ptsname(master_fd_);
+    slave_fd_ = ::open(slave_path_.c_str(), O_RDWR | O_NOCTTY);
+    if (slave_fd_ < 0)
+        return false;
+
+    // Raw bytes like a CDC port, clients still apply their own settings
+    termios settings;
+    tcgetattr(slave_fd_, &settings);
+    cfmakeraw(&settings);
+    tcsetattr(slave_fd_, TCSANOW, &settings);
+
+    fcntl(master_fd_, F_SETFL, fcntl(master_fd_, F_GETFL) | O_NONBLOCK);
+
+    if (link_path != nullptr)
+    {
+        unlink(link_path);
+        if (symlink(slave_path_.c_str(), link_path) != 0)
+            return false;
+        link_path_ = link_path;
+    }
+    return true;
+}
+
+const char *SerialLink::getPath() const
+{
+    return link_path_.empty() ? slave_path_.c_str() : link_path_.c_str();
+}
+
+void SerialLink::setBaud(unsigned long baud)
+{
+    baud_ = baud;
+}
+
+void SerialLink::setLatency(unsigned long latency_us)
+{
+    latency_us_ = latency_us;
+}
+
+uint64_t SerialLink::schedule(uint64_t now_us, uint64_t &line_free_us) const
+{
+    uint64_t byte_time_us = baud_ > 0 ? 10000000ull / baud_ : 0; // start, 8 data and stop bits
+    line_free_us = max(line_free_us, now_us) + byte_time_us;
+    return line_free_us + latency_us_;
+}
+
+bool SerialLink::service(HardwareSerial &serial, uint64_t now_us)
+{
+    bool moved = false;
+    uint8_t buffer[256];
+
+    ssize_t count;
+    while ((count = ::read(master_fd_, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t i = 0; i < count; i++)
+            inbound_.push_back({schedule(now_us, inbound_line_free_us_), buffer[i]});
+    }
+
+    size_t due = 0;
+    while (!inbound_.empty() && inbound_.front().due_us <= now_us && due < sizeof(buffer))
+    {
+        buffer[due++] = inbound_.front().byte;
+        inbound_.pop_front();
+    }
+    if (due > 0)
+    {
+        serial.deliver(buffer, due);
+        moved = true;
+    }
+
+    while ((count = serial.takeTransmitted(buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t i = 0; i < count; i++)
+            outbound_.push_back({schedule(now_us, outbound_line_free_us_), buffer[i]});
+    }
+
+    due = 0;
+    while (!outbound_.empty() && outbound_.front().due_us <= now_us && due < sizeof(buffer))
+    {
+        buffer[due++] = outbound_.front().byte;
+        outbound_.pop_front();
+    }
+    if (due > 0)
+    {
+        // a full pty buffer means no client is reading, drop rather than block the firmware
+        if (::write(master_fd_, buffer, due) < 0 && errno != EAGAIN)
+            return moved;
+        moved = true;
+    }
+    return moved;
+}
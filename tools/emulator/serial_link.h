@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <Arduino.h>
+
+/**
+ * @brief Connects a firmware serial port to a Linux pseudo-terminal
+ *
+ * Bytes in both directions are held back to model the link: each byte occupies the line for
+ * 10 bit times at the configured baud rate (0 = unlimited, as on USB CDC), and is delivered a
+ * fixed latency after it has been sent.
+ */
+class SerialLink
+{
+private:
+    struct PendingByte
+    {
+        uint64_t due_us;
+        uint8_t byte;
+    };
+
+    int master_fd_ = -1;
+    int slave_fd_ = -1; // kept open so the master never reads EIO between clients
+    std::string slave_path_;
+    std::string link_path_;
+
+    unsigned long baud_ = 0;
+    unsigned long latency_us_ = 0;
+
+    std::deque<PendingByte> inbound_;
+    std::deque<PendingByte> outbound_;
+    uint64_t inbound_line_free_us_ = 0;
+    uint64_t outbound_line_free_us_ = 0;
+
+    uint64_t schedule(uint64_t now_us, uint64_t &line_free_us) const;
+
+public:
+    ~SerialLink();
+
+    /**
+     * @brief Create the pseudo-terminal
+     * @param link_path Symlink to create to the slave side, nullptr for none
+     * @return false on failure, errno is set
+     */
+    bool open(const char *link_path);
+
+    const char *getPath() const;
+
+    void setBaud(unsigned long baud);
+    void setLatency(unsigned long latency_us);
+
+    /**
+     * @brief Move due bytes between the pseudo-terminal and the firmware port
+     * @return true if any byte moved
+     */
+    bool service(HardwareSerial &serial, uint64_t now_us);
+};
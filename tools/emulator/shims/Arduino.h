@@ -0,0 +1,96 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino-ESP32 core the firmware uses.
+// Time, GPIO and the serial ports are provided by the emulator (see virtual_hardware.h).
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+using std::abs;
+using std::max;
+using std::min;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+
+#define SERIAL_8N1 0x800001c
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long micros();
+unsigned long millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+/**
+ * @brief Serial port backed by the emulator
+ *
+ * Received bytes are handed in by the emulator with deliver(), which also runs the onReceive()
+ * callback. Written bytes are queued until the emulator collects them with takeTransmitted().
+ * Both directions use fixed FIFOs like the USB CDC buffers, so the port itself never allocates
+ * and the replay benchmark's allocation counts belong to the firmware alone.
+ */
+class HardwareSerial
+{
+private:
+    struct Fifo
+    {
+        static constexpr size_t SIZE = 4096;
+
+        uint8_t bytes[SIZE];
+        size_t head = 0; // oldest byte
+        size_t count = 0;
+
+        bool push(uint8_t byte); // false when full, the byte is dropped
+        int pop();
+        int peek() const;
+    };
+
+    Fifo rx_;
+    Fifo tx_;
+    std::function<void(void)> on_receive_;
+
+public:
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rx_pin = -1, int8_t tx_pin = -1);
+    void end();
+
+    int available();
+    int read();
+    int peek();
+
+    size_t write(uint8_t byte);
+    size_t write(const uint8_t *buffer, size_t size);
+    size_t print(const char *str);
+    size_t print(char ch);
+    void flush();
+
+    void onReceive(std::function<void(void)> function, bool onlyOnTimeout = false);
+
+    explicit operator bool() const
+    {
+        return true;
+    }
+
+    // Emulator side
+    void deliver(const uint8_t *buffer, size_t size);
+    size_t takeTransmitted(uint8_t *buffer, size_t size);
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
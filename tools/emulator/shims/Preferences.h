@@ -0,0 +1,24 @@
+#pragma once
+
+// In-memory NVS stand-in, contents last until the emulator exits
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Preferences
+{
+private:
+    const char *namespace_ = nullptr;
+    bool read_only_ = true;
+
+public:
+    bool begin(const char *name, bool read_only = false, const char *partition_label = nullptr);
+    void end();
+
+    size_t putUChar(const char *key, uint8_t value);
+    uint8_t getUChar(const char *key, uint8_t default_value = 0);
+    size_t putBytes(const char *key, const void *value, size_t length);
+    size_t getBytesLength(const char *key);
+    size_t getBytes(const char *key, void *buffer, size_t max_length);
+    bool remove(const char *key);
+};
@@ -0,0 +1,276 @@
+#pragma once
+
+// Host model of the TMC2209 registers the firmware touches.
+// Step pulses reach the model through the emulator's GPIO layer, and raw UART datagrams on Serial1
+// through the bus model, see VirtualHardware. The register library's setters for the registers the
+// model follows send their write datagram through the bus model too, and wait out the library's
+// reply delay on the emulator's clock like the real library does.
+
+#include <algorithm>
+#include <stdint.h>
+
+class HardwareSerial;
+
+/**
+ * @brief Mechanical load on an emulated motor
+ *
+ * Torques are fractions of the motor's torque at standstill. Speeds are in firmware steps of 16
+ * microsteps, so they match the profile's units in either step mode.
+ */
+struct LoadModel
+{
+    float friction = 0.0f;         // torque to keep the drawtube moving
+    float gravity = 0.0f;          // torque against outward motion, it helps inward
+    float inertia = 0.0f;          // torque per step/s^2
+    float pullout_speed = 3000.0f; // the available torque falls linearly to zero at this speed
+};
+
+class TMC2209Stepper
+{
+private:
+    HardwareSerial *serial_;
+    uint8_t address_;
+    uint16_t microsteps_ = 256;
+    uint32_t chopconf_ = 0x10000053; // the library's reset value, MRES 0 is 256 microsteps
+    uint16_t mscnt_ = 0;
+    uint8_t sgthrs_ = 0;
+    long position_ = 0; // 1/256 microsteps from the inward end stop
+    bool stalled_ = false;
+
+    LoadModel load_;
+    uint64_t last_step_us_ = 0;
+    float speed_ = 0.0f;        // steps/s
+    float acceleration_ = 0.0f; // steps/s^2, smoothed over a few steps
+    uint16_t sg_result_ = SG_NO_LOAD;
+
+    // Chopper and current registers, the run current scales the torque
+    bool en_spreadcycle_ = false;
+    uint32_t tpwmthrs_ = 0;
+    uint32_t tstep_ = TSTEP_MAX;
+    bool spreadcycle_ = false;
+    uint16_t mode_switches_ = 0;
+    uint8_t irun_ = 31;
+    uint8_t ihold_ = 31;
+    uint8_t iholddelay_ = 0;
+
+    static constexpr uint16_t SG_NO_LOAD = 300;
+    static constexpr uint32_t TSTEP_MAX = 0xFFFFF;
+    static constexpr float CLOCK_MHZ = 12.0f;
+    static constexpr uint32_t REPLY_DELAY_US = 2000; // the library's delay(replyDelay) after every write
+
+    /**
+     * @brief A write the way the register library makes it: the datagram, then the reply delay
+     *
+     * The model takes the value from the bus like a raw write, so a write lost to a collision on the
+     * bus is lost here as well.
+     */
+    void write(uint8_t address, uint32_t value);
+
+    uint32_t currents() const
+    {
+        return ihold_ | (static_cast<uint32_t>(irun_) << 8) | (static_cast<uint32_t>(iholddelay_) << 16);
+    }
+
+public:
+    TMC2209Stepper(HardwareSerial *serial, float r_sense, uint8_t address);
+    ~TMC2209Stepper();
+
+    // Registers the model does not follow, only set up once
+    void begin() {}
+    void rms_current(uint16_t) {}
+    void intpol(bool) {}
+    void pwm_autoscale(bool) {}
+    void I_scale_analog(bool) {}
+    void TPOWERDOWN(uint8_t) {}
+    void TCOOLTHRS(uint32_t) {}
+
+    void toff(uint8_t off_time)
+    {
+        write(0x6C, (chopconf_ & ~0x0Ful) | (off_time & 0x0F));
+    }
+
+    void en_spreadCycle(bool enabled)
+    {
+        write(0x00, enabled ? 0x04 : 0x00); // GCONF, en_SpreadCycle is bit 2
+    }
+
+    void iholddelay(uint8_t delay)
+    {
+        iholddelay_ = delay & 0x0F;
+        write(0x10, currents());
+    }
+
+    void ihold(uint8_t current)
+    {
+        write(0x10, (currents() & ~0x1Ful) | (current & 0x1F));
+    }
+
+    uint8_t ihold() const
+    {
+        return ihold_;
+    }
+
+    void irun(uint8_t current)
+    {
+        write(0x10, (currents() & ~0x1F00ul) | (static_cast<uint32_t>(current & 0x1F) << 8));
+    }
+
+    uint8_t irun() const
+    {
+        return irun_;
+    }
+
+    void TPWMTHRS(uint32_t threshold)
+    {
+        write(0x13, threshold & TSTEP_MAX);
+    }
+
+    uint32_t TPWMTHRS() const
+    {
+        return tpwmthrs_;
+    }
+
+    // Time between 1/256 microsteps in clock cycles, measured over the last pulse
+    uint32_t TSTEP() const
+    {
+        return tstep_;
+    }
+
+    void microsteps(uint16_t microsteps)
+    {
+        // CHOPCONF, MRES in bits 24-27 counts halvings from 256 microsteps
+        uint32_t mres = 0;
+        while (mres < 8 && (256u >> mres) > microsteps)
+            mres++;
+        write(0x6C, (chopconf_ & ~0x0F000000ul) | (mres << 24));
+    }
+
+    uint16_t microsteps() const
+    {
+        return microsteps_;
+    }
+
+    uint32_t CHOPCONF() const
+    {
+        return chopconf_;
+    }
+
+    void SGTHRS(uint8_t threshold)
+    {
+        write(0x40, threshold);
+    }
+
+    uint8_t SGTHRS() const
+    {
+        return sgthrs_;
+    }
+
+    uint16_t MSCNT() const
+    {
+        return mscnt_;
+    }
+
+    // Falls from SG_NO_LOAD as the load takes up the available torque, 0 while the rotor slips
+    uint16_t SG_RESULT() const
+    {
+        return stalled_ ? 0 : sg_result_;
+    }
+
+    // Emulator side
+    uint8_t getAddress() const
+    {
+        return address_;
+    }
+
+    void setPosition(long position)
+    {
+        position_ = position;
+    }
+
+    long getPosition() const
+    {
+        return position_;
+    }
+
+    bool isStalled() const
+    {
+        return stalled_;
+    }
+
+    // The chopper the last pulse ran in: SpreadCycle once TSTEP falls below TPWMTHRS
+    bool isSpreadCycle() const
+    {
+        return spreadcycle_;
+    }
+
+    // Changes between StealthChop and SpreadCycle since the last call
+    uint16_t takeModeSwitches()
+    {
+        uint16_t switches = mode_switches_;
+        mode_switches_ = 0;
+        return switches;
+    }
+
+    void setLoad(const LoadModel &load)
+    {
+        load_ = load;
+    }
+
+    /**
+     * @brief Register value for a UART read datagram
+     * @return false for registers the model does not answer
+     */
+    bool readRegister(uint8_t address, uint32_t &value) const
+    {
+        switch (address)
+        {
+        case 0x41:
+            value = SG_RESULT();
+            return true;
+        case 0x6A:
+            value = MSCNT();
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * @brief A UART write datagram, registers the model does not follow are ignored
+     */
+    void writeRegister(uint8_t address, uint32_t value)
+    {
+        switch (address)
+        {
+        case 0x00: // GCONF
+            en_spreadcycle_ = (value & 0x04) != 0;
+            break;
+        case 0x10: // IHOLD_IRUN
+            ihold_ = value & 0x1F;
+            irun_ = (value >> 8) & 0x1F;
+            iholddelay_ = (value >> 16) & 0x0F;
+            break;
+        case 0x13: // TPWMTHRS
+            tpwmthrs_ = value & TSTEP_MAX;
+            break;
+        case 0x40: // SGTHRS
+            sgthrs_ = value & 0xFF;
+            break;
+        case 0x6C: // CHOPCONF, the model follows MRES
+            chopconf_ = value;
+            microsteps_ = 256 >> std::min<uint32_t>((value >> 24) & 0x0F, 8);
+            break;
+        default:
+            break;
+        }
+    }
+
+    /**
+     * @brief One STEP pulse, the rotor stops at the end stop while the counter would keep going
+     * @param inward DIR level, HIGH moves inward
+     *
+     * The rotor also slips, without moving, while the load needs more torque than is available. The
+     * pulse also updates TSTEP and with it the chopper mode.
+     */
+    void step(bool inward);
+};
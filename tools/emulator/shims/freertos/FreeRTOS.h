@@ -0,0 +1,16 @@
+#pragma once
+
+// Types only: the emulator builds with EAF_SINGLE_LOOP, so no task is ever started
+
+#include <stdint.h>
+
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFF
+#define pdMS_TO_TICKS(ms) (ms)
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+void xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
@@ -0,0 +1,575 @@
+#include "virtual_hardware.h"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <time.h>
+
+namespace
+{
+    uint64_t hostNanos()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    // TMC2209 datagram CRC: polynomial x^8 + x^2 + x + 1, bytes fed LSB first
+    uint8_t tmcCrc(const uint8_t *datagram, size_t length)
+    {
+        uint8_t crc = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            uint8_t byte = datagram[i];
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = ((crc >> 7) ^ (byte & 0x01)) ? (crc << 1) ^ 0x07 : crc << 1;
+                byte >>= 1;
+            }
+        }
+        return crc;
+    }
+}
+
+VirtualHardware::VirtualHardware() : start_ns_(hostNanos())
+{
+}
+
+VirtualHardware &VirtualHardware::instance()
+{
+    static VirtualHardware hardware;
+    return hardware;
+}
+
+void VirtualHardware::setTimeScale(double scale)
+{
+    // keep the clock continuous across the change
+    uint64_t now_us = micros() - skipped_us_;
+    time_scale_ = scale;
+    start_ns_ = hostNanos() - static_cast<uint64_t>(now_us * 1000.0 / time_scale_);
+}
+
+void VirtualHardware::useManualClock()
+{
+    manual_now_us_ = micros() - skipped_us_;
+    manual_clock_ = true;
+}
+
+void VirtualHardware::advanceTo(uint64_t us)
+{
+    if (us > micros())
+        manual_now_us_ = us - skipped_us_;
+}
+
+uint64_t VirtualHardware::micros() const
+{
+    if (manual_clock_)
+        return manual_now_us_ + skipped_us_;
+    return static_cast<uint64_t>((hostNanos() - start_ns_) * time_scale_ / 1000.0) + skipped_us_;
+}
+
+void VirtualHardware::delayMicroseconds(uint32_t us)
+{
+    skipped_us_ += us;
+}
+
+void VirtualHardware::attachAxis(const AxisWiring &wiring)
+{
+    axes_.push_back(wiring);
+}
+
+void VirtualHardware::setStartPosition(long full_steps)
+{
+    // the firmware's drivers are static objects and already registered
+    start_position_ = full_steps;
+    for (TMC2209Stepper *driver : drivers_)
+        driver->setPosition(start_position_ * 256);
+}
+
+void VirtualHardware::setLoad(const LoadModel &load)
+{
+    load_ = load;
+    for (TMC2209Stepper *driver : drivers_)
+        driver->setLoad(load_);
+}
+
+void VirtualHardware::registerDriver(TMC2209Stepper *driver)
+{
+    driver->setPosition(start_position_ * 256);
+    driver->setLoad(load_);
+    drivers_.push_back(driver);
+}
+
+void VirtualHardware::unregisterDriver(TMC2209Stepper *driver)
+{
+    drivers_.erase(std::remove(drivers_.begin(), drivers_.end(), driver), drivers_.end());
+}
+
+TMC2209Stepper *VirtualHardware::findDriver(uint8_t address) const
+{
+    for (TMC2209Stepper *driver : drivers_)
+    {
+        if (driver->getAddress() == address)
+            return driver;
+    }
+    return nullptr;
+}
+
+void VirtualHardware::receiveDriverUart(uint8_t byte)
+{
+    // reads are 4 bytes, writes 8, both start with the sync nibble
+    if (uart_length_ == 0)
+    {
+        if ((byte & 0x0F) != 0x05)
+            return;
+        uart_collided_ = uart_reply_pending_;
+        if (uart_collided_)
+        {
+            bus_collisions_++;
+            uart_reply_pending_ = false;
+        }
+    }
+
+    uart_request_[uart_length_++] = byte;
+    if (uart_length_ < 3)
+        return;
+
+    bool write = (uart_request_[2] & 0x80) != 0;
+    uint8_t length = write ? 8 : 4;
+    if (uart_length_ < length)
+        return;
+    uart_length_ = 0;
+
+    // TX and RX share the wire, so the request comes back first
+    Serial1.deliver(uart_request_, length);
+    if (uart_collided_)
+        return;
+
+    TMC2209Stepper *driver = findDriver(uart_request_[1]);
+    if (write)
+    {
+        if (driver != nullptr && tmcCrc(uart_request_, 7) == uart_request_[7])
+            driver->writeRegister(uart_request_[2] & 0x7F,
+                                  (static_cast<uint32_t>(uart_request_[3]) << 24) |
+                                      (static_cast<uint32_t>(uart_request_[4]) << 16) |
+                                      (static_cast<uint32_t>(uart_request_[5]) << 8) | uart_request_[6]);
+        return;
+    }
+    if (tmcCrc(uart_request_, 3) != uart_request_[3])
+        return;
+
+    uint32_t value;
+    if (driver == nullptr || !driver->readRegister(uart_request_[2], value))
+        return;
+
+    uint8_t reply[8] = {0x05, 0xFF, uart_request_[2], static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16),
+                        static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value), 0};
+    reply[7] = tmcCrc(reply, 7);
+    std::copy(reply, reply + sizeof(reply), uart_reply_);
+    uart_reply_pending_ = true;
+}
+
+void VirtualHardware::deliverDriverReply()
+{
+    if (!uart_reply_pending_)
+        return;
+    uart_reply_pending_ = false;
+    Serial1.deliver(uart_reply_, sizeof(uart_reply_));
+}
+
+uint32_t VirtualHardware::takeBusCollisions()
+{
+    uint32_t collisions = bus_collisions_;
+    bus_collisions_ = 0;
+    return collisions;
+}
+
+void VirtualHardware::waitLibraryWrite(uint32_t us)
+{
+    library_write_us_ += us;
+    delayMicroseconds(us);
+}
+
+uint64_t VirtualHardware::takeLibraryWriteMicros()
+{
+    uint64_t us = library_write_us_;
+    library_write_us_ = 0;
+    return us;
+}
+
+void VirtualHardware::digitalWrite(uint8_t pin, uint8_t level)
+{
+    if (pin >= PIN_COUNT)
+        return;
+
+    bool rising = level == HIGH && pin_levels_[pin] == LOW;
+    pin_levels_[pin] = level;
+    if (!rising)
+        return;
+
+    for (const AxisWiring &axis : axes_)
+    {
+        if (axis.step_pin != pin)
+            continue;
+        if (TMC2209Stepper *driver = findDriver(axis.address))
+            driver->step(pin_levels_[axis.dir_pin] == HIGH);
+    }
+}
+
+int VirtualHardware::digitalRead(uint8_t pin) const
+{
+    for (const AxisWiring &axis : axes_)
+    {
+        if (axis.diag_pin != pin)
+            continue;
+        TMC2209Stepper *driver = findDriver(axis.address);
+        return (driver != nullptr && driver->isStalled()) ? HIGH : LOW;
+    }
+    return pin < PIN_COUNT ? pin_levels_[pin] : LOW;
+}
+
+void VirtualHardware::notifyTask()
+{
+    task_notifications_++;
+}
+
+uint32_t VirtualHardware::takeTaskNotifications()
+{
+    uint32_t notifications = task_notifications_;
+    task_notifications_ = 0;
+    return notifications;
+}
+
+// Arduino core
+
+unsigned long micros()
+{
+    return static_cast<unsigned long>(VirtualHardware::instance().micros());
+}
+
+unsigned long millis()
+{
+    return static_cast<unsigned long>(VirtualHardware::instance().micros() / 1000);
+}
+
+// the 64-bit clock micros() is cut from on the ESP32
+int64_t esp_timer_get_time()
+{
+    return static_cast<int64_t>(VirtualHardware::instance().micros());
+}
+
+void delay(uint32_t ms)
+{
+    VirtualHardware::instance().delayMicroseconds(ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    VirtualHardware::instance().delayMicroseconds(us);
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    VirtualHardware::instance().digitalWrite(pin, val);
+}
+
+int digitalRead(uint8_t pin)
+{
+    return VirtualHardware::instance().digitalRead(pin);
+}
+
+// Serial ports
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+
+void HardwareSerial::begin(unsigned long, uint32_t, int8_t, int8_t)
+{
+}
+
+void HardwareSerial::end()
+{
+}
+
+bool HardwareSerial::Fifo::push(uint8_t byte)
+{
+    if (count == SIZE)
+        return false;
+    bytes[(head + count++) % SIZE] = byte;
+    return true;
+}
+
+int HardwareSerial::Fifo::pop()
+{
+    if (count == 0)
+        return -1;
+    uint8_t byte = bytes[head];
+    head = (head + 1) % SIZE;
+    count--;
+    return byte;
+}
+
+int HardwareSerial::Fifo::peek() const
+{
+    return count == 0 ? -1 : bytes[head];
+}
+
+int HardwareSerial::available()
+{
+    if (this == &Serial1)
+        VirtualHardware::instance().deliverDriverReply();
+    return static_cast<int>(rx_.count);
+}
+
+int HardwareSerial::read()
+{
+    if (this == &Serial1)
+        VirtualHardware::instance().deliverDriverReply();
+    return rx_.pop();
+}
+
+int HardwareSerial::peek()
+{
+    if (this == &Serial1)
+        VirtualHardware::instance().deliverDriverReply();
+    return rx_.peek();
+}
+
+size_t HardwareSerial::write(uint8_t byte)
+{
+    if (this == &Serial1)
+    {
+        VirtualHardware::instance().receiveDriverUart(byte);
+        return 1;
+    }
+    return tx_.push(byte) ? 1 : 0;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    if (this == &Serial1)
+    {
+        for (size_t i = 0; i < size; i++)
+            VirtualHardware::instance().receiveDriverUart(buffer[i]);
+        return size;
+    }
+
+    size_t written = 0;
+    while (written < size && tx_.push(buffer[written]))
+        written++;
+    return written;
+}
+
+size_t HardwareSerial::print(const char *str)
+{
+    return write(reinterpret_cast<const uint8_t *>(str), strlen(str));
+}
+
+size_t HardwareSerial::print(char ch)
+{
+    return write(static_cast<uint8_t>(ch));
+}
+
+void HardwareSerial::flush()
+{
+}
+
+void HardwareSerial::onReceive(std::function<void(void)> function, bool)
+{
+    on_receive_ = function;
+}
+
+void HardwareSerial::deliver(const uint8_t *buffer, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        rx_.push(buffer[i]);
+    if (on_receive_)
+        on_receive_();
+}
+
+size_t HardwareSerial::takeTransmitted(uint8_t *buffer, size_t size)
+{
+    size_t count = 0;
+    while (count < size && tx_.count > 0)
+        buffer[count++] = static_cast<uint8_t>(tx_.pop());
+    return count;
+}
+
+// TMC2209 model
+
+TMC2209Stepper::TMC2209Stepper(HardwareSerial *serial, float, uint8_t address) : serial_(serial), address_(address)
+{
+    VirtualHardware::instance().registerDriver(this);
+}
+
+void TMC2209Stepper::write(uint8_t address, uint32_t value)
+{
+    uint8_t datagram[8] = {0x05, address_, static_cast<uint8_t>(address | 0x80), static_cast<uint8_t>(value >> 24),
+                           static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8),
+                           static_cast<uint8_t>(value), 0};
+    datagram[7] = tmcCrc(datagram, 7);
+    serial_->write(datagram, sizeof(datagram));
+    VirtualHardware::instance().waitLibraryWrite(REPLY_DELAY_US);
+}
+
+TMC2209Stepper::~TMC2209Stepper()
+{
+    VirtualHardware::instance().unregisterDriver(this);
+}
+
+void TMC2209Stepper::step(bool inward)
+{
+    static constexpr uint64_t STANDSTILL_US = 100000;    // a longer pause restarts from rest
+    static constexpr float ACCELERATION_SMOOTHING_US = 20000.0f;
+
+    uint16_t increment = 256 / microsteps_;
+    mscnt_ = (mscnt_ + (inward ? 1024 - increment : increment)) % 1024;
+
+    uint64_t now = VirtualHardware::instance().micros();
+    uint64_t interval = now - last_step_us_;
+    last_step_us_ = now;
+    if (interval == 0 || interval > STANDSTILL_US)
+    {
+        speed_ = 0.0f;
+        acceleration_ = 0.0f;
+        tstep_ = TSTEP_MAX;
+    }
+    else
+    {
+        tstep_ = std::min<uint64_t>(TSTEP_MAX, static_cast<uint64_t>(interval * CLOCK_MHZ / increment));
+        // a firmware step is 16 microsteps, 256 / 16 MSCNT counts
+        float speed = 1e6f * increment / (16.0f * interval);
+        if (speed_ > 0.0f)
+        {
+            float weight = std::min(1.0f, interval / ACCELERATION_SMOOTHING_US);
+            acceleration_ += ((speed - speed_) * 1e6f / interval - acceleration_) * weight;
+        }
+        speed_ = speed;
+    }
+
+    bool spreadcycle = en_spreadcycle_ || (tpwmthrs_ > 0 && tstep_ < tpwmthrs_);
+    if (spreadcycle != spreadcycle_)
+        mode_switches_++;
+    spreadcycle_ = spreadcycle;
+
+    float demand = load_.friction + load_.inertia * std::fabs(acceleration_) + (inward ? -load_.gravity : load_.gravity);
+    float available = std::max(0.0f, 1.0f - speed_ / load_.pullout_speed) * (irun_ + 1) / 32.0f;
+    demand = std::max(0.0f, demand);
+    bool slipping = demand >= available;
+    sg_result_ = slipping ? 0 : static_cast<uint16_t>(SG_NO_LOAD * (1.0f - demand / available));
+
+    // the coils follow MSCNT, the rotor stops at the end stop or slips under too much load
+    if (slipping || (inward && position_ < increment))
+    {
+        stalled_ = true;
+        return;
+    }
+    stalled_ = false;
+    position_ += inward ? -increment : increment;
+}
+
+// NVS
+
+namespace
+{
+    std::map<std::string, std::map<std::string, std::string>> nvs;
+}
+
+bool Preferences::begin(const char *name, bool read_only, const char *)
+{
+    namespace_ = name;
+    read_only_ = read_only;
+    return true;
+}
+
+void Preferences::end()
+{
+    namespace_ = nullptr;
+}
+
+size_t Preferences::putUChar(const char *key, uint8_t value)
+{
+    return putBytes(key, &value, 1);
+}
+
+uint8_t Preferences::getUChar(const char *key, uint8_t default_value)
+{
+    uint8_t value = default_value;
+    return getBytes(key, &value, 1) == 1 ? value : default_value;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length)
+{
+    if (namespace_ == nullptr || read_only_)
+        return 0;
+    nvs[namespace_][key].assign(static_cast<const char *>(value), length);
+    return length;
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+    if (namespace_ == nullptr)
+        return 0;
+    auto &entries = nvs[namespace_];
+    auto entry = entries.find(key);
+    return entry == entries.end() ? 0 : entry->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t max_length)
+{
+    size_t length = getBytesLength(key);
+    if (length == 0 || length > max_length)
+        return 0;
+    memcpy(buffer, nvs[namespace_][key].data(), length);
+    return length;
+}
+
+bool Preferences::remove(const char *key)
+{
+    return namespace_ != nullptr && !read_only_ && nvs[namespace_].erase(key) > 0;
+}
+
+// FreeRTOS and esp_timer, never reached with EAF_SINGLE_LOOP
+
+BaseType_t xTaskCreate(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *)
+{
+    return pdFALSE;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return nullptr;
+}
+
+void xTaskNotifyGive(TaskHandle_t)
+{
+    VirtualHardware::instance().notifyTask();
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t)
+{
+    return 0;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *, esp_timer_handle_t *)
+{
+    return -1;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t, uint64_t)
+{
+    return -1;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t)
+{
+    return -1;
+}
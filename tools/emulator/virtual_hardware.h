@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <TMCStepper.h>
+
+/**
+ * @brief Board wiring of one focuser axis, the emulator routes GPIO through it
+ */
+struct AxisWiring
+{
+    uint8_t address; // TMC2209 UART address
+    uint8_t step_pin;
+    uint8_t dir_pin;
+    uint8_t diag_pin;
+};
+
+/**
+ * @brief Clock, GPIO and driver models behind the Arduino shims
+ *
+ * The clock follows the host clock scaled by the time scale, and busy waits in
+ * delayMicroseconds() advance it without sleeping. STEP edges on a wired axis are fed to the
+ * TMC2209 model with the same UART address, and its DIAG pin reads high while that model stalls.
+ * Raw datagrams written to Serial1 go to the bus model, which echoes them like the single-wire bus
+ * and answers register reads from the addressed model. A reply stays on the wire until the firmware
+ * next looks at Serial1; a datagram sent before then collides with it, and both are lost.
+ */
+class VirtualHardware
+{
+private:
+    static constexpr uint8_t PIN_COUNT = 64;
+
+    double time_scale_ = 1.0;
+    bool manual_clock_ = false;
+    uint64_t manual_now_us_ = 0;
+    uint64_t start_ns_ = 0;
+    uint64_t skipped_us_ = 0; // time added by delayMicroseconds()
+
+    uint8_t pin_levels_[PIN_COUNT] = {};
+    std::vector<AxisWiring> axes_;
+    std::vector<TMC2209Stepper *> drivers_;
+    long start_position_ = 0;
+    LoadModel load_;
+
+    uint8_t uart_request_[8] = {};
+    uint8_t uart_length_ = 0;
+    bool uart_collided_ = false;   // the datagram being received started over a reply
+    uint8_t uart_reply_[8] = {};
+    bool uart_reply_pending_ = false;
+    uint32_t bus_collisions_ = 0;
+    uint64_t library_write_us_ = 0; // waited out in the register library's writes
+
+    uint32_t task_notifications_ = 0;
+
+    VirtualHardware();
+
+public:
+    static VirtualHardware &instance();
+
+    /**
+     * @param scale Virtual microseconds per host microsecond
+     */
+    void setTimeScale(double scale);
+
+    /**
+     * @brief Detach the clock from the host, it then only moves with advanceTo() and busy waits
+     */
+    void useManualClock();
+
+    /**
+     * @brief Move the manual clock forward (never backwards)
+     */
+    void advanceTo(uint64_t us);
+
+    uint64_t micros() const;
+    void delayMicroseconds(uint32_t us);
+
+    void attachAxis(const AxisWiring &wiring);
+
+    /**
+     * @brief Distance of every focuser from its inward end stop when the drivers are created
+     */
+    void setStartPosition(long full_steps);
+
+    /**
+     * @brief Mechanical load on every focuser
+     */
+    void setLoad(const LoadModel &load);
+
+    void registerDriver(TMC2209Stepper *driver);
+    void unregisterDriver(TMC2209Stepper *driver);
+
+    /**
+     * @brief The driver model at a UART address, nullptr if none was created
+     */
+    TMC2209Stepper *findDriver(uint8_t address) const;
+
+    /**
+     * @brief One byte written to the drivers' UART (Serial1)
+     */
+    void receiveDriverUart(uint8_t byte);
+
+    /**
+     * @brief Hand a reply still on the wire to Serial1, the firmware is looking at its receive buffer
+     */
+    void deliverDriverReply();
+
+    /**
+     * @brief Datagrams sent while a reply was still on the wire since the last call
+     */
+    uint32_t takeBusCollisions();
+
+    /**
+     * @brief Wait out the register library's reply delay after one of its writes
+     */
+    void waitLibraryWrite(uint32_t us);
+
+    /**
+     * @brief Time spent in the register library's writes since the last call
+     */
+    uint64_t takeLibraryWriteMicros();
+
+    void digitalWrite(uint8_t pin, uint8_t level);
+    int digitalRead(uint8_t pin) const;
+
+    /**
+     * @brief Count one xTaskNotifyGive(), no task is ever woken
+     */
+    void notifyTask();
+
+    /**
+     * @brief Task notifications given since the last call, to any task
+     */
+    uint32_t takeTaskNotifications();
+};
@@ -0,0 +1,278 @@
+// Host check of the learned temperature model (src/autofocus/focus_model.h) against synthetic
+// drift: simulates nights of falling temperature on a telescope whose best focus follows a curved
+// temperature law, and keeps it in focus the way FocusCompensation does, with a full focus run
+// whenever the focuser drifts out of the critical focus zone.
+//
+//   pio run -e focus_model_check && .pio/build/focus_model_check/program [--nights N] [--seed N]
+//
+// Three strategies see the same nights: no compensation, one linear coefficient (the Moonlite SC
+// value, fitted to the first night's runs) and the learned model, which records every run. It
+// reports focus runs per night, the focus error between runs and the model's prediction error,
+// and fails if the learned model needs more runs than the linear coefficient once it has learned
+// a night, or predicts the curve worse than the focus zone.
+
+#include <chrono>
+#include <getopt.h>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "autofocus/focus_model.h"
+
+namespace
+{
+    constexpr double CRITICAL_FOCUS_ZONE = 25.0; // steps either side of best focus
+    constexpr double RUN_NOISE = 4.0;            // standard deviation of a focus run's result, steps
+    constexpr double NIGHT_OFFSET = 6.0;         // standard deviation of the night to night focus offset
+    constexpr int SAMPLE_MINUTES = 1;            // temperature sample period
+    constexpr int NIGHT_MINUTES = 8 * 60;
+    constexpr long MIN_CORRECTION = 4;           // FocusCompensation::MIN_CORRECTION
+
+    // Best focus in steps against temperature in degrees: the drawtube contracts faster in the cold
+    double trueFocus(double temperature)
+    {
+        double t = temperature - 20.0;
+        return 20000.0 - 18.0 * t + 0.6 * t * t;
+    }
+
+    int16_t toHalfDegrees(double temperature)
+    {
+        return static_cast<int16_t>(lround(temperature * 2.0));
+    }
+
+    struct Night
+    {
+        std::vector<double> temperatures; // one per sample
+        double offset;                    // focus shift of the whole night, e.g. a filter or camera tilt
+    };
+
+    Night makeNight(std::mt19937 &random)
+    {
+        std::uniform_real_distribution<double> start(10.0, 20.0);
+        std::uniform_real_distribution<double> drop(8.0, 16.0);
+        std::normal_distribution<double> wiggle(0.0, 0.15);
+        std::normal_distribution<double> offset(0.0, NIGHT_OFFSET);
+
+        Night night;
+        double first = start(random);
+        double total_drop = drop(random);
+        double noise = 0.0;
+        for (int minute = 0; minute < NIGHT_MINUTES; minute += SAMPLE_MINUTES)
+        {
+            // most of the drop in the first hours after sunset, with slow weather wiggles on top
+            noise = 0.95 * noise + wiggle(random);
+            night.temperatures.push_back(first - total_drop * (1.0 - exp(-minute / 150.0)) + noise);
+        }
+        night.offset = offset(random);
+        return night;
+    }
+
+    enum class Strategy
+    {
+        NONE,
+        LINEAR,
+        LEARNED,
+    };
+
+    const char *strategyName(Strategy strategy)
+    {
+        switch (strategy)
+        {
+        case Strategy::NONE:
+            return "none";
+        case Strategy::LINEAR:
+            return "linear";
+        default:
+            return "learned";
+        }
+    }
+
+    struct NightResult
+    {
+        int runs = 0;
+        double error_sum = 0.0;
+        double error_max = 0.0;
+        int samples = 0;
+    };
+
+    // One night with FocusCompensation's logic: correct from the reference temperature, refocus when out of the zone
+    NightResult runNight(const Night &night, Strategy strategy, FocusModel &model, int8_t slope, std::mt19937 &random,
+                         std::vector<std::pair<int16_t, long>> *runs)
+    {
+        std::normal_distribution<double> run_noise(0.0, RUN_NOISE);
+        NightResult result;
+        long position = 0;
+        int16_t reference = 0;
+        bool focused = false;
+
+        for (double temperature : night.temperatures)
+        {
+            int16_t reading = toHalfDegrees(temperature);
+            double best = trueFocus(temperature) + night.offset;
+
+            if (focused && strategy != Strategy::NONE)
+            {
+                FocusModel empty;
+                const FocusModel &used = (strategy == Strategy::LEARNED) ? model : empty;
+                long correction = used.getCorrection(reference, reading, slope);
+                if (labs(correction) >= MIN_CORRECTION)
+                {
+                    position += correction;
+                    reference = reading;
+                }
+            }
+
+            if (!focused || fabs(position - best) > CRITICAL_FOCUS_ZONE)
+            {
+                position = lround(best + run_noise(random));
+                reference = reading;
+                focused = true;
+                result.runs++;
+                if (strategy == Strategy::LEARNED)
+                    model.record(reading, position);
+                if (runs != nullptr)
+                    runs->push_back({reading, position});
+            }
+
+            double error = fabs(position - best);
+            result.error_sum += error;
+            result.error_max = std::max(result.error_max, error);
+            result.samples++;
+        }
+        return result;
+    }
+
+    // Least-squares steps per degree through a night's runs, the coefficient a user would set with SC
+    int8_t fitSlope(const std::vector<std::pair<int16_t, long>> &runs)
+    {
+        double n = runs.size(), sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (const auto &run : runs)
+        {
+            double x = run.first / 2.0;
+            sx += x;
+            sy += run.second;
+            sxx += x * x;
+            sxy += x * run.second;
+        }
+        double denominator = n * sxx - sx * sx;
+        double slope = denominator > 0.0 ? (n * sxy - sx * sy) / denominator : 0.0;
+        return static_cast<int8_t>(std::max(-128.0, std::min(127.0, round(slope))));
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [--nights N] [--seed N]\n"
+                "  --nights N  nights simulated, the first one calibrates, default 30\n"
+                "  --seed N    random seed for the weather and the focus runs\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int nights = 30;
+    unsigned long seed = 1;
+
+    static const option options[] = {
+        {"nights", required_argument, nullptr, 'n'},
+        {"seed", required_argument, nullptr, 's'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            nights = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, nullptr, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+    if (nights < 2)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::mt19937 weather(seed);
+    std::vector<Night> schedule;
+    for (int i = 0; i < nights; i++)
+        schedule.push_back(makeNight(weather));
+
+    // The first night calibrates: the linear coefficient is fitted to its runs, the model records them
+    FocusModel model;
+    std::vector<std::pair<int16_t, long>> calibration;
+    std::mt19937 calibration_runs(seed + 1);
+    runNight(schedule[0], Strategy::LEARNED, model, 0, calibration_runs, &calibration);
+    int8_t slope = fitSlope(calibration);
+
+    printf("calibration night: %zu runs, linear coefficient %d steps per degree, %zu model points\n\n",
+           calibration.size(), slope, model.getCount());
+    printf("%-8s %12s %12s %12s\n", "strategy", "runs/night", "mean_error", "max_error");
+
+    double runs_per_night[3] = {};
+    for (Strategy strategy : {Strategy::NONE, Strategy::LINEAR, Strategy::LEARNED})
+    {
+        FocusModel learned = model;
+        std::mt19937 focus_runs(seed + 2); // the same run noise for every strategy
+        int runs = 0;
+        double error_sum = 0.0, error_max = 0.0;
+        int samples = 0;
+        for (int i = 1; i < nights; i++)
+        {
+            NightResult result = runNight(schedule[i], strategy, learned, slope, focus_runs, nullptr);
+            runs += result.runs;
+            error_sum += result.error_sum;
+            error_max = std::max(error_max, result.error_max);
+            samples += result.samples;
+        }
+        runs_per_night[static_cast<int>(strategy)] = static_cast<double>(runs) / (nights - 1);
+        printf("%-8s %12.2f %12.1f %12.1f\n", strategyName(strategy), runs_per_night[static_cast<int>(strategy)],
+               error_sum / samples, error_max);
+
+        if (strategy == Strategy::LEARNED)
+            model = learned;
+    }
+
+    // How well the learned knots follow the curve over the temperatures the nights covered
+    double prediction_max = 0.0;
+    long anchor;
+    model.predict(toHalfDegrees(10.0), anchor);
+    for (int16_t reading = model.getPoints()[0].temperature; reading <= model.getPoints()[model.getCount() - 1].temperature;
+         reading++)
+    {
+        long predicted;
+        model.predict(reading, predicted);
+        // only differences matter, compare against the curve through the same anchor
+        double expected = trueFocus(reading / 2.0) - trueFocus(10.0);
+        prediction_max = std::max(prediction_max, fabs((predicted - anchor) - expected));
+    }
+
+    // Interpolation cost, it runs on every temperature check
+    auto started = std::chrono::steady_clock::now();
+    long sink = 0;
+    constexpr int CALLS = 1000000;
+    for (int i = 0; i < CALLS; i++)
+        sink += labs(model.getCorrection(static_cast<int16_t>(i % 40), static_cast<int16_t>((i * 7) % 40), slope));
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / CALLS;
+
+    printf("\nmodel: %zu points from %.1f to %.1f degrees, largest prediction error %.1f steps (zone %.0f)\n",
+           model.getCount(), model.getPoints()[0].temperature / 2.0,
+           model.getPoints()[model.getCount() - 1].temperature / 2.0, prediction_max, CRITICAL_FOCUS_ZONE);
+    printf("getCorrection: %.1f ns per call on this host (checksum %ld)\n", ns, sink);
+
+    bool ok = runs_per_night[static_cast<int>(Strategy::LEARNED)] <= runs_per_night[static_cast<int>(Strategy::LINEAR)] &&
+              runs_per_night[static_cast<int>(Strategy::LEARNED)] < runs_per_night[static_cast<int>(Strategy::NONE)] &&
+              prediction_max < CRITICAL_FOCUS_ZONE;
+    return ok ? 0 : 1;
+}
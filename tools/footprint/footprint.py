@@ -0,0 +1,328 @@
+# Static RAM and flash use per firmware subsystem, read from the linker map.
+#
+# As a PlatformIO post script it runs after every firmware link and prints the report; the map is
+# requested with -Wl,-Map and -Wl,--cref in platformio.ini. Standalone:
+#
+#   python tools/footprint/footprint.py .pio/build/esp32_c3_super_mini/firmware.map
+#
+# Options (environment variables under PlatformIO):
+#   --baseline FILE    compare against a saved report, default tools/footprint/baseline.json
+#   --update           write the current numbers to the baseline (FOOTPRINT_UPDATE=1)
+#   --heap-guard       fail if a firmware source references an allocator (builds with EAF_HEAP_GUARD)
+#   --source-dir DIR   firmware sources to read the types of globals from, default src/
+#
+# Flash is code, read-only data and the initial values of initialised data; RAM is initialised and
+# zeroed data plus code placed in IRAM. Sizes are those of the input sections the linker kept.
+#
+# With -ffunction-sections and -fdata-sections every input section is named after its symbol, and
+# a symbol counts towards the subsystem of its class or namespace, so a MotionController method
+# counts towards motion wherever it is defined. Globals have no type in their name: the types of
+# the globals defined in src/*.cpp are read from the sources, so motionControllers in main.cpp
+# counts towards motion too. Anything else counts towards the file defining it.
+
+import json
+import os
+import re
+import sys
+
+# First matching pattern wins, patterns are matched against the object path from the map
+SUBSYSTEMS = [
+    ("protocol", [r"/src/moonlite/", r"/src/app/"]),
+    ("motion", [r"/src/stepper/motion_controller", r"/src/stepper/ramp_table", r"/src/stepper/autotune",
+                r"/src/stepper/rmt_step_stream",
+                r"/src/tasks/", r"/src/storage/"]),
+    ("driver tmc2209", [r"/src/stepper/driver/tmc2209"]),
+    ("driver drv8825", [r"/src/stepper/driver/drv8825"]),
+    ("driver ulm2003", [r"/src/stepper/driver/ulm2003"]),
+    ("driver rmt", [r"/src/stepper/driver/rmt_step_channel"]),
+    ("autofocus", [r"/src/autofocus/", r"/src/filters/"]),
+    ("telemetry", [r"/src/telemetry/", r"/src/sensors/"]),
+    ("main", [r"/src/main\.cpp", r"/src/util/"]),
+    ("TMCStepper", [r"TMCStepper"]),
+    ("arduino core", [r"FrameworkArduino", r"framework-arduino"]),
+    ("toolchain libs", [r"lib(c|m|g|gcc|stdc\+\+|nosys)(_nano)?\.a"]),
+]
+OTHER = "other (ESP-IDF, linker)"
+
+# First matching class or namespace wins, matched against every component of a symbol's name
+SYMBOL_SUBSYSTEMS = [
+    ("protocol", ["Moonlite", "BinaryFrame", "CommandSpec", "Command", "Response", "AppContext",
+                  "COMMAND_TABLE"]),
+    ("motion", ["MotionController", "RampTable", "MotionProfile", "ResonanceBand", "Autotune", "MotionTask",
+                "RmtStepStream", "SpscQueue", "ProfileStore", "DEFAULT_PROFILES"]),
+    ("driver tmc2209", ["TMC2209Driver"]),
+    ("driver drv8825", ["DRV8825Driver"]),
+    ("driver ulm2003", ["ULM2003Driver"]),
+    ("driver rmt", ["RmtStepChannel"]),
+    ("autofocus", ["Autofocus", "VCurveFit", "FocusModel", "FocusModelStore", "FocusCompensation",
+                   "FilterOffsets", "FilterOffsetStore"]),
+    ("telemetry", ["Telemetry", "TemperatureSensor"]),
+    ("TMCStepper", ["TMCStepper", "TMC2208Stepper", "TMC2209Stepper", "TMC_UART"]),
+]
+
+# Allocation entry points, plus every operator new, mangled or as ld demangles it in the map
+ALLOCATORS = {"malloc", "calloc", "realloc", "strdup", "strndup", "_malloc_r", "_calloc_r", "_realloc_r",
+              "heap_caps_malloc", "heap_caps_calloc", "heap_caps_realloc", "pvPortMalloc"}
+# Objects built from this project's src/, libraries are built elsewhere under .pio/build/<env>
+FIRMWARE_SOURCE = re.compile(r"/build/[^/]+/src/")
+# The guard itself forwards to malloc until setup() ends
+ALLOCATOR_ALLOWED = re.compile(r"/src/util/heap_guard\.cpp")
+
+# Namespace-scope definitions at the start of a line, "Type name[...] ..." or "Type name(...)"
+GLOBAL_DEFINITION = re.compile(r"^(?:static\s+|const\s+|constexpr\s+)*([A-Z]\w*)(?:<[^>]*>)?\s+(\w+)\s*[\[({=;]",
+                               re.MULTILINE)
+# Section name prefixes of -ffunction-sections and -fdata-sections
+SYMBOL_SECTION = re.compile(r"^\.(?:text|literal|iram1|rodata|data|sdata|srodata|bss|sbss|dram1)\.(.+)$")
+
+SECTION_LINE = re.compile(r"^ (\.\S+|COMMON)(?:\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(.+))?$")
+ADDRESS_LINE = re.compile(r"^\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(.+)$")
+
+
+def is_allocator(symbol):
+    name = symbol.split("@")[0]
+    return name in ALLOCATORS or name.startswith(("operator new", "_Znw", "_Zna"))
+
+
+def classify(output_section):
+    """(flash, ram) flags for an output section"""
+    name = output_section.lower()
+    if name.startswith((".debug", ".comment", ".note", ".stab", ".riscv.attributes", ".xt.")):
+        return False, False
+    if "bss" in name or "noinit" in name or name == "common":
+        return False, True
+    if "data" in name and "rodata" not in name or "iram" in name or "dram" in name or "rtc" in name:
+        return True, True
+    return True, False
+
+
+def subsystem(path):
+    path = "/" + path.replace("\\", "/")
+    for name, patterns in SUBSYSTEMS:
+        if any(re.search(pattern, path) for pattern in patterns):
+            return name
+    return OTHER
+
+
+def name_components(symbol):
+    """Names in a symbol, outermost first: the nested name of a mangled symbol, else the symbol"""
+    if not symbol.startswith("_Z"):
+        return [symbol]
+    rest = symbol[2:]
+    # vtables, typeinfo and guard variables, then the enclosing function of a local static
+    for prefix in ("TV", "TI", "TS", "GV", "Z", "L"):
+        if rest.startswith(prefix):
+            rest = rest[len(prefix):]
+    if rest.startswith("N"):
+        rest = rest[1:].lstrip("rVKRO")
+    components = []
+    while rest[:1].isdigit():
+        digits = re.match(r"\d+", rest).group(0)
+        length = int(digits)
+        components.append(rest[len(digits):len(digits) + length])
+        rest = rest[len(digits) + length:]
+    return components
+
+
+def global_types(source_dir):
+    """Type of each namespace-scope global defined in the firmware sources, by name"""
+    types = {}
+    for root, _, files in os.walk(source_dir):
+        for file_name in files:
+            if file_name.endswith(".cpp"):
+                with open(os.path.join(root, file_name), errors="replace") as source:
+                    for type_name, name in GLOBAL_DEFINITION.findall(source.read()):
+                        types.setdefault(name, type_name)
+    return types
+
+
+def symbol_subsystem(section, types):
+    """Subsystem of the class or namespace an input section's symbol belongs to, None if unknown"""
+    match = SYMBOL_SECTION.match(section)
+    if not match:
+        return None
+    components = name_components(match.group(1))
+    if len(components) == 1 and components[0] in types:
+        components = [types[components[0]]]
+    for name, classes in SYMBOL_SUBSYSTEMS:
+        if any(component in classes for component in components):
+            return name
+    return None
+
+
+def parse_map(path, types):
+    """Per-subsystem sizes and the allocator cross references of a GNU ld map"""
+    sizes = {}
+    references = {}
+    output_section = None
+    pending = None  # input section whose address line follows on the next line
+    in_memory_map = False
+    in_cref = False
+    cref_symbol = None
+    cref_definer_pending = False  # long symbol names put the defining file on the next line
+
+    with open(path, errors="replace") as lines:
+        for line in lines:
+            line = line.rstrip("\n")
+
+            if line.startswith("Linker script and memory map"):
+                in_memory_map = True
+                continue
+            if line.startswith("Cross Reference Table"):
+                in_memory_map = False
+                in_cref = True
+                continue
+
+            if in_cref:
+                # symbol and defining file on one line, referencing files indented on the following ones
+                if not line.strip() or line.startswith("Symbol"):
+                    continue
+                if not line[0].isspace():
+                    # demangled names contain spaces, the file starts at column 50
+                    symbol = line[:50].strip() if len(line) > 50 else line.strip()
+                    cref_symbol = symbol if is_allocator(symbol) else None
+                    cref_definer_pending = len(line) <= 50
+                    continue
+                if cref_definer_pending:
+                    cref_definer_pending = False
+                    continue
+                if cref_symbol is not None:
+                    references.setdefault(cref_symbol, []).append(line.strip())
+                continue
+
+            if not in_memory_map:
+                continue
+
+            if line.startswith(".") or line.startswith("COMMON"):
+                output_section = line.split()[0]
+                pending = None
+                continue
+
+            match = SECTION_LINE.match(line)
+            if match:
+                if match.group(2) is None:
+                    pending = match.group(1)
+                    continue
+                section, size, source = match.group(1), int(match.group(3), 16), match.group(4)
+            elif pending is not None and ADDRESS_LINE.match(line):
+                match = ADDRESS_LINE.match(line)
+                section, size, source = pending, int(match.group(2), 16), match.group(3)
+            else:
+                pending = None
+                continue
+            pending = None
+
+            if size == 0 or output_section is None or source.startswith("load address"):
+                continue
+            flash, ram = classify(output_section)
+            if not flash and not ram:
+                continue
+            owner = symbol_subsystem(section, types) if FIRMWARE_SOURCE.search("/" + source) else None
+            entry = sizes.setdefault(owner or subsystem(source), {"flash": 0, "ram": 0})
+            if flash:
+                entry["flash"] += size
+            if ram:
+                entry["ram"] += size
+
+    return sizes, references
+
+
+def report(sizes, baseline):
+    order = [name for name, _ in SUBSYSTEMS] + [OTHER]
+    rows = [name for name in order if name in sizes or name in baseline]
+    lines = ["%-24s %10s %10s %10s %10s" % ("subsystem", "flash", "delta", "ram", "delta")]
+    total = {"flash": 0, "ram": 0}
+    total_base = {"flash": 0, "ram": 0}
+    for name in rows:
+        now = sizes.get(name, {"flash": 0, "ram": 0})
+        base = baseline.get(name, now)
+        for key in total:
+            total[key] += now[key]
+            total_base[key] += base[key]
+        lines.append("%-24s %10d %+10d %10d %+10d" % (name, now["flash"], now["flash"] - base["flash"],
+                                                    now["ram"], now["ram"] - base["ram"]))
+    lines.append("%-24s %10d %+10d %10d %+10d" % ("total", total["flash"], total["flash"] - total_base["flash"],
+                                                total["ram"], total["ram"] - total_base["ram"]))
+    return "\n".join(lines)
+
+
+def firmware_allocations(references):
+    """Firmware sources that reference an allocator, as (source, symbol) pairs"""
+    found = []
+    for symbol, sources in sorted(references.items()):
+        for source in sources:
+            path = "/" + source.replace("\\", "/")
+            if FIRMWARE_SOURCE.search(path) and not ALLOCATOR_ALLOWED.search(path):
+                found.append((source, symbol))
+    return found
+
+
+def run(map_path, baseline_path, update, heap_guard, source_dir):
+    if not os.path.exists(map_path):
+        print("footprint: %s not found, link with -Wl,-Map" % map_path)
+        return 1
+
+    sizes, references = parse_map(map_path, global_types(source_dir))
+    baseline = {}
+    if os.path.exists(baseline_path):
+        with open(baseline_path) as baseline_file:
+            baseline = json.load(baseline_file)
+
+    print("Static footprint by subsystem (bytes, delta against %s)" % os.path.relpath(baseline_path))
+    print(report(sizes, baseline))
+    if not baseline and not update:
+        print("footprint: empty baseline, record one with FOOTPRINT_UPDATE=1 (or --update)")
+
+    if update:
+        with open(baseline_path, "w") as baseline_file:
+            json.dump(sizes, baseline_file, indent=2, sort_keys=True)
+            baseline_file.write("\n")
+        print("footprint: baseline updated")
+
+    if heap_guard:
+        if not references:
+            print("footprint: no cross reference table in the map, link with -Wl,--cref")
+            return 1
+        found = firmware_allocations(references)
+        for source, symbol in found:
+            print("footprint: %s references %s, firmware sources must not allocate" % (source, symbol))
+        if found:
+            return 1
+    return 0
+
+
+def default_baseline():
+    return os.path.join(os.path.dirname(os.path.abspath(__file__)), "baseline.json")
+
+
+def default_source_dir():
+    return os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "src")
+
+
+try:
+    Import("env")  # noqa: F821, provided by PlatformIO
+except NameError:
+    env = None
+
+if env is not None:
+    def after_link(target, source, env):
+        defines = [define[0] if isinstance(define, (list, tuple)) else define for define in env.get("CPPDEFINES", [])]
+        status = run(env.subst("$BUILD_DIR/firmware.map"),
+                     os.path.join(env.subst("$PROJECT_DIR"), "tools", "footprint", "baseline.json"),
+                     os.environ.get("FOOTPRINT_UPDATE") == "1",
+                     "EAF_HEAP_GUARD" in defines,
+                     env.subst("$PROJECT_SRC_DIR"))
+        if status != 0:
+            env.Exit(status)
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", after_link)
+elif __name__ == "__main__":
+    import argparse
+
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("map")
+    parser.add_argument("--baseline", default=default_baseline())
+    parser.add_argument("--update", action="store_true")
+    parser.add_argument("--heap-guard", action="store_true")
+    parser.add_argument("--source-dir", default=default_source_dir())
+    arguments = parser.parse_args()
+    sys.exit(run(arguments.map, arguments.baseline, arguments.update, arguments.heap_guard, arguments.source_dir))
@@ -0,0 +1,235 @@
+// Host latency check of jogging (MotionController::setJogVelocity(), XJV): runs the firmware on the
+// emulator's virtual clock, sends XJV while the focuser jogs at a steady speed and times, from the
+// command to the STEP pulses, how long it takes before the pulse timing follows the new velocity.
+// Commands land at random points between two steps.
+//
+//   pio run -e jog_check && .pio/build/jog_check/program [--trials N] [--seed N]
+//
+// Latency runs to the first pulse off the old schedule: a pulse earlier than the steady interval,
+// or the moment a pulse due at the steady interval did not come. Per scenario it reports the worst
+// latency, also in steady step intervals, and fails when a speed-up takes more than one interval
+// (it re-times the pending step) or a slow-down, stop or reversal more than two (it starts at the
+// pending step, so the step after that is the first one late). The watchdog stop is timed from
+// JOG_TIMEOUT_MS after the last refresh. From rest the first step also waits for the coils to
+// settle at the raised hold current, that latency is reported only.
+
+#include <getopt.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../emulator/firmware_session.h"
+
+namespace
+{
+    constexpr unsigned long REFRESH_US = 200000; // hand controllers repeat XJV well inside the watchdog
+    constexpr unsigned long JOG_TIMEOUT_MS = 500; // MotionController::JOG_TIMEOUT_US
+    constexpr unsigned long SETTLE_US = 4000000;  // enough to reach any jog speed on the default profile
+    constexpr unsigned long CHANGE_TIMEOUT_US = 2000000;
+
+    struct Scenario
+    {
+        const char *name;
+        int from;         // steps/s jogged before the command, 0 starts from rest
+        int to;           // velocity sent
+        bool stop_refresh; // send nothing, the watchdog has to stop the jog
+        double max_intervals; // allowed latency in steady step intervals, 0 reports only
+    };
+
+    const Scenario SCENARIOS[] = {
+        {"start", 0, 150, false, 0.0},
+        {"faster", 100, 200, false, 1.0},
+        {"slower", 200, 100, false, 2.0},
+        {"stop", 150, 0, false, 2.0},
+        {"reverse", 150, -150, false, 2.0},
+        {"watchdog", 150, 150, true, 2.0},
+    };
+
+    struct Tracker
+    {
+        long position;
+        uint64_t last_step_us = 0;
+        unsigned long interval_us = 0; // between the last two steps
+        uint64_t last_refresh_us = 0;
+    };
+
+    enum class Watch
+    {
+        NOTHING,
+        FIRST_STEP, // from rest
+        SCHEDULE,   // pulses leaving the steady interval
+    };
+
+    void sendVelocity(Tracker &tracker, int velocity)
+    {
+        char command[16];
+        snprintf(command, sizeof(command), ":XJV%04X#", static_cast<uint16_t>(velocity));
+        tracker.last_refresh_us = VirtualHardware::instance().micros();
+        FirmwareSession::send(command);
+    }
+
+    // Runs the firmware to until_us, refreshing the jog velocity unless it is left to the watchdog;
+    // returns the time of what it watches for, 0 if that did not happen
+    uint64_t runJog(Tracker &tracker, uint64_t until_us, int velocity, bool refresh, Watch watch,
+                    unsigned long steady_us = 0, bool outward = true)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        MotionController &controller = motionControllers[0];
+        while (hardware.micros() < until_us)
+        {
+            uint64_t now = hardware.micros();
+            uint64_t expected_us = tracker.last_step_us + steady_us;
+            if (watch == Watch::SCHEDULE && now > expected_us)
+                return expected_us; // the step due on the old schedule did not come
+
+            uint64_t next_refresh_us = tracker.last_refresh_us + REFRESH_US;
+            if (refresh && now >= next_refresh_us)
+            {
+                sendVelocity(tracker, velocity);
+                next_refresh_us = now + REFRESH_US;
+            }
+
+            FirmwareSession::step(refresh ? min(until_us, next_refresh_us) : until_us);
+
+            // loop() stepped at the time it ran
+            long position = controller.getCurrentPosition();
+            if (position == tracker.position)
+                continue;
+
+            bool step_outward = position > tracker.position;
+            unsigned long interval_us = tracker.last_step_us > 0 ? now - tracker.last_step_us : 0;
+            tracker.position = position;
+            tracker.last_step_us = now;
+            tracker.interval_us = interval_us;
+            if (watch == Watch::FIRST_STEP)
+                return now;
+            if (watch == Watch::SCHEDULE && (interval_us != steady_us || step_outward != outward))
+                return min(now, expected_us);
+        }
+        return 0;
+    }
+
+    struct Result
+    {
+        unsigned long worst_us = 0;
+        double worst_intervals = 0.0;
+        int missing = 0;
+    };
+
+    Result runScenario(const Scenario &scenario, int trials, std::mt19937 &random)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        Result result;
+        for (int trial = 0; trial < trials; trial++)
+        {
+            Tracker tracker = {motionControllers[0].getCurrentPosition()};
+            uint64_t command_us;
+            uint64_t changed_us;
+            unsigned long steady_us = 0;
+
+            if (scenario.from != 0)
+            {
+                // jog until the speed is steady, then wait a random part of an interval
+                sendVelocity(tracker, scenario.from);
+                runJog(tracker, hardware.micros() + SETTLE_US, scenario.from, true, Watch::NOTHING);
+                steady_us = tracker.interval_us;
+                std::uniform_int_distribution<unsigned long> phase(0, steady_us);
+                runJog(tracker, hardware.micros() + phase(random), scenario.from, true, Watch::NOTHING);
+
+                if (!scenario.stop_refresh)
+                    sendVelocity(tracker, scenario.to);
+                command_us = tracker.last_refresh_us;
+                changed_us = runJog(tracker, hardware.micros() + CHANGE_TIMEOUT_US, scenario.to, !scenario.stop_refresh,
+                                    Watch::SCHEDULE, steady_us, scenario.from > 0);
+            }
+            else
+            {
+                // from rest with the hold current dropped, the way a hand pad finds the focuser
+                FirmwareSession::run(2000000 + std::uniform_int_distribution<unsigned long>(0, 100000)(random));
+                sendVelocity(tracker, scenario.to);
+                command_us = tracker.last_refresh_us;
+                changed_us = runJog(tracker, hardware.micros() + CHANGE_TIMEOUT_US, scenario.to, true, Watch::FIRST_STEP);
+            }
+
+            if (changed_us == 0)
+            {
+                result.missing++;
+            }
+            else
+            {
+                unsigned long latency_us = changed_us - command_us;
+                if (scenario.stop_refresh)
+                    latency_us -= min<unsigned long>(latency_us, JOG_TIMEOUT_MS * 1000);
+                result.worst_us = max(result.worst_us, latency_us);
+                if (steady_us > 0)
+                    result.worst_intervals = max(result.worst_intervals, static_cast<double>(latency_us) / steady_us);
+            }
+
+            sendVelocity(tracker, 0);
+            FirmwareSession::runUntilIdle(10000000);
+        }
+        return result;
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --trials N   commands per scenario, at random points between steps (default 50)\n"
+                "  --seed N     random seed (default 1)\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int trials = 50;
+    unsigned long seed = 1;
+
+    static const option options[] = {
+        {"trials", required_argument, nullptr, 't'},
+        {"seed", required_argument, nullptr, 's'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 't':
+            trials = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, nullptr, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (trials <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FirmwareSession::begin();
+    std::mt19937 random(seed);
+
+    bool ok = true;
+    printf("%-9s %6s %6s %12s %10s %8s\n", "scenario", "from", "to", "latency_us", "intervals", "missing");
+    for (const Scenario &scenario : SCENARIOS)
+    {
+        Result result = runScenario(scenario, trials, random);
+        bool passed = result.missing == 0 && (scenario.max_intervals == 0.0 || result.worst_intervals <= scenario.max_intervals);
+        printf("%-9s %6d %6d %12lu %10.2f %8d %s\n", scenario.name, scenario.from, scenario.to, result.worst_us,
+               result.worst_intervals, result.missing, passed ? "ok" : "FAIL");
+        ok &= passed;
+    }
+    printf("latency is the worst over %d trials from XJV to the first pulse off the old schedule;\n"
+           "watchdog is timed from %lu ms after the last refresh\n",
+           trials, JOG_TIMEOUT_MS);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,323 @@
+// Scripted Moonlite load generator: replays a command script against a serial device (the
+// emulator's pseudo-terminal or real hardware) and reports the round-trip latency distribution.
+//
+//   .pio/build/loadgen/program --device /tmp/eaf --iterations 1000 script.txt
+//
+// Script lines:
+//   :SN1000#      send, no reply expected
+//   ? :GP#        send and time the '#' terminated reply
+//   wait 100      pause for 100 ms
+//   # ...         comment
+// Without a script the polled getters (GP, GN, GI, GD, GH, GV) are timed.
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Step
+    {
+        enum class Kind
+        {
+            SEND,
+            QUERY,
+            WAIT,
+        };
+
+        Kind kind;
+        std::string text;
+        long wait_ms;
+    };
+
+    const char *DEFAULT_SCRIPT[] = {"? :GP#", "? :GN#", "? :GI#", "? :GD#", "? :GH#", "? :GV#"};
+
+    std::string trim(const std::string &line)
+    {
+        size_t begin = line.find_first_not_of(" \t\r\n");
+        size_t end = line.find_last_not_of(" \t\r\n");
+        return begin == std::string::npos ? std::string() : line.substr(begin, end - begin + 1);
+    }
+
+    bool parseLine(const std::string &raw, std::vector<Step> &script)
+    {
+        std::string line = trim(raw);
+        if (line.empty() || line[0] == '#')
+            return true;
+
+        if (line.compare(0, 5, "wait ") == 0)
+            script.push_back({Step::Kind::WAIT, "", strtol(line.c_str() + 5, nullptr, 10)});
+        else if (line[0] == '?')
+            script.push_back({Step::Kind::QUERY, trim(line.substr(1)), 0});
+        else if (line[0] == ':')
+            script.push_back({Step::Kind::SEND, line, 0});
+        else
+            return false;
+        return true;
+    }
+
+    speed_t baudConstant(unsigned long baud)
+    {
+        switch (baud)
+        {
+        case 9600:
+            return B9600;
+        case 19200:
+            return B19200;
+        case 38400:
+            return B38400;
+        case 57600:
+            return B57600;
+        case 115200:
+            return B115200;
+        default:
+            return B0;
+        }
+    }
+
+    int openDevice(const char *path, unsigned long baud)
+    {
+        int fd = open(path, O_RDWR | O_NOCTTY);
+        if (fd < 0)
+            return -1;
+
+        termios settings;
+        if (tcgetattr(fd, &settings) == 0)
+        {
+            cfmakeraw(&settings);
+            if (baudConstant(baud) != B0)
+            {
+                cfsetispeed(&settings, baudConstant(baud));
+                cfsetospeed(&settings, baudConstant(baud));
+            }
+            tcsetattr(fd, TCSANOW, &settings);
+        }
+        tcflush(fd, TCIOFLUSH);
+        return fd;
+    }
+
+    bool writeAll(int fd, const std::string &text)
+    {
+        size_t written = 0;
+        while (written < text.size())
+        {
+            ssize_t count = write(fd, text.data() + written, text.size() - written);
+            if (count < 0 && errno != EINTR)
+                return false;
+            if (count > 0)
+                written += count;
+        }
+        return true;
+    }
+
+    // Read up to and including '#', false on timeout
+    bool readReply(int fd, long timeout_ms, std::string &reply)
+    {
+        reply.clear();
+        Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+        for (;;)
+        {
+            long remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if (remaining_ms < 0)
+                return false;
+
+            pollfd descriptor = {fd, POLLIN, 0};
+            if (poll(&descriptor, 1, static_cast<int>(remaining_ms)) <= 0)
+                continue;
+
+            char ch;
+            if (read(fd, &ch, 1) == 1)
+            {
+                reply += ch;
+                if (ch == '#')
+                    return true;
+            }
+        }
+    }
+
+    double percentile(const std::vector<double> &sorted, double fraction)
+    {
+        size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+        return sorted[index];
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s --device PATH [options] [script]\n"
+                "  --iterations N      passes over the script (default 100)\n"
+                "  --baud N            set the line speed of a real serial device\n"
+                "  --timeout-ms N      reply timeout (default 1000)\n"
+                "  --histogram         print a latency histogram\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *device = nullptr;
+    long iterations = 100;
+    unsigned long baud = 0;
+    long timeout_ms = 1000;
+    bool histogram = false;
+
+    static const option options[] = {
+        {"device", required_argument, nullptr, 'd'},
+        {"iterations", required_argument, nullptr, 'n'},
+        {"baud", required_argument, nullptr, 'b'},
+        {"timeout-ms", required_argument, nullptr, 't'},
+        {"histogram", no_argument, nullptr, 'H'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            device = optarg;
+            break;
+        case 'n':
+            iterations = strtol(optarg, nullptr, 10);
+            break;
+        case 'b':
+            baud = strtoul(optarg, nullptr, 10);
+            break;
+        case 't':
+            timeout_ms = strtol(optarg, nullptr, 10);
+            break;
+        case 'H':
+            histogram = true;
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (device == nullptr)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<Step> script;
+    if (optind < argc)
+    {
+        FILE *file = fopen(argv[optind], "r");
+        if (file == nullptr)
+        {
+            fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+            return 1;
+        }
+        char line[256];
+        int number = 0;
+        while (fgets(line, sizeof(line), file) != nullptr)
+        {
+            number++;
+            if (!parseLine(line, script))
+            {
+                fprintf(stderr, "%s:%d: cannot parse '%s'\n", argv[optind], number, trim(line).c_str());
+                fclose(file);
+                return 1;
+            }
+        }
+        fclose(file);
+    }
+    else
+    {
+        for (const char *line : DEFAULT_SCRIPT)
+            parseLine(line, script);
+    }
+
+    int fd = openDevice(device, baud);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", device, strerror(errno));
+        return 1;
+    }
+
+    std::vector<double> latencies_us;
+    long timeouts = 0;
+    Clock::time_point started = Clock::now();
+
+    for (long pass = 0; pass < iterations; pass++)
+    {
+        for (const Step &step : script)
+        {
+            switch (step.kind)
+            {
+            case Step::Kind::WAIT:
+                usleep(step.wait_ms * 1000);
+                break;
+
+            case Step::Kind::SEND:
+                writeAll(fd, step.text);
+                break;
+
+            case Step::Kind::QUERY:
+            {
+                std::string reply;
+                Clock::time_point sent = Clock::now();
+                writeAll(fd, step.text);
+                if (!readReply(fd, timeout_ms, reply))
+                {
+                    timeouts++;
+                    tcflush(fd, TCIFLUSH);
+                    break;
+                }
+                latencies_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+                break;
+            }
+            }
+        }
+    }
+
+    double elapsed_s = std::chrono::duration<double>(Clock::now() - started).count();
+    close(fd);
+
+    printf("queries %zu, timeouts %ld, %.1f queries/s\n", latencies_us.size(), timeouts,
+           latencies_us.size() / elapsed_s);
+    if (latencies_us.empty())
+        return timeouts > 0 ? 1 : 0;
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+    printf("round trip us: min %.0f  p50 %.0f  p90 %.0f  p99 %.0f  max %.0f\n", latencies_us.front(),
+           percentile(latencies_us, 0.50), percentile(latencies_us, 0.90), percentile(latencies_us, 0.99),
+           latencies_us.back());
+
+    if (histogram)
+    {
+        // logarithmic buckets, powers of two from 64 us
+        std::vector<size_t> buckets;
+        for (double latency : latencies_us)
+        {
+            size_t bucket = 0;
+            while (latency >= (64 << bucket))
+                bucket++;
+            if (bucket >= buckets.size())
+                buckets.resize(bucket + 1);
+            buckets[bucket]++;
+        }
+        for (size_t bucket = 0; bucket < buckets.size(); bucket++)
+        {
+            size_t bar = buckets[bucket] * 50 / latencies_us.size();
+            printf("  < %7d us %7zu %s\n", 64 << bucket, buckets[bucket], std::string(bar, '*').c_str());
+        }
+    }
+    return timeouts > 0 ? 1 : 0;
+}
@@ -0,0 +1,344 @@
+// Replay benchmark for the protocol stack: feeds captured Moonlite sessions, with their timing,
+// through the serial RX callback and the dispatcher in src/main.cpp on a virtual clock, and
+// reports CPU time, heap allocations and reply latency per command type plus frame errors.
+//
+//   pio run -e replay && .pio/build/replay/program session.log [more.log ...]
+//
+// Capture format, one event per line:
+//   <time_us> > <bytes>   host to focuser, e.g.  120500 > :GP#
+//   <time_us> < <bytes>   focuser reply as logged, e.g.  121900 < 1234#
+//   # comment
+// Bytes may use \xHH and \\ escapes. Recorded replies are only compared by length, since the
+// simulated focuser does not end up at exactly the logged positions.
+
+#include <Arduino.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <errno.h>
+#include <getopt.h>
+#include <map>
+#include <new>
+#include <string>
+#include <time.h>
+#include <vector>
+#include "app/command_table.h"
+#include "moonlite/moonlite.h"
+#include "tasks/motion_task.h"
+#include "../emulator/virtual_hardware.h"
+
+void setup();
+void dispatchCommands();
+void dispatchRequests();
+extern Moonlite moonlite;
+extern MotionTask motionTask;
+
+// Allocation counting. GCC flags free() inside a replaced operator delete as a mismatch, it is not.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+namespace
+{
+    std::atomic<unsigned long> allocation_count{0};
+    std::atomic<unsigned long> allocation_bytes{0};
+}
+
+void *operator new(size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void *block = malloc(size ? size : 1))
+        return block;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *block) noexcept
+{
+    free(block);
+}
+
+void operator delete(void *block, size_t) noexcept
+{
+    free(block);
+}
+
+namespace
+{
+    // Mirrors the MotionController wiring in src/main.cpp
+    constexpr AxisWiring BOARD_AXES[] = {
+        {0b00, 6, 5, 0},
+        {0b01, 3, 4, 1},
+    };
+
+    struct Event
+    {
+        uint64_t time_us;
+        bool from_host;
+        std::string bytes;
+    };
+
+    struct Stats
+    {
+        std::vector<double> cpu_us;
+        std::vector<double> latency_us;
+        unsigned long allocations = 0;
+        unsigned long allocated_bytes = 0;
+        unsigned long unanswered = 0;  // a reply was logged but none was produced
+        unsigned long reply_mismatch = 0; // reply length differs from the logged one
+    };
+
+    double threadCpuUs()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+    }
+
+    bool unescape(const std::string &text, std::string &bytes)
+    {
+        bytes.clear();
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            if (text[i] != '\\')
+            {
+                bytes += text[i];
+                continue;
+            }
+            if (i + 1 < text.size() && text[i + 1] == '\\')
+            {
+                bytes += '\\';
+                i++;
+            }
+            else if (i + 3 < text.size() && text[i + 1] == 'x')
+            {
+                bytes += static_cast<char>(strtoul(text.substr(i + 2, 2).c_str(), nullptr, 16));
+                i += 3;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool loadCapture(const char *path, std::vector<Event> &events)
+    {
+        FILE *file = fopen(path, "r");
+        if (file == nullptr)
+        {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            return false;
+        }
+
+        char line[512];
+        int number = 0;
+        uint64_t offset_us = events.empty() ? 0 : events.back().time_us; // captures play back to back
+        while (fgets(line, sizeof(line), file) != nullptr)
+        {
+            number++;
+            std::string text(line);
+            while (!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+                text.pop_back();
+            if (text.empty() || text[0] == '#')
+                continue;
+
+            char *end;
+            uint64_t time_us = strtoull(text.c_str(), &end, 10);
+            size_t direction = end - text.c_str();
+            while (direction < text.size() && text[direction] == ' ')
+                direction++;
+
+            Event event;
+            if (direction + 2 > text.size() || (text[direction] != '>' && text[direction] != '<') ||
+                !unescape(text.substr(min(direction + 2, text.size())), event.bytes))
+            {
+                fprintf(stderr, "%s:%d: cannot parse event\n", path, number);
+                fclose(file);
+                return false;
+            }
+            event.time_us = offset_us + time_us;
+            event.from_host = text[direction] == '>';
+            events.push_back(event);
+        }
+        fclose(file);
+        return true;
+    }
+
+    // Command name for grouping, the opcode of the matching table entry
+    std::string commandName(const std::string &bytes)
+    {
+        if (!bytes.empty() && static_cast<uint8_t>(bytes[0]) == BinaryFrame::SYNC)
+            return "binary";
+
+        size_t start = bytes.find(':');
+        if (start == std::string::npos)
+            return "?";
+        std::string message = bytes.substr(start + 1);
+        if (!message.empty() && message[0] == '2')
+            message.erase(0, 1);
+
+        for (const CommandSpec &spec : COMMAND_TABLE)
+        {
+            if (message.compare(0, strlen(spec.opcode), spec.opcode) == 0)
+                return spec.opcode;
+        }
+        return "?";
+    }
+
+    // Run motion until the virtual clock reaches time_us, jumping straight over idle stretches
+    void runMotionUntil(VirtualHardware &hardware, uint64_t time_us)
+    {
+        while (hardware.micros() < time_us)
+        {
+            unsigned long wait_us = motionTask.poll();
+            uint64_t next_us = (wait_us == ULONG_MAX) ? time_us : hardware.micros() + max(wait_us, 1UL);
+            hardware.advanceTo(min(next_us, time_us));
+        }
+    }
+
+    double percentile(std::vector<double> values, double fraction)
+    {
+        if (values.empty())
+            return 0.0;
+        std::sort(values.begin(), values.end());
+        return values[static_cast<size_t>(fraction * (values.size() - 1) + 0.5)];
+    }
+
+    double mean(const std::vector<double> &values)
+    {
+        double sum = 0.0;
+        for (double value : values)
+            sum += value;
+        return values.empty() ? 0.0 : sum / values.size();
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [--budget-us N] [--heap-free] capture [capture ...]\n"
+                "  --budget-us N   fail if any command type's p99 CPU time exceeds N microseconds\n"
+                "  --heap-free     fail if handling any command allocates from the heap\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double budget_us = 0.0;
+    bool heap_free = false;
+
+    static const option options[] = {
+        {"budget-us", required_argument, nullptr, 'b'},
+        {"heap-free", no_argument, nullptr, 'f'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'b':
+            budget_us = strtod(optarg, nullptr);
+            break;
+        case 'f':
+            heap_free = true;
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<Event> events;
+    for (int i = optind; i < argc; i++)
+    {
+        if (!loadCapture(argv[i], events))
+            return 1;
+    }
+
+    VirtualHardware &hardware = VirtualHardware::instance();
+    hardware.useManualClock();
+    for (const AxisWiring &axis : BOARD_AXES)
+        hardware.attachAxis(axis);
+
+    setup();
+
+    std::map<std::string, Stats> stats;
+    uint8_t reply[512];
+
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        const Event &event = events[i];
+        if (!event.from_host)
+            continue;
+
+        runMotionUntil(hardware, event.time_us);
+
+        Stats &entry = stats[commandName(event.bytes)];
+        unsigned long allocations = allocation_count.load();
+        unsigned long allocated_bytes = allocation_bytes.load();
+        auto started = std::chrono::steady_clock::now();
+        double cpu_started_us = threadCpuUs();
+
+        // Bytes arrive through the RX callback exactly as from the USB stack, then the dispatcher runs
+        Serial.deliver(reinterpret_cast<const uint8_t *>(event.bytes.data()), event.bytes.size());
+        dispatchCommands();
+        dispatchRequests();
+        size_t reply_length = Serial.takeTransmitted(reply, sizeof(reply));
+
+        double cpu_us = threadCpuUs() - cpu_started_us;
+        double latency_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count();
+        entry.allocations += allocation_count.load() - allocations;
+        entry.allocated_bytes += allocation_bytes.load() - allocated_bytes;
+        entry.cpu_us.push_back(cpu_us); // after reading the counters, vector growth is not the firmware's
+        entry.latency_us.push_back(latency_us);
+
+        // Compare against the reply logged right after this command, if any
+        if (i + 1 < events.size() && !events[i + 1].from_host)
+        {
+            if (reply_length == 0)
+                entry.unanswered++;
+            else if (reply_length != events[i + 1].bytes.size())
+                entry.reply_mismatch++;
+        }
+    }
+
+    printf("%-8s %8s %9s %9s %9s %11s %11s %8s %8s %6s %6s\n", "command", "count", "cpu_mean", "cpu_p99", "cpu_max",
+           "latency_p50", "latency_p99", "allocs", "bytes", "unans", "shape");
+
+    bool over_budget = false;
+    bool allocated = false;
+    unsigned long unanswered = 0;
+    unsigned long reply_mismatch = 0;
+    for (const auto &item : stats)
+    {
+        const Stats &entry = item.second;
+        double cpu_p99 = percentile(entry.cpu_us, 0.99);
+        over_budget |= budget_us > 0.0 && cpu_p99 > budget_us;
+        allocated |= heap_free && entry.allocations > 0;
+        unanswered += entry.unanswered;
+        reply_mismatch += entry.reply_mismatch;
+
+        printf("%-8s %8zu %9.2f %9.2f %9.2f %11.2f %11.2f %8lu %8lu %6lu %6lu\n", item.first.c_str(), entry.cpu_us.size(),
+               mean(entry.cpu_us), cpu_p99, *std::max_element(entry.cpu_us.begin(), entry.cpu_us.end()),
+               percentile(entry.latency_us, 0.50), percentile(entry.latency_us, 0.99), entry.allocations,
+               entry.allocated_bytes, entry.unanswered, entry.reply_mismatch);
+    }
+
+    printf("\nunknown %u, dropped %u, binary frame errors %u, unanswered %lu, reply shape mismatches %lu\n",
+           moonlite.getUnknownCommandCount(), moonlite.getDroppedCommandCount(), moonlite.getFrameErrorCount(),
+           unanswered, reply_mismatch);
+    printf("times in microseconds, cpu is thread CPU time for parse and dispatch, latency is wall time to the reply\n");
+
+    bool frame_errors = moonlite.getUnknownCommandCount() > 0 || moonlite.getDroppedCommandCount() > 0 ||
+                        moonlite.getFrameErrorCount() > 0 || unanswered > 0 || reply_mismatch > 0;
+    return (frame_errors || over_budget || allocated) ? 1 : 0;
+}
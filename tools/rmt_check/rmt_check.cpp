@@ -0,0 +1,335 @@
+// Host check of the RMT step stream (src/stepper/rmt_step_stream.h): plans moves the way
+// MotionController does with EAF_RMT_STEPPING, plays the encoded items through a model of the
+// ESP32-C3 channel (two halves refilled on the threshold interrupt, stop at the end marker) while
+// the producer only wakes when getRefillDelayUs() says so, plus a random wake-up latency, and
+// compares the pulses on the modelled STEP pin with the live per-pulse ramp of update().
+//
+//   pio run -e rmt_check && .pio/build/rmt_check/program [--latency-us N] [--seed N]
+//
+// Per profile, step mode and move length it reports the pulse count, the largest interval error,
+// the items and producer wake-ups per pulse and the underruns. Fails on a pulse count mismatch,
+// any interval error or any underrun.
+
+#include <getopt.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "stepper/ramp_table.h"
+#include "stepper/rmt_step_stream.h"
+
+namespace
+{
+    constexpr size_t CHANNEL_ITEMS = 2 * RmtStepStream::CHUNK_ITEMS;
+    constexpr unsigned long STREAM_MAX_SLEEP_US = 20000; // MotionController::STREAM_MAX_SLEEP_US
+
+    const unsigned long MOVE_LENGTHS[] = {1, 2, 3, 10, 60, 500, 5000, 40000};
+
+    // Profiles beyond the defaults: a fast one that runs the queue tight, one slow enough for filler items
+    const MotionProfile EXTRA_PROFILES[] = {
+        {"TUNED", 4000.0f, 20000.0f, 100.0f, 0.0f},
+        {"CRAWL", 4.0f, 1.0f, 2.5f, 0.0f},
+    };
+
+    struct Move
+    {
+        const RampTable *ramp;
+        size_t cruise_index;
+        bool half_step;
+        unsigned long distance;
+    };
+
+    struct Result
+    {
+        size_t pulses = 0;
+        size_t expected_pulses = 0;
+        uint32_t max_error_us = 0;
+        size_t items = 0;
+        size_t wakeups = 0;
+        size_t underruns = 0;
+    };
+
+    // Intervals between the pulses of the live path, MotionController::update()
+    std::vector<uint32_t> referenceIntervals(const Move &move)
+    {
+        std::vector<uint32_t> intervals;
+        unsigned long distance = move.distance;
+        size_t index = 0;
+        uint32_t interval_us = move.ramp->getInterval(0);
+        bool change_position = true;
+        while (distance > 0)
+        {
+            // a pulse goes out here
+            if (move.half_step)
+                change_position = !change_position;
+            if (change_position)
+            {
+                distance--;
+                index = RampTable::getNextIndex(index, distance, move.cruise_index);
+                interval_us = move.ramp->getInterval(index);
+            }
+            if (distance > 0)
+                intervals.push_back(move.half_step ? interval_us >> 1 : interval_us);
+        }
+        return intervals;
+    }
+
+    // Producer state, MotionController::fillStream()
+    struct Producer
+    {
+        const Move &move;
+        RmtStepStream &stream;
+        unsigned long distance;
+        size_t index = 0;
+        bool change_position = true;
+
+        Producer(const Move &move, RmtStepStream &stream) : move(move), stream(stream), distance(move.distance)
+        {
+        }
+
+        void fill()
+        {
+            while (distance > 0)
+            {
+                bool change = !move.half_step || !change_position;
+                unsigned long remaining = change ? distance - 1 : distance;
+                size_t next = change ? RampTable::getNextIndex(index, remaining, move.cruise_index) : index;
+                uint32_t interval_us = move.ramp->getInterval(next);
+                uint32_t gap_us = (remaining == 0) ? 0 : (move.half_step ? interval_us >> 1 : interval_us);
+                if (!stream.pushPulse(gap_us))
+                    return;
+                change_position = change;
+                distance = remaining;
+                index = next;
+            }
+        }
+    };
+
+    // RmtStepChannel and the channel memory
+    struct Channel
+    {
+        RmtStepStream &stream;
+        RmtItem memory[CHANNEL_ITEMS] = {};
+        size_t next_half = 0;
+        size_t position = 0; // item being sent
+        bool running = false;
+        uint64_t item_end_us = 0;
+
+        explicit Channel(RmtStepStream &stream) : stream(stream)
+        {
+        }
+
+        bool loadHalf(size_t half)
+        {
+            RmtItem items[RmtStepStream::CHUNK_ITEMS];
+            size_t count = stream.takeChunk(items);
+            for (size_t i = 0; i < count; i++)
+                memory[half * RmtStepStream::CHUNK_ITEMS + i] = items[i];
+            return count > 0;
+        }
+
+        void start(uint64_t now_us, std::vector<uint64_t> &edges, size_t &items)
+        {
+            if (running || !loadHalf(0))
+                return;
+            next_half = 1;
+            if (!stream.isEnded() && loadHalf(1))
+                next_half = 0;
+            running = true;
+            position = 0;
+            beginItem(now_us, edges, items);
+        }
+
+        void beginItem(uint64_t now_us, std::vector<uint64_t> &edges, size_t &items)
+        {
+            const RmtItem &item = memory[position];
+            if (item.isEnd())
+            {
+                running = false;
+                return;
+            }
+            if (item.getLevel0())
+                edges.push_back(now_us);
+            items++;
+            item_end_us = now_us + item.getDuration0() + item.getDuration1();
+        }
+
+        // The current item has been sent
+        void advance(std::vector<uint64_t> &edges, size_t &items)
+        {
+            position = (position + 1) % CHANNEL_ITEMS;
+            if (position % RmtStepStream::CHUNK_ITEMS == 0 && loadHalf(next_half))
+                next_half ^= 1; // threshold interrupt
+            beginItem(item_end_us, edges, items);
+        }
+    };
+
+    Result run(const Move &move, unsigned long latency_us, std::mt19937 &random)
+    {
+        std::vector<uint32_t> reference = referenceIntervals(move);
+        std::uniform_int_distribution<unsigned long> jitter(0, latency_us);
+
+        RmtStepStream stream;
+        stream.reset();
+        Producer producer(move, stream);
+        Channel channel(stream);
+        std::vector<uint64_t> edges;
+        Result result;
+
+        uint64_t now_us = 0;
+        uint64_t wake_us = 0;
+        for (;;)
+        {
+            if (channel.running && channel.item_end_us <= wake_us)
+            {
+                now_us = channel.item_end_us;
+                channel.advance(edges, result.items);
+                continue;
+            }
+
+            // MotionController::updateStream()
+            now_us = wake_us;
+            result.wakeups++;
+            producer.fill();
+            if (!channel.running)
+            {
+                if (!stream.empty())
+                {
+                    if (stream.isEnded())
+                        stream.restart();
+                    channel.start(now_us, edges, result.items);
+                }
+                else if (producer.distance == 0)
+                {
+                    break;
+                }
+            }
+
+            // MotionController::getMicrosUntilNextStep()
+            unsigned long delay_us = (producer.distance > 0) ? std::min(stream.getRefillDelayUs(), STREAM_MAX_SLEEP_US)
+                                                             : STREAM_MAX_SLEEP_US;
+            wake_us = now_us + delay_us + jitter(random);
+        }
+
+        result.pulses = edges.size();
+        result.expected_pulses = reference.size() + 1;
+        result.underruns = stream.getUnderrunCount();
+        for (size_t i = 1; i < edges.size() && i <= reference.size(); i++)
+        {
+            uint64_t actual_us = edges[i] - edges[i - 1];
+            uint32_t error_us = (actual_us > reference[i - 1]) ? actual_us - reference[i - 1] : reference[i - 1] - actual_us;
+            result.max_error_us = std::max(result.max_error_us, error_us);
+        }
+        return result;
+    }
+
+    bool checkEncoder()
+    {
+        // every interval must come back exactly, split over items no longer than the duration field
+        const uint32_t intervals[] = {1, 4, 5, 100, 32768, 32769, 32770, 32771, 65536, 98303, 98304,
+                                      RmtStepStream::MAX_INTERVAL_US};
+        for (uint32_t interval_us : intervals)
+        {
+            RmtItem items[RmtStepStream::MAX_PULSE_ITEMS];
+            size_t count = RmtStepStream::encode(interval_us, items);
+            uint32_t total_us = 0;
+            bool valid = count == RmtStepStream::encode(interval_us, nullptr) && count <= RmtStepStream::MAX_PULSE_ITEMS &&
+                         items[0].getLevel0() && items[0].getDuration0() == RmtStepStream::PULSE_US;
+            for (size_t i = 0; i < count; i++)
+            {
+                valid &= !items[i].isEnd() && !items[i].getLevel1() && (i == 0 || !items[i].getLevel0());
+                total_us += items[i].getDuration0() + items[i].getDuration1();
+            }
+            uint32_t expected_us = std::max(interval_us, 2 * RmtStepStream::PULSE_US);
+            if (!valid || total_us != expected_us)
+            {
+                printf("encoder: interval %u us gave %zu items totalling %u us\n", interval_us, count, total_us);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [--latency-us N] [--seed N]\n"
+                "  --latency-us N  largest producer wake-up delay past the requested time, default 500\n"
+                "  --seed N        random seed for the wake-up delays\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long latency_us = 500;
+    unsigned long seed = 1;
+
+    static const option options[] = {
+        {"latency-us", required_argument, nullptr, 'l'},
+        {"seed", required_argument, nullptr, 's'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'l':
+            latency_us = strtoul(optarg, nullptr, 10);
+            break;
+        case 's':
+            seed = strtoul(optarg, nullptr, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    bool ok = checkEncoder();
+    std::mt19937 random(seed);
+
+    std::vector<MotionProfile> profiles(DEFAULT_PROFILES, DEFAULT_PROFILES + PROFILE_COUNT);
+    profiles.insert(profiles.end(), EXTRA_PROFILES, EXTRA_PROFILES + sizeof(EXTRA_PROFILES) / sizeof(EXTRA_PROFILES[0]));
+
+    printf("%-8s %-4s %8s %8s %9s %11s %12s %9s\n", "profile", "mode", "steps", "pulses", "error_us", "items/pulse",
+           "wakeups/pulse", "underruns");
+
+    for (const MotionProfile &profile : profiles)
+    {
+        static RampTable ramp;
+        ramp.build(profile);
+        size_t cruise_index = ramp.getIndexForSpeed(profile.max_speed);
+        if (ramp.getInterval(0) > RmtStepStream::MAX_INTERVAL_US)
+        {
+            printf("%-8s stays live, its start interval does not fit the encoder\n", profile.name);
+            continue;
+        }
+
+        for (bool half_step : {false, true})
+        {
+            for (unsigned long distance : MOVE_LENGTHS)
+            {
+                // slow profiles take minutes for the long moves, the short ones cover them
+                if (profile.max_speed < 10.0f && distance > 60)
+                    continue;
+
+                Move move = {&ramp, cruise_index, half_step, distance};
+                Result result = run(move, latency_us, random);
+                bool passed = result.pulses == result.expected_pulses && result.max_error_us == 0 && result.underruns == 0;
+                ok &= passed;
+
+                printf("%-8s %-4s %8lu %8zu %9u %11.2f %12.3f %9zu%s\n", profile.name, half_step ? "half" : "full",
+                       distance, result.pulses, result.max_error_us, static_cast<double>(result.items) / result.pulses,
+                       static_cast<double>(result.wakeups) / result.pulses, result.underruns, passed ? "" : "  FAIL");
+            }
+        }
+    }
+
+    printf("\nproducer wake-up latency up to %lu us; error is the largest deviation of a pulse interval from the live ramp\n",
+           latency_us);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+// Host latency check of the Moonlite receive path (src/moonlite/moonlite.h): random ASCII commands
+// arrive in random fragments at the serial line rate while a stand-in loop stays busy for random
+// stretches of up to --load-us between two passes over the command queue. The RX callback frames
+// and parses every fragment as it is delivered, on the emulator's virtual clock and timed on the
+// host clock.
+//
+//   pio run -e rx_latency && .pio/build/rx_latency/program [--frames N] [--load-us N] [--baud N] [--seed N]
+//
+// Reports the host time from delivering a frame's last byte to its Command in the queue (99.9th
+// percentile and worst, the worst includes host scheduling noise) and the worst virtual time from
+// that byte to the loop taking the Command. Fails on a command that is not queued and the
+// dispatcher not notified by the time its last byte is delivered (so parsing waited for the loop),
+// a command missing, altered, out of order or dropped, or a 99.9th percentile parse time over
+// --max-parse-us.
+
+#include <algorithm>
+#include <chrono>
+#include <getopt.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "app/command_table.h"
+#include "moonlite/moonlite.h"
+#include "../emulator/virtual_hardware.h"
+
+namespace
+{
+    Moonlite moonlite(COMMAND_TABLE, COMMAND_COUNT);
+    int dispatcher; // stands in for the dispatcher task, only its address is used
+
+    constexpr size_t MAX_FRAGMENT = 8; // bytes per delivery, a USB CDC packet carries up to 64
+    const char *NOISE[] = {"", "", "", "\r", "\n", "\r\n", " "};
+
+    struct Frame
+    {
+        std::string bytes;
+        Command command;
+        uint64_t arrival_us = 0; // last byte delivered
+        bool dropped = false;    // the queue was full
+    };
+
+    Frame randomFrame(std::mt19937 &random)
+    {
+        const CommandSpec &spec = COMMAND_TABLE[std::uniform_int_distribution<size_t>(0, COMMAND_COUNT - 1)(random)];
+        bool secondary = std::uniform_int_distribution<int>(0, 3)(random) == 0;
+
+        uint32_t value = 0;
+        for (uint8_t digit = 0; digit < spec.value_digits; digit++)
+            value = (value << 4) | std::uniform_int_distribution<uint32_t>(0, 15)(random);
+
+        char digits[12] = "";
+        if (spec.value_digits > 0)
+            snprintf(digits, sizeof(digits), "%0*X", spec.value_digits, value);
+        char text[32];
+        snprintf(text, sizeof(text), "%s:%s%s%s#", NOISE[std::uniform_int_distribution<size_t>(0, 6)(random)],
+                 secondary ? "2" : "", spec.opcode, digits);
+
+        Frame frame;
+        frame.bytes = text;
+        frame.command = Command{spec.type, static_cast<int>(value), secondary ? SECONDARY_MOTOR : PRIMARY_MOTOR};
+        return frame;
+    }
+
+    bool sameCommand(const Command &a, const Command &b)
+    {
+        return a.type == b.type && a.value == b.value && a.motor == b.motor;
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --frames N         commands to send (default 20000)\n"
+                "  --load-us N        longest busy stretch of the loop between queue passes, at least the time\n"
+                "                     one fragment takes on the line (default 20000)\n"
+                "  --baud N           serial line rate, 10 bits per byte (default 9600)\n"
+                "  --max-parse-us N   99.9th percentile host time to parse a final fragment (default 20)\n"
+                "  --seed N           random seed (default 1)\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long frame_count = 20000;
+    unsigned long load_us = 20000;
+    unsigned long baud = 9600;
+    double max_parse_us = 20.0;
+    unsigned long seed = 1;
+
+    static const option options[] = {
+        {"frames", required_argument, nullptr, 'f'},
+        {"load-us", required_argument, nullptr, 'l'},
+        {"baud", required_argument, nullptr, 'b'},
+        {"max-parse-us", required_argument, nullptr, 'p'},
+        {"seed", required_argument, nullptr, 's'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'f':
+            frame_count = strtol(optarg, nullptr, 10);
+            break;
+        case 'l':
+            load_us = strtoul(optarg, nullptr, 10);
+            break;
+        case 'b':
+            baud = strtoul(optarg, nullptr, 10);
+            break;
+        case 'p':
+            max_parse_us = atof(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, nullptr, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    const double byte_us = 10e6 / baud;
+    if (frame_count <= 0 || baud == 0 || load_us < MAX_FRAGMENT * byte_us)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    VirtualHardware &hardware = VirtualHardware::instance();
+    hardware.useManualClock();
+    moonlite.begin();
+    moonlite.setDispatcherTask(&dispatcher);
+
+    std::mt19937 random(seed);
+    std::vector<Frame> frames;
+    for (long i = 0; i < frame_count; i++)
+        frames.push_back(randomFrame(random));
+
+    size_t next_frame = 0;  // first frame not fully delivered
+    size_t next_byte = 0;   // within it
+    size_t next_taken = 0;  // first frame the loop has not taken
+    uint64_t line_free_us = 0;
+    std::vector<double> parse_us;
+    uint64_t worst_dispatch_us = 0;
+    long late = 0;
+    long wrong = 0;
+
+    while (next_taken < frames.size())
+    {
+        // the loop takes what has been queued
+        uint64_t now = hardware.micros();
+        while (moonlite.commandAvailable())
+        {
+            Command command = moonlite.getCommand();
+            while (next_taken < next_frame && frames[next_taken].dropped)
+                next_taken++;
+            if (next_taken >= next_frame || !sameCommand(command, frames[next_taken].command))
+            {
+                wrong++;
+                continue;
+            }
+            worst_dispatch_us = max(worst_dispatch_us, now - frames[next_taken].arrival_us);
+            next_taken++;
+        }
+        while (next_taken < next_frame && frames[next_taken].dropped)
+            next_taken++;
+        if (next_taken < next_frame)
+        {
+            wrong += next_frame - next_taken; // delivered but never queued
+            next_taken = next_frame;
+        }
+
+        // then stays busy while fragments arrive and the RX callback runs
+        uint64_t busy_until_us = now + std::uniform_int_distribution<unsigned long>(1, load_us)(random);
+        while (next_frame < frames.size())
+        {
+            const Frame &frame = frames[next_frame];
+            size_t length = min(frame.bytes.size() - next_byte,
+                                std::uniform_int_distribution<size_t>(1, MAX_FRAGMENT)(random));
+            uint64_t arrival_us = max(line_free_us, now) + static_cast<uint64_t>(length * byte_us);
+            if (arrival_us > busy_until_us)
+                break;
+
+            hardware.advanceTo(arrival_us);
+            line_free_us = arrival_us;
+            uint16_t dropped = moonlite.getDroppedCommandCount();
+            auto start = std::chrono::steady_clock::now();
+            Serial.deliver(reinterpret_cast<const uint8_t *>(frame.bytes.data()) + next_byte, length);
+            double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+            next_byte += length;
+            uint32_t notifications = hardware.takeTaskNotifications();
+            if (next_byte < frame.bytes.size())
+            {
+                late += notifications; // nothing may be queued before the '#'
+                continue;
+            }
+
+            // the last byte is in: the command must be queued and the dispatcher woken before the loop runs
+            frames[next_frame].arrival_us = arrival_us;
+            parse_us.push_back(elapsed_us);
+            frames[next_frame].dropped = moonlite.getDroppedCommandCount() != dropped;
+            if (notifications != 1 && !frames[next_frame].dropped)
+                late++;
+            next_frame++;
+            next_byte = 0;
+        }
+        hardware.advanceTo(busy_until_us);
+    }
+
+    std::sort(parse_us.begin(), parse_us.end());
+    double p999_us = parse_us[parse_us.size() * 999 / 1000];
+    uint16_t dropped = moonlite.getDroppedCommandCount();
+    bool ok = late == 0 && wrong == 0 && dropped == 0 && moonlite.getUnknownCommandCount() == 0 &&
+              p999_us <= max_parse_us;
+
+    printf("%-8s %8s %9s %9s %12s %6s %6s %8s\n", "frames", "load_us", "p99.9_us", "max_us", "dispatch_us", "late",
+           "wrong", "dropped");
+    printf("%-8zu %8lu %9.2f %9.2f %12llu %6ld %6ld %8u %s\n", frames.size(), load_us, p999_us, parse_us.back(),
+           static_cast<unsigned long long>(worst_dispatch_us), late, wrong, dropped, ok ? "ok" : "FAIL");
+    printf("p99.9_us and max_us: host time to queue a command from its last fragment; dispatch_us: worst\n"
+           "virtual time from the last byte to the loop taking the command\n");
+    return ok ? 0 : 1;
+}
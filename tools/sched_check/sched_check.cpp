@@ -0,0 +1,364 @@
+// Host comparison of step jitter between the single-loop build (EAF_SINGLE_LOOP, everything in
+// loop()) and the task split of src/main.cpp, run on the emulator's virtual clock with a stand-in
+// scheduler: the motion task (MotionTask::poll()) preempts the protocol task at every wake-up, the
+// protocol task runs the same dispatchCommands()/dispatchRequests()/streamTelemetry()/saveSettings()
+// passes as loop() when a command arrives or housekeeping is due. Both builds get the same client
+// (moves on both axes with the FAST profile, position and moving polls, and a speed change of the
+// resting axis with every move, which rewrites its TPWMTHRS while the other axis steps) and the same
+// housekeeping work, a busy stretch of up to --load-us every HOUSEKEEPING_PERIOD_MS standing in for
+// temperature reads and the like.
+//
+//   pio run -e sched_check && .pio/build/sched_check/program [--seconds N] [--load-us N] [--wake-latency-us N] [--seed N]
+//
+// Reports the worst step lateness (XFJ) per axis for both schedulers. Fails when a move does not
+// arrive, or when the task split lets a step run later than the motion task's wake-up latency plus
+// MotionTask::MIN_SLEEP_US (the busy wait before a close step) plus --margin-us. Either scheduler
+// fails when a register write waits out the register library's reply delay, or goes out while a
+// read reply is still on the drivers' shared UART.
+
+#include <getopt.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "../emulator/firmware_session.h"
+
+void dispatchCommands();
+void dispatchRequests();
+void streamTelemetry();
+void saveSettings();
+
+namespace
+{
+    constexpr uint64_t HOUSEKEEPING_PERIOD_US = 100000; // HOUSEKEEPING_PERIOD_MS in src/main.cpp
+    constexpr unsigned long MIN_SLEEP_US = 100;         // MotionTask::MIN_SLEEP_US
+    constexpr uint64_t POLL_PERIOD_US = 250000;         // client polls of GP and GI
+    constexpr uint64_t MOVE_PERIOD_US = 6000000;        // between moves of one axis
+    constexpr long START_POSITION = 20000;
+    constexpr long MAX_MOVE = 1000;
+    constexpr uint64_t NEVER = UINT64_MAX;
+
+    struct Event
+    {
+        uint64_t at_us; // from the start of the run
+        std::string bytes;
+    };
+
+    struct Run
+    {
+        unsigned long lateness_us[MOTOR_COUNT] = {};
+        long moves = 0;
+        long missed = 0; // moves that did not reach their target
+        uint64_t library_us = 0; // waited out in the register library's writes
+        uint32_t collisions = 0; // datagrams sent over a read reply
+    };
+
+    // The same client and housekeeping work for both schedulers
+    struct Workload
+    {
+        std::vector<Event> events;
+        std::vector<long> targets[MOTOR_COUNT];
+        std::vector<unsigned long> housekeeping_us; // busy time of each housekeeping pass
+    };
+
+    Workload makeWorkload(uint64_t duration_us, unsigned long load_us, std::mt19937 &random)
+    {
+        Workload workload;
+        for (uint64_t at_us = 0; at_us < duration_us; at_us += POLL_PERIOD_US)
+            workload.events.push_back({at_us, ":GP#:GI#:2GP#:2GI#"});
+
+        // the axes take turns, half a move period apart; the resting one changes speed as the other starts
+        std::uniform_int_distribution<long> offset(-MAX_MOVE, MAX_MOVE);
+        for (uint64_t at_us = 10000; at_us + MOVE_PERIOD_US < duration_us; at_us += MOVE_PERIOD_US / 2)
+        {
+            size_t axis = workload.targets[0].size() > workload.targets[1].size() ? 1 : 0;
+            long target = START_POSITION + offset(random);
+            int speed = (workload.targets[axis].size() % 2) ? 0x02 : 0x04;
+            char text[48];
+            snprintf(text, sizeof(text), ":%sSN%04lX#:%sFG#:%sSD%02X#", axis ? "2" : "", target, axis ? "2" : "",
+                     axis ? "" : "2", speed);
+            workload.events.push_back({at_us, text});
+            workload.targets[axis].push_back(target);
+        }
+        std::stable_sort(workload.events.begin(), workload.events.end(),
+                         [](const Event &a, const Event &b) { return a.at_us < b.at_us; });
+
+        std::uniform_int_distribution<unsigned long> busy(0, load_us);
+        for (uint64_t at_us = 0; at_us < duration_us; at_us += HOUSEKEEPING_PERIOD_US)
+            workload.housekeeping_us.push_back(busy(random));
+        return workload;
+    }
+
+    void deliver(const std::string &bytes)
+    {
+        Serial.deliver(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+    }
+
+    void discardReplies()
+    {
+        uint8_t buffer[256];
+        while (Serial.takeTransmitted(buffer, sizeof(buffer)))
+        {
+        }
+    }
+
+    // Tracks which target each axis was sent last, to check it got there before the next one
+    struct MoveCheck
+    {
+        const Workload &workload;
+        size_t sent[MOTOR_COUNT] = {};
+
+        void onEvent(const Event &event, Run &run)
+        {
+            if (event.bytes.find("FG") == std::string::npos)
+                return;
+            size_t axis = event.bytes[1] == '2' ? 1 : 0;
+            if (sent[axis] > 0 && motionControllers[axis].getCurrentPosition() != workload.targets[axis][sent[axis] - 1])
+                run.missed++;
+            sent[axis]++;
+            run.moves++;
+        }
+
+        void finish(Run &run)
+        {
+            for (size_t axis = 0; axis < MOTOR_COUNT; axis++)
+                if (sent[axis] > 0 && motionControllers[axis].getCurrentPosition() != workload.targets[axis][sent[axis] - 1])
+                    run.missed++;
+        }
+    };
+
+    void resetAxes()
+    {
+        FirmwareSession::runUntilIdle();
+        FirmwareSession::send(":SP4E20#:2SP4E20#:XPS01#:2XPS01#:SD02#:2SD02#"); // FAST at full speed
+        for (size_t axis = 0; axis < MOTOR_COUNT; axis++)
+            motionControllers[axis].clearFaults();
+        discardReplies();
+
+        VirtualHardware &hardware = VirtualHardware::instance();
+        hardware.takeLibraryWriteMicros();
+        hardware.takeBusCollisions();
+    }
+
+    void finishBus(Run &run)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        run.library_us = hardware.takeLibraryWriteMicros();
+        run.collisions = hardware.takeBusCollisions();
+    }
+
+    // loop() does everything in turn, a housekeeping pass holds up the steps due meanwhile
+    Run runSingleLoop(const Workload &workload, uint64_t duration_us)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        resetAxes();
+        Run run;
+        MoveCheck check{workload};
+        uint64_t start_us = hardware.micros();
+        size_t next_event = 0;
+        size_t next_housekeeping = 0;
+
+        while (hardware.micros() - start_us < duration_us)
+        {
+            uint64_t now = hardware.micros() - start_us;
+            while (next_event < workload.events.size() && workload.events[next_event].at_us <= now)
+            {
+                check.onEvent(workload.events[next_event], run);
+                deliver(workload.events[next_event++].bytes);
+            }
+
+            loop();
+            discardReplies();
+            if (next_housekeeping < workload.housekeeping_us.size() && next_housekeeping * HOUSEKEEPING_PERIOD_US <= now)
+            {
+                hardware.advanceTo(hardware.micros() + workload.housekeeping_us[next_housekeeping++]);
+                continue;
+            }
+
+            unsigned long wait_us = motionTask.poll();
+            uint64_t next_us = duration_us;
+            if (wait_us != ULONG_MAX)
+                next_us = min<uint64_t>(next_us, now + max(wait_us, 1ul));
+            if (next_event < workload.events.size())
+                next_us = min(next_us, workload.events[next_event].at_us);
+            if (next_housekeeping < workload.housekeeping_us.size())
+                next_us = min(next_us, next_housekeeping * HOUSEKEEPING_PERIOD_US);
+            hardware.advanceTo(start_us + max(next_us, now + 1));
+        }
+
+        check.finish(run);
+        finishBus(run);
+        for (size_t axis = 0; axis < MOTOR_COUNT; axis++)
+            run.lateness_us[axis] = motionControllers[axis].getMaxStepLatenessUs();
+        return run;
+    }
+
+    // The motion task runs whenever it is woken, the protocol task only in between
+    Run runTaskSplit(const Workload &workload, uint64_t duration_us, unsigned long wake_latency_us)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        resetAxes();
+        Run run;
+        MoveCheck check{workload};
+        uint64_t start_us = hardware.micros();
+        size_t next_event = 0;
+        size_t next_housekeeping = 0;
+        uint64_t motion_wake_us = 0;    // relative to start_us, NEVER while it waits for a command
+        uint64_t protocol_busy_us = 0;  // until then the protocol task is in a housekeeping stretch
+        bool protocol_woken = false;    // by the RX callback or the housekeeping timeout
+        unsigned long housekeeping_us = 0;
+
+        while (hardware.micros() - start_us < duration_us)
+        {
+            uint64_t now = hardware.micros() - start_us;
+            if (now >= motion_wake_us)
+            {
+                // a wait shorter than MIN_SLEEP_US is spun out, a longer one goes through the timer
+                unsigned long wait_us = motionTask.poll();
+                if (wait_us == ULONG_MAX)
+                    motion_wake_us = NEVER;
+                else if (wait_us < MIN_SLEEP_US)
+                    motion_wake_us = now + max(wait_us, 1ul);
+                else
+                    motion_wake_us = now + wait_us + wake_latency_us;
+                continue;
+            }
+
+            // the RX callback frames commands as they arrive, whatever the protocol task is doing
+            while (next_event < workload.events.size() && workload.events[next_event].at_us <= now)
+            {
+                check.onEvent(workload.events[next_event], run);
+                deliver(workload.events[next_event++].bytes);
+                protocol_woken = true;
+            }
+            if (next_housekeeping < workload.housekeeping_us.size() && next_housekeeping * HOUSEKEEPING_PERIOD_US <= now)
+            {
+                housekeeping_us += workload.housekeeping_us[next_housekeeping++];
+                protocol_woken = true;
+            }
+
+            if (protocol_woken && now >= protocol_busy_us)
+            {
+                dispatchCommands();
+                dispatchRequests();
+                streamTelemetry();
+                saveSettings();
+                discardReplies();
+                if (hardware.takeTaskNotifications() > 0 || motion_wake_us == NEVER)
+                    motion_wake_us = now; // post() switches to the motion task right away
+                protocol_busy_us = now + housekeeping_us;
+                housekeeping_us = 0;
+                protocol_woken = false;
+                continue;
+            }
+
+            uint64_t next_us = min<uint64_t>(duration_us, motion_wake_us);
+            if (next_event < workload.events.size())
+                next_us = min(next_us, workload.events[next_event].at_us);
+            if (next_housekeeping < workload.housekeeping_us.size())
+                next_us = min(next_us, next_housekeeping * HOUSEKEEPING_PERIOD_US);
+            if (protocol_woken)
+                next_us = min(next_us, protocol_busy_us);
+            hardware.advanceTo(start_us + max(next_us, now + 1));
+        }
+
+        check.finish(run);
+        finishBus(run);
+        for (size_t axis = 0; axis < MOTOR_COUNT; axis++)
+            run.lateness_us[axis] = motionControllers[axis].getMaxStepLatenessUs();
+        return run;
+    }
+
+    void printRun(const char *name, const Run &run, bool passed)
+    {
+        printf("%-10s %6ld %7ld %11lu %11lu %8llu %8u %s\n", name, run.moves, run.missed, run.lateness_us[0],
+               run.lateness_us[1], static_cast<unsigned long long>(run.library_us), run.collisions,
+               passed ? "ok" : "FAIL");
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --seconds N           virtual run time per scheduler (default 120)\n"
+                "  --load-us N           longest housekeeping stretch per period (default 5000)\n"
+                "  --wake-latency-us N   timer to motion task switch on the split (default 50)\n"
+                "  --margin-us N         allowed on top of the wake-up latency and busy wait (default 20)\n"
+                "  --seed N              random seed (default 1)\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long seconds = 120;
+    unsigned long load_us = 5000;
+    unsigned long wake_latency_us = 50;
+    unsigned long margin_us = 20;
+    unsigned long seed = 1;
+
+    static const option options[] = {
+        {"seconds", required_argument, nullptr, 't'},
+        {"load-us", required_argument, nullptr, 'l'},
+        {"wake-latency-us", required_argument, nullptr, 'w'},
+        {"margin-us", required_argument, nullptr, 'm'},
+        {"seed", required_argument, nullptr, 's'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 't':
+            seconds = strtoul(optarg, nullptr, 10);
+            break;
+        case 'l':
+            load_us = strtoul(optarg, nullptr, 10);
+            break;
+        case 'w':
+            wake_latency_us = strtoul(optarg, nullptr, 10);
+            break;
+        case 'm':
+            margin_us = strtoul(optarg, nullptr, 10);
+            break;
+        case 's':
+            seed = strtoul(optarg, nullptr, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (seconds == 0 || load_us >= HOUSEKEEPING_PERIOD_US)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FirmwareSession::begin();
+    std::mt19937 random(seed);
+    uint64_t duration_us = seconds * 1000000ULL;
+    Workload workload = makeWorkload(duration_us, load_us, random);
+
+    Run single = runSingleLoop(workload, duration_us);
+    Run split = runTaskSplit(workload, duration_us, wake_latency_us);
+
+    unsigned long bound_us = wake_latency_us + MIN_SLEEP_US + margin_us;
+    bool split_passed = split.missed == 0 && split.lateness_us[0] <= bound_us && split.lateness_us[1] <= bound_us &&
+                        split.library_us == 0 && split.collisions == 0;
+    bool single_passed = single.missed == 0 && single.library_us == 0 && single.collisions == 0;
+
+    printf("%-10s %6s %7s %11s %11s %8s %8s\n", "scheduler", "moves", "missed", "xfj0_us", "xfj1_us", "lib_us",
+           "collide");
+    printRun("loop", single, single_passed);
+    printRun("tasks", split, split_passed);
+    printf("xfj is the worst step lateness per axis over %lu s with up to %lu us of housekeeping every %llu ms;\n"
+           "the task split must stay within %lu us; lib_us is time spent in register library writes, collide\n"
+           "counts UART datagrams sent over a read reply\n",
+           seconds, load_us, static_cast<unsigned long long>(HOUSEKEEPING_PERIOD_US / 1000), bound_us);
+    return single_passed && split_passed ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+// Host check of stall detection (src/stepper/motion_controller.h) against the emulator's TMC2209
+// model: two MotionControllers on the shared UART, one reading StallGuard through its DIAG pin and
+// one without DIAG, falling back to split SG_RESULT reads. Each runs a free move, a move that slips
+// under load and sensorless homing against the model's end stop.
+//
+//   pio run -e stall_check && .pio/build/stall_check/program [--start-steps N]
+//
+// Per controller and scenario it reports the stall flag, the SG_RESULT samples taken and, for
+// homing, how far each seek drove on into the end stop after the rotor stopped. Fails on a stall
+// flagged in a free move, a slip that is not flagged, homing that does not finish HOMED or a seek
+// that overruns the end stop by more than MAX_HOMING_OVERRUN steps. The model answers UART reads
+// at once; on the board a split read takes about 1.2 ms, one more step at the fast seek speed.
+
+#include <Arduino.h>
+#include <climits>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "stepper/motion_controller.h"
+#include "../emulator/virtual_hardware.h"
+
+namespace
+{
+    constexpr uint8_t NO_DIAG_STEP_PIN = 6;
+    constexpr uint8_t DIAG_STEP_PIN = 3;
+    constexpr uint8_t DIAG_PIN = 1;
+    constexpr uint8_t MODEL_DIAG_PIN = 20; // the model's stall output on the axis without DIAG, only read here
+
+    // The emulator routes GPIO by these, as it does for the board in src/main.cpp
+    constexpr AxisWiring AXES[] = {
+        {0b00, NO_DIAG_STEP_PIN, 5, MODEL_DIAG_PIN},
+        {0b01, DIAG_STEP_PIN, 4, DIAG_PIN},
+    };
+
+    MotionController controllers[] = {
+        MotionController(NO_DIAG_STEP_PIN, 5, 21, 7, 8, 0b00, "stall0"),
+        MotionController(DIAG_STEP_PIN, 4, 10, 7, 8, 0b01, "stall1", DIAG_PIN),
+    };
+    constexpr size_t CONTROLLER_COUNT = sizeof(controllers) / sizeof(controllers[0]);
+
+    constexpr uint8_t HEAVY_PROFILE = 3;   // cruises at 125 steps/s in StealthChop
+    constexpr float SLIP_FRICTION = 0.97f; // the model slips above about 90 steps/s
+    constexpr uint64_t TIMEOUT_US = 300000000;
+    constexpr long MAX_HOMING_OVERRUN = 2;
+
+    const char *NAMES[] = {"no DIAG", "DIAG"};
+
+    struct Homing
+    {
+        bool homed = false;
+        long overrun_fast = 0; // steps sent while the model stood at the end stop
+        long overrun_slow = 0;
+    };
+
+    // Runs every controller the way MotionTask::poll() does until the one under test comes to rest
+    template <typename Observer>
+    bool runUntilIdle(MotionController &controller, Observer observe)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        uint64_t deadline = hardware.micros() + TIMEOUT_US;
+        while (controller.getIsMoving())
+        {
+            unsigned long wait_us = ULONG_MAX;
+            for (MotionController &each : controllers)
+            {
+                each.update();
+                wait_us = min(wait_us, each.getMicrosUntilNextStep());
+            }
+            observe();
+
+            uint64_t now = hardware.micros();
+            if (now > deadline)
+                return false;
+            hardware.advanceTo(now + (wait_us == ULONG_MAX ? 1000 : max(wait_us, 1ul)));
+        }
+        return true;
+    }
+
+    bool move(MotionController &controller, long steps)
+    {
+        controller.setTargetPosition(controller.getCurrentPosition() + steps);
+        controller.startMovement();
+        return runUntilIdle(controller, [] {});
+    }
+
+    Homing home(size_t axis)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        MotionController &controller = controllers[axis];
+        Homing result;
+        long stopped_at = 0;
+        bool at_stop = false;
+
+        controller.startHoming();
+        bool finished = runUntilIdle(controller, [&] {
+            // the model raises its stall output while the rotor stands at the end stop
+            bool stalled = hardware.digitalRead(AXES[axis].diag_pin) == HIGH;
+            MotionController::HomingState state = controller.getHomingState();
+            bool seeking = state == MotionController::HomingState::SEEK_FAST ||
+                           state == MotionController::HomingState::SEEK_SLOW;
+            if (!seeking || !stalled)
+            {
+                at_stop = false;
+                return;
+            }
+            if (!at_stop)
+            {
+                at_stop = true;
+                stopped_at = controller.getCurrentPosition();
+            }
+            long &overrun = (state == MotionController::HomingState::SEEK_FAST) ? result.overrun_fast : result.overrun_slow;
+            overrun = max(overrun, stopped_at - controller.getCurrentPosition());
+        });
+        result.homed = finished && controller.getHomingState() == MotionController::HomingState::HOMED;
+        return result;
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --start-steps N   distance of each focuser from its inward end stop in full steps (default 200)\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long start_steps = 200;
+
+    static const option options[] = {
+        {"start-steps", required_argument, nullptr, 's'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 's':
+            start_steps = strtol(optarg, nullptr, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (start_steps < 100)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    VirtualHardware &hardware = VirtualHardware::instance();
+    hardware.useManualClock();
+    for (const AxisWiring &axis : AXES)
+        hardware.attachAxis(axis);
+    for (MotionController &controller : controllers)
+        controller.begin();
+
+    bool ok = true;
+    printf("%-8s %-6s %6s %8s %8s %9s %9s\n", "driver", "test", "stall", "samples", "min_sg", "fast_over", "slow_over");
+
+    for (size_t axis = 0; axis < CONTROLLER_COUNT; axis++)
+    {
+        MotionController &controller = controllers[axis];
+        controller.selectProfile(HEAVY_PROFILE);
+        hardware.setStartPosition(start_steps);
+
+        // free move: nothing may be flagged
+        hardware.setLoad(LoadModel{});
+        controller.clearFaults();
+        bool passed = move(controller, 1000) && (controller.getFaultFlags() & MotionController::FAULT_STALL) == 0;
+        printf("%-8s %-6s %6s %8u %8u %9s %9s %s\n", NAMES[axis], "free",
+               (controller.getFaultFlags() & MotionController::FAULT_STALL) ? "yes" : "no",
+               controller.getMoveLoadSampleCount(), controller.getMoveMinLoad(), "-", "-", passed ? "ok" : "FAIL");
+        ok &= passed;
+
+        // the rotor slips once the move is past the model's pull-out speed
+        LoadModel slip;
+        slip.friction = SLIP_FRICTION;
+        hardware.setLoad(slip);
+        controller.clearFaults();
+        passed = move(controller, 1000) && (controller.getFaultFlags() & MotionController::FAULT_STALL) != 0;
+        printf("%-8s %-6s %6s %8u %8u %9s %9s %s\n", NAMES[axis], "slip",
+               (controller.getFaultFlags() & MotionController::FAULT_STALL) ? "yes" : "no",
+               controller.getMoveLoadSampleCount(), controller.getMoveMinLoad(), "-", "-", passed ? "ok" : "FAIL");
+        ok &= passed;
+
+        hardware.setLoad(LoadModel{});
+        hardware.setStartPosition(start_steps);
+        Homing homing = home(axis);
+        passed = homing.homed && homing.overrun_fast <= MAX_HOMING_OVERRUN && homing.overrun_slow <= MAX_HOMING_OVERRUN;
+        printf("%-8s %-6s %6s %8s %8s %9ld %9ld %s\n", NAMES[axis], "home", homing.homed ? "homed" : "failed", "-", "-",
+               homing.overrun_fast, homing.overrun_slow, passed ? "ok" : "FAIL");
+        ok &= passed;
+    }
+
+    printf("samples and min_sg are SG_RESULT reads of the move, over is steps sent past the end stop\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+// Host check of the focuser-side autofocus (src/autofocus/autofocus.h, VCurveFit) against synthetic
+// V-curves: a MotionController steps on the emulator's virtual clock while Autofocus runs, and every
+// time the run waits for a measurement the check reports the HFR of a hyperbolic V-curve at the
+// focuser's position, with multiplicative Gaussian noise. The true focus lies at a random offset
+// from the start, inside the planned grid or beyond it so the grid has to grow.
+//
+//   pio run -e vcurve_check && .pio/build/vcurve_check/program [--trials N] [--max-error N] [--seed N]
+//
+// Per noise level, planned grid and focus offset range it reports runs that did not end at best
+// focus, the mean and worst distance from the true focus in grid steps and the samples per run.
+// Fails when a run ends anywhere but DONE at its best position, when a noise-free curve is missed
+// by more than one motor step, or when the mean error of a noisy case exceeds --max-error grid
+// steps per percent of noise.
+
+#include <Arduino.h>
+#include <climits>
+#include <getopt.h>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include "autofocus/autofocus.h"
+#include "stepper/motion_controller.h"
+#include "../emulator/virtual_hardware.h"
+
+namespace
+{
+    constexpr uint8_t ADDRESS = 0b00;
+    constexpr AxisWiring AXIS = {ADDRESS, 6, 5, 0};
+    MotionController controller(6, 5, 21, 7, 8, ADDRESS, "vcurve", 0);
+    Autofocus autofocus(controller);
+
+    constexpr long START_POSITION = 20000;
+    constexpr uint16_t GRID_STEPS[] = {20, 50, 120};
+    constexpr double MIN_HFR = 150.0; // hundredths of a pixel at focus
+    constexpr double SLOPE = 1.0;     // HFR growth in MIN_HFR per grid step, far from focus
+    constexpr uint64_t RUN_TIMEOUT_US = 3600000000ULL;
+
+    struct Case
+    {
+        double noise;       // relative standard deviation of each measurement
+        uint8_t planned;    // grid points before the fit decides
+        double max_offset;  // true focus within +-max_offset grid steps of the start
+    };
+
+    const Case CASES[] = {
+        {0.00, 5, 1.5}, {0.00, 7, 5.0}, {0.00, 5, 6.0},
+        {0.02, 5, 1.5}, {0.02, 7, 2.5}, {0.02, 7, 5.0}, {0.02, 9, 5.0},
+        {0.05, 7, 2.5}, {0.05, 7, 5.0}, {0.05, 9, 5.0},
+    };
+
+    struct Result
+    {
+        int runs = 0;
+        int failed = 0;
+        double error_sum = 0.0; // grid steps
+        double worst_error = 0.0;
+        long worst_error_steps = 0;
+        long samples = 0;
+    };
+
+    double trueHfr(long position, double focus, uint16_t grid_step)
+    {
+        double x = (position - focus) / grid_step;
+        return MIN_HFR * sqrt(1.0 + SLOPE * SLOPE * x * x);
+    }
+
+    // Steps the controller and the run the way MotionTask::poll() does until the run waits or ends
+    // and the focuser is at rest
+    Autofocus::State runUntilWaiting()
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        uint64_t deadline = hardware.micros() + RUN_TIMEOUT_US;
+        while (hardware.micros() < deadline)
+        {
+            controller.update();
+            autofocus.update();
+            Autofocus::State state = autofocus.getState();
+            if (!controller.getIsMoving() && (!autofocus.isActive() || state == Autofocus::State::WAITING))
+                return state;
+
+            unsigned long wait_us = controller.getMicrosUntilNextStep();
+            hardware.advanceTo(hardware.micros() + (wait_us == ULONG_MAX ? 1000 : max(wait_us, 1ul)));
+        }
+        return autofocus.getState();
+    }
+
+    void runTrial(const Case &trial, uint16_t grid_step, std::mt19937 &random, Result &result)
+    {
+        controller.setTargetPosition(START_POSITION);
+        controller.startMovement();
+        runUntilWaiting();
+
+        double focus = START_POSITION +
+                       std::uniform_real_distribution<double>(-trial.max_offset, trial.max_offset)(random) * grid_step;
+        std::normal_distribution<double> noise(1.0, trial.noise);
+
+        autofocus.start(grid_step, trial.planned);
+        long samples = 0;
+        Autofocus::State state;
+        while ((state = runUntilWaiting()) == Autofocus::State::WAITING)
+        {
+            double hfr = trueHfr(controller.getCurrentPosition(), focus, grid_step) * max(noise(random), 0.1);
+            autofocus.addSample(static_cast<uint16_t>(min(lround(hfr), static_cast<long>(UINT16_MAX))));
+            samples++;
+        }
+
+        result.runs++;
+        result.samples += samples;
+        if (state != Autofocus::State::DONE || controller.getCurrentPosition() != autofocus.getBestPosition())
+        {
+            result.failed++;
+            return;
+        }
+
+        double error = fabs(autofocus.getBestPosition() - focus) / grid_step;
+        result.error_sum += error;
+        if (error > result.worst_error)
+        {
+            result.worst_error = error;
+            result.worst_error_steps = lround(fabs(autofocus.getBestPosition() - focus));
+        }
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --trials N      runs per case and grid step (default 100)\n"
+                "  --max-error N   allowed mean error in grid steps per percent of noise (default 0.05)\n"
+                "  --seed N        random seed (default 1)\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int trials = 100;
+    double max_error = 0.05;
+    unsigned long seed = 1;
+
+    static const option options[] = {
+        {"trials", required_argument, nullptr, 't'},
+        {"max-error", required_argument, nullptr, 'e'},
+        {"seed", required_argument, nullptr, 's'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 't':
+            trials = atoi(optarg);
+            break;
+        case 'e':
+            max_error = atof(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, nullptr, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (trials <= 0 || max_error <= 0.0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    VirtualHardware &hardware = VirtualHardware::instance();
+    hardware.useManualClock();
+    hardware.setStartPosition(START_POSITION);
+    hardware.attachAxis(AXIS);
+    controller.begin();
+    controller.selectProfile(1); // FAST, the grid moves dominate the run time otherwise
+    controller.setSpeed(0x02);
+    controller.setCurrentPosition(START_POSITION);
+    std::mt19937 random(seed);
+
+    bool ok = true;
+    printf("%6s %7s %7s %6s %6s %10s %10s %9s %8s\n", "noise", "planned", "offset", "runs", "failed", "mean_err",
+           "worst_err", "worst_st", "samples");
+    for (const Case &trial : CASES)
+    {
+        Result result;
+        for (uint16_t grid_step : GRID_STEPS)
+        {
+            for (int i = 0; i < trials; i++)
+                runTrial(trial, grid_step, random, result);
+        }
+
+        int focused = result.runs - result.failed;
+        double mean_error = focused > 0 ? result.error_sum / focused : 0.0;
+        bool passed = result.failed == 0;
+        if (trial.noise == 0.0)
+            passed &= result.worst_error_steps <= 1;
+        else
+            passed &= mean_error <= max_error * trial.noise * 100;
+
+        printf("%5.0f%% %7u %7.1f %6d %6d %10.3f %10.3f %9ld %8.1f %s\n", trial.noise * 100, trial.planned,
+               trial.max_offset, result.runs, result.failed, mean_error, result.worst_error, result.worst_error_steps,
+               static_cast<double>(result.samples) / result.runs, passed ? "ok" : "FAIL");
+        ok &= passed;
+    }
+
+    printf("offset: true focus within +- that many grid steps of the start; errors in grid steps from the\n"
+           "true focus, worst_st in motor steps; grid steps of %u, %u and %u motor steps\n",
+           GRID_STEPS[0], GRID_STEPS[1], GRID_STEPS[2]);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+// Host check of the move-time estimate (XMT, MotionController::getRemainingMoveTimeUs()) against the
+// stepped firmware on the emulator's virtual clock. For every profile, speed code, step mode,
+// distance and delay between SN and FG it sets the target, reads XMT just before FG and times the
+// move from FG to the last STEP pulse; half way through it reads XMT again and compares it with the
+// time actually left. The delays cover FG at once (coils still settling), after a client round trip
+// and after the hold current has dropped back to idle. A last move crawls to the end of the position
+// range at the slowest speed, longer than the 32-bit micros() wrap on the ESP32.
+//
+//   pio run -e xmt_check && .pio/build/xmt_check/program [--tolerance-ms N] [--verbose]
+//
+// The error is XMT minus the measured time, both in whole milliseconds rounded down, so an exact
+// estimate gives -1 or 0 and loop latency only makes it more negative. The check fails on any error
+// outside -1-tolerance..tolerance ms (default tolerance 1 ms).
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "../emulator/firmware_session.h"
+
+namespace
+{
+    constexpr const char *STEP_MODES[] = {"SF", "SH"};
+    constexpr uint8_t SPEED_CODES[] = {0x02, 0x04, 0x08, 0x10, 0x20};
+    constexpr long DISTANCES[] = {1, 7, 60, 500, 4000, -1, -60, -4000};
+    constexpr long START_POSITION = 30000;
+    constexpr unsigned long FG_DELAYS_US[] = {
+        0,
+        50000,   // a client round trip over USB
+        1500000, // past MotionController::HOLD_DROP_DELAY_US
+    };
+    constexpr uint64_t MOVE_TIMEOUT_US = 3 * 3600000000ULL;
+
+    // HEAVY at the slowest speed code cruises at its 8 steps/s start speed: about 74 minutes
+    constexpr uint8_t LONG_PROFILE = 3;
+    constexpr uint8_t LONG_SPEED_CODE = 0x20;
+    constexpr long LONG_DISTANCE = 0xFFFF - START_POSITION;
+
+    std::string command(const char *opcode, long value = -1, int digits = 0)
+    {
+        char text[24];
+        if (value < 0)
+            snprintf(text, sizeof(text), ":%s#", opcode);
+        else
+            snprintf(text, sizeof(text), ":%s%0*lX#", opcode, digits, value);
+        return text;
+    }
+
+    long readMoveTimeMs()
+    {
+        std::string reply = FirmwareSession::send(":XMT#");
+        return strtol(reply.c_str(), nullptr, 16);
+    }
+
+    struct Timing
+    {
+        long planned_ms = 0;    // XMT before FG
+        long planned_error_ms = 0;
+        long remaining_ms = 0;  // XMT half way
+        long remaining_error_ms = 0;
+        bool arrived = false;
+    };
+
+    // Runs until the axis is at rest, returns the time of the last step; reads XMT once at read_at_us
+    uint64_t runMove(uint64_t read_at_us, long &remaining_ms, uint64_t &read_us)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        MotionController &controller = motionControllers[0];
+        uint64_t until_us = hardware.micros() + MOVE_TIMEOUT_US;
+        long position = controller.getCurrentPosition();
+        uint64_t last_step_us = 0;
+        read_us = 0;
+
+        while (controller.getIsMoving() && hardware.micros() < until_us)
+        {
+            uint64_t now = hardware.micros();
+            if (read_us == 0 && now >= read_at_us)
+            {
+                remaining_ms = readMoveTimeMs();
+                read_us = now;
+            }
+
+            FirmwareSession::step(read_us == 0 ? min(until_us, read_at_us) : until_us);
+
+            // loop() stepped at the time it ran
+            if (controller.getCurrentPosition() != position)
+            {
+                position = controller.getCurrentPosition();
+                last_step_us = now;
+            }
+        }
+        return last_step_us;
+    }
+
+    Timing measure(long distance, unsigned long fg_delay_us)
+    {
+        VirtualHardware &hardware = VirtualHardware::instance();
+        Timing timing;
+
+        FirmwareSession::send(command("SP", START_POSITION, 4));
+        FirmwareSession::send(command("SN", START_POSITION + distance, 4));
+        FirmwareSession::run(fg_delay_us);
+        timing.planned_ms = readMoveTimeMs();
+
+        FirmwareSession::send(":FG#");
+        uint64_t start_us = hardware.micros();
+        long remaining_ms = 0;
+        uint64_t read_us = 0;
+        uint64_t last_step_us = runMove(start_us + timing.planned_ms * 500, remaining_ms, read_us);
+
+        timing.arrived = motionControllers[0].getCurrentPosition() == START_POSITION + distance;
+        timing.planned_error_ms = timing.planned_ms - static_cast<long>((last_step_us - start_us) / 1000);
+        if (read_us > 0)
+        {
+            timing.remaining_ms = remaining_ms;
+            timing.remaining_error_ms = remaining_ms - static_cast<long>((last_step_us - read_us) / 1000);
+        }
+        return timing;
+    }
+
+    bool withinTolerance(long error_ms, long tolerance_ms)
+    {
+        // an exact estimate truncates to the measured millisecond or the one below
+        return error_ms <= tolerance_ms && error_ms >= -1 - tolerance_ms;
+    }
+
+    void usage(const char *program)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --tolerance-ms N   allowed error beyond XMT's 1 ms resolution (default 1)\n"
+                "  --verbose          print every move, not only the worst per profile\n",
+                program);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long tolerance_ms = 1;
+    bool verbose = false;
+
+    static const option options[] = {
+        {"tolerance-ms", required_argument, nullptr, 't'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 't':
+            tolerance_ms = strtol(optarg, nullptr, 10);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (tolerance_ms < 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FirmwareSession::begin();
+
+    bool ok = true;
+    int moves = 0;
+    int failed = 0;
+    printf("%-8s %5s %4s %6s %6s %10s %9s %10s %9s\n", "profile", "speed", "mode", "steps", "fg_ms", "planned_ms",
+           "error_ms", "remain_ms", "error_ms");
+    for (uint8_t profile = 0; profile < PROFILE_COUNT; profile++)
+    {
+        FirmwareSession::send(command("XPS", profile, 2));
+        long worst_planned_ms = 0;
+        long worst_remaining_ms = 0;
+
+        for (uint8_t speed : SPEED_CODES)
+        {
+            FirmwareSession::send(command("SD", speed, 2));
+            for (const char *mode : STEP_MODES)
+            {
+                FirmwareSession::send(command(mode));
+                for (long distance : DISTANCES)
+                {
+                    for (unsigned long fg_delay_us : FG_DELAYS_US)
+                    {
+                        Timing timing = measure(distance, fg_delay_us);
+                        bool passed = timing.arrived && withinTolerance(timing.planned_error_ms, tolerance_ms) &&
+                                      withinTolerance(timing.remaining_error_ms, tolerance_ms);
+                        if (abs(timing.planned_error_ms) > abs(worst_planned_ms))
+                            worst_planned_ms = timing.planned_error_ms;
+                        if (abs(timing.remaining_error_ms) > abs(worst_remaining_ms))
+                            worst_remaining_ms = timing.remaining_error_ms;
+                        moves++;
+                        if (!passed)
+                            failed++;
+                        if (verbose || !passed)
+                            printf("%-8s %5X %4s %6ld %6lu %10ld %9ld %10ld %9ld %s\n", DEFAULT_PROFILES[profile].name,
+                                   speed, mode, distance, fg_delay_us / 1000, timing.planned_ms, timing.planned_error_ms,
+                                   timing.remaining_ms, timing.remaining_error_ms, passed ? "ok" : "FAIL");
+                        ok &= passed;
+                    }
+                }
+            }
+        }
+
+        if (!verbose)
+            printf("%-8s %5s %4s %6s %6s %10s %9ld %10s %9ld worst\n", DEFAULT_PROFILES[profile].name, "all", "all",
+                   "all", "all", "-", worst_planned_ms, "-", worst_remaining_ms);
+    }
+
+    FirmwareSession::send(command("XPS", LONG_PROFILE, 2) + command("SD", LONG_SPEED_CODE, 2) + command("SF"));
+    Timing timing = measure(LONG_DISTANCE, 0);
+    bool passed = timing.arrived && withinTolerance(timing.planned_error_ms, tolerance_ms) &&
+                  withinTolerance(timing.remaining_error_ms, tolerance_ms);
+    printf("%-8s %5X %4s %6ld %6d %10ld %9ld %10ld %9ld %s (long)\n", DEFAULT_PROFILES[LONG_PROFILE].name,
+           LONG_SPEED_CODE, "SF", LONG_DISTANCE, 0, timing.planned_ms, timing.planned_error_ms, timing.remaining_ms,
+           timing.remaining_error_ms, passed ? "ok" : "FAIL");
+    moves++;
+    if (!passed)
+        failed++;
+    ok &= passed;
+
+    printf("%d moves, %d outside -%ld..%ld ms; error is XMT minus the time to the last STEP pulse\n", moves, failed,
+           1 + tolerance_ms, tolerance_ms);
+    return ok ? 0 : 1;
+}